@@ -0,0 +1,257 @@
+#!/usr/bin/env python3.2
+
+# Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+# 
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+# 
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+# 
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+
+"""
+Benchmarks for cmonster's preprocessor and parser throughput.
+
+Each benchmark runs over a synthetic translation unit, and reports its rate
+(tokens, expansions, calls, ... per second), the process's resident set size
+and, where the "tracemalloc" module is available, the peak memory allocated
+through Python while it runs. Results may be written as JSON, to be tracked
+across versions:
+
+    python3 bench/benchmark.py --json results.json
+"""
+
+import argparse
+import atexit
+import json
+import os
+import platform
+import resource
+import shutil
+import sys
+import tempfile
+import time
+
+try:
+    import tracemalloc
+except ImportError:
+    # Python < 3.4: allocations are not measured.
+    tracemalloc = None
+
+import cmonster
+
+
+def _synthetic_source(n):
+    "Generate a translation unit with roughly 30 tokens per line."
+    lines = []
+    for i in range(n):
+        lines.append(
+            "static int f%d(int a, int b) { return (a + %d) * (b - a) / 2; }"
+            % (i, i))
+    return "\n".join(lines) + "\n"
+
+
+def bench_token_iteration(scale):
+    "Iterate over the tokens of a large translation unit."
+    data = _synthetic_source(2000 * scale)
+    def run():
+        pp = cmonster.Preprocessor("bench.c", data=data)
+        return sum(1 for tok in pp)
+    return run, "tokens"
+
+
+def bench_py_def_expansion(scale):
+    "Expand a py_def macro many times."
+    n = 2000 * scale
+    data = ("py_def(TWICE(x))\n    return str(x) + str(x)\npy_end\n" +
+            "".join("int v%d = TWICE(%d);\n" % (i, i) for i in range(n)))
+    def run():
+        pp = cmonster.Preprocessor("bench.c", data=data)
+        for tok in pp:
+            pass
+        return n
+    return run, "expansions"
+
+
+def bench_tokenize(scale):
+    "Call Preprocessor.tokenize repeatedly."
+    n = 20000 * scale
+    pp = cmonster.Preprocessor("bench.c", data="")
+    def run():
+        tokenize = pp.tokenize
+        for i in range(n):
+            tokenize("a + b * (c - 1)")
+        return n
+    return run, "calls"
+
+
+def bench_include_locator(scale):
+    "Resolve many includes through an include locator."
+    n = 200 * scale
+    directory = tempfile.mkdtemp(prefix="cmonster-bench-")
+    atexit.register(shutil.rmtree, directory, True)
+    for i in range(n):
+        with open(os.path.join(directory, "h%d.h" % i), "w") as f:
+            f.write("int h%d;\n" % i)
+    data = "".join("#include <bench_missing_%d.h>\n" % i for i in range(n))
+    def locator(include):
+        i = int(include[len("<bench_missing_"):-len(".h>")])
+        return os.path.join(directory, "h%d.h" % i)
+    def run():
+        pp = cmonster.Preprocessor("bench.c", data=data)
+        pp.set_include_locator(locator)
+        for tok in pp:
+            pass
+        return n
+    return run, "includes"
+
+
+def bench_parse(scale):
+    "Parse a translation unit, and walk its declaration index."
+    data = _synthetic_source(1000 * scale)
+    def run():
+        result = cmonster.Parser("bench.c", data=data).parse()
+        count = result.decl_count
+        for i in range(count):
+            result.get_decl_info(i)
+        return count
+    return run, "decls"
+
+
+def bench_rewriter(scale):
+    "Make many insertions with Rewriter.insert_many."
+    data = _synthetic_source(1000 * scale)
+    result = cmonster.Parser("bench.c", data=data).parse()
+    functions = result.match(decl_kinds="Function", main_file_only=True)
+    edits = [(f.location, "/*x*/", 0) for f in functions]
+    def run():
+        rewriter = cmonster.Rewriter(result)
+        rewriter.insert_many(edits)
+        return len(edits)
+    return run, "edits"
+
+
+BENCHMARKS = [
+    ("token_iteration", bench_token_iteration),
+    ("py_def_expansion", bench_py_def_expansion),
+    ("tokenize", bench_tokenize),
+    ("include_locator", bench_include_locator),
+    ("parse", bench_parse),
+    ("rewriter", bench_rewriter),
+]
+
+
+def _rss_kb():
+    "Get the current resident set size in KiB, or None if unknown."
+    try:
+        with open("/proc/self/statm") as f:
+            pages = int(f.read().split()[1])
+        return pages * resource.getpagesize() // 1024
+    except (IOError, OSError, ValueError, IndexError):
+        return None
+
+
+def run_benchmark(name, factory, scale, repeat):
+    """
+    Run a benchmark "repeat" times, and return a dict of its results. The
+    best time is reported, as it is the least affected by other activity
+    on the machine.
+    """
+
+    run, unit = factory(scale)
+    times = []
+    items = 0
+    for i in range(repeat):
+        start = time.time()
+        items = run()
+        times.append(time.time() - start)
+    best = min(times)
+
+    result = {
+        "name": name,
+        "unit": unit,
+        "items": items,
+        "seconds": best,
+        "rate": items / best if best > 0 else None,
+        "rss_kb": _rss_kb(),
+        "max_rss_kb": resource.getrusage(resource.RUSAGE_SELF).ru_maxrss,
+        # None where tracemalloc is unavailable, so that every report has
+        # the same fields.
+        "py_alloc_peak_bytes": None,
+    }
+
+    # Measure allocations in a separate run, as tracing slows Python down.
+    if tracemalloc is not None:
+        tracemalloc.start()
+        try:
+            run()
+            result["py_alloc_peak_bytes"] = tracemalloc.get_traced_memory()[1]
+        finally:
+            tracemalloc.stop()
+    return result
+
+
+def main():
+    description = __doc__.strip().split("\n")[0]
+    parser = argparse.ArgumentParser(description=description)
+    parser.add_argument(
+        "benchmarks", nargs="*",
+        help="the benchmarks to run (default: all); one of: " +
+             ", ".join(name for (name, _) in BENCHMARKS))
+    parser.add_argument(
+        "--scale", type=int, default=1,
+        help="multiply the size of each synthetic input")
+    parser.add_argument(
+        "--repeat", type=int, default=3,
+        help="the number of times to run each benchmark")
+    parser.add_argument(
+        "--json", dest="json_path",
+        help="write the results as JSON to this file ('-' for stdout)")
+    args = parser.parse_args()
+
+    factories = dict(BENCHMARKS)
+    names = args.benchmarks or [name for (name, _) in BENCHMARKS]
+    for name in names:
+        if name not in factories:
+            parser.error("unknown benchmark: %s" % name)
+
+    results = []
+    for name in names:
+        result = run_benchmark(name, factories[name], args.scale, args.repeat)
+        results.append(result)
+        print("%-18s %12.0f %s/s  (%.3fs, rss %s KiB)" % (
+                  name, result["rate"] or 0, result["unit"],
+                  result["seconds"], result["rss_kb"]),
+              file=sys.stderr)
+
+    if args.json_path:
+        report = {
+            "version": getattr(cmonster, "__version__", None),
+            "python": platform.python_version(),
+            "platform": platform.platform(),
+            "scale": args.scale,
+            "repeat": args.repeat,
+            "results": results,
+        }
+        if args.json_path == "-":
+            json.dump(report, sys.stdout, indent=2)
+            sys.stdout.write("\n")
+        else:
+            with open(args.json_path, "w") as f:
+                json.dump(report, f, indent=2)
+
+
+if __name__ == "__main__":
+    main()
@@ -25,11 +25,14 @@ if sys.version_info < (3, 2):
 
 # Import the extension module's contents, so we get all of the token IDs.
 from ._cmonster import *
-from ._parser import Parser
-from ._preprocessor import Preprocessor
+from ._parser import Parser, ParserPool, TimeoutError, generate_pch
+from ._preprocessor import Preprocessor, pure
+from .cache import ResultCache
 
 # Define the names to import from this module.
 __all__ = [
-    "ast", "Parser", "Preprocessor", "Token"
-] + [name for name in locals() if name.startswith("tok_")]
+    "ast", "Parser", "ParserConfig", "ParserPool", "Preprocessor",
+    "ResultCache", "Token", "generate_pch", "pure"
+] + [name for name in locals()
+     if name.startswith("tok_") or name.startswith("category_")]
 
@@ -20,23 +20,46 @@
 
 from . import _cmonster
 from . import _preprocessor
-from . import config
+from .config import configure as _configure
+
+import contextlib
+import os
+import queue
+
+try:
+    TimeoutError = TimeoutError
+except NameError:
+    # Python < 3.3 has no builtin TimeoutError.
+    class TimeoutError(OSError):
+        "Raised when a ParserPool has no parser available in time."
+
 
 class Parser(_cmonster.Parser):
-    def __init__(self, filename, data=None):
-        if data is None:
-            if type(filename) is str:
-                data = open(filename).read()
-            else:
-                # Assume 'filename' is a file.
-                data = filename.read()
-                if hasattr(filename, "name"):
-                    filename = filename.name
-        _cmonster.Parser.__init__(self, data, filename)
-
-        # TODO allow configuration of target preprocessor/compiler.
+    def __init__(self, filename, data=None, pch=None, config=None):
+        """
+        Create a Parser for the given file. If "data" is not specified,
+        "filename" may be either a path, in which case the file will be read
+        (or memory-mapped) directly by the parser, or a file-like object.
+        Data may be given as str, bytes or another buffer (e.g. bytearray).
+        Bytes are used without copying, and str is encoded to UTF-8 once;
+        other buffers are copied, as they may be modified.
+
+        If a ParserConfig is specified as "config", it determines the
+        target, language, system include directories and predefined macros,
+        and the parser is not otherwise configured for the target compiler.
+        A ParserConfig may be shared by any number of parsers.
+        """
+
+        if data is None and type(filename) is not str:
+            # Assume 'filename' is a file.
+            data = filename.read()
+            if hasattr(filename, "name"):
+                filename = filename.name
+        _cmonster.Parser.__init__(self, data, filename, pch, config)
+
         pp = self.preprocessor
-        config.configure(pp)
+        if config is None:
+            _configure(pp)
 
         # XXX Should this be configurable?
         pp.add_include_dir(".", False)
@@ -44,3 +67,115 @@ class Parser(_cmonster.Parser):
         # Predefined macros.
         pp.define('py_def', _preprocessor.PyDefHandler(pp))
 
+
+    @classmethod
+    def from_path(cls, path, pch=None):
+        "Create a Parser which reads the main file directly from disk."
+        return cls(path, pch=pch)
+
+
+    def reset(self, filename, data=None):
+        """
+        Replace the main file, returning the parser to its configured state:
+        include directories, macros (including py_def) and pragmas are kept,
+        while the previous main file, preamble and AST are dropped. The
+        arguments are as for the constructor. The results of previous
+        parses remain valid, but any tokens obtained from the preprocessor
+        are invalidated.
+        """
+
+        if data is None and type(filename) is not str:
+            data = filename.read()
+            if hasattr(filename, "name"):
+                filename = filename.name
+        _cmonster.Parser.reset(self, data, filename)
+
+
+class ParserPool:
+    """
+    A thread-safe pool of configured Parsers, so that servers may reuse warm
+    instances rather than constructing (and configuring) a Parser for each
+    request. Each parser is used by one thread at a time; parsing releases
+    the GIL, so parsers in different threads run concurrently.
+    """
+
+    def __init__(self, size, factory=None):
+        """
+        Create "size" parsers up front by calling "factory" with no
+        arguments; by default, a Parser with the default configuration is
+        created. The factory should perform any configuration that is to be
+        shared by all requests, such as adding include directories.
+        """
+
+        if factory is None:
+            factory = lambda: Parser("", data="")
+        self._parsers = queue.LifoQueue()
+        for _ in range(size):
+            self._parsers.put(factory())
+
+
+    def acquire(self, filename, data=None, timeout=None):
+        """
+        Take a parser from the pool, waiting up to "timeout" seconds (by
+        default, forever) for one to become available, and reset it with the
+        given main file. The parser must be returned with "release". If no
+        parser becomes available, cmonster.TimeoutError (the builtin
+        TimeoutError, where there is one) is raised.
+        """
+
+        try:
+            parser = self._parsers.get(timeout=timeout)
+        except queue.Empty:
+            raise TimeoutError("No parser became available")
+        try:
+            parser.reset(filename, data)
+        except:
+            self._parsers.put(parser)
+            raise
+        return parser
+
+
+    def release(self, parser):
+        "Return a parser taken with \"acquire\" to the pool."
+        self._parsers.put(parser)
+
+
+    @contextlib.contextmanager
+    def parser(self, filename, data=None, timeout=None):
+        """
+        A context manager which acquires a parser for the given main file,
+        and releases it on exit.
+        """
+
+        parser = self.acquire(filename, data, timeout)
+        try:
+            yield parser
+        finally:
+            self.release(parser)
+
+
+def generate_pch(headers, output, configure=None):
+    """
+    Generate a precompiled header which includes each of the given headers,
+    for use with Parser(..., pch=output).
+
+    The precompiled header must be used by parsers configured in the same way
+    as the one that generated it. If a "configure" callable is specified, it
+    will be called with the generating Parser before the headers are parsed,
+    and should be used equally on the parsers consuming the precompiled
+    header.
+    """
+
+    # The umbrella header is implicitly included by consumers of the
+    # precompiled header, so it must be written to disk.
+    umbrella = output + ".h"
+    data = "".join("#include \"%s\"\n" % os.path.abspath(header)
+                   for header in headers)
+    with open(umbrella, "w") as f:
+        f.write(data)
+
+    parser = Parser(umbrella, data=data)
+    if configure is not None:
+        configure(parser)
+    parser.generate_pch(output)
+    return output
@@ -19,36 +19,188 @@
 # SOFTWARE.
 
 
+import hashlib
+import marshal
+import os
+
+from ._cmonster import tok_identifier, _current_macro_preprocessor
+
+try:
+    from importlib.util import MAGIC_NUMBER as _MAGIC
+except ImportError:
+    # Python < 3.4.
+    import imp
+    _MAGIC = imp.get_magic()
+
+
+# Process-wide cache of compiled "py_def" code objects, keyed by a digest of
+# the macro's tokens.
+_code_cache = {}
+
+# Directory in which to store compiled "py_def" code objects, if any.
+_code_cache_dir = os.environ.get("CMONSTER_PYDEF_CACHE")
+
+
+def set_pydef_cache_dir(path):
+    """
+    Set the directory in which compiled "py_def" macro bodies will be cached
+    across processes. Pass None to disable the on-disk cache.
+    """
+
+    global _code_cache_dir
+    if path is not None and not os.path.isdir(path):
+        os.makedirs(path)
+    _code_cache_dir = path
+
+
+def _tokens_digest(signature_tokens, body):
+    """
+    Compute a digest of a "py_def" block. The formatted signature depends
+    only on the token spellings and their relative positions, so these are
+    all we hash, along with the text of the body.
+    """
+
+    h = hashlib.sha1()
+    first_line = None
+    for tok in signature_tokens:
+        loc = tok.location
+        line = loc.line
+        if first_line is None:
+            first_line = line
+        h.update(("%d:%d:" % (line-first_line, loc.column)).encode())
+        h.update(str(tok).encode())
+        h.update(b"\0")
+    h.update(b"\1")
+    h.update(body.encode())
+    return h.hexdigest()
+
+
+def _load_cached_code(digest):
+    code = _code_cache.get(digest)
+    if code is None and _code_cache_dir is not None:
+        path = os.path.join(_code_cache_dir, digest + ".pydef")
+        try:
+            with open(path, "rb") as f:
+                if f.read(len(_MAGIC)) == _MAGIC:
+                    code = marshal.load(f)
+                    _code_cache[digest] = code
+        except (IOError, OSError, EOFError, ValueError, TypeError):
+            code = None
+    return code
+
+
+def _store_cached_code(digest, code):
+    _code_cache[digest] = code
+    if _code_cache_dir is not None:
+        # Write to a temporary file and rename, so concurrent processes never
+        # see a partially written file.
+        path = os.path.join(_code_cache_dir, digest + ".pydef")
+        tmp = "%s.%d" % (path, os.getpid())
+        try:
+            with open(tmp, "wb") as f:
+                f.write(_MAGIC)
+                marshal.dump(code, f)
+            os.rename(tmp, path)
+        except (IOError, OSError):
+            pass
+
+
+class _MacroContextProxy(object):
+    """
+    Stand-in for an object that depends on the macro being expanded on the
+    calling thread. Python macro functions are given these as their
+    "preprocessor" and "location" globals, so that a function (and its
+    module's globals) may be shared by several preprocessors.
+    """
+
+    __slots__ = ("_get",)
+
+    def __init__(self, get):
+        object.__setattr__(self, "_get", get)
+
+    def __getattr__(self, name):
+        return getattr(self._get(), name)
+
+    def __setattr__(self, name, value):
+        setattr(self._get(), name, value)
+
+    def __repr__(self):
+        return repr(self._get())
+
+    def __str__(self):
+        return str(self._get())
+
+    def __eq__(self, other):
+        return self._get() == other
+
+    def __ne__(self, other):
+        return self._get() != other
+
+    def __hash__(self):
+        return hash(self._get())
+
+    def __bool__(self):
+        return bool(self._get())
+
+
+_macro_preprocessor = _MacroContextProxy(_current_macro_preprocessor)
+_macro_location = _MacroContextProxy(
+    lambda: _current_macro_preprocessor().location)
+
+
+def pure(fn):
+    """
+    Decorator for marking a Python macro function as pure: its result
+    depends only on its arguments, so expansions with identical arguments
+    may be served from a cache rather than calling the function again.
+    """
+
+    fn.__cmonster_pure__ = True
+    return fn
+
+
 class PyDefHandler(object):
     def __init__(self, preprocessor):
         self.__preprocessor = preprocessor
+        # Macros are evaluated in globals private to the preprocessor, so
+        # that their names are not shared with other preprocessors.
+        self.__globals = {"__builtins__": __builtins__}
 
     def __call__(self, *signature_tokens):
         """
-        Callback method for handling "py_def" pragmas.
+        Callback method for handling "py_def" pragmas. A macro signature
+        prefixed with "pure" (e.g. "py_def(pure ABC(x))") is memoized.
         """
 
-        # Grab all of the tokens up to and including the "py_end" token.
-        body = []
-        while True:
-            tok = self.next(False) # Get next unexpanded token
-            if tok.token_id == tok_identifier and str(tok) == "py_end":
-                break
-            body.append(tok)
-
-        # Format the Python function.
-        signature = self.__preprocessor.format_tokens(signature_tokens)
-        body = self.__preprocessor.format_tokens(body)
-        function_source = "def %s:\n%s" % (signature, body)
-
-        # Compile the Python function.
-        code = compile(function_source, "<cmonster>", "exec")
+        is_pure = len(signature_tokens) > 1 and \
+            signature_tokens[0].token_id == tok_identifier and \
+            signature_tokens[0].identifier == "pure" and \
+            signature_tokens[1].token_id == tok_identifier
+        if is_pure:
+            signature_tokens = signature_tokens[1:]
+
+        # Grab the source text up to the "py_end" token, which is consumed.
+        body = self.__preprocessor.capture_until("py_end")
+
+        # Identical macros (e.g. from a header included in every translation
+        # unit) are only formatted and compiled once.
+        digest = _tokens_digest(signature_tokens, body)
+        code = _load_cached_code(digest)
+        if code is None:
+            # Format the Python function.
+            signature = self.__preprocessor.format_tokens(signature_tokens)
+            function_source = "def %s:\n%s" % (signature, body)
+
+            # Compile the Python function.
+            code = compile(function_source, "<cmonster>", "exec")
+            _store_cached_code(digest, code)
+
         locals_ = {}
-        eval(code, globals(), locals_)
-        fn = locals_[str(signature_tokens[0])]
+        eval(code, self.__globals, locals_)
+        fn = locals_[signature_tokens[0].identifier]
 
         # Define the macro.
-        self.__preprocessor.define(fn)
+        self.__preprocessor.define(fn, pure=is_pure)
 
 
 def Preprocessor(*args, **kwargs):
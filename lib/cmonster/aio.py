@@ -0,0 +1,141 @@
+# Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+# 
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+# 
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+# 
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+"""
+Asynchronous preprocessing, for use with asyncio (Python 3.5+).
+
+Preprocessing runs on a worker thread, with the GIL released while tokens
+are lexed, so that one large translation unit does not stall the event
+loop. Batches of tokens are handed to the event loop through a bounded
+queue; when the consumer falls behind, the worker stops lexing until there
+is room again.
+"""
+
+import asyncio
+import concurrent.futures
+
+
+# Sentinel queued by the worker once the token stream is exhausted.
+_END = object()
+
+
+class AsyncTokenIterator:
+    """
+    Asynchronous iterator over TokenBatch objects, as returned by
+    iter_batches.
+
+    Python macros (including py_def macros) are invoked on the worker
+    thread, holding the GIL, in the same order as they would be when
+    iterating synchronously. They must not use the event loop directly;
+    use loop.call_soon_threadsafe to hand work back to it. The preprocessor
+    must not otherwise be used until iteration has finished, or the
+    iterator has been closed.
+    """
+
+    def __init__(self, preprocessor, batch_size, max_pending, loop):
+        if max_pending <= 0:
+            raise ValueError("max_pending must be positive")
+        self.__batches = preprocessor.iter_batches(batch_size)
+        self.__loop = loop
+        self.__queue = asyncio.Queue(max_pending)
+        self.__executor = concurrent.futures.ThreadPoolExecutor(1)
+        self.__producer = None
+        # The executor future for the batch being lexed, if any.
+        self.__pending = None
+        self.__done = False
+
+
+    def __aiter__(self):
+        return self
+
+
+    async def __anext__(self):
+        if self.__done:
+            raise StopAsyncIteration
+        if self.__producer is None:
+            self.__producer = self.__loop.create_task(self.__produce())
+
+        item = await self.__queue.get()
+        if item is _END:
+            await self.aclose()
+            raise StopAsyncIteration
+        if isinstance(item, BaseException):
+            await self.aclose()
+            raise item
+        return item
+
+
+    async def aclose(self):
+        """
+        Stop preprocessing, and release the worker thread. A batch that is
+        being lexed when this is called is completed, and discarded.
+        """
+
+        self.__done = True
+        if self.__producer is not None and not self.__producer.done():
+            self.__producer.cancel()
+            try:
+                await self.__producer
+            except asyncio.CancelledError:
+                pass
+        # Cancelling the producer does not stop the worker thread, so wait
+        # for the batch in flight before the preprocessor may be reused.
+        if self.__pending is not None:
+            try:
+                await self.__pending
+            except (Exception, asyncio.CancelledError):
+                pass
+            self.__pending = None
+        # The worker is idle, so this does not block the event loop.
+        self.__executor.shutdown(wait=False)
+
+
+    async def __produce(self):
+        next_batch = lambda: next(self.__batches, _END)
+        while True:
+            # The executor future is shielded from the producer's
+            # cancellation, so that aclose can wait for it.
+            self.__pending = self.__loop.run_in_executor(
+                self.__executor, next_batch)
+            try:
+                item = await asyncio.shield(self.__pending)
+            except Exception as e:
+                item = e
+            # Blocks while the queue is full, which keeps the worker idle
+            # until the consumer catches up.
+            await self.__queue.put(item)
+            if item is _END or isinstance(item, BaseException):
+                return
+
+
+def iter_batches(preprocessor, batch_size=1024, max_pending=4, loop=None):
+    """
+    Asynchronously iterate over the preprocessor's tokens, in batches of up
+    to "batch_size" tokens. At most "max_pending" batches are lexed ahead of
+    the consumer.
+
+        async for batch in cmonster.aio.iter_batches(pp):
+            ...
+    """
+
+    if loop is None:
+        loop = asyncio.get_event_loop()
+    return AsyncTokenIterator(preprocessor, batch_size, max_pending, loop)
+
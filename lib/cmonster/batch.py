@@ -0,0 +1,209 @@
+# Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+# 
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+# 
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+# 
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+"""
+Batch preprocessing of many files, sharded across a pool of workers, each
+with its own Parser.
+"""
+
+import collections
+import functools
+import json
+import multiprocessing
+import multiprocessing.pool
+import os
+import shlex
+
+
+def split_defines(defines):
+    "Split NAME[=VALUE] strings, as given to -D, into (name, value) pairs."
+    for define in defines:
+        assign = define.find("=")
+        if assign == -1:
+            yield (define, None)
+        else:
+            yield (define[:assign], define[assign+1:])
+
+
+class Job:
+    """
+    A single file to preprocess, and the options to preprocess it with.
+    Relative paths in "filename" and "include_dirs" are relative to
+    "directory", if given, or otherwise to the current directory.
+    """
+
+    def __init__(self, filename, include_dirs=(), defines=(), directory=None,
+                 stats=False):
+        self.filename = filename
+        self.include_dirs = tuple(include_dirs)
+        self.defines = tuple(defines)
+        self.directory = directory
+        self.stats = stats
+
+
+# The outcome of a Job: the preprocessed output (bytes), or the error message
+# if preprocessing failed, and the parser's statistics (see Parser.stats) if
+# they were requested. There are no statistics for results served from a
+# ResultCache.
+Result = collections.namedtuple(
+    "Result", ["job", "output", "error", "stats"])
+
+
+def merge_stats(total, stats, top_n=10):
+    """
+    Merge the statistics returned by one Parser.stats() call into another,
+    keeping the "top_n" slowest entries for each phase.
+    """
+
+    for (phase, phase_stats) in stats.items():
+        total_phase = total.setdefault(
+            phase, {"count": 0, "total_ns": 0, "slowest": []})
+        total_phase["count"] += phase_stats["count"]
+        total_phase["total_ns"] += phase_stats["total_ns"]
+        slowest = total_phase["slowest"] + phase_stats["slowest"]
+        slowest.sort(key=lambda entry: entry[1], reverse=True)
+        total_phase["slowest"] = slowest[:top_n]
+    return total
+
+
+def jobs_from_compile_commands(path):
+    "Create a list of Jobs from a compile_commands.json file."
+
+    with open(path) as f:
+        commands = json.load(f)
+
+    jobs = []
+    for entry in commands:
+        directory = entry.get("directory", os.path.dirname(path))
+        if "arguments" in entry:
+            arguments = list(entry["arguments"])
+        else:
+            arguments = shlex.split(entry["command"])
+
+        include_dirs, defines = [], []
+        i = 1
+        while i < len(arguments):
+            arg = arguments[i]
+            for (flag, values) in (("-I", include_dirs), ("-D", defines),
+                                   ("-isystem", include_dirs)):
+                if arg == flag and i+1 < len(arguments):
+                    i += 1
+                    values.append(arguments[i])
+                    break
+                elif arg.startswith(flag) and flag != "-isystem":
+                    values.append(arg[len(flag):])
+                    break
+            i += 1
+
+        include_dirs = [os.path.join(directory, d) for d in include_dirs]
+        filename = os.path.join(directory, entry["file"])
+        jobs.append(Job(filename, include_dirs, defines, directory))
+    return jobs
+
+
+def _job_path(job, path):
+    # The working directory is shared by threads, so paths are resolved
+    # against the job's directory rather than changing to it.
+    if job.directory:
+        return os.path.join(job.directory, path)
+    return path
+
+
+def _configure_job(job, parser):
+    pp = parser.preprocessor
+    for include_dir in job.include_dirs:
+        pp.add_include_dir(_job_path(job, include_dir))
+    pp.define_many(split_defines(job.defines))
+
+
+def _run_job(job, cache=None, key=()):
+    "Preprocess a single job, returning a Result."
+
+    from . import Parser
+    try:
+        filename = _job_path(job, job.filename)
+        if cache is not None and not job.stats:
+            output = cache.preprocess(
+                filename,
+                setup=functools.partial(_configure_job, job),
+                key=(key, job.directory, job.include_dirs, job.defines))
+            return Result(job, output, None, None)
+        parser = Parser(filename)
+        if job.stats:
+            parser.enable_stats()
+        _configure_job(job, parser)
+        output = parser.preprocessor.preprocess_to_bytes()
+        stats = parser.stats() if job.stats else None
+        return Result(job, output, None, stats)
+    except Exception as e:
+        return Result(job, None, "%s: %s" % (job.filename, e), None)
+
+
+def _init_worker(executable):
+    # Warm the per-process target profile and include cache. When workers
+    # are forked, these are inherited from the parent and this is a no-op.
+    from .config import gcc
+    gcc.get_target_profile(executable)
+    gcc.get_include_cache(executable)
+
+
+def run(jobs, processes=None, threads=False, executable="g++",
+        cache_dir=None):
+    """
+    Preprocess each of the jobs using a pool of workers, yielding a Result
+    for each job in the order given.
+
+    Worker processes are used by default, as most of the work is done with
+    the GIL held; specify threads=True to use a pool of threads instead.
+
+    If "cache_dir" is specified, outputs are looked up in, and stored in, a
+    ResultCache in that directory. Jobs that request statistics always run.
+    """
+
+    jobs = list(jobs)
+    if processes is None:
+        processes = multiprocessing.cpu_count()
+    processes = max(1, min(processes, len(jobs)))
+
+    # Compute the target profile before creating the pool, so forked workers
+    # inherit it rather than each running the compiler.
+    _init_worker(executable)
+    run_job = _run_job
+    if cache_dir is not None:
+        from .cache import ResultCache
+        run_job = functools.partial(
+            _run_job, cache=ResultCache(cache_dir), key=(executable,))
+    if processes == 1:
+        for job in jobs:
+            yield run_job(job)
+        return
+
+    if threads:
+        pool = multiprocessing.pool.ThreadPool(processes)
+    else:
+        pool = multiprocessing.Pool(
+            processes, initializer=_init_worker, initargs=(executable,))
+    try:
+        chunksize = max(1, len(jobs) // (processes * 4))
+        for result in pool.imap(run_job, jobs, chunksize):
+            yield result
+    finally:
+        pool.terminate()
+        pool.join()
@@ -0,0 +1,333 @@
+# Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+# 
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+# 
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+# 
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+
+"""
+A content-addressed, on-disk cache of preprocessing and parsing results.
+
+Results are keyed by the main file, the parser configuration and a
+caller-supplied key, and are valid for as long as every file entered while
+producing them is unchanged. A cache hit returns the stored result without
+creating a Parser, so Clang is not run at all.
+
+Entries are spread over 256 shard directories. Whenever a cache has written
+more than a small fraction of its maximum size, the whole directory is
+trimmed to that size by discarding the least recently used entries, other
+than those just written. A cache directory may be shared by concurrent
+processes.
+"""
+
+import collections
+import hashlib
+import marshal
+import os
+import sys
+import tempfile
+
+
+# Bump this when the layout or contents of the cache files change.
+_FORMAT = ("cmonster-cache", 1)
+
+# The maximum number of dependency sets kept for each input. An input may
+# produce different results when the headers it includes change, e.g. when
+# switching between branches.
+_MAX_MANIFEST_ENTRIES = 4
+
+# The cache directory is trimmed after this fraction of its maximum size has
+# been written, rather than after every write, as trimming must stat every
+# entry.
+_TRIM_FRACTION = 64
+
+
+# The outcome of ResultCache.parse: the diagnostics, as a list of
+# (level, id, filename, line, column, message) tuples, the value returned by
+# the function given to "parse", and whether it was served from the cache.
+CachedParse = collections.namedtuple(
+    "CachedParse", ["diagnostics", "value", "hit"])
+
+
+def _diagnostics(result):
+    "Convert a ParseResult's diagnostics into marshallable tuples."
+    diagnostics = []
+    for (level, id_, location, message) in result.diagnostics:
+        try:
+            filename = location.filename
+            line, column = location.line, location.column
+        except Exception:
+            filename, line, column = None, 0, 0
+        diagnostics.append(
+            (level, id_, filename, line, column, message))
+    return diagnostics
+
+
+class ResultCache:
+    def __init__(self, directory, max_size=1<<30):
+        """
+        Create a cache which stores its entries in "directory", creating it
+        if necessary. "max_size" is the approximate size, in bytes, to
+        which the cache is trimmed.
+        """
+
+        self.directory = directory
+        self.max_size = max_size
+        self.hits = 0
+        self.misses = 0
+        # The number of bytes written since the cache was last trimmed.
+        self.__unchecked = 0
+        # Digests of dependencies, keyed by (path, size, mtime), so that an
+        # unchanged file is read at most once per ResultCache.
+        self.__file_digests = {}
+        if not os.path.isdir(directory):
+            os.makedirs(directory, exist_ok=True)
+
+
+    def preprocess(self, filename, data=None, config=None, setup=None,
+                   key=()):
+        """
+        Preprocess a file, returning the output as bytes.
+
+        "filename" is the path of the main file, and "data" and "config"
+        are as for the Parser constructor.
+        "setup", if given, is called with the new Parser before
+        preprocessing, e.g. to add include directories and macros; anything
+        it does that affects the output must be reflected in "key", which
+        may be any object with a stable repr.
+        """
+
+        input_key = self.__input_key("preprocess", filename, data, config,
+                                     key)
+        found, value = self.__lookup(input_key)
+        if found:
+            return value
+
+        parser = self.__create_parser(filename, data, config, setup)
+        pp = parser.preprocessor
+        output = pp.preprocess_to_bytes()
+        self.__store(input_key, filename, pp.get_entered_files(), output)
+        return output
+
+
+    def parse(self, filename, function=None, data=None, config=None,
+              setup=None, key=()):
+        """
+        Parse a file, collecting its diagnostics, and return a CachedParse.
+
+        If "function" is given, it is called with the ParseResult on a miss,
+        and its return value, which must be marshallable (e.g. the bytes
+        written by Rewriter.dump), is stored with the diagnostics. The
+        remaining arguments are as for "preprocess"; the function's
+        module and name are included in the key, but "key" must reflect
+        anything else that affects its return value.
+        """
+
+        name = None
+        if function is not None:
+            name = "%s.%s" % (getattr(function, "__module__", None),
+                              getattr(function, "__name__",
+                                      type(function).__name__))
+        input_key = self.__input_key("parse", filename, data, config,
+                                     (name, key))
+        found, value = self.__lookup(input_key)
+        if found:
+            return CachedParse(value[0], value[1], True)
+
+        parser = self.__create_parser(filename, data, config, setup)
+        result = parser.parse(collect_diagnostics=True)
+        diagnostics = _diagnostics(result)
+        value = function(result) if function is not None else None
+        self.__store(input_key, filename,
+                     parser.preprocessor.get_entered_files(),
+                     (diagnostics, value))
+        return CachedParse(diagnostics, value, False)
+
+
+    def __create_parser(self, filename, data, config, setup):
+        from . import Parser
+        parser = Parser(filename, data, config=config)
+        if setup is not None:
+            setup(parser)
+        return parser
+
+
+    def __input_key(self, kind, filename, data, config, key):
+        h = hashlib.sha1()
+        for part in (_FORMAT, sys.version_info[:2], kind, os.getcwd(),
+                     os.path.abspath(filename)):
+            h.update(repr(part).encode())
+            h.update(b"\0")
+        if data is None:
+            with open(filename, "rb") as f:
+                data = f.read()
+        elif isinstance(data, str):
+            data = data.encode()
+        h.update(hashlib.sha1(data).digest())
+        if config is not None:
+            for name in ("triple", "language", "standard", "include_dirs",
+                         "predefines"):
+                h.update(repr(getattr(config, name)).encode())
+                h.update(b"\0")
+        h.update(repr(key).encode())
+        return h.hexdigest()
+
+
+    def __file_digest(self, path):
+        try:
+            st = os.stat(path)
+        except OSError:
+            return None
+        stamp = (path, st.st_size, st.st_mtime)
+        digest = self.__file_digests.get(stamp)
+        if digest is None:
+            try:
+                with open(path, "rb") as f:
+                    digest = hashlib.sha1(f.read()).hexdigest()
+            except (IOError, OSError):
+                return None
+            self.__file_digests[stamp] = digest
+        return digest
+
+
+    def __path(self, name):
+        return os.path.join(self.directory, name[:2], name)
+
+
+    def __read(self, path):
+        try:
+            with open(path, "rb") as f:
+                header, value = marshal.load(f)
+        except (IOError, OSError, EOFError, ValueError, TypeError):
+            return (False, None)
+        if header != _FORMAT:
+            return (False, None)
+        # Touch the file, so that eviction sees it as recently used.
+        try:
+            os.utime(path, None)
+        except OSError:
+            pass
+        return (True, value)
+
+
+    def __write(self, path, value):
+        # Write to a temporary file and rename, so concurrent processes never
+        # see a partially written file.
+        shard = os.path.dirname(path)
+        try:
+            os.makedirs(shard, exist_ok=True)
+            fd, tmp = tempfile.mkstemp(dir=shard, suffix=".tmp")
+            try:
+                with os.fdopen(fd, "wb") as f:
+                    marshal.dump((_FORMAT, value), f)
+                    self.__unchecked += f.tell()
+                os.rename(tmp, path)
+            except Exception:
+                os.unlink(tmp)
+                raise
+        except (IOError, OSError, ValueError):
+            pass
+
+
+    def __lookup(self, input_key):
+        found, manifest = self.__read(self.__path(input_key + ".m"))
+        if found:
+            for (deps, result_digest) in manifest:
+                if all(self.__file_digest(path) == digest
+                       for (path, digest) in deps):
+                    found, value = self.__read(
+                        self.__path(result_digest + ".r"))
+                    if found:
+                        self.hits += 1
+                        return (True, value)
+        self.misses += 1
+        return (False, None)
+
+
+    def __store(self, input_key, filename, files, value):
+        # The main file's contents are part of the input key already, and
+        # it need not exist on disk if its data was given.
+        main = os.path.abspath(filename)
+        deps = []
+        for path in files:
+            if os.path.abspath(path) == main:
+                continue
+            digest = self.__file_digest(path)
+            if digest is None:
+                # The file has gone, or cannot be read: don't cache.
+                return
+            deps.append((path, digest))
+        deps = tuple(deps)
+
+        data = marshal.dumps(value)
+        result_digest = hashlib.sha1(data).hexdigest()
+        self.__write(self.__path(result_digest + ".r"), value)
+
+        manifest_path = self.__path(input_key + ".m")
+        found, manifest = self.__read(manifest_path)
+        if not found:
+            manifest = []
+        manifest = [entry for entry in manifest if entry[0] != deps]
+        manifest.insert(0, (deps, result_digest))
+        self.__write(manifest_path, manifest[:_MAX_MANIFEST_ENTRIES])
+
+        if self.__unchecked > self.max_size // _TRIM_FRACTION:
+            self.__unchecked = 0
+            result_path = self.__path(result_digest + ".r")
+            self.__evict(set([result_path, manifest_path]))
+
+
+    def __evict(self, keep):
+        """
+        Trim the cache to max_size, least recently used entries first. The
+        paths in "keep", i.e. the entry just stored, are never removed.
+        """
+
+        entries = []
+        total = 0
+        try:
+            shards = os.listdir(self.directory)
+        except OSError:
+            return
+        for shard in shards:
+            shard = os.path.join(self.directory, shard)
+            try:
+                names = os.listdir(shard)
+            except OSError:
+                continue
+            for name in names:
+                if name.endswith(".tmp"):
+                    continue
+                path = os.path.join(shard, name)
+                try:
+                    st = os.stat(path)
+                except OSError:
+                    continue
+                total += st.st_size
+                if path not in keep:
+                    entries.append((st.st_mtime, st.st_size, path))
+        if total <= self.max_size:
+            return
+        entries.sort()
+        for (mtime, size, path) in entries:
+            if total <= self.max_size:
+                break
+            try:
+                os.unlink(path)
+            except OSError:
+                pass
+            total -= size
@@ -18,35 +18,93 @@
 # OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 # SOFTWARE.
 
+def _apply_options(parser, include_dirs, defines):
+    if include_dirs:
+        for include_dir in include_dirs:
+            parser.preprocessor.add_include_dir(include_dir)
+    if defines:
+        from .batch import split_defines
+        parser.preprocessor.define_many(split_defines(defines))
+
+
+def _print_stats(stats, file):
+    "Print the statistics returned by Parser.stats()."
+    print("%-16s %10s %12s" % ("phase", "count", "total ms"), file=file)
+    for (phase, phase_stats) in sorted(stats.items()):
+        print("%-16s %10d %12.3f" % (phase, phase_stats["count"],
+                                     phase_stats["total_ns"] / 1e6),
+              file=file)
+        for (name, ns) in phase_stats["slowest"]:
+            print("    %12.3f  %s" % (ns / 1e6, name), file=file)
+
+
 def cli_main():
     # First up, parse the command line arguments.
     import argparse
     description = "C Preprocessor with Python macros"
     parser = argparse.ArgumentParser(description=description)
     parser.add_argument(
-        "file", type=argparse.FileType("r"), nargs=1,
-        help="the file to preprocess")
+        "file", nargs="*",
+        help="the file(s) to preprocess")
     parser.add_argument(
         "-I", action="append", dest="include_dirs")
     parser.add_argument(
         "-D", action="append", dest="defines")
+    parser.add_argument(
+        "-j", "--jobs", type=int, default=None,
+        help="the number of files to preprocess in parallel")
+    parser.add_argument(
+        "--compile-commands", dest="compile_commands",
+        help="preprocess each file in a compile_commands.json file")
+    parser.add_argument(
+        "--stats", action="store_true",
+        help="print timing statistics for each phase to stderr")
+    parser.add_argument(
+        "--cache-dir", dest="cache_dir",
+        help="reuse preprocessed outputs stored in this directory")
     args = parser.parse_args()
+    if not args.file and not args.compile_commands:
+        parser.error("no input files")
 
-    # Create the preprocessor.
     import sys
-    from . import Parser
+    if len(args.file) == 1 and not args.compile_commands and \
+           not args.cache_dir:
+        # Create the preprocessor, and write straight to stdout.
+        from . import Parser
+        parser = Parser(args.file[0])
+        _apply_options(parser, args.include_dirs, args.defines)
+        if args.stats:
+            parser.enable_stats()
+        parser.preprocessor.preprocess()
+        if args.stats:
+            sys.stdout.flush()
+            _print_stats(parser.stats(), sys.stderr)
+        return
 
-    parser = Parser(args.file[0])
-    if args.include_dirs:
-        for include_dir in args.include_dirs:
-            parser.preprocessor.add_include_dir(include_dir)
-    if args.defines:
-        for define in args.defines:
-            assign = define.find("=")
-            if assign == -1:
-                parser.preprocessor.define(define)
-            else:
-                name, value = define[:assign], define[assign+1:]
-                parser.preprocessor.define(name, value)
-    parser.preprocessor.preprocess()
+    # Many files: shard them across a pool of workers, writing the outputs
+    # in the order given.
+    from . import batch
+    jobs = [batch.Job(filename, args.include_dirs or (), args.defines or ())
+            for filename in args.file]
+    if args.compile_commands:
+        jobs.extend(batch.jobs_from_compile_commands(args.compile_commands))
+    for job in jobs:
+        job.stats = args.stats
 
+    failed = False
+    stats = {}
+    sys.stdout.flush()
+    for result in batch.run(jobs, processes=args.jobs,
+                            cache_dir=args.cache_dir):
+        if result.error is not None:
+            failed = True
+            print(result.error, file=sys.stderr)
+        else:
+            sys.stdout.buffer.write(result.output)
+        if result.stats is not None:
+            batch.merge_stats(stats, result.stats)
+    sys.stdout.flush()
+    if args.stats:
+        _print_stats(stats, sys.stderr)
+    if failed:
+        sys.exit(1)
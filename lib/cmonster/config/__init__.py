@@ -23,3 +23,8 @@ def configure(preprocessor):
     from . import gcc
     gcc.configure(preprocessor)
 
+
+def get_parser_config():
+    "Get a ParserConfig shared by parsers for the default target."
+    from . import gcc
+    return gcc.get_target_profile().get_parser_config()
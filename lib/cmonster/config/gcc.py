@@ -18,9 +18,52 @@
 # OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 # SOFTWARE.
 
+import atexit
 import os
 import subprocess
 
+from .._cmonster import IncludeCache, ParserConfig
+
+
+# Include caches, shared by all preprocessors configured for the same
+# executable.
+_include_caches = {}
+
+
+def _which(executable):
+    "Find an executable on PATH (shutil.which requires Python 3.3)."
+    if os.path.dirname(executable):
+        return executable if os.access(executable, os.X_OK) else None
+    for directory in os.environ.get("PATH", os.defpath).split(os.pathsep):
+        path = os.path.join(directory, executable)
+        if os.path.isfile(path) and os.access(path, os.X_OK):
+            return path
+    return None
+
+
+def get_include_cache(executable="g++"):
+    """
+    Get the include cache shared by all preprocessors configured for the
+    given gcc/g++ executable.
+
+    If the CMONSTER_INCLUDE_CACHE environment variable names a directory,
+    the cache is loaded from and saved to a file in that directory. The
+    file is ignored if the executable has changed since it was written.
+    """
+
+    cache = _include_caches.get(executable)
+    if cache is None:
+        cache = IncludeCache()
+        _include_caches[executable] = cache
+        cache_dir = os.environ.get("CMONSTER_INCLUDE_CACHE")
+        if cache_dir:
+            compiler = _which(executable) or executable
+            path = os.path.join(
+                cache_dir, "includes-%s.cache" % os.path.basename(executable))
+            cache.load(path, compiler)
+            atexit.register(cache.save, path, compiler)
+    return cache
+
 
 def _get_predefined_macros(executable):
     "Determine the predefined macros for gcc/g++."
@@ -36,10 +79,98 @@ def _get_predefined_macros(executable):
     for line in stdout.splitlines():
         line = line.decode()[len("#define "):].rstrip()
         space = line.find(" ")
-        macro = (line[:space], line[space+1:])
+        if space == -1:
+            macro = (line, "")
+        else:
+            macro = (line[:space], line[space+1:])
         yield macro
 
 
+def _get_system_include_dirs(executable):
+    "Determine the system include directories for g++."
+    # TODO detect language, stop assuming C++.
+    proc = subprocess.Popen(
+        [executable, "-x", "c++", "-E", "-v", "-"],
+        stdout=subprocess.PIPE,
+        stderr=subprocess.PIPE,
+        stdin=subprocess.PIPE)
+    stdout, stderr = proc.communicate()
+    include_dirs = []
+    in_search_list = False
+    for line in stderr.decode().splitlines():
+        if line.startswith("#include <...> search starts here:"):
+            in_search_list = True
+        elif line.startswith("End of search list."):
+            break
+        elif in_search_list:
+            # Skip frameworks directories (Darwin).
+            path = line.strip()
+            if not path.endswith("(framework directory)"):
+                include_dirs.append(os.path.normpath(path))
+    return include_dirs
+
+
+class TargetProfile:
+    """
+    The predefined macros and system include directories for a compiler,
+    captured once and installed into any number of preprocessors.
+    """
+
+    def __init__(self, predefines, include_dirs):
+        self.predefines = predefines
+        self.include_dirs = tuple(include_dirs)
+        self.__parser_config = None
+
+    def install(self, preprocessor):
+        "Install the target profile into a preprocessor."
+        preprocessor.add_predefines(self.predefines)
+        # System include directories are each inserted before any previously
+        # added system directories, so add them in reverse to preserve the
+        # compiler's search order.
+        for include_dir in reversed(self.include_dirs):
+            preprocessor.add_include_dir(include_dir, True)
+
+    def get_parser_config(self):
+        """
+        Get a ParserConfig for the target profile, which may be passed to
+        any number of parsers in place of installing the profile into each.
+        """
+        if self.__parser_config is None:
+            self.__parser_config = ParserConfig(
+                system_include_dirs=self.include_dirs,
+                predefines=self.predefines)
+        return self.__parser_config
+
+
+# Target profiles, keyed by executable.
+_target_profiles = {}
+
+
+def get_target_profile(executable="g++"):
+    """
+    Get the target profile for a gcc/g++ executable. The compiler is only
+    consulted the first time a profile is requested for each executable.
+    """
+
+    profile = _target_profiles.get(executable)
+    if profile is None:
+        # Build the predefines buffer. The compiler's definitions replace
+        # those of Clang, as they would with Preprocessor.define.
+        lines = []
+        for (name, value) in _get_predefined_macros(executable):
+            lparen = name.find("(")
+            base_name = name if lparen == -1 else name[:lparen]
+            # Clang implements these itself.
+            if base_name.startswith("__has_include"):
+                continue
+            lines.append("#undef %s\n#define %s %s\n" % \
+                         (base_name, name, value))
+        profile = TargetProfile(
+            "".join(lines), _get_system_include_dirs(executable))
+        _target_profiles[executable] = profile
+    return profile
+
+
 class IncludeLocator:
     """
     An "include locator" that consults GCC for the location of an include
@@ -92,10 +223,10 @@ def configure(preprocessor, executable="g++"):
     preprocessor object.
     """
 
-    # Define builtin macros.
-    for (name, value) in _get_predefined_macros(executable):
-        preprocessor.define(name, value)
+    # Define builtin macros, and add system include directories.
+    get_target_profile(executable).install(preprocessor)
 
-    # Add an include locator.
+    # Add an include locator, and the cache of its results.
     preprocessor.set_include_locator(IncludeLocator(preprocessor, executable))
+    preprocessor.set_include_cache(get_include_cache(executable))
 
@@ -57,27 +57,49 @@ class build_ext(Cython.Distutils.build_ext):
 _cmonster_extension = Extension(
     "cmonster._cmonster",
     [
+        "src/cmonster/core/impl/ast_query.cpp",
+        "src/cmonster/core/impl/builtin_macros.cpp",
+        "src/cmonster/core/impl/collecting_diagnostic_client.cpp",
+        "src/cmonster/core/impl/decl_export.cpp",
+        "src/cmonster/core/impl/decl_index.cpp",
+        "src/cmonster/core/impl/diagnostics.cpp",
         "src/cmonster/core/impl/exception_diagnostic_client.cpp",
+        "src/cmonster/core/impl/file_cache.cpp",
+        "src/cmonster/core/impl/file_cache_client.cpp",
+        "src/cmonster/core/impl/include_cache.cpp",
         "src/cmonster/core/impl/include_locator_impl.cpp",
+        "src/cmonster/core/impl/location_table.cpp",
         "src/cmonster/core/impl/function_macro.cpp",
         "src/cmonster/core/impl/parser.cpp",
+        "src/cmonster/core/impl/parser_config.cpp",
         "src/cmonster/core/impl/parse_result.cpp",
         "src/cmonster/core/impl/preprocessor_impl.cpp",
+        "src/cmonster/core/impl/profiler.cpp",
+        "src/cmonster/core/impl/stats.cpp",
+        "src/cmonster/core/impl/token_arena.cpp",
+        "src/cmonster/core/impl/token_batch.cpp",
+        "src/cmonster/core/impl/token_cache.cpp",
         "src/cmonster/core/impl/token_iterator.cpp",
+        "src/cmonster/core/impl/token_kinds.cpp",
         "src/cmonster/core/impl/token_predicate.cpp",
         "src/cmonster/core/impl/token.cpp",
 
         "src/cmonster/python/exception.cpp",
+        "src/cmonster/python/include_cache.cpp",
         "src/cmonster/python/include_locator.cpp",
+        "src/cmonster/python/file_cache.cpp",
         "src/cmonster/python/function_macro.cpp",
         "src/cmonster/python/module.cpp",
+        "src/cmonster/python/output_stream.cpp",
         "src/cmonster/python/parser.cpp",
+        "src/cmonster/python/parser_config.cpp",
         "src/cmonster/python/parse_result.cpp",
         "src/cmonster/python/preprocessor.cpp",
-        "src/cmonster/python/pyfile_ostream.cpp",
         "src/cmonster/python/rewriter.cpp",
         "src/cmonster/python/source_location.cpp",
         "src/cmonster/python/token.cpp",
+        "src/cmonster/python/token_batch.cpp",
+        "src/cmonster/python/token_filter.cpp",
         "src/cmonster/python/token_iterator.cpp",
         "src/cmonster/python/token_predicate.cpp",
 
@@ -127,7 +149,8 @@ _cmonster_extension = Extension(
         "LLVMSupport",
         "LLVMCore",
         "pthread",
-        "dl"
+        "dl",
+        "rt"
     ],
 
     # No RTTI in Clang, so none here either.
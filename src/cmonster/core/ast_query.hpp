@@ -0,0 +1,97 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _CMONSTER_CORE_AST_QUERY_HPP
+#define _CMONSTER_CORE_AST_QUERY_HPP
+
+#include <clang/AST/ASTContext.h>
+#include <clang/AST/DeclBase.h>
+#include <clang/AST/Stmt.h>
+
+#include <string>
+#include <vector>
+
+namespace cmonster {
+namespace core {
+
+/**
+ * A declarative query over the AST, evaluated natively by "match_ast".
+ */
+struct AstQuery
+{
+    AstQuery();
+
+    /**
+     * Kinds of declarations to match, as named by Decl::getDeclKindName
+     * (e.g. "Function", "Var"). Abstract kinds (e.g. "Named") match all of
+     * their subclasses, as do concrete kinds with subclasses (e.g. "Function"
+     * matches "CXXMethod"). If both this and "stmt_kinds" are empty, all
+     * declarations are matched.
+     */
+    std::vector<std::string> decl_kinds;
+
+    /**
+     * Kinds of statements to match, as named by Stmt::getStmtClassName (e.g.
+     * "ReturnStmt", "Expr"). Statements are only matched if this is
+     * non-empty.
+     */
+    std::vector<std::string> stmt_kinds;
+
+    /**
+     * If non-empty, a regular expression which must match (part of) a
+     * declaration's name. Only applies to declarations.
+     */
+    std::string name_pattern;
+
+    /**
+     * If true, only match nodes whose expansion location is in the main
+     * file.
+     */
+    bool main_file_only;
+
+    /**
+     * If true, only match declarations which have a body (e.g. function
+     * definitions).
+     */
+    bool with_body;
+};
+
+/**
+ * A node matched by "match_ast". Exactly one of the members is non-NULL.
+ */
+struct AstMatch
+{
+    clang::Decl *decl;
+    clang::Stmt *stmt;
+};
+
+/**
+ * Traverse the AST with a RecursiveASTVisitor, and return the nodes which
+ * satisfy the query, in traversal order. Throws std::invalid_argument if a
+ * kind name or the name pattern is invalid.
+ */
+std::vector<AstMatch>
+match_ast(clang::ASTContext &context, AstQuery const& query);
+
+}}
+
+#endif
@@ -0,0 +1,76 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _CMONSTER_CORE_BUILTIN_MACROS_HPP
+#define _CMONSTER_CORE_BUILTIN_MACROS_HPP
+
+#include "function_macro.hpp"
+
+#include <boost/shared_ptr.hpp>
+
+#include <string>
+#include <vector>
+
+namespace cmonster {
+namespace core {
+
+class Preprocessor;
+
+/**
+ * Create one of the built-in native function macros, which expand without
+ * calling into Python. The available kinds are:
+ *
+ *  - "counter": expands to an integer which increments with each expansion,
+ *    starting at params[0] (default 0).
+ *  - "stringify": expands to a string literal of the arguments.
+ *  - "concat_counter": expands to an identifier made of the arguments'
+ *    spelling followed by an incrementing integer.
+ *  - "table": looks up the arguments' spelling in params, which are given
+ *    as "key=value" strings, and expands to the value. An entry with an
+ *    empty key (i.e. "=value") is the default; otherwise a missing key is
+ *    an error.
+ *
+ * @param pp The preprocessor the macro will be defined in.
+ * @param kind The kind of built-in macro to create.
+ * @param params Parameters for the macro.
+ * @return The function macro, or a null pointer if "kind" is unknown.
+ */
+boost::shared_ptr<FunctionMacro>
+create_builtin_macro(Preprocessor &pp, std::string const& kind,
+                     std::vector<std::string> const& params);
+
+/**
+ * Create a function macro which invokes a native handler from a shared
+ * library. The handler must conform to "cmonster_native_macro_fn", declared
+ * in "native_macro.h".
+ *
+ * @param pp The preprocessor the macro will be defined in.
+ * @param library The path of the shared library.
+ * @param symbol The name of the handler function.
+ */
+boost::shared_ptr<FunctionMacro>
+create_native_macro(Preprocessor &pp, std::string const& library,
+                    std::string const& symbol);
+
+}}
+
+#endif
@@ -0,0 +1,84 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _CMONSTER_CORE_DECL_EXPORT_HPP
+#define _CMONSTER_CORE_DECL_EXPORT_HPP
+
+#include "decl_index.hpp"
+
+#include <clang/AST/ASTContext.h>
+
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace cmonster {
+namespace core {
+
+/**
+ * A column of strings, stored as in Apache Arrow: the i'th string is
+ * data[offsets[i]:offsets[i+1]], encoded as UTF-8.
+ */
+struct StringColumn
+{
+    std::vector<uint32_t> offsets;
+    std::string           data;
+};
+
+/**
+ * The declarations of a DeclIndex, one row per entry, stored by column.
+ */
+struct DeclColumns
+{
+    // The file index of declarations without a valid location (the same
+    // as LocationTable::NO_FILE).
+    static const uint32_t NO_FILE = ~0U;
+
+    std::vector<uint32_t> kinds;   // clang::Decl::Kind
+    std::vector<uint32_t> parents; // DeclIndex::NO_PARENT for the TU
+    std::vector<uint32_t> files;   // Index into "filenames", or NO_FILE
+    std::vector<uint32_t> lines;   // Presumed line, or zero
+    StringColumn          names;
+    StringColumn          qualified_names;
+    StringColumn          types;   // Empty for declarations without a type
+
+    std::vector<std::string>            filenames;
+    std::map<uint32_t, std::string>     kind_names;
+};
+
+/**
+ * Export the entries of a DeclIndex in columnar form.
+ *
+ * Locations are resolved on the calling thread, since the source manager
+ * is not thread-safe. Names and types are printed on up to "nthreads"
+ * threads (or one per CPU, if zero), each taking a share of the top-level
+ * declarations. If the AST has an external source (e.g. a precompiled
+ * header), which may be deserialised lazily, only one thread is used.
+ */
+DeclColumns export_decls(clang::ASTContext &context, DeclIndex const& index,
+                         unsigned int nthreads = 0);
+
+}}
+
+#endif
+
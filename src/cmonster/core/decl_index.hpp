@@ -0,0 +1,92 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _CMONSTER_CORE_DECL_INDEX_HPP
+#define _CMONSTER_CORE_DECL_INDEX_HPP
+
+#include <clang/AST/ASTContext.h>
+#include <clang/AST/DeclBase.h>
+
+#include <vector>
+
+namespace cmonster {
+namespace core {
+
+/**
+ * A flat index of all declarations in a translation unit, in pre-order.
+ * Entry zero is the translation unit declaration itself.
+ *
+ * The index is built once, with a single walk of the AST, and may then be
+ * queried repeatedly without touching the (pointer-heavy) AST nodes.
+ */
+class DeclIndex
+{
+public:
+    // The parent of the translation unit.
+    static const unsigned int NO_PARENT = ~0U;
+
+    struct Entry
+    {
+        clang::Decl           *decl;
+        clang::IdentifierInfo *name; // NULL for unnamed declarations.
+        unsigned int           parent;
+        unsigned int           kind; // clang::Decl::Kind
+        unsigned int           begin; // Raw encoding of the source range.
+        unsigned int           end;
+    };
+
+    /**
+     * Build the index for the given AST context.
+     */
+    explicit DeclIndex(clang::ASTContext &context);
+
+    /**
+     * Get the number of entries.
+     */
+    size_t size() const {return m_entries.size();}
+
+    /**
+     * Get the entry at the given index. The index must be in range.
+     */
+    Entry const& operator[](size_t index) const {return m_entries[index];}
+
+    /**
+     * Find the indices of declarations with the given kind.
+     */
+    std::vector<unsigned int> find_by_kind(clang::Decl::Kind kind) const;
+
+    /**
+     * Find the indices of declarations with the given name. If "kind" is
+     * non-NULL, then only declarations of that kind are returned.
+     */
+    std::vector<unsigned int>
+    find_by_name(llvm::StringRef name,
+                 const clang::Decl::Kind *kind = NULL) const;
+
+private:
+    clang::ASTContext  &m_context;
+    std::vector<Entry>  m_entries;
+};
+
+}}
+
+#endif
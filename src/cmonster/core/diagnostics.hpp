@@ -0,0 +1,84 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _CMONSTER_CORE_DIAGNOSTICS_HPP
+#define _CMONSTER_CORE_DIAGNOSTICS_HPP
+
+#include <llvm/ADT/StringRef.h>
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace cmonster {
+namespace core {
+
+/**
+ * A compact list of the diagnostics reported while parsing. Each record
+ * refers to its formatted message by offset into a single buffer.
+ */
+class DiagnosticList
+{
+public:
+    struct Record
+    {
+        uint32_t level;    // clang::DiagnosticsEngine::Level
+        uint32_t id;       // The diagnostic ID
+        uint32_t location; // Raw encoding of the diagnostic's location
+        uint32_t message_offset;
+        uint32_t message_length;
+    };
+
+    DiagnosticList() : m_records(), m_messages(), m_errors(0) {}
+
+    /**
+     * Append a diagnostic, copying its message.
+     */
+    void add(uint32_t level, uint32_t id, uint32_t location,
+             llvm::StringRef message);
+
+    size_t size() const {return m_records.size();}
+    bool empty() const {return m_records.empty();}
+    Record const& operator[](size_t i) const {return m_records[i];}
+
+    /**
+     * Get the formatted message of the i'th diagnostic.
+     */
+    llvm::StringRef get_message(size_t i) const;
+
+    /**
+     * Get the number of errors and fatal errors in the list.
+     */
+    size_t get_error_count() const {return m_errors;}
+
+    void clear();
+
+private:
+    std::vector<Record> m_records;
+    std::string         m_messages;
+    size_t              m_errors;
+};
+
+}}
+
+#endif
+
@@ -0,0 +1,138 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _CMONSTER_CORE_FILE_CACHE_HPP
+#define _CMONSTER_CORE_FILE_CACHE_HPP
+
+#include <llvm/Support/MemoryBuffer.h>
+
+#include <boost/shared_ptr.hpp>
+
+#include <map>
+#include <string>
+
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+namespace cmonster {
+namespace core {
+
+/**
+ * A cache of file system lookups (stat results, including failures) and
+ * file contents, which may be shared between parsers so that headers are
+ * only stat'd and read once per process.
+ *
+ * Stat results from header search are kept until the cache is invalidated
+ * explicitly. Each file that is entered is stat'd again, and its cached
+ * contents are only used while its modification time and size are
+ * unchanged. Contents that are in use by a parser are kept alive by the
+ * parser even after they are invalidated.
+ *
+ * A FileCache may be shared between parsers used concurrently from
+ * multiple threads.
+ */
+class FileCache
+{
+public:
+    FileCache();
+    ~FileCache();
+
+    /**
+     * Look up a cached stat result.
+     *
+     * @param path The path that was stat'd.
+     * @param st Set to the cached result, if the path exists.
+     * @param exists Set to true if the path exists, else false.
+     * @return True if there was a cached result for the path.
+     */
+    bool lookup_stat(std::string const& path, struct stat &st,
+                     bool &exists) const;
+
+    /**
+     * Record a stat result. A NULL "st" records that the path does not
+     * exist.
+     */
+    void insert_stat(std::string const& path, struct stat const* st);
+
+    /**
+     * Get the contents of a file, reading it if its contents are not
+     * cached, or were cached with a different modification time or size.
+     *
+     * @param path The path of the file.
+     * @param mtime The expected modification time of the file.
+     * @param size The expected size of the file.
+     * @return The file contents, or NULL if the file could not be read or
+     *         did not have the expected size.
+     */
+    boost::shared_ptr<const llvm::MemoryBuffer>
+    get_contents(std::string const& path, time_t mtime, off_t size);
+
+    /**
+     * Remove the cached stat result and contents of a file.
+     */
+    void invalidate(std::string const& path);
+
+    /**
+     * Remove all entries from the cache.
+     */
+    void clear();
+
+    /**
+     * Get the number of files whose contents are cached.
+     */
+    size_t size() const;
+
+    /**
+     * Get the total size of the cached file contents, in bytes.
+     */
+    size_t get_total_memory() const;
+
+private:
+    // Non-copyable.
+    FileCache(FileCache const&);
+    FileCache& operator=(FileCache const&);
+
+    struct StatEntry
+    {
+        bool        exists;
+        struct stat st;
+    };
+    typedef std::map<std::string, StatEntry> StatMap;
+
+    struct ContentsEntry
+    {
+        time_t                                      mtime;
+        off_t                                       size;
+        boost::shared_ptr<const llvm::MemoryBuffer> buffer;
+    };
+    typedef std::map<std::string, ContentsEntry> ContentsMap;
+
+    StatMap                 m_stats;
+    ContentsMap             m_contents;
+    size_t                  m_total_memory;
+    mutable pthread_mutex_t m_mutex;
+};
+
+}}
+
+#endif
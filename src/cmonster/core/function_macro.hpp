@@ -27,6 +27,10 @@ SOFTWARE.
 
 #include <clang/Basic/SourceLocation.h>
 
+#include <boost/shared_ptr.hpp>
+
+#include <map>
+#include <string>
 #include <vector>
 
 namespace cmonster {
@@ -47,6 +51,50 @@ public:
     virtual std::vector<Token>
     operator()(clang::SourceLocation const& location,
                std::vector<Token> const& args) const = 0;
+
+    /**
+     * Called when the preprocessor is reset, after which any tokens
+     * previously passed to or returned by the function are invalid.
+     */
+    virtual void invalidate();
+};
+
+/**
+ * A function macro which memoizes the results of another, keyed by the
+ * spellings of the argument tokens. This is only correct for pure functions:
+ * those whose result depends only on the argument spellings.
+ *
+ * Cached results are replayed as they were first returned. Tokens created
+ * by the function are spelled in the preprocessor's scratch buffer; tokens
+ * taken from the arguments keep the location of the expansion that first
+ * produced them, as their spellings are read from there.
+ */
+class MemoizingFunctionMacro : public FunctionMacro
+{
+public:
+    /**
+     * @param function The pure function to memoize.
+     * @param max_entries The maximum number of results to cache. When the
+     *                    cache is full, it is emptied.
+     */
+    MemoizingFunctionMacro(boost::shared_ptr<FunctionMacro> const& function,
+                           size_t max_entries = 4096);
+
+    std::vector<Token>
+    operator()(clang::SourceLocation const& location,
+               std::vector<Token> const& args) const;
+
+    /**
+     * Discard the cached results.
+     */
+    void invalidate();
+
+private:
+    typedef std::map<std::string, std::vector<Token> > ResultMap;
+
+    boost::shared_ptr<FunctionMacro> m_function;
+    size_t                           m_max_entries;
+    mutable ResultMap                m_results;
 };
 
 }}
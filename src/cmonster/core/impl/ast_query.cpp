@@ -0,0 +1,220 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "../ast_query.hpp"
+
+#include <clang/AST/Decl.h>
+#include <clang/AST/RecursiveASTVisitor.h>
+#include <clang/Basic/SourceManager.h>
+#include <llvm/Support/Regex.h>
+
+#include <boost/scoped_ptr.hpp>
+#include <boost/throw_exception.hpp>
+
+#include <map>
+#include <stdexcept>
+#include <utility>
+
+#include <pthread.h>
+
+namespace cmonster {
+namespace core {
+
+namespace {
+
+// An inclusive range of kind values.
+typedef std::pair<unsigned int, unsigned int> KindRange;
+typedef std::map<std::string, KindRange> KindMap;
+
+// The kind maps are built once, as queries may be matched concurrently
+// with the GIL released.
+pthread_once_t kinds_once = PTHREAD_ONCE_INIT;
+KindMap *decl_kinds = 0;
+KindMap *stmt_kinds = 0;
+
+void create_kinds()
+{
+    decl_kinds = new KindMap;
+    stmt_kinds = new KindMap;
+
+    // Concrete kinds first, so that ranges for kinds with subclasses
+    // replace them.
+#define DECL(DERIVED, BASE) \
+    (*decl_kinds)[#DERIVED] = KindRange(clang::Decl::DERIVED, \
+                                        clang::Decl::DERIVED);
+#define ABSTRACT_DECL(DECL)
+#include <clang/AST/DeclNodes.inc>
+#define DECL(DERIVED, BASE)
+#define DECL_RANGE(BASE, START, END) \
+    (*decl_kinds)[#BASE] = KindRange(clang::Decl::first##BASE, \
+                                     clang::Decl::last##BASE);
+#include <clang/AST/DeclNodes.inc>
+
+#define STMT(CLASS, PARENT) \
+    (*stmt_kinds)[#CLASS] = KindRange(clang::Stmt::CLASS##Class, \
+                                      clang::Stmt::CLASS##Class);
+#define ABSTRACT_STMT(STMT)
+#include <clang/AST/StmtNodes.inc>
+#define STMT(CLASS, PARENT)
+#define STMT_RANGE(BASE, FIRST, LAST) \
+    (*stmt_kinds)[#BASE] = KindRange(clang::Stmt::first##BASE##Constant, \
+                                     clang::Stmt::last##BASE##Constant);
+#include <clang/AST/StmtNodes.inc>
+}
+
+KindMap const& get_decl_kinds()
+{
+    pthread_once(&kinds_once, &create_kinds);
+    return *decl_kinds;
+}
+
+KindMap const& get_stmt_kinds()
+{
+    pthread_once(&kinds_once, &create_kinds);
+    return *stmt_kinds;
+}
+
+std::vector<KindRange>
+resolve_kinds(KindMap const& kinds, std::vector<std::string> const& names)
+{
+    std::vector<KindRange> result;
+    for (std::vector<std::string>::const_iterator iter = names.begin();
+         iter != names.end(); ++iter)
+    {
+        KindMap::const_iterator kind = kinds.find(*iter);
+        if (kind == kinds.end())
+        {
+            boost::throw_exception(std::invalid_argument(
+                "Unknown AST node kind: " + *iter));
+        }
+        result.push_back(kind->second);
+    }
+    return result;
+}
+
+bool
+in_ranges(std::vector<KindRange> const& ranges, unsigned int kind)
+{
+    for (std::vector<KindRange>::const_iterator iter = ranges.begin();
+         iter != ranges.end(); ++iter)
+    {
+        if (kind >= iter->first && kind <= iter->second)
+            return true;
+    }
+    return false;
+}
+
+class Matcher : public clang::RecursiveASTVisitor<Matcher>
+{
+public:
+    Matcher(clang::ASTContext &context, AstQuery const& query)
+      : m_sm(context.getSourceManager()), m_query(query),
+        m_decl_kinds(resolve_kinds(get_decl_kinds(), query.decl_kinds)),
+        m_stmt_kinds(resolve_kinds(get_stmt_kinds(), query.stmt_kinds)),
+        m_match_decls(!query.decl_kinds.empty() || query.stmt_kinds.empty()),
+        m_name_regex(), m_matches()
+    {
+        if (!query.name_pattern.empty())
+        {
+            m_name_regex.reset(new llvm::Regex(query.name_pattern));
+            std::string error;
+            if (!m_name_regex->isValid(error))
+            {
+                boost::throw_exception(std::invalid_argument(
+                    "Invalid name pattern: " + error));
+            }
+        }
+    }
+
+    bool VisitDecl(clang::Decl *decl)
+    {
+        if (!m_match_decls)
+            return true;
+        if (!m_decl_kinds.empty() && !in_ranges(m_decl_kinds, decl->getKind()))
+            return true;
+        if (m_query.with_body && !decl->hasBody())
+            return true;
+        if (m_query.main_file_only && !in_main_file(decl->getLocation()))
+            return true;
+        if (m_name_regex)
+        {
+            clang::NamedDecl *named = llvm::dyn_cast<clang::NamedDecl>(decl);
+            if (!named || !m_name_regex->match(named->getNameAsString()))
+                return true;
+        }
+        AstMatch match = {decl, NULL};
+        m_matches.push_back(match);
+        return true;
+    }
+
+    bool VisitStmt(clang::Stmt *stmt)
+    {
+        if (m_stmt_kinds.empty() ||
+            !in_ranges(m_stmt_kinds, stmt->getStmtClass()))
+        {
+            return true;
+        }
+        if (m_query.main_file_only && !in_main_file(stmt->getLocStart()))
+            return true;
+        AstMatch match = {NULL, stmt};
+        m_matches.push_back(match);
+        return true;
+    }
+
+    std::vector<AstMatch>& getMatches() {return m_matches;}
+
+private:
+    bool in_main_file(clang::SourceLocation const& loc) const
+    {
+        return loc.isValid() &&
+            m_sm.isFromMainFile(m_sm.getExpansionLoc(loc));
+    }
+
+    clang::SourceManager            &m_sm;
+    AstQuery const&                  m_query;
+    std::vector<KindRange>           m_decl_kinds;
+    std::vector<KindRange>           m_stmt_kinds;
+    bool                             m_match_decls;
+    boost::scoped_ptr<llvm::Regex>   m_name_regex;
+    std::vector<AstMatch>            m_matches;
+};
+
+}
+
+AstQuery::AstQuery()
+  : decl_kinds(), stmt_kinds(), name_pattern(), main_file_only(false),
+    with_body(false)
+{
+}
+
+std::vector<AstMatch>
+match_ast(clang::ASTContext &context, AstQuery const& query)
+{
+    Matcher matcher(context, query);
+    matcher.TraverseDecl(context.getTranslationUnitDecl());
+    std::vector<AstMatch> result;
+    result.swap(matcher.getMatches());
+    return result;
+}
+
+}}
+
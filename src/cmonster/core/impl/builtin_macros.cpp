@@ -0,0 +1,357 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "../builtin_macros.hpp"
+#include "../native_macro.h"
+#include "../preprocessor.hpp"
+
+#include <clang/Basic/SourceManager.h>
+#include <clang/Lex/Preprocessor.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <boost/exception/all.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <dlfcn.h>
+#include <map>
+#include <stdexcept>
+
+namespace cmonster {
+namespace core {
+
+namespace {
+
+/**
+ * Spell a sequence of tokens, separating tokens with a single space where
+ * there was whitespace in the source.
+ */
+std::string
+spell(std::vector<Token> const& tokens, bool spaces = true)
+{
+    std::string result;
+    llvm::raw_string_ostream out(result);
+    for (std::vector<Token>::const_iterator iter = tokens.begin();
+         iter != tokens.end(); ++iter)
+    {
+        if (spaces && iter != tokens.begin() &&
+            iter->getClangToken().hasLeadingSpace())
+        {
+            out << ' ';
+        }
+        out << *iter;
+    }
+    out.flush();
+    return result;
+}
+
+std::vector<Token>
+tokenize(Preprocessor &pp, std::string const& s)
+{
+    return pp.tokenize(s.data(), s.size());
+}
+
+class CounterMacro : public FunctionMacro
+{
+public:
+    CounterMacro(Preprocessor &pp, long start)
+      : m_pp(pp), m_next(start) {}
+
+    std::vector<Token>
+    operator()(clang::SourceLocation const& location,
+               std::vector<Token> const& args) const
+    {
+        return tokenize(m_pp, boost::lexical_cast<std::string>(m_next++));
+    }
+
+private:
+    Preprocessor &m_pp;
+    mutable long  m_next;
+};
+
+class StringifyMacro : public FunctionMacro
+{
+public:
+    StringifyMacro(Preprocessor &pp) : m_pp(pp) {}
+
+    std::vector<Token>
+    operator()(clang::SourceLocation const& location,
+               std::vector<Token> const& args) const
+    {
+        std::string const& spelling = spell(args);
+        std::string literal(1, '"');
+        literal.reserve(spelling.size() + 2);
+        for (std::string::const_iterator iter = spelling.begin();
+             iter != spelling.end(); ++iter)
+        {
+            if (*iter == '"' || *iter == '\\')
+                literal += '\\';
+            literal += *iter;
+        }
+        literal += '"';
+        return tokenize(m_pp, literal);
+    }
+
+private:
+    Preprocessor &m_pp;
+};
+
+class ConcatCounterMacro : public FunctionMacro
+{
+public:
+    ConcatCounterMacro(Preprocessor &pp, long start)
+      : m_pp(pp), m_next(start) {}
+
+    std::vector<Token>
+    operator()(clang::SourceLocation const& location,
+               std::vector<Token> const& args) const
+    {
+        std::string const& prefix = spell(args, false);
+        return tokenize(
+            m_pp, prefix + boost::lexical_cast<std::string>(m_next++));
+    }
+
+private:
+    Preprocessor &m_pp;
+    mutable long  m_next;
+};
+
+/**
+ * Maps the spelling of its arguments to a value. The values are kept as
+ * text and tokenized on each expansion, as tokens do not outlive the Clang
+ * preprocessor (and its scratch buffer) that they were lexed by.
+ */
+class TableMacro : public FunctionMacro
+{
+public:
+    TableMacro(Preprocessor &pp, std::vector<std::string> const& params)
+      : m_pp(pp), m_table(), m_default(), m_has_default(false)
+    {
+        for (std::vector<std::string>::const_iterator iter = params.begin();
+             iter != params.end(); ++iter)
+        {
+            std::string::size_type eq = iter->find('=');
+            if (eq == std::string::npos)
+            {
+                boost::throw_exception(std::invalid_argument(
+                    "table entries must be of the form key=value: " +
+                    *iter));
+            }
+            std::string const& value = iter->substr(eq + 1);
+            if (eq == 0)
+            {
+                m_default = value;
+                m_has_default = true;
+            }
+            else
+            {
+                m_table[iter->substr(0, eq)] = value;
+            }
+        }
+    }
+
+    std::vector<Token>
+    operator()(clang::SourceLocation const& location,
+               std::vector<Token> const& args) const
+    {
+        std::string const& key = spell(args);
+        std::map<std::string, std::string>::const_iterator iter =
+            m_table.find(key);
+        if (iter != m_table.end())
+            return tokenize(m_pp, iter->second);
+        if (!m_has_default)
+        {
+            boost::throw_exception(std::invalid_argument(
+                "no table entry for key: " + key));
+        }
+        return tokenize(m_pp, m_default);
+    }
+
+private:
+    Preprocessor                         &m_pp;
+    std::map<std::string, std::string>    m_table;
+    std::string                           m_default;
+    bool                                  m_has_default;
+};
+
+long get_start(std::vector<std::string> const& params)
+{
+    if (params.empty())
+        return 0;
+    if (params.size() > 1)
+    {
+        boost::throw_exception(std::invalid_argument(
+            "expected at most one parameter (the start value)"));
+    }
+    try
+    {
+        return boost::lexical_cast<long>(params[0]);
+    }
+    catch (boost::bad_lexical_cast const&)
+    {
+        boost::throw_exception(std::invalid_argument(
+            "invalid start value: " + params[0]));
+    }
+    return 0; // unreachable
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+struct LibraryCloser
+{
+    void operator()(void *handle) const {if (handle) dlclose(handle);}
+};
+
+void emit_to_string(void *sink, const char *text, size_t length)
+{
+    static_cast<std::string*>(sink)->append(text, length);
+}
+
+class NativeMacro : public FunctionMacro
+{
+public:
+    NativeMacro(Preprocessor &pp, boost::shared_ptr<void> const& library,
+                cmonster_native_macro_fn fn)
+      : m_pp(pp), m_library(library), m_fn(fn) {}
+
+    std::vector<Token>
+    operator()(clang::SourceLocation const& location,
+               std::vector<Token> const& args) const
+    {
+        // Spell each argument token. The spellings are stored contiguously
+        // so that only one allocation is made, for the common case.
+        std::string buffer;
+        std::vector<size_t> offsets, lengths;
+        offsets.reserve(args.size());
+        lengths.reserve(args.size());
+        {
+            llvm::raw_string_ostream out(buffer);
+            for (std::vector<Token>::const_iterator iter = args.begin();
+                 iter != args.end(); ++iter)
+            {
+                size_t offset = out.tell();
+                out << *iter;
+                offsets.push_back(offset);
+                lengths.push_back(out.tell() - offset);
+            }
+        }
+        std::vector<const char*> spellings(args.size());
+        for (size_t i = 0; i < args.size(); ++i)
+            spellings[i] = buffer.data() + offsets[i];
+
+        cmonster_macro_args native_args;
+        native_args.num_tokens = args.size();
+        native_args.spellings = spellings.empty() ? NULL : &spellings[0];
+        native_args.lengths = lengths.empty() ? NULL : &lengths[0];
+        native_args.filename = NULL;
+        native_args.line = 0;
+        native_args.column = 0;
+        clang::SourceManager const& sm =
+            m_pp.getClangPreprocessor().getSourceManager();
+        clang::PresumedLoc ploc = sm.getPresumedLoc(location);
+        if (ploc.isValid())
+        {
+            native_args.filename = ploc.getFilename();
+            native_args.line = ploc.getLine();
+            native_args.column = ploc.getColumn();
+        }
+
+        std::string result;
+        const int rc = m_fn(&native_args, &result, &emit_to_string);
+        if (rc != 0)
+        {
+            boost::throw_exception(std::runtime_error(
+                "native macro failed with status " +
+                boost::lexical_cast<std::string>(rc)));
+        }
+        return tokenize(m_pp, result);
+    }
+
+private:
+    Preprocessor             &m_pp;
+    boost::shared_ptr<void>   m_library;
+    cmonster_native_macro_fn  m_fn;
+};
+
+}
+
+boost::shared_ptr<FunctionMacro>
+create_builtin_macro(Preprocessor &pp, std::string const& kind,
+                     std::vector<std::string> const& params)
+{
+    boost::shared_ptr<FunctionMacro> result;
+    if (kind == "counter")
+    {
+        result.reset(new CounterMacro(pp, get_start(params)));
+    }
+    else if (kind == "stringify")
+    {
+        if (!params.empty())
+        {
+            boost::throw_exception(std::invalid_argument(
+                "stringify does not accept parameters"));
+        }
+        result.reset(new StringifyMacro(pp));
+    }
+    else if (kind == "concat_counter")
+    {
+        result.reset(new ConcatCounterMacro(pp, get_start(params)));
+    }
+    else if (kind == "table")
+    {
+        result.reset(new TableMacro(pp, params));
+    }
+    return result;
+}
+
+boost::shared_ptr<FunctionMacro>
+create_native_macro(Preprocessor &pp, std::string const& library,
+                    std::string const& symbol)
+{
+    boost::shared_ptr<void> handle(
+        dlopen(library.c_str(), RTLD_NOW | RTLD_LOCAL), LibraryCloser());
+    if (!handle)
+    {
+        const char *error = dlerror();
+        boost::throw_exception(std::runtime_error(
+            "failed to load " + library + ": " +
+            (error ? error : "unknown error")));
+    }
+
+    dlerror();
+    void *address = dlsym(handle.get(), symbol.c_str());
+    if (!address)
+    {
+        const char *error = dlerror();
+        boost::throw_exception(std::runtime_error(
+            "failed to find " + symbol + " in " + library + ": " +
+            (error ? error : "null symbol")));
+    }
+
+    // POSIX guarantees that a data pointer returned by dlsym may be
+    // converted to a function pointer.
+    cmonster_native_macro_fn fn;
+    *reinterpret_cast<void**>(&fn) = address;
+    return boost::shared_ptr<FunctionMacro>(new NativeMacro(pp, handle, fn));
+}
+
+}}
+
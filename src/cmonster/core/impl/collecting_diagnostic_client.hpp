@@ -0,0 +1,59 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _CMONSTER_CORE_IMPL_COLLECTINGDIAGNOSTICCLIENT_HPP
+#define _CMONSTER_CORE_IMPL_COLLECTINGDIAGNOSTICCLIENT_HPP
+
+#include "../diagnostics.hpp"
+
+#include <clang/Basic/Diagnostic.h>
+
+#include <boost/shared_ptr.hpp>
+
+namespace cmonster {
+namespace core {
+namespace impl {
+
+/**
+ * A diagnostic client that records every diagnostic in a DiagnosticList,
+ * rather than raising an exception for the first one, so that parsing
+ * continues and all of the errors in a translation unit are reported.
+ */
+class CollectingDiagnosticClient : public clang::DiagnosticConsumer
+{
+public:
+    CollectingDiagnosticClient(
+        boost::shared_ptr<DiagnosticList> const& diagnostics);
+
+    void HandleDiagnostic(clang::DiagnosticsEngine::Level level,
+                          const clang::Diagnostic &info);
+
+    clang::DiagnosticConsumer* clone(clang::DiagnosticsEngine &diags) const;
+
+private:
+    boost::shared_ptr<DiagnosticList> m_diagnostics;
+};
+
+}}}
+
+#endif
+
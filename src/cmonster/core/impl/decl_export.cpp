@@ -0,0 +1,205 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "../decl_export.hpp"
+#include "../location_table.hpp"
+
+#include <clang/AST/Decl.h>
+#include <clang/AST/PrettyPrinter.h>
+#include <clang/Basic/SourceManager.h>
+
+#include <algorithm>
+#include <pthread.h>
+#include <unistd.h>
+
+namespace cmonster {
+namespace core {
+
+namespace {
+
+// The strings printed for each entry, before they are packed into columns.
+struct DeclStrings
+{
+    std::vector<std::string> names;
+    std::vector<std::string> qualified_names;
+    std::vector<std::string> types;
+};
+
+// A share of the top-level declarations, for one thread: subtrees first,
+// first+stride, first+2*stride, ... of "subtrees".
+struct ExportTask
+{
+    DeclIndex const                 *index;
+    std::vector<unsigned int> const *subtrees;
+    size_t                           first;
+    size_t                           stride;
+    clang::PrintingPolicy const     *policy;
+    DeclStrings                     *strings;
+};
+
+clang::QualType get_decl_type(clang::Decl *decl)
+{
+    if (clang::ValueDecl *value = llvm::dyn_cast<clang::ValueDecl>(decl))
+        return value->getType();
+    if (clang::TypedefNameDecl *typedef_ =
+            llvm::dyn_cast<clang::TypedefNameDecl>(decl))
+        return typedef_->getUnderlyingType();
+    if (clang::TypeDecl *type = llvm::dyn_cast<clang::TypeDecl>(decl))
+    {
+        // Don't create the type if it doesn't exist; the AST context is
+        // shared with other threads.
+        if (type->getTypeForDecl())
+            return clang::QualType(type->getTypeForDecl(), 0);
+    }
+    return clang::QualType();
+}
+
+void print_decl(ExportTask const& task, unsigned int i)
+{
+    clang::Decl *decl = (*task.index)[i].decl;
+    if (clang::NamedDecl *named = llvm::dyn_cast<clang::NamedDecl>(decl))
+    {
+        task.strings->names[i] = named->getNameAsString();
+        task.strings->qualified_names[i] =
+            named->getQualifiedNameAsString(*task.policy);
+    }
+    clang::QualType type = get_decl_type(decl);
+    if (!type.isNull())
+        task.strings->types[i] = type.getAsString(*task.policy);
+}
+
+void* export_subtrees(void *arg)
+{
+    ExportTask const& task = *static_cast<ExportTask*>(arg);
+    std::vector<unsigned int> const& subtrees = *task.subtrees;
+    for (size_t k = task.first; k + 1 < subtrees.size(); k += task.stride)
+    {
+        for (unsigned int i = subtrees[k]; i < subtrees[k+1]; ++i)
+            print_decl(task, i);
+    }
+    return NULL;
+}
+
+void pack(std::vector<std::string> const& strings, StringColumn &column)
+{
+    size_t total = 0;
+    for (size_t i = 0; i < strings.size(); ++i)
+        total += strings[i].size();
+    column.offsets.reserve(strings.size() + 1);
+    column.data.reserve(total);
+    column.offsets.push_back(0);
+    for (size_t i = 0; i < strings.size(); ++i)
+    {
+        column.data.append(strings[i]);
+        column.offsets.push_back(static_cast<uint32_t>(column.data.size()));
+    }
+}
+
+}
+
+DeclColumns export_decls(clang::ASTContext &context, DeclIndex const& index,
+                         unsigned int nthreads)
+{
+    const size_t n = index.size();
+    DeclColumns columns;
+    columns.kinds.reserve(n);
+    columns.parents.reserve(n);
+
+    // Find the subtrees of the top-level declarations. Entries are in
+    // pre-order, so each subtree is a contiguous range, ending where the
+    // next one starts.
+    std::vector<unsigned int> subtrees;
+    std::vector<uint32_t> locations;
+    locations.reserve(n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        DeclIndex::Entry const& entry = index[i];
+        columns.kinds.push_back(entry.kind);
+        columns.parents.push_back(entry.parent);
+        locations.push_back(entry.begin);
+        if (columns.kind_names.find(entry.kind) == columns.kind_names.end())
+            columns.kind_names[entry.kind] = entry.decl->getDeclKindName();
+        if (entry.parent == 0)
+            subtrees.push_back(i);
+    }
+    subtrees.push_back(n);
+
+    // Resolve locations on this thread.
+    LocationTable table;
+    decompose_locations(context.getSourceManager(),
+                        n ? &locations[0] : NULL, n, table);
+    columns.files.swap(table.files);
+    columns.lines.swap(table.lines);
+    columns.filenames.assign(table.filenames.begin(), table.filenames.end());
+
+    // Print the names and types, in parallel.
+    DeclStrings strings;
+    strings.names.resize(n);
+    strings.qualified_names.resize(n);
+    strings.types.resize(n);
+    clang::PrintingPolicy policy(context.getLangOptions());
+    if (nthreads == 0)
+    {
+        long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = ncpus > 0 ? static_cast<unsigned int>(ncpus) : 1;
+    }
+    if (context.getExternalSource())
+        nthreads = 1;
+    nthreads = std::max<size_t>(
+        1, std::min<size_t>(nthreads, subtrees.size() - 1));
+
+    std::vector<ExportTask> tasks(nthreads);
+    std::vector<pthread_t> threads(nthreads);
+    std::vector<bool> started(nthreads, false);
+    for (size_t i = 0; i < nthreads; ++i)
+    {
+        ExportTask task = {&index, &subtrees, i, nthreads, &policy, &strings};
+        tasks[i] = task;
+        // The calling thread takes the first share, and any share for
+        // which a thread could not be started.
+        if (i > 0)
+        {
+            started[i] = pthread_create(
+                &threads[i], NULL, &export_subtrees, &tasks[i]) == 0;
+        }
+    }
+    if (n > 0)
+        print_decl(tasks[0], 0);
+    for (size_t i = 0; i < nthreads; ++i)
+    {
+        if (!started[i])
+            export_subtrees(&tasks[i]);
+    }
+    for (size_t i = 0; i < nthreads; ++i)
+    {
+        if (started[i])
+            pthread_join(threads[i], NULL);
+    }
+
+    pack(strings.names, columns.names);
+    pack(strings.qualified_names, columns.qualified_names);
+    pack(strings.types, columns.types);
+    return columns;
+}
+
+}}
+
@@ -0,0 +1,139 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "../decl_index.hpp"
+
+#include <clang/AST/Decl.h>
+
+#include <utility>
+
+namespace cmonster {
+namespace core {
+
+namespace {
+
+void add_entry(std::vector<DeclIndex::Entry> &entries, clang::Decl *decl,
+               unsigned int parent)
+{
+    DeclIndex::Entry entry;
+    entry.decl = decl;
+    entry.name = NULL;
+    if (clang::NamedDecl *named = llvm::dyn_cast<clang::NamedDecl>(decl))
+        entry.name = named->getIdentifier();
+    entry.parent = parent;
+    entry.kind = decl->getKind();
+    clang::SourceRange const& range = decl->getSourceRange();
+    entry.begin = range.getBegin().getRawEncoding();
+    entry.end = range.getEnd().getRawEncoding();
+    entries.push_back(entry);
+}
+
+}
+
+DeclIndex::DeclIndex(clang::ASTContext &context)
+  : m_context(context), m_entries()
+{
+    clang::TranslationUnitDecl *tu = context.getTranslationUnitDecl();
+    add_entry(m_entries, tu, NO_PARENT);
+
+    // Walk the declaration contexts in pre-order with an explicit stack,
+    // which holds (entry index, next child) pairs.
+    typedef std::pair<unsigned int, clang::DeclContext::decl_iterator>
+        StackEntry;
+    std::vector<StackEntry> stack;
+    stack.push_back(StackEntry(0, tu->decls_begin()));
+    while (!stack.empty())
+    {
+        StackEntry &top = stack.back();
+        clang::DeclContext *dc =
+            clang::Decl::castToDeclContext(m_entries[top.first].decl);
+        if (top.second == dc->decls_end())
+        {
+            stack.pop_back();
+            continue;
+        }
+
+        clang::Decl *decl = *top.second;
+        ++top.second;
+        const unsigned int index = m_entries.size();
+        add_entry(m_entries, decl, top.first);
+
+        // Function parameters are only members of the function's
+        // declaration context if they are named and the function has a
+        // body, so add the others explicitly.
+        clang::FunctionDecl *fd = llvm::dyn_cast<clang::FunctionDecl>(decl);
+        if (fd)
+        {
+            for (clang::FunctionDecl::param_iterator
+                     iter = fd->param_begin(); iter != fd->param_end(); ++iter)
+            {
+                if (!fd->containsDecl(*iter))
+                    add_entry(m_entries, *iter, index);
+            }
+        }
+
+        clang::DeclContext *child = llvm::dyn_cast<clang::DeclContext>(decl);
+        if (child)
+            stack.push_back(StackEntry(index, child->decls_begin()));
+    }
+}
+
+std::vector<unsigned int>
+DeclIndex::find_by_kind(clang::Decl::Kind kind) const
+{
+    std::vector<unsigned int> result;
+    const unsigned int kind_ = kind;
+    for (size_t i = 0; i < m_entries.size(); ++i)
+    {
+        if (m_entries[i].kind == kind_)
+            result.push_back(i);
+    }
+    return result;
+}
+
+std::vector<unsigned int>
+DeclIndex::find_by_name(llvm::StringRef name,
+                        const clang::Decl::Kind *kind) const
+{
+    std::vector<unsigned int> result;
+
+    // Look the name up without inserting it (IdentifierTable::get would),
+    // so that queries do not grow the AST's identifier table. Every indexed
+    // declaration's identifier is already in the table.
+    clang::IdentifierTable::iterator found = m_context.Idents.find(name);
+    if (found == m_context.Idents.end())
+        return result;
+    const clang::IdentifierInfo *ident = found->getValue();
+    for (size_t i = 0; i < m_entries.size(); ++i)
+    {
+        Entry const& entry = m_entries[i];
+        if (entry.name == ident &&
+            (!kind || entry.kind == static_cast<unsigned int>(*kind)))
+        {
+            result.push_back(i);
+        }
+    }
+    return result;
+}
+
+}}
+
@@ -0,0 +1,60 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "../diagnostics.hpp"
+
+#include <clang/Basic/Diagnostic.h>
+
+namespace cmonster {
+namespace core {
+
+void DiagnosticList::add(uint32_t level, uint32_t id, uint32_t location,
+                         llvm::StringRef message)
+{
+    Record record;
+    record.level = level;
+    record.id = id;
+    record.location = location;
+    record.message_offset = static_cast<uint32_t>(m_messages.size());
+    record.message_length = static_cast<uint32_t>(message.size());
+    m_messages.append(message.data(), message.size());
+    m_records.push_back(record);
+    if (level >= clang::DiagnosticsEngine::Error)
+        ++m_errors;
+}
+
+llvm::StringRef DiagnosticList::get_message(size_t i) const
+{
+    Record const& record = m_records[i];
+    return llvm::StringRef(m_messages.data() + record.message_offset,
+                           record.message_length);
+}
+
+void DiagnosticList::clear()
+{
+    m_records.clear();
+    m_messages.clear();
+    m_errors = 0;
+}
+
+}}
+
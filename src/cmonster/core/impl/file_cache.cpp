@@ -0,0 +1,152 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "../file_cache.hpp"
+
+#include <llvm/ADT/OwningPtr.h>
+#include <llvm/Support/system_error.h>
+
+namespace {
+
+struct ScopedLock
+{
+    ScopedLock(pthread_mutex_t &mutex) : m_mutex(mutex)
+    {
+        pthread_mutex_lock(&m_mutex);
+    }
+    ~ScopedLock() {pthread_mutex_unlock(&m_mutex);}
+private:
+    pthread_mutex_t &m_mutex;
+};
+
+} // Anonymous namespace.
+
+namespace cmonster {
+namespace core {
+
+FileCache::FileCache() : m_stats(), m_contents(), m_total_memory(0)
+{
+    pthread_mutex_init(&m_mutex, NULL);
+}
+
+FileCache::~FileCache()
+{
+    pthread_mutex_destroy(&m_mutex);
+}
+
+bool FileCache::lookup_stat(std::string const& path, struct stat &st,
+                            bool &exists) const
+{
+    ScopedLock lock(m_mutex);
+    StatMap::const_iterator iter = m_stats.find(path);
+    if (iter == m_stats.end())
+        return false;
+    exists = iter->second.exists;
+    if (exists)
+        st = iter->second.st;
+    return true;
+}
+
+void FileCache::insert_stat(std::string const& path, struct stat const* st)
+{
+    StatEntry entry;
+    entry.exists = st != NULL;
+    if (st)
+        entry.st = *st;
+    ScopedLock lock(m_mutex);
+    m_stats[path] = entry;
+}
+
+boost::shared_ptr<const llvm::MemoryBuffer>
+FileCache::get_contents(std::string const& path, time_t mtime, off_t size)
+{
+    {
+        ScopedLock lock(m_mutex);
+        ContentsMap::const_iterator iter = m_contents.find(path);
+        if (iter != m_contents.end() && iter->second.mtime == mtime &&
+            iter->second.size == size)
+            return iter->second.buffer;
+    }
+
+    // Read the file without holding the lock, so that other threads may
+    // use the cache in the meantime. If the file changed size since it was
+    // stat'd, then it is not cached.
+    llvm::OwningPtr<llvm::MemoryBuffer> buffer;
+    if (llvm::MemoryBuffer::getFile(path, buffer, size) ||
+        static_cast<off_t>(buffer->getBufferSize()) != size)
+        return boost::shared_ptr<const llvm::MemoryBuffer>();
+
+    ContentsEntry entry;
+    entry.mtime = mtime;
+    entry.size = size;
+    entry.buffer.reset(buffer.take());
+
+    // Another thread may have read the file concurrently; the last reader
+    // replaces the entry, and parsers keep whichever buffer they were given.
+    ScopedLock lock(m_mutex);
+    ContentsMap::iterator iter = m_contents.find(path);
+    if (iter != m_contents.end())
+    {
+        m_total_memory -= iter->second.buffer->getBufferSize();
+        iter->second = entry;
+    }
+    else
+    {
+        m_contents.insert(std::make_pair(path, entry));
+    }
+    m_total_memory += entry.buffer->getBufferSize();
+    return entry.buffer;
+}
+
+void FileCache::invalidate(std::string const& path)
+{
+    ScopedLock lock(m_mutex);
+    m_stats.erase(path);
+    ContentsMap::iterator iter = m_contents.find(path);
+    if (iter != m_contents.end())
+    {
+        m_total_memory -= iter->second.buffer->getBufferSize();
+        m_contents.erase(iter);
+    }
+}
+
+void FileCache::clear()
+{
+    ScopedLock lock(m_mutex);
+    m_stats.clear();
+    m_contents.clear();
+    m_total_memory = 0;
+}
+
+size_t FileCache::size() const
+{
+    ScopedLock lock(m_mutex);
+    return m_contents.size();
+}
+
+size_t FileCache::get_total_memory() const
+{
+    ScopedLock lock(m_mutex);
+    return m_total_memory;
+}
+
+}}
@@ -0,0 +1,106 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "file_cache_client.hpp"
+
+#include <sys/stat.h>
+
+namespace cmonster {
+namespace core {
+namespace impl {
+
+SharedStatCache::SharedStatCache() : m_cache() {}
+
+clang::FileSystemStatCache::LookupResult
+SharedStatCache::getStat(const char *path, struct stat &st,
+                         int *file_descriptor)
+{
+    if (!m_cache)
+        return statChained(path, st, file_descriptor);
+
+    bool exists = false;
+    if (m_cache->lookup_stat(path, st, exists))
+        return exists ? CacheExists : CacheMissing;
+    const LookupResult result = statChained(path, st, file_descriptor);
+    m_cache->insert_stat(path, result == CacheExists ? &st : NULL);
+    return result;
+}
+
+void SharedStatCache::setFileCache(boost::shared_ptr<FileCache> const& cache)
+{
+    m_cache = cache;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+FileCacheClient::FileCacheClient(clang::FileManager &fm,
+                                 clang::SourceManager &sm)
+  : m_cache(), m_stat_cache(new SharedStatCache), m_sm(&sm), m_overridden(),
+    m_buffers()
+{
+    fm.addStatCache(m_stat_cache);
+}
+
+void FileCacheClient::setFileCache(boost::shared_ptr<FileCache> const& cache)
+{
+    m_cache = cache;
+    m_stat_cache->setFileCache(cache);
+}
+
+void FileCacheClient::enterFile(const clang::FileEntry *file)
+{
+    if (!m_cache || !file || m_overridden.count(file))
+        return;
+    m_overridden.insert(file);
+
+    // The file entry's modification time and size may have come from a
+    // stat result cached by an earlier parse, so stat the file again before
+    // reusing its contents. If it changed, the cached stat result is
+    // replaced; the contents given to the source manager are read afresh,
+    // so the stale size in the file entry is not used to read the file.
+    struct stat st;
+    if (::stat(file->getName(), &st) != 0)
+    {
+        m_cache->insert_stat(file->getName(), NULL);
+        return;
+    }
+    if (st.st_mtime != file->getModificationTime() ||
+        st.st_size != file->getSize())
+        m_cache->insert_stat(file->getName(), &st);
+    boost::shared_ptr<const llvm::MemoryBuffer> buffer =
+        m_cache->get_contents(file->getName(), st.st_mtime, st.st_size);
+    if (buffer)
+    {
+        // The source manager must not free the buffer, which is owned by
+        // the cache (and this object).
+        m_buffers.push_back(buffer);
+        m_sm->overrideFileContents(file, buffer.get(), true);
+    }
+}
+
+void FileCacheClient::setSourceManager(clang::SourceManager &sm)
+{
+    m_sm = &sm;
+    m_overridden.clear();
+}
+
+}}}
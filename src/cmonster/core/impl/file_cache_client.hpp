@@ -0,0 +1,112 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _CMONSTER_CORE_FILE_CACHE_CLIENT_HPP
+#define _CMONSTER_CORE_FILE_CACHE_CLIENT_HPP
+
+#include "../file_cache.hpp"
+
+#include <clang/Basic/FileManager.h>
+#include <clang/Basic/FileSystemStatCache.h>
+#include <clang/Basic/SourceManager.h>
+
+#include <boost/shared_ptr.hpp>
+
+#include <set>
+#include <vector>
+
+namespace cmonster {
+namespace core {
+namespace impl {
+
+/**
+ * A Clang stat cache that consults, and updates, a shared FileCache. With
+ * no FileCache, every stat is passed through.
+ */
+class SharedStatCache : public clang::FileSystemStatCache
+{
+public:
+    SharedStatCache();
+
+    /**
+     * Override for clang::FileSystemStatCache::getStat.
+     */
+    LookupResult getStat(const char *path, struct stat &st,
+                         int *file_descriptor);
+
+    void setFileCache(boost::shared_ptr<FileCache> const& cache);
+
+private:
+    boost::shared_ptr<FileCache> m_cache;
+};
+
+/**
+ * Attaches a shared FileCache to a file manager and source manager: stat
+ * results are taken from the cache, and the contents of each included file
+ * are supplied from the cache before the source manager reads the file.
+ * The contents given to the source manager are kept alive for the lifetime
+ * of this object, which must not be destroyed while the source manager's
+ * files are in use.
+ */
+class FileCacheClient
+{
+public:
+    /**
+     * The stat cache is installed in "fm", which takes ownership of it.
+     */
+    FileCacheClient(clang::FileManager &fm, clang::SourceManager &sm);
+
+    /**
+     * Set the cache to use, or NULL to stop using one. Files whose
+     * contents have already been read are unaffected.
+     */
+    void setFileCache(boost::shared_ptr<FileCache> const& cache);
+
+    /**
+     * Called when a file is about to be included. If the source manager has
+     * not yet been given the file's contents, the file is stat'd again and
+     * its contents are taken from the cache, or read if the file has
+     * changed.
+     */
+    void enterFile(const clang::FileEntry *file);
+
+    /**
+     * Supply contents to a new source manager from now on. Contents given
+     * to the previous source manager are still kept alive.
+     */
+    void setSourceManager(clang::SourceManager &sm);
+
+private:
+    // Non-copyable.
+    FileCacheClient(FileCacheClient const&);
+    FileCacheClient& operator=(FileCacheClient const&);
+
+    boost::shared_ptr<FileCache>                             m_cache;
+    SharedStatCache                                         *m_stat_cache;
+    clang::SourceManager                                    *m_sm;
+    std::set<const clang::FileEntry*>                        m_overridden;
+    std::vector<boost::shared_ptr<const llvm::MemoryBuffer> > m_buffers;
+};
+
+}}}
+
+#endif
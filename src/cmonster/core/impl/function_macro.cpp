@@ -22,6 +22,8 @@ SOFTWARE.
 
 #include "../function_macro.hpp"
 
+#include <llvm/ADT/SmallString.h>
+
 namespace cmonster {
 namespace core {
 
@@ -29,5 +31,50 @@ FunctionMacro::~FunctionMacro()
 {
 }
 
+void FunctionMacro::invalidate()
+{
+}
+
+MemoizingFunctionMacro::MemoizingFunctionMacro(
+    boost::shared_ptr<FunctionMacro> const& function, size_t max_entries)
+  : m_function(function), m_max_entries(max_entries), m_results()
+{
+}
+
+std::vector<Token>
+MemoizingFunctionMacro::operator()(clang::SourceLocation const& location,
+                                   std::vector<Token> const& args) const
+{
+    // The key is each argument's kind, whether it has leading space, and
+    // its spelling, so that e.g. "a b" and "ab" are distinguished.
+    std::string key;
+    llvm::SmallString<64> buffer;
+    for (std::vector<Token>::const_iterator iter = args.begin();
+         iter != args.end(); ++iter)
+    {
+        clang::Token const& token = iter->getClangToken();
+        key.push_back(static_cast<char>(token.getKind()));
+        key.push_back(token.hasLeadingSpace() ? ' ' : '\0');
+        key.append(iter->getPreprocessor().getSpelling(token, buffer));
+        key.push_back('\0');
+    }
+
+    ResultMap::const_iterator cached = m_results.find(key);
+    if (cached != m_results.end())
+        return cached->second;
+
+    std::vector<Token> result = (*m_function)(location, args);
+    if (m_results.size() >= m_max_entries)
+        m_results.clear();
+    m_results.insert(std::make_pair(key, result));
+    return result;
+}
+
+void MemoizingFunctionMacro::invalidate()
+{
+    m_results.clear();
+    m_function->invalidate();
+}
+
 }}
 
@@ -0,0 +1,209 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "../include_cache.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const char *CACHE_FILE_MAGIC = "cmonster-include-cache-1";
+
+struct ScopedLock
+{
+    ScopedLock(pthread_mutex_t &mutex) : m_mutex(mutex)
+    {
+        pthread_mutex_lock(&m_mutex);
+    }
+    ~ScopedLock() {pthread_mutex_unlock(&m_mutex);}
+private:
+    pthread_mutex_t &m_mutex;
+};
+
+/**
+ * Get a stamp identifying the version of the compiler binary, or an empty
+ * string if it cannot be determined.
+ */
+std::string get_compiler_stamp(std::string const& compiler)
+{
+    struct stat st;
+    if (compiler.empty() || ::stat(compiler.c_str(), &st) != 0)
+        return std::string();
+    std::ostringstream ss;
+    ss << st.st_mtime << ':' << st.st_size;
+    return ss.str();
+}
+
+} // Anonymous namespace.
+
+namespace cmonster {
+namespace core {
+
+bool IncludeCache::Key::operator<(Key const& rhs) const
+{
+    if (angled != rhs.angled)
+        return angled < rhs.angled;
+    int cmp = filename.compare(rhs.filename);
+    if (cmp != 0)
+        return cmp < 0;
+    return includer_dir < rhs.includer_dir;
+}
+
+IncludeCache::IncludeCache() : m_entries()
+{
+    pthread_mutex_init(&m_mutex, NULL);
+}
+
+IncludeCache::~IncludeCache()
+{
+    pthread_mutex_destroy(&m_mutex);
+}
+
+bool IncludeCache::lookup(std::string const& filename, bool angled,
+                          std::string const& includer_dir,
+                          std::string &absolute_path, bool &located) const
+{
+    Key key;
+    key.filename = filename;
+    key.angled = angled;
+    key.includer_dir = includer_dir;
+
+    ScopedLock lock(m_mutex);
+    EntryMap::const_iterator iter = m_entries.find(key);
+    if (iter == m_entries.end())
+        return false;
+    located = !iter->second.empty();
+    if (located)
+        absolute_path = iter->second;
+    return true;
+}
+
+void IncludeCache::insert(std::string const& filename, bool angled,
+                          std::string const& includer_dir,
+                          std::string const& absolute_path)
+{
+    Key key;
+    key.filename = filename;
+    key.angled = angled;
+    key.includer_dir = includer_dir;
+
+    ScopedLock lock(m_mutex);
+    m_entries[key] = absolute_path;
+}
+
+void IncludeCache::clear()
+{
+    ScopedLock lock(m_mutex);
+    m_entries.clear();
+}
+
+size_t IncludeCache::size() const
+{
+    ScopedLock lock(m_mutex);
+    return m_entries.size();
+}
+
+bool IncludeCache::load(std::string const& path, std::string const& compiler)
+{
+    std::ifstream in(path.c_str());
+    if (!in)
+        return false;
+
+    // Check the header: the magic string, and the compiler stamp.
+    std::string magic, stamp;
+    if (!std::getline(in, magic) || magic != CACHE_FILE_MAGIC ||
+        !std::getline(in, stamp) || stamp != get_compiler_stamp(compiler))
+        return false;
+
+    // Read the entries into a temporary map, so a truncated file doesn't
+    // leave a partially loaded cache.
+    EntryMap entries;
+    std::string line;
+    while (std::getline(in, line))
+    {
+        // <a|q> TAB <includer dir> TAB <filename> TAB <path>
+        const size_t tab1 = line.find('\t');
+        const size_t tab2 = line.find('\t', tab1+1);
+        const size_t tab3 = line.find('\t', tab2+1);
+        if (tab1 != 1 || tab2 == std::string::npos ||
+            tab3 == std::string::npos)
+            return false;
+
+        Key key;
+        key.angled = line[0] == 'a';
+        key.includer_dir = line.substr(tab1+1, tab2-tab1-1);
+        key.filename = line.substr(tab2+1, tab3-tab2-1);
+        entries[key] = line.substr(tab3+1);
+    }
+
+    ScopedLock lock(m_mutex);
+    for (EntryMap::const_iterator iter = entries.begin();
+         iter != entries.end(); ++iter)
+    {
+        m_entries.insert(*iter);
+    }
+    return true;
+}
+
+bool IncludeCache::save(std::string const& path,
+                        std::string const& compiler) const
+{
+    // Write to a temporary file, and then rename it into place, so that
+    // concurrent readers never see a partially written file.
+    std::ostringstream tmp_path;
+    tmp_path << path << ".tmp." << ::getpid();
+    {
+        std::ofstream out(tmp_path.str().c_str());
+        if (!out)
+            return false;
+        out << CACHE_FILE_MAGIC << '\n'
+            << get_compiler_stamp(compiler) << '\n';
+
+        ScopedLock lock(m_mutex);
+        for (EntryMap::const_iterator iter = m_entries.begin();
+             iter != m_entries.end(); ++iter)
+        {
+            out << (iter->first.angled ? 'a' : 'q') << '\t'
+                << iter->first.includer_dir << '\t'
+                << iter->first.filename << '\t'
+                << iter->second << '\n';
+        }
+        if (!out.flush())
+        {
+            std::remove(tmp_path.str().c_str());
+            return false;
+        }
+    }
+    if (std::rename(tmp_path.str().c_str(), path.c_str()) != 0)
+    {
+        std::remove(tmp_path.str().c_str());
+        return false;
+    }
+    return true;
+}
+
+}}
@@ -51,8 +51,8 @@ namespace impl {
 
 IncludeLocatorDiagnosticClient::IncludeLocatorDiagnosticClient(
     clang::Preprocessor &pp, clang::DiagnosticConsumer *delegate)
-  : m_locator(), m_pp(pp), m_delegate(delegate), m_include_fid(),
-    m_include_loc() {}
+  : m_locator(), m_cache(), m_stats(0), m_pp(pp), m_delegate(delegate),
+    m_include_fid(), m_include_loc() {}
 
 void
 IncludeLocatorDiagnosticClient::setIncludeLocator(
@@ -61,6 +61,18 @@ IncludeLocatorDiagnosticClient::setIncludeLocator(
     m_locator = locator;
 }
 
+void
+IncludeLocatorDiagnosticClient::setIncludeCache(
+    boost::shared_ptr<IncludeCache> const& cache)
+{
+    m_cache = cache;
+}
+
+void IncludeLocatorDiagnosticClient::setStats(Stats *stats)
+{
+    m_stats = stats;
+}
+
 void
 IncludeLocatorDiagnosticClient::HandleDiagnostic(
     clang::DiagnosticsEngine::Level level, const clang::Diagnostic &info)
@@ -82,24 +94,56 @@ IncludeLocatorDiagnosticClient::HandleDiagnostic(
                "Failed to resolve #include filename spelling");
         const bool angled = spelling[0] == '<';
 
+        // Determine the directory of the including file, for the cache.
+        std::string includer_dir;
+        const clang::FileEntry *includer =
+            sm.getFileEntryForID(sm.getFileID(loc));
+        if (includer && includer->getDir())
+            includer_dir = includer->getDir()->getName();
+
         try
         {
-            // Try external resolution using the locator.
-            std::string include(filename.size() + 2, angled ? '<' : '"');
-            include.replace(1, filename.size(), filename);
-            if (angled) include[include.size()-1] = '>';
-
+            // Consult the cache first, and then try external resolution
+            // using the locator.
             std::string path;
-            if (m_locator->locate(include, path))
+            bool located = false;
+            ScopedTimer timer(m_stats, Stats::INCLUDE_LOCATOR, filename);
+            if (!m_cache || !m_cache->lookup(
+                    filename, angled, includer_dir, path, located))
+            {
+                std::string include(filename.size() + 2, angled ? '<' : '"');
+                include.replace(1, filename.size(), filename);
+                if (angled) include[include.size()-1] = '>';
+
+                located = m_locator->locate(include, path);
+                if (m_cache)
+                {
+                    m_cache->insert(filename, angled, includer_dir,
+                                    located ? path : std::string());
+                }
+            }
+
+            if (located)
             {
                 // Enter the located file.
                 clang::FileManager &fm = m_pp.getFileManager();
                 const clang::FileEntry *file = fm.getFile(path);
                 if (file)
                 {
+                    // Apply the multiple-include optimisation, as the
+                    // preprocessor does for files found by header search:
+                    // skip the file if it has "#pragma once" and has been
+                    // entered already, or if its controlling macro is
+                    // defined. This also counts the inclusion.
+                    clang::HeaderSearch &hs = m_pp.getHeaderSearchInfo();
+                    if (!hs.ShouldEnterIncludeFile(file, false))
+                    {
+                        m_pp.getDiagnostics().setLastDiagnosticIgnored();
+                        return;
+                    }
+
                     // Nabbed from "clang/lib/Lex/PPDirectives.cpp".
                     // XXX this should be user-specifiable, right?
-                    clang::HeaderSearch &hs = m_pp.getHeaderSearchInfo();
                     clang::SrcMgr::CharacteristicKind file_characteristic =
                         std::max(hs.getFileDirFlavor(file),
                                  sm.getFileCharacteristic(loc));
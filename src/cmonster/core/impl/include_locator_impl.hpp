@@ -23,7 +23,9 @@ SOFTWARE.
 #ifndef _CMONSTER_CORE_INCLUDE_LOCATOR_IMPL_HPP
 #define _CMONSTER_CORE_INCLUDE_LOCATOR_IMPL_HPP
 
+#include "../include_cache.hpp"
 #include "../include_locator.hpp"
+#include "../stats.hpp"
 
 #include <clang/Basic/Diagnostic.h>
 #include <clang/Lex/Preprocessor.h>
@@ -53,6 +55,19 @@ public:
      */
     void setIncludeLocator(boost::shared_ptr<IncludeLocator> const& locator);
 
+    /**
+     * @param cache The cache that will be consulted before, and updated
+     *              after, the include locator is invoked. May be shared with
+     *              other preprocessors.
+     */
+    void setIncludeCache(boost::shared_ptr<IncludeCache> const& cache);
+
+    /**
+     * @param stats The statistics to record include location timings in,
+     *              or NULL.
+     */
+    void setStats(Stats *stats);
+
     /**
      * Override for clang::DiagnosticConsumer::HandleDiagnostic.
      *
@@ -71,6 +86,8 @@ public:
 
 private:
     boost::shared_ptr<IncludeLocator>         m_locator;
+    boost::shared_ptr<IncludeCache>           m_cache;
+    Stats                                    *m_stats;
     clang::Preprocessor                      &m_pp;
     std::auto_ptr<clang::DiagnosticConsumer>  m_delegate;
     clang::FileID                             m_include_fid;
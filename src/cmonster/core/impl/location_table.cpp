@@ -0,0 +1,93 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "../location_table.hpp"
+
+#include <llvm/ADT/DenseMap.h>
+#include <boost/throw_exception.hpp>
+
+#include <sstream>
+#include <stdexcept>
+
+namespace cmonster {
+namespace core {
+
+void decompose_locations(clang::SourceManager &sm, const uint32_t *locations,
+                         size_t n, LocationTable &table)
+{
+    // Check every encoding first, so that the table is left unchanged if
+    // any is invalid. An encoding refers to the source manager's entries if
+    // its offset is below the next local offset, or within the entries
+    // loaded from a precompiled header; others would be looked up out of
+    // bounds.
+    for (size_t i = 0; i < n; ++i)
+    {
+        clang::SourceLocation loc =
+            clang::SourceLocation::getFromRawEncoding(locations[i]);
+        if (loc.isValid() && !sm.isLocalSourceLocation(loc) &&
+            !sm.isLoadedSourceLocation(loc))
+        {
+            std::ostringstream ss;
+            ss << "Invalid source location encoding " << locations[i];
+            boost::throw_exception(std::invalid_argument(ss.str()));
+        }
+    }
+
+    table.files.reserve(table.files.size() + n);
+    table.lines.reserve(table.lines.size() + n);
+    table.columns.reserve(table.columns.size() + n);
+
+    // Presumed filenames are owned by a file entry or the line table, so
+    // the same file always has the same pointer.
+    llvm::DenseMap<const char*, uint32_t> indices;
+    for (size_t i = 0; i < table.filenames.size(); ++i)
+        indices[table.filenames[i]] = static_cast<uint32_t>(i);
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        uint32_t file = LocationTable::NO_FILE, line = 0, column = 0;
+        clang::SourceLocation loc =
+            clang::SourceLocation::getFromRawEncoding(locations[i]);
+        if (loc.isValid())
+        {
+            clang::PresumedLoc ploc = sm.getPresumedLoc(loc);
+            if (ploc.isValid())
+            {
+                std::pair<llvm::DenseMap<const char*, uint32_t>::iterator,
+                          bool> inserted = indices.insert(std::make_pair(
+                    ploc.getFilename(),
+                    static_cast<uint32_t>(table.filenames.size())));
+                if (inserted.second)
+                    table.filenames.push_back(ploc.getFilename());
+                file = inserted.first->second;
+                line = ploc.getLine();
+                column = ploc.getColumn();
+            }
+        }
+        table.files.push_back(file);
+        table.lines.push_back(line);
+        table.columns.push_back(column);
+    }
+}
+
+}}
+
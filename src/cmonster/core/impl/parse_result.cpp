@@ -26,8 +26,16 @@ SOFTWARE.
 namespace cmonster {
 namespace core {
 
-ParseResultImpl::ParseResultImpl(clang::ASTContext &context_)
-  : context(context_)
+ParseResultImpl::ParseResultImpl(
+    clang::CompilerInstance &compiler,
+    boost::shared_ptr<DiagnosticList> const& diagnostics_)
+  : context(compiler.getASTContext()),
+    source_manager_ref(&compiler.getSourceManager()),
+    preprocessor_ref(&compiler.getPreprocessor()),
+    context_ref(&compiler.getASTContext()),
+    diagnostics(diagnostics_ ? diagnostics_ :
+                boost::shared_ptr<DiagnosticList>(new DiagnosticList)),
+    decl_index()
 {
 }
 
@@ -41,5 +49,17 @@ clang::ASTContext& ParseResult::getClangASTContext()
     return m_impl->context;
 }
 
+DiagnosticList const& ParseResult::getDiagnostics() const
+{
+    return *m_impl->diagnostics;
+}
+
+DeclIndex const& ParseResult::getDeclIndex()
+{
+    if (!m_impl->decl_index)
+        m_impl->decl_index.reset(new DeclIndex(m_impl->context));
+    return *m_impl->decl_index;
+}
+
 }}
 
@@ -23,7 +23,17 @@ SOFTWARE.
 #ifndef _SRC_CMONSTER_CORE_IMPL_PARSERESULTIMPL_HPP
 #define _SRC_CMONSTER_CORE_IMPL_PARSERESULTIMPL_HPP
 
+#include "../decl_index.hpp"
+#include "../diagnostics.hpp"
+
 #include <clang/AST/ASTContext.h>
+#include <clang/Basic/SourceManager.h>
+#include <clang/Frontend/CompilerInstance.h>
+#include <clang/Lex/Preprocessor.h>
+#include <llvm/ADT/IntrusiveRefCntPtr.h>
+
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
 
 namespace cmonster {
 namespace core {
@@ -31,8 +41,26 @@ namespace core {
 class ParseResultImpl
 {
 public:
-    ParseResultImpl(clang::ASTContext &context_);
+    /**
+     * Take the AST of the compiler's most recent parse. The AST context,
+     * and the preprocessor and source manager that its identifiers and
+     * locations refer to, are kept alive by this object, so the result
+     * remains valid after the parser is reset or reparses.
+     */
+    ParseResultImpl(clang::CompilerInstance &compiler,
+                    boost::shared_ptr<DiagnosticList> const& diagnostics_);
     clang::ASTContext &context;
+
+    // Declared in dependency order, so the AST context is destroyed first.
+    llvm::IntrusiveRefCntPtr<clang::SourceManager> source_manager_ref;
+    llvm::IntrusiveRefCntPtr<clang::Preprocessor>  preprocessor_ref;
+    llvm::IntrusiveRefCntPtr<clang::ASTContext>    context_ref;
+
+    // Never null; empty unless diagnostics were collected.
+    boost::shared_ptr<DiagnosticList> diagnostics;
+
+    // Built on first use.
+    boost::scoped_ptr<DeclIndex> decl_index;
 };
 
 }}
@@ -21,44 +21,333 @@ SOFTWARE.
 */
 
 #include "../parser.hpp"
+#include "../parser_config.hpp"
+#include "collecting_diagnostic_client.hpp"
 #include "parse_result_impl.hpp"
 #include "preprocessor_impl.hpp"
 
 #include <boost/scoped_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+#include <boost/throw_exception.hpp>
 
-#include <clang/Basic/TargetInfo.h>
-#include <clang/Frontend/CompilerInvocation.h>
+#include <clang/AST/ASTContext.h>
+#include <clang/Basic/FileManager.h>
+#include <clang/Lex/Lexer.h>
 #include <clang/Parse/Parser.h>
 #include <clang/Sema/Sema.h>
 #include <clang/Sema/SemaConsumer.h>
-#include <llvm/Support/Host.h>
+#include <clang/Serialization/ASTWriter.h>
+#include <llvm/Support/raw_ostream.h>
 
+#include <cstdlib>
 #include <iostream>
+#include <stdexcept>
+#include <vector>
+
+#include <unistd.h>
 
 namespace cmonster {
 namespace core {
 
+/**
+ * Throw std::invalid_argument if the options are not supported by this
+ * version of Clang.
+ */
+static void check_parse_options(ParseOptions const& options)
+{
+    if (options.skip_header_function_bodies)
+    {
+        boost::throw_exception(std::invalid_argument(
+            "Skipping header function bodies is not supported by this "
+            "version of Clang"));
+    }
+}
+
+/**
+ * Ignores all warnings for the lifetime of this object, if requested, and
+ * then restores the previous setting. Sema does not compute warnings that
+ * are ignored.
+ */
+class ScopedIgnoreWarnings
+{
+public:
+    ScopedIgnoreWarnings(clang::DiagnosticsEngine &diags, bool ignore)
+      : m_diags(diags), m_previous(diags.getIgnoreAllWarnings())
+    {
+        if (ignore)
+            m_diags.setIgnoreAllWarnings(true);
+    }
+
+    ~ScopedIgnoreWarnings()
+    {
+        m_diags.setIgnoreAllWarnings(m_previous);
+    }
+
+private:
+    clang::DiagnosticsEngine &m_diags;
+    bool                      m_previous;
+};
+
+/**
+ * Delegates unhandled diagnostics to another client for the lifetime of this
+ * object, and then restores the previous one.
+ */
+class ScopedDiagnosticDelegate
+{
+public:
+    ScopedDiagnosticDelegate(impl::PreprocessorImpl &pp,
+                             clang::DiagnosticConsumer *delegate)
+      : m_pp(pp), m_previous(pp.swap_diagnostic_delegate(delegate)) {}
+
+    ~ScopedDiagnosticDelegate()
+    {
+        delete m_pp.swap_diagnostic_delegate(m_previous);
+    }
+
+private:
+    impl::PreprocessorImpl    &m_pp;
+    clang::DiagnosticConsumer *m_previous;
+};
+
+/**
+ * Attaches a parser configuration to a compiler instance for the lifetime of
+ * this object, which must be destroyed before the compiler instance.
+ */
+class ConfigAttachment
+{
+public:
+    ConfigAttachment(boost::shared_ptr<const ParserConfig> const& config,
+                     clang::CompilerInstance &compiler)
+      : m_config(config ? config : ParserConfig::get_default()),
+        m_compiler(compiler)
+    {
+        m_config->attach(m_compiler);
+    }
+
+    ~ConfigAttachment()
+    {
+        m_config->detach(m_compiler);
+    }
+
+    ParserConfig const* operator->() const
+    {
+        return m_config.get();
+    }
+
+private:
+    boost::shared_ptr<const ParserConfig>  m_config;
+    clang::CompilerInstance               &m_compiler;
+};
+
 class ParserImpl
 {
 public:
     ParserImpl(const char *buffer,
                size_t buflen,
-               const char *filename) : m_compiler()
+               const char *filename,
+               std::string const& pch,
+               bool copy_buffer,
+               boost::shared_ptr<const ParserConfig> const& config)
+      : m_compiler(), m_config(config, m_compiler), m_filename(filename),
+        m_pch(pch), m_preamble(), m_preamble_pch()
     {
-        // Create diagnostics.
-        m_compiler.createDiagnostics(0, NULL);
+        create_compiler();
+
+        // Set the main file. If we're not copying the buffer, then the
+        // caller guarantees that it outlives the parser, and that it is
+        // NUL-terminated (as required by the lexer).
+        llvm::StringRef data(buffer, buflen);
+        llvm::MemoryBuffer *membuf = copy_buffer ?
+            llvm::MemoryBuffer::getMemBufferCopy(data, filename) :
+            llvm::MemoryBuffer::getMemBuffer(data, filename);
+        m_compiler.getSourceManager().createMainFileIDForMemBuffer(membuf);
+
+        create_preprocessor();
+    }
+
+    ParserImpl(std::string const& path,
+               std::string const& pch,
+               boost::shared_ptr<const ParserConfig> const& config)
+      : m_compiler(), m_config(config, m_compiler), m_filename(path),
+        m_pch(pch), m_preamble(), m_preamble_pch()
+    {
+        create_compiler();
+
+        // Set the main file. The file manager will memory-map the file when
+        // it is large enough to benefit.
+        const clang::FileEntry *file =
+            m_compiler.getFileManager().getFile(path);
+        if (!file)
+        {
+            boost::throw_exception(std::runtime_error(
+                "Failed to open '" + path + "'"));
+        }
+        m_compiler.getSourceManager().createMainFileID(file);
+
+        create_preprocessor();
+    }
+
+    ~ParserImpl()
+    {
+        if (!m_preamble_pch.empty())
+            unlink(m_preamble_pch.c_str());
+    }
+
+    Preprocessor& getPreprocessor()
+    {
+        return *m_preprocessor;
+    }
+
+    ParseResult parse(ParseOptions const& options)
+    {
+        check_parse_options(options);
+
+        // The parser reads this when it is constructed, and Sema when
+        // instantiating templates at the end of the translation unit.
+        m_compiler.getLangOpts().DelayedTemplateParsing =
+            options.delayed_template_parsing || options.syntax_only;
+
+        // A prefix translation unit (as for a precompiled header) leaves
+        // implicit instantiations, vtables and the like to its includer,
+        // so Sema skips them at the end of the translation unit.
+        initialise_sema(new clang::SemaConsumer,
+                        options.syntax_only ? clang::TU_Prefix :
+                                              clang::TU_Complete);
+        boost::shared_ptr<DiagnosticList> diagnostics;
+        {
+            ScopedTimer timer(&m_preprocessor->get_stats(), Stats::PARSE,
+                              m_filename);
+            ScopedIgnoreWarnings ignore_warnings(
+                m_compiler.getDiagnostics(), options.syntax_only);
+            if (options.collect_diagnostics)
+            {
+                diagnostics.reset(new DiagnosticList);
+                ScopedDiagnosticDelegate collector(*m_preprocessor,
+                    new impl::CollectingDiagnosticClient(diagnostics));
+                parse_main_file();
+            }
+            else
+            {
+                parse_main_file();
+            }
+        }
+        boost::shared_ptr<ParseResultImpl> result(
+            new ParseResultImpl(m_compiler, diagnostics));
+        m_result = result;
+        return ParseResult(result);
+    }
+
+    ParseResult reparse(const char *buffer, size_t buflen,
+                        ParseOptions const& options)
+    {
+        check_parse_options(options);
+        llvm::StringRef data(buffer, buflen);
+        std::auto_ptr<llvm::MemoryBuffer> membuf(
+            llvm::MemoryBuffer::getMemBufferCopy(data, m_filename));
+
+        // Compute the preamble: the leading run of preprocessor directives
+        // (and comments), which ends with the last #include. The preamble is
+        // not used together with a user-specified precompiled header, as
+        // they cannot be chained.
+        std::pair<unsigned, bool> preamble(0, false);
+        if (m_pch.empty())
+        {
+            preamble = clang::Lexer::ComputePreamble(
+                membuf.get(), m_compiler.getLangOpts());
+        }
+
+        // Rebuild the preamble's precompiled header only if it has changed.
+        llvm::StringRef preamble_text = data.substr(0, preamble.first);
+        if (preamble_text.empty())
+            m_preamble.clear();
+        else if (m_preamble.empty() || preamble_text != m_preamble)
+            build_preamble(preamble_text);
 
-        // Create target info.
-        // XXX make this configurable?
-        clang::TargetOptions target_options;
-        target_options.Triple = llvm::sys::getHostTriple();
-        m_compiler.setTarget(clang::TargetInfo::CreateTargetInfo(
-            m_compiler.getDiagnostics(), target_options));
+        // Skip the preamble in the main file, and load its precompiled
+        // header in its place.
+        clang::PreprocessorOptions &ppopts = m_compiler.getPreprocessorOpts();
+        if (!m_preamble.empty())
+        {
+            ppopts.ImplicitPCHInclude = m_preamble_pch;
+            ppopts.PrecompiledPreambleBytes = preamble;
+            ppopts.DisablePCHValidation = true;
+        }
+        else
+        {
+            ppopts.ImplicitPCHInclude = m_pch;
+            ppopts.PrecompiledPreambleBytes = std::make_pair(0U, false);
+            ppopts.DisablePCHValidation = false;
+        }
 
-        // Set the language options.
-        // XXX make this configurable?
-        clang::CompilerInvocation::setLangDefaults(
-            m_compiler.getLangOpts(), clang::IK_CXX);
+        reset(membuf.release());
+        return parse(options);
+    }
+
+    void reset(const char *buffer, size_t buflen, const char *filename)
+    {
+        m_filename = filename;
+        clear_preamble();
+        reset(llvm::MemoryBuffer::getMemBufferCopy(
+            llvm::StringRef(buffer, buflen), m_filename));
+    }
+
+    void reset(std::string const& path)
+    {
+        const clang::FileEntry *file =
+            m_compiler.getFileManager().getFile(path);
+        if (!file)
+        {
+            boost::throw_exception(std::runtime_error(
+                "Failed to open '" + path + "'"));
+        }
+        m_filename = path;
+        clear_preamble();
+        reset(file);
+    }
+
+    void generate_pch(std::string const& path)
+    {
+        std::string error;
+        llvm::raw_fd_ostream out(
+            path.c_str(), error, llvm::raw_fd_ostream::F_Binary);
+        if (!error.empty())
+        {
+            boost::throw_exception(std::runtime_error(
+                "Failed to open '" + path + "': " + error));
+        }
+
+        // The PCH generator is owned by the compiler instance, but does not
+        // refer to the output stream after HandleTranslationUnit.
+        clang::PCHGenerator *generator = new clang::PCHGenerator(
+            m_compiler.getPreprocessor(), path, false, "", &out);
+        m_compiler.getLangOpts().DelayedTemplateParsing = false;
+        initialise_sema(generator, clang::TU_Prefix);
+        parse_main_file();
+        if (m_compiler.getDiagnostics().hasErrorOccurred())
+        {
+            boost::throw_exception(std::runtime_error(
+                "Errors occurred while generating precompiled header"));
+        }
+        generator->HandleTranslationUnit(m_compiler.getASTContext());
+        out.close();
+        if (out.has_error())
+        {
+            out.clear_error();
+            boost::throw_exception(std::runtime_error(
+                "Failed to write precompiled header '" + path + "'"));
+        }
+    }
+
+private:
+    /**
+     * Create the diagnostics, file and source managers. The target, language
+     * options and configured include paths are set by the parser
+     * configuration.
+     */
+    void create_compiler()
+    {
+        // Create diagnostics.
+        m_compiler.createDiagnostics(0, NULL);
 
         // Configure the include paths.
         clang::HeaderSearchOptions &hsopts = m_compiler.getHeaderSearchOpts();
@@ -71,52 +360,218 @@ public:
         // FIXME disabling this causes a segfault, will come back to it.
         //compiler.getPreprocessorOpts().UsePredefines = false;
 
+        // Implicitly include the precompiled header, if any. This must be
+        // set before the preprocessor is created.
+        if (!m_pch.empty())
+            m_compiler.getPreprocessorOpts().ImplicitPCHInclude = m_pch;
+
         // Create the rest.
         m_compiler.createFileManager();
         m_compiler.createSourceManager(m_compiler.getFileManager());
+    }
 
-        // Set the main file.
-        m_compiler.getSourceManager().createMainFileIDForMemBuffer(
-            llvm::MemoryBuffer::getMemBufferCopy(
-                llvm::StringRef(buffer, buflen), filename));
-
+    /**
+     * Create the preprocessor and AST context, once the main file is set.
+     */
+    void create_preprocessor()
+    {
         m_preprocessor.reset(new impl::PreprocessorImpl(m_compiler));
+        std::string const& predefines = m_config->getPredefines();
+        if (!predefines.empty())
+            m_preprocessor->add_predefines(predefines);
 
-        // Initialise parser and co.
+        // Initialise the AST context. Sema and the parser are created when
+        // parsing begins, as the precompiled header (if any) must be loaded
+        // after the preprocessor has been fully configured.
         m_compiler.createASTContext();
-        clang::SemaConsumer *semaConsumer = new clang::SemaConsumer;
-        m_compiler.setASTConsumer(semaConsumer);
-        m_compiler.createSema(clang::TU_Complete, NULL);
-        semaConsumer->InitializeSema(m_compiler.getSema());
+    }
+
+    /**
+     * Load the precompiled header (if any), and create Sema and the parser.
+     * Takes ownership of "consumer".
+     */
+    void initialise_sema(clang::SemaConsumer *consumer,
+                         clang::TranslationUnitKind kind)
+    {
+        std::auto_ptr<clang::SemaConsumer> consumer_(consumer);
+        if (m_parser)
+        {
+            boost::throw_exception(std::logic_error(
+                "The translation unit has already been parsed"));
+        }
+
+        clang::PreprocessorOptions const& ppopts =
+            m_compiler.getPreprocessorOpts();
+        std::string const& pch = ppopts.ImplicitPCHInclude;
+        if (!pch.empty())
+        {
+            m_compiler.createPCHExternalASTSource(
+                pch, ppopts.DisablePCHValidation, false, NULL);
+            if (!m_compiler.getASTContext().getExternalSource())
+            {
+                boost::throw_exception(std::runtime_error(
+                    "Failed to load precompiled header '" + pch + "'"));
+            }
+        }
+
+        m_compiler.setASTConsumer(consumer_.release());
+        m_compiler.createSema(kind, NULL);
+        consumer->InitializeSema(m_compiler.getSema());
         m_parser.reset(new clang::Parser(
             m_compiler.getPreprocessor(), m_compiler.getSema()));
     }
 
-    Preprocessor& getPreprocessor()
+    /**
+     * Discard the results of the previous parse, and set a new main file.
+     * The file manager, and the source manager's cache of file contents,
+     * are kept so that unchanged headers are not read again. Takes
+     * ownership of "main_buffer".
+     */
+    void reset(llvm::MemoryBuffer *main_buffer)
     {
-        return *m_preprocessor;
+        std::auto_ptr<llvm::MemoryBuffer> main_buffer_(main_buffer);
+        discard_sema();
+
+        clang::SourceManager &sm = reset_source_manager();
+        sm.createMainFileIDForMemBuffer(main_buffer_.release());
+
+        m_preprocessor->reset();
+        m_compiler.createASTContext();
     }
 
-    ParseResult parse()
+    /**
+     * As above, but with a main file read from disk.
+     */
+    void reset(const clang::FileEntry *main_file)
+    {
+        discard_sema();
+
+        clang::SourceManager &sm = reset_source_manager();
+        sm.createMainFileID(main_file);
+
+        m_preprocessor->reset();
+        m_compiler.createASTContext();
+    }
+
+    /**
+     * Destroy the parser and Sema of the previous parse, while the AST
+     * context and preprocessor they refer to are still alive.
+     */
+    void discard_sema()
+    {
+        m_parser.reset();
+        delete m_compiler.takeSema();
+    }
+
+    /**
+     * Clear the source manager for a new main file. It is reused, keeping
+     * the contents of the files read so far, unless the result of the
+     * previous parse is still in use: the result then keeps the old source
+     * manager (with its AST and preprocessor), and a new one is created.
+     */
+    clang::SourceManager& reset_source_manager()
+    {
+        if (m_result.expired())
+        {
+            m_compiler.getSourceManager().clearIDTables();
+        }
+        else
+        {
+            m_compiler.createSourceManager(m_compiler.getFileManager());
+            m_result.reset();
+        }
+        return m_compiler.getSourceManager();
+    }
+
+    /**
+     * Forget the preamble of the previous main file, so that the next
+     * parse uses only the user-specified precompiled header (if any).
+     */
+    void clear_preamble()
+    {
+        m_preamble.clear();
+        clang::PreprocessorOptions &ppopts = m_compiler.getPreprocessorOpts();
+        ppopts.ImplicitPCHInclude = m_pch;
+        ppopts.PrecompiledPreambleBytes = std::make_pair(0U, false);
+        ppopts.DisablePCHValidation = false;
+    }
+
+    /**
+     * Generate a precompiled header from the preamble of the main file. If
+     * this fails, then the preamble is cleared and the main file will be
+     * parsed in full; any errors will be reported then.
+     */
+    void build_preamble(llvm::StringRef preamble)
+    {
+        m_preamble.clear();
+        if (m_preamble_pch.empty())
+        {
+            const char *tmpdir = std::getenv("TMPDIR");
+            std::string path_template(tmpdir ? tmpdir : "/tmp");
+            path_template += "/cmonster-preamble-XXXXXX";
+            std::vector<char> path(
+                path_template.begin(), path_template.end());
+            path.push_back('\0');
+            const int fd = mkstemp(&path[0]);
+            if (fd == -1)
+                return;
+            close(fd);
+            m_preamble_pch = &path[0];
+        }
+
+        clang::PreprocessorOptions &ppopts = m_compiler.getPreprocessorOpts();
+        ppopts.ImplicitPCHInclude.clear();
+        ppopts.PrecompiledPreambleBytes = std::make_pair(0U, false);
+        ppopts.DisablePCHValidation = false;
+        reset(llvm::MemoryBuffer::getMemBufferCopy(preamble, m_filename));
+        try
+        {
+            ScopedTimer timer(&m_preprocessor->get_stats(), Stats::PREAMBLE,
+                              m_filename);
+            generate_pch(m_preamble_pch);
+            m_preamble = preamble.str();
+        }
+        catch (...)
+        {
+        }
+    }
+
+    void parse_main_file()
     {
         m_compiler.getPreprocessor().EnterMainSourceFile();
         m_parser->ParseTranslationUnit();
+        m_preprocessor->end_main_file();
         m_preprocessor->check_exception();
-        return ParseResult(boost::shared_ptr<ParseResultImpl>(
-            new ParseResultImpl(m_compiler.getASTContext())));
     }
 
 private:
     clang::CompilerInstance                   m_compiler;
+    ConfigAttachment                          m_config;
+    std::string                               m_filename;
+    std::string                               m_pch;
+    std::string                               m_preamble;
+    std::string                               m_preamble_pch;
     boost::scoped_ptr<impl::PreprocessorImpl> m_preprocessor;
     boost::scoped_ptr<clang::Parser>          m_parser;
+    // The result of the most recent parse, while it is in use.
+    boost::weak_ptr<ParseResultImpl>          m_result;
 };
 
 
 Parser::Parser(const char *buffer,
                size_t buflen,
-               const char *filename)
-  : m_impl(new ParserImpl(buffer, buflen, filename))
+               const char *filename,
+               std::string const& pch,
+               bool copy_buffer,
+               boost::shared_ptr<const ParserConfig> const& config)
+  : m_impl(new ParserImpl(buffer, buflen, filename, pch, copy_buffer,
+                          config))
+{
+}
+
+Parser::Parser(std::string const& path, std::string const& pch,
+               boost::shared_ptr<const ParserConfig> const& config)
+  : m_impl(new ParserImpl(path, pch, config))
 {
 }
 
@@ -125,9 +580,35 @@ Preprocessor& Parser::getPreprocessor()
     return m_impl->getPreprocessor();
 }
 
-ParseResult Parser::parse()
+Stats& Parser::getStats()
+{
+    return m_impl->getPreprocessor().get_stats();
+}
+
+ParseResult Parser::parse(ParseOptions const& options)
+{
+    return m_impl->parse(options);
+}
+
+ParseResult Parser::reparse(const char *buffer, size_t buflen,
+                            ParseOptions const& options)
+{
+    return m_impl->reparse(buffer, buflen, options);
+}
+
+void Parser::reset(const char *buffer, size_t buflen, const char *filename)
+{
+    m_impl->reset(buffer, buflen, filename);
+}
+
+void Parser::reset(std::string const& path)
+{
+    m_impl->reset(path);
+}
+
+void Parser::generate_pch(std::string const& path)
 {
-    return m_impl->parse();
+    m_impl->generate_pch(path);
 }
 
 }}
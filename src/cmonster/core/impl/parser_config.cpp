@@ -0,0 +1,189 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "../parser_config.hpp"
+
+#include <boost/throw_exception.hpp>
+
+#include <clang/Basic/Diagnostic.h>
+#include <clang/Basic/TargetInfo.h>
+#include <clang/Basic/TargetOptions.h>
+#include <clang/Frontend/CompilerInstance.h>
+#include <clang/Frontend/CompilerInvocation.h>
+#include <clang/Frontend/LangStandard.h>
+#include <llvm/Support/Host.h>
+
+#include <stdexcept>
+
+namespace {
+
+struct ScopedLock
+{
+    ScopedLock(pthread_mutex_t &mutex) : m_mutex(mutex)
+    {
+        pthread_mutex_lock(&m_mutex);
+    }
+    ~ScopedLock() {pthread_mutex_unlock(&m_mutex);}
+private:
+    pthread_mutex_t &m_mutex;
+};
+
+clang::InputKind get_input_kind(std::string const& language)
+{
+    if (language == "c")
+        return clang::IK_C;
+    if (language == "c++")
+        return clang::IK_CXX;
+    if (language == "objective-c")
+        return clang::IK_ObjC;
+    if (language == "objective-c++")
+        return clang::IK_ObjCXX;
+    boost::throw_exception(std::invalid_argument(
+        "Unknown language '" + language + "'"));
+    return clang::IK_None;
+}
+
+clang::LangStandard::Kind get_lang_standard(std::string const& standard)
+{
+    if (standard.empty())
+        return clang::LangStandard::lang_unspecified;
+#define LANGSTANDARD(id, name, desc, features) \
+    if (standard == name) \
+        return clang::LangStandard::lang_##id;
+#include <clang/Frontend/LangStandards.def>
+    boost::throw_exception(std::invalid_argument(
+        "Unknown language standard '" + standard + "'"));
+    return clang::LangStandard::lang_unspecified;
+}
+
+pthread_once_t default_config_once = PTHREAD_ONCE_INIT;
+boost::shared_ptr<const cmonster::core::ParserConfig> *default_config = 0;
+
+void create_default_config()
+{
+    default_config = new boost::shared_ptr<const cmonster::core::ParserConfig>(
+        new cmonster::core::ParserConfig);
+}
+
+} // Anonymous namespace.
+
+namespace cmonster {
+namespace core {
+
+ParserConfig::ParserConfig(std::string const& triple,
+                           std::string const& language,
+                           std::string const& standard,
+                           std::vector<IncludeDir> const& include_dirs,
+                           std::string const& predefines)
+  : m_triple(triple.empty() ? llvm::sys::getHostTriple() : triple),
+    m_language(language), m_standard(standard), m_lang_options(),
+    m_include_dirs(include_dirs), m_predefines(predefines), m_target()
+{
+    clang::CompilerInvocation::setLangDefaults(
+        m_lang_options, get_input_kind(language),
+        get_lang_standard(standard));
+
+    // Create the target information, with a throwaway diagnostics engine;
+    // failure is reported by a null result.
+    llvm::IntrusiveRefCntPtr<clang::DiagnosticIDs> ids(
+        new clang::DiagnosticIDs);
+    clang::DiagnosticsEngine diags(ids, new clang::IgnoringDiagConsumer);
+    clang::TargetOptions target_options;
+    target_options.Triple = m_triple;
+    m_target = clang::TargetInfo::CreateTargetInfo(diags, target_options);
+    if (!m_target)
+    {
+        boost::throw_exception(std::invalid_argument(
+            "Unknown target triple '" + m_triple + "'"));
+    }
+
+    pthread_mutex_init(&m_mutex, NULL);
+}
+
+ParserConfig::~ParserConfig()
+{
+    pthread_mutex_destroy(&m_mutex);
+}
+
+boost::shared_ptr<const ParserConfig> ParserConfig::get_default()
+{
+    pthread_once(&default_config_once, &create_default_config);
+    return *default_config;
+}
+
+std::string const& ParserConfig::getTriple() const
+{
+    return m_triple;
+}
+
+std::string const& ParserConfig::getLanguage() const
+{
+    return m_language;
+}
+
+std::string const& ParserConfig::getStandard() const
+{
+    return m_standard;
+}
+
+clang::LangOptions const& ParserConfig::getLangOptions() const
+{
+    return m_lang_options;
+}
+
+std::vector<ParserConfig::IncludeDir> const&
+ParserConfig::getIncludeDirs() const
+{
+    return m_include_dirs;
+}
+
+std::string const& ParserConfig::getPredefines() const
+{
+    return m_predefines;
+}
+
+void ParserConfig::attach(clang::CompilerInstance &compiler) const
+{
+    {
+        ScopedLock lock(m_mutex);
+        compiler.setTarget(m_target.getPtr());
+    }
+    compiler.getLangOpts() = m_lang_options;
+
+    clang::HeaderSearchOptions &hsopts = compiler.getHeaderSearchOpts();
+    for (std::vector<IncludeDir>::const_iterator iter =
+             m_include_dirs.begin(); iter != m_include_dirs.end(); ++iter)
+    {
+        hsopts.AddPath(iter->first,
+                       iter->second ? clang::frontend::System
+                                    : clang::frontend::Angled,
+                       true, false, true);
+    }
+}
+
+void ParserConfig::detach(clang::CompilerInstance &compiler) const
+{
+    ScopedLock lock(m_mutex);
+    compiler.setTarget(0);
+}
+
+}}
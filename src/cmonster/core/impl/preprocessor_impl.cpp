@@ -25,30 +25,42 @@ SOFTWARE.
 
 #include "preprocessor_impl.hpp"
 #include "../function_macro.hpp"
+#include "../token_batch.hpp"
+#include "../token_cache.hpp"
 #include "../token_iterator.hpp"
 #include "../token_predicate.hpp"
 #include "../token.hpp"
 #include "exception_diagnostic_client.hpp"
 #include "include_locator_impl.hpp"
+#include "token_arena.hpp"
 
 #include <clang/Frontend/Utils.h>
 #include <clang/Basic/FileManager.h>
 #include <clang/Lex/HeaderSearch.h>
+#include <clang/Lex/Lexer.h>
 #include <clang/Lex/Preprocessor.h>
 #include <clang/Lex/Pragma.h>
+#include <clang/Lex/TokenConcatenation.h>
 
 #include <boost/exception_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
 
 #include <algorithm>
 #include <cassert>
+#include <cctype>
+#include <cstring>
 #include <functional>
 #include <iostream>
 #include <iterator>
 #include <list>
 #include <memory>
+#include <set>
 #include <sstream>
 #include <stdexcept>
 
+#include <sys/mman.h>
+#include <unistd.h>
+
 ///////////////////////////////////////////////////////////////////////////////
 
 namespace {
@@ -57,17 +69,115 @@ struct null_deleter {
     void operator()(const void *) {}
 };
 
-struct PreprocessorResetter
+// Sets a location for the lifetime of the object, then restores it.
+struct LocationSaver
 {
-    PreprocessorResetter(
-        clang::CompilerInstance &compiler, clang::Preprocessor &pp)
-      : m_compiler(compiler), m_pp(pp) {}
-    ~PreprocessorResetter() {m_compiler.setPreprocessor(&m_pp);}
+    LocationSaver(clang::SourceLocation &loc,
+                  clang::SourceLocation const& value)
+      : m_loc(loc), m_saved(loc) {m_loc = value;}
+    ~LocationSaver() {m_loc = m_saved;}
+private:
+    clang::SourceLocation &m_loc;
+    clang::SourceLocation  m_saved;
+};
+
+// A raw lexer over a block of "#define" directives.
+class DefinitionLexer
+{
+public:
+    DefinitionLexer(clang::Preprocessor &pp, clang::SourceLocation loc,
+                    const char *start, const char *end)
+      : m_pp(pp), m_start(start),
+        m_lexer(loc, pp.getLangOptions(), start, start, end) {}
+
+    void lex(clang::Token &tok)
+    {
+        m_lexer.LexFromRawLexer(tok);
+        // Raw identifiers must be looked up in the live preprocessor to get
+        // their IdentifierInfo and keyword kind.
+        if (tok.is(clang::tok::raw_identifier))
+            m_pp.LookUpIdentifierInfo(tok);
+    }
+
+    // Throw an exception describing an error at the given token.
+    void error(clang::Token const& tok, const char *message) const
+    {
+        const char *p =
+            m_pp.getSourceManager().getCharacterData(tok.getLocation());
+        std::stringstream ss;
+        ss << message << " in macro definitions, line "
+           << (std::count(m_start, p, '\n') + 1);
+        boost::throw_exception(std::invalid_argument(ss.str()));
+    }
+
 private:
-    clang::CompilerInstance &m_compiler;
     clang::Preprocessor &m_pp;
+    const char          *m_start;
+    clang::Lexer         m_lexer;
 };
 
+inline bool is_identifier_char(char c)
+{
+    return std::isalnum(static_cast<unsigned char>(c)) || c == '_' ||
+           c == '$';
+}
+
+// Find the first occurrence of "identifier" in "buffer", at or after
+// "from", that is not part of a longer identifier. Candidates are found
+// with memchr, which the C library vectorises. Returns npos if there are
+// none.
+size_t find_identifier(llvm::StringRef buffer, std::string const& identifier,
+                       size_t from)
+{
+    const char *begin = buffer.data();
+    const char *end = begin + buffer.size();
+    const size_t n = identifier.size();
+    const char *p = begin + std::min(from, buffer.size());
+    while (static_cast<size_t>(end - p) >= n)
+    {
+        p = static_cast<const char*>(
+            std::memchr(p, identifier[0], (end - p) - n + 1));
+        if (!p)
+            break;
+        if (std::memcmp(p, identifier.data(), n) == 0 &&
+            (p == begin || !is_identifier_char(p[-1])) &&
+            (p + n == end || !is_identifier_char(p[n])))
+        {
+            return p - begin;
+        }
+        ++p;
+    }
+    return llvm::StringRef::npos;
+}
+
+// Copy the text of buffer[begin, end) with trailing whitespace removed.
+// The text is preceded by the start of the line containing "begin", with
+// everything but tabs replaced by spaces, so that the first line keeps
+// its indentation.
+std::string
+slice_lines(llvm::StringRef buffer, size_t begin, size_t end)
+{
+    size_t line = begin;
+    while (line > 0 && buffer[line-1] != '\n' && buffer[line-1] != '\r')
+        --line;
+    while (end > begin && std::isspace(static_cast<unsigned char>(
+               buffer[end-1])))
+        --end;
+    std::string text;
+    text.reserve(end - line);
+    for (size_t i = line; i < begin; ++i)
+        text += buffer[i] == '\t' ? '\t' : ' ';
+    text.append(buffer.data() + begin, end - begin);
+    return text;
+}
+
+inline bool
+is_identifier(clang::Token const& tok, std::string const& identifier)
+{
+    const clang::IdentifierInfo *II = tok.getIdentifierInfo();
+    return II && II->getName() == identifier;
+}
+
 } // Anonymous namespace.
 
 namespace cmonster {
@@ -76,7 +186,65 @@ namespace impl {
 
 struct FileChangePPCallback : public clang::PPCallbacks
 {
-    FileChangePPCallback() : depth(0), location() {}
+    FileChangePPCallback(clang::SourceManager &sm_)
+      : sm(sm_), depth(0), location(), files(), entered(), inclusions(0),
+        included_files(), pending(false), file_cache(0), profiler(0) {}
+
+    void MacroExpands(const clang::Token &MacroNameTok,
+                      const clang::MacroInfo *MI,
+                      clang::SourceRange Range)
+    {
+        // The expansion of a Python macro passes through _CMONSTER_PRAGMA,
+        // which is an implementation detail.
+        if (profiler && profiler->isEnabled())
+        {
+            const clang::IdentifierInfo *II =
+                MacroNameTok.getIdentifierInfo();
+            if (II && II->getName() != "_CMONSTER_PRAGMA")
+            {
+                profiler->macro_expands(
+                    MacroNameTok.getLocation(), II->getNameStart());
+            }
+        }
+    }
+
+    void InclusionDirective(clang::SourceLocation HashLoc,
+                            const clang::Token &IncludeTok,
+                            llvm::StringRef FileName,
+                            bool IsAngled,
+                            const clang::FileEntry *File,
+                            clang::SourceLocation EndLoc,
+                            llvm::StringRef SearchPath,
+                            llvm::StringRef RelativePath)
+    {
+        // Supply the file's contents from the shared cache before it is
+        // entered (the include locator enters files itself).
+        if (file_cache && File)
+            file_cache->enterFile(File);
+
+        if (!inclusions)
+            return;
+        Inclusion inclusion;
+        const std::pair<clang::FileID, unsigned> decomposed =
+            sm.getDecomposedExpansionLoc(HashLoc);
+        const clang::FileEntry *includer =
+            sm.getFileEntryForID(decomposed.first);
+        if (includer)
+            inclusion.includer = includer->getName();
+        inclusion.filename = FileName;
+        inclusion.angled = IsAngled;
+        inclusion.line =
+            sm.getLineNumber(decomposed.first, decomposed.second);
+        if (File)
+            inclusion.path = File->getName();
+        inclusions->push_back(inclusion);
+        included_files.push_back(File);
+
+        // If the file was not found, it may yet be entered by the include
+        // locator; it will be the next file entered.
+        pending = !File;
+    }
+
     void FileChanged(clang::SourceLocation Loc,
                      clang::PPCallbacks::FileChangeReason Reason,
                      clang::SrcMgr::CharacteristicKind FileType)
@@ -84,13 +252,46 @@ struct FileChangePPCallback : public clang::PPCallbacks
         location = Loc;
         switch (Reason)
         {
-            case clang::PPCallbacks::EnterFile: ++depth; break;
-            case clang::PPCallbacks::ExitFile: --depth; break;
+            case clang::PPCallbacks::EnterFile:
+            {
+                ++depth;
+                const clang::FileEntry *file =
+                    sm.getFileEntryForID(sm.getFileID(Loc));
+                if (file && entered.insert(file).second)
+                    files.push_back(file);
+                if (pending && file)
+                {
+                    inclusions->back().path = file->getName();
+                    included_files.back() = file;
+                }
+                pending = false;
+                if (profiler && profiler->isEnabled())
+                    profiler->enter_file(sm.getPresumedLoc(Loc).getFilename());
+                break;
+            }
+            case clang::PPCallbacks::ExitFile:
+            {
+                --depth;
+                if (profiler && profiler->isEnabled())
+                    profiler->exit_file();
+                break;
+            }
             default: break;
         }
     }
+    clang::SourceManager &sm;
     unsigned int depth;
     clang::SourceLocation location;
+    // The files entered so far, in the order they were first entered.
+    std::vector<const clang::FileEntry*> files;
+    std::set<const clang::FileEntry*> entered;
+    // If non-NULL, #include directives are recorded here, along with the
+    // file each resolved to (or NULL).
+    IncludeGraph *inclusions;
+    std::vector<const clang::FileEntry*> included_files;
+    bool pending;
+    FileCacheClient *file_cache;
+    Profiler *profiler;
 };
 
 /**
@@ -128,17 +329,27 @@ struct DynamicPragmaHandler : public clang::PragmaHandler
 {
     DynamicPragmaHandler(
         TokenSaverPragmaHandler &token_saver,
+        TokenArena &arena,
         std::string const& name,
         boost::shared_ptr<cmonster::core::FunctionMacro> const& function,
-        boost::exception_ptr &exception)
+        boost::exception_ptr &exception,
+        clang::SourceLocation &expansion_location,
+        cmonster::core::Stats &stats,
+        cmonster::core::Profiler &profiler,
+        size_t const& streaming_window)
       : clang::PragmaHandler(llvm::StringRef(name.c_str(), name.size())),
-        m_token_saver(token_saver), m_function(function),
-        m_exception(exception) {}
+        m_token_saver(token_saver), m_arena(arena), m_function(function),
+        m_exception(exception), m_expansion_location(expansion_location),
+        m_stats(stats), m_profiler(profiler),
+        m_streaming_window(streaming_window) {}
 
     void HandlePragma(clang::Preprocessor &PP,
                       clang::PragmaIntroducerKind Introducer,
                       clang::Token &FirstToken)
     {
+        cmonster::core::ScopedTimer timer(
+            &m_stats, cmonster::core::Stats::PRAGMA, getName());
+
         // Discard remaining directive tokens (there shouldn't be any before
         // 'eod').
         clang::Token token;
@@ -152,27 +363,42 @@ struct DynamicPragmaHandler : public clang::PragmaHandler
                 PP.getSourceManager().getExpansionLoc(
                     FirstToken.getLocation());
 
-            std::vector<cmonster::core::Token> result =
-                (*m_function)(expansion_loc, m_token_saver.tokens);
+            // Record the expansion location for the duration of the call,
+            // restoring it afterwards in case of nested invocations.
+            std::vector<cmonster::core::Token> result;
+            {
+                LocationSaver saver(m_expansion_location, expansion_loc);
+                cmonster::core::ScopedTimer timer(
+                    &m_stats, cmonster::core::Stats::FUNCTION_MACRO,
+                    getName());
+                result = (*m_function)(expansion_loc, m_token_saver.tokens);
+            }
+            m_token_saver.tokens.clear();
+            if (m_profiler.isEnabled())
+            {
+                m_profiler.python_macro(PP.getSourceManager(),
+                                        FirstToken.getLocation(), result);
+            }
             if (!result.empty())
             {
-                // Enter the results back into the preprocessor.
-                clang::Token *tokens(new clang::Token[result.size()]);
-                try
+                // Enter the results back into the preprocessor. The token
+                // array is owned by the arena, or in streaming mode, by
+                // Clang, which frees it once it has been lexed.
+                const bool streaming = m_streaming_window != 0;
+                clang::Token *tokens;
+                if (streaming)
                 {
-                    tokens[0] = result[0].getClangToken();
-                    for (size_t i = 1; i < result.size(); ++i)
-                    {
+                    tokens = new clang::Token[result.size()];
+                    for (size_t i = 0; i < result.size(); ++i)
                         tokens[i] = result[i].getClangToken();
-                        tokens[i].setFlag(clang::Token::LeadingSpace);
-                    }
                 }
-                catch (...)
+                else
                 {
-                    delete [] tokens;
-                    throw;
+                    tokens = m_arena.copy(result);
                 }
-                PP.EnterTokenStream(tokens, result.size(), false, true);
+                for (size_t i = 1; i < result.size(); ++i)
+                    tokens[i].setFlag(clang::Token::LeadingSpace);
+                PP.EnterTokenStream(tokens, result.size(), false, streaming);
             }
             return;
         }
@@ -190,16 +416,21 @@ struct DynamicPragmaHandler : public clang::PragmaHandler
         //
         // If we get here, an exception was caught. Let's tell the preprocessor
         // to stop.
-        clang::Token tok;
-        tok.startToken();
-        tok.setKind(clang::tok::eof);
-        PP.EnterTokenStream(&tok, 1, false, true);
+        clang::Token *tok = m_arena.allocate(1);
+        tok->startToken();
+        tok->setKind(clang::tok::eof);
+        PP.EnterTokenStream(tok, 1, false, false);
     }
 
 private:
     TokenSaverPragmaHandler                          &m_token_saver;
+    TokenArena                                       &m_arena;
     boost::shared_ptr<cmonster::core::FunctionMacro>  m_function;
     boost::exception_ptr                             &m_exception;
+    clang::SourceLocation                            &m_expansion_location;
+    cmonster::core::Stats                            &m_stats;
+    cmonster::core::Profiler                         &m_profiler;
+    size_t const                                     &m_streaming_window;
 };
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -207,25 +438,45 @@ private:
 class TokenIteratorImpl : public TokenIterator
 {
 public:
-    TokenIteratorImpl(clang::Preprocessor &pp, boost::exception_ptr &exception)
-      : m_pp(pp), m_exception(exception), m_current(m_pp), m_next()
+    TokenIteratorImpl(PreprocessorImpl &impl, clang::Preprocessor &pp,
+                      boost::exception_ptr &exception, Profiler &profiler)
+      : m_impl(impl), m_pp(pp), m_exception(exception),
+        m_profiler(profiler), m_current(m_pp), m_next(), m_count(0)
     {
-        // Pinched from "clang/lib/Frontend/PrintPreprocessedOutput.cpp". Skip
-        // tokens from the predefines buffer.
+        // Skip tokens from the predefines buffer. The directives in it are
+        // handled within the first Lex; any other tokens are discarded.
+        // Scratch buffers (macro expansions) have no file entry either, so
+        // check the presumed filename, but only when the FileID changes.
         const clang::SourceManager &sm = m_pp.getSourceManager();
+        const clang::FileID main_fid = sm.getMainFileID();
+        clang::FileID predefines_fid;
+        const bool profiling = m_profiler.isEnabled();
+        if (profiling)
+            m_profiler.begin_token();
         do
         {
             m_pp.Lex(m_next);
             if (m_next.is(clang::tok::eof) || !m_next.getLocation().isFileID())
                 break;
-            clang::PresumedLoc PLoc = sm.getPresumedLoc(m_next.getLocation());
-            if (PLoc.isInvalid())
-                break;
-            if (strcmp(PLoc.getFilename(), "<built-in>") != 0)
+            const clang::FileID fid = sm.getFileID(m_next.getLocation());
+            if (fid == main_fid)
                 break;
+            if (fid != predefines_fid)
+            {
+                clang::PresumedLoc PLoc =
+                    sm.getPresumedLoc(m_next.getLocation());
+                if (PLoc.isInvalid() ||
+                    strcmp(PLoc.getFilename(), "<built-in>") != 0)
+                    break;
+                predefines_fid = fid;
+            }
         } while (true);
+        if (profiling)
+            m_profiler.end_token(sm, m_next);
         if (m_exception)
             boost::rethrow_exception(m_exception);
+        if (m_next.is(clang::tok::eof))
+            m_impl.end_main_file();
     }
 
     bool has_next() const throw()
@@ -236,24 +487,110 @@ public:
     Token& next()
     {
         m_current.setClangToken(m_next);
-        m_pp.Lex(m_next);
+        lex();
         if (m_exception)
             boost::rethrow_exception(m_exception);
+        if (++m_count % RELEASE_INTERVAL == 0)
+            m_impl.release_consumed();
+        if (m_next.is(clang::tok::eof))
+            m_impl.end_main_file();
         return m_current;
     }
 
+    size_t next_batch(TokenBatch &batch, size_t n)
+    {
+        batch.clear();
+        for (size_t i = 0; i < n && m_next.isNot(clang::tok::eof); ++i)
+        {
+            batch.append(m_pp, m_next);
+            lex();
+            if (m_exception)
+                boost::rethrow_exception(m_exception);
+        }
+        m_impl.release_consumed();
+        if (m_next.is(clang::tok::eof))
+            m_impl.end_main_file();
+        return batch.size();
+    }
+
 private:
+    // The number of tokens returned by "next" between each release of
+    // consumed memory in streaming mode.
+    enum {RELEASE_INTERVAL = 4096};
+
+    // Lex the next token, charging it to the profile if enabled.
+    void lex()
+    {
+        if (!m_profiler.isEnabled())
+        {
+            m_pp.Lex(m_next);
+            return;
+        }
+        m_profiler.begin_token();
+        m_pp.Lex(m_next);
+        m_profiler.end_token(m_pp.getSourceManager(), m_next);
+    }
+
+    PreprocessorImpl     &m_impl;
     clang::Preprocessor  &m_pp;
     boost::exception_ptr &m_exception;
+    Profiler             &m_profiler;
     Token                 m_current;
     clang::Token          m_next;
+    size_t                m_count;
+};
+
+/**
+ * An output stream that forwards to another, releasing the memory consumed
+ * by the preprocessor each time it is flushed. This is used in streaming
+ * mode, where preprocessing is driven by Clang's output printer.
+ */
+class ReleasingOutputStream : public llvm::raw_ostream
+{
+public:
+    ReleasingOutputStream(PreprocessorImpl &impl, llvm::raw_ostream &out)
+      : m_impl(impl), m_out(out)
+    {
+        SetBufferSize(64 * 1024);
+    }
+
+    ~ReleasingOutputStream()
+    {
+        flush();
+    }
+
+private:
+    void write_impl(const char *ptr, size_t size)
+    {
+        m_out.write(ptr, size);
+        m_impl.release_consumed();
+    }
+
+    uint64_t current_pos() const
+    {
+        return m_out.tell();
+    }
+
+    PreprocessorImpl  &m_impl;
+    llvm::raw_ostream &m_out;
 };
 
 
 ///////////////////////////////////////////////////////////////////////////////
 
 PreprocessorImpl::PreprocessorImpl(clang::CompilerInstance &compiler)
-  : m_compiler(compiler), m_exception()
+  : m_compiler(compiler), m_settings(), m_locator(), m_cache(),
+    m_exception(), m_arena(), m_expansion_location(), m_stats(),
+    m_profiler(),
+    m_file_cache_client(compiler.getFileManager(),
+                        compiler.getSourceManager()),
+    m_streaming_window(0), m_high_water(0), m_released(),
+    m_released_total(0), m_generation(0)
+{
+    initialise();
+}
+
+void PreprocessorImpl::initialise()
 {
     m_compiler.createPreprocessor();
 
@@ -276,7 +613,10 @@ PreprocessorImpl::PreprocessorImpl(clang::CompilerInstance &compiler)
 
     // Add preprocessing callbacks so we know when a file is entered or
     // exited.
-    m_file_change_callback = new impl::FileChangePPCallback;
+    m_file_change_callback =
+        new impl::FileChangePPCallback(m_compiler.getSourceManager());
+    m_file_change_callback->file_cache = &m_file_cache_client;
+    m_file_change_callback->profiler = &m_profiler;
     m_compiler.getPreprocessor().addPPCallbacks(m_file_change_callback);
 
     // Set the include locator diagnostic client.
@@ -284,6 +624,9 @@ PreprocessorImpl::PreprocessorImpl(clang::CompilerInstance &compiler)
         m_compiler.getDiagnostics().takeClient();
     m_include_locator = new IncludeLocatorDiagnosticClient(
         m_compiler.getPreprocessor(), orig_client);
+    m_include_locator->setIncludeLocator(m_locator);
+    m_include_locator->setIncludeCache(m_cache);
+    m_include_locator->setStats(&m_stats);
     m_compiler.getDiagnostics().setClient(m_include_locator);
 
     // Tell the diagnostic client that we've entered a source file, or bad
@@ -295,6 +638,63 @@ PreprocessorImpl::PreprocessorImpl(clang::CompilerInstance &compiler)
         m_compiler.getLangOpts(), &m_compiler.getPreprocessor());
 }
 
+void PreprocessorImpl::reset()
+{
+    // Restore the original diagnostic client. This destroys the include
+    // locator client, which refers to the old preprocessor.
+    clang::DiagnosticConsumer *orig_client = m_include_locator->takeDelegate();
+    orig_client->EndSourceFile();
+    m_compiler.getDiagnostics().setClient(orig_client);
+    m_compiler.getDiagnostics().Reset();
+
+    m_exception = boost::exception_ptr();
+    m_expansion_location = clang::SourceLocation();
+    m_arena.reset();
+    m_released.clear();
+    m_released_total = 0;
+    m_high_water = 0;
+    m_profiler.reset();
+    ++m_generation;
+    m_file_cache_client.setSourceManager(m_compiler.getSourceManager());
+    initialise();
+
+    // Reapply the configuration. Each call records itself again.
+    std::vector<Setting> settings;
+    std::map<std::string, std::string> guards;
+    settings.swap(m_settings);
+    for (std::vector<Setting>::const_iterator iter = settings.begin();
+         iter != settings.end(); ++iter)
+    {
+        switch (iter->kind)
+        {
+        case Setting::INCLUDE_DIR:
+            add_include_dir(iter->name, iter->flag);
+            break;
+        case Setting::DEFINE:
+            define(iter->name, iter->value);
+            break;
+        case Setting::DEFINE_MANY:
+            define_many(iter->value);
+            break;
+        case Setting::PREDEFINES:
+            add_predefines(iter->value);
+            break;
+        case Setting::FUNCTION:
+            iter->function->invalidate();
+            define(iter->name, iter->function);
+            break;
+        case Setting::PRAGMA:
+            iter->function->invalidate();
+            add_pragma(iter->name, iter->function);
+            break;
+        case Setting::GUARD:
+            guards[iter->name] = iter->value;
+            break;
+        }
+    }
+    add_guarded_files(guards);
+}
+
 bool
 PreprocessorImpl::add_include_dir(std::string const& path, bool sysinclude)
 {
@@ -303,13 +703,28 @@ PreprocessorImpl::add_include_dir(std::string const& path, bool sysinclude)
     clang::FileManager &filemgr = headers.getFileMgr();
     const clang::DirectoryEntry *entry =
         filemgr.getDirectory(llvm::StringRef(path.c_str(), path.size()));
+    if (!entry)
+        return false;
+
+    // If the directory is already in the search path, then leave the
+    // search path alone. Directory entries are unique per directory, so
+    // this also catches different paths to the same directory. Like GCC,
+    // the first occurrence determines whether it is a system directory.
+    for (clang::HeaderSearch::search_dir_iterator
+             iter = headers.search_dir_begin();
+         iter != headers.search_dir_end(); ++iter)
+    {
+        if (iter->getDir() == entry)
+            return true;
+    }
+    m_settings.push_back(
+        Setting(Setting::INCLUDE_DIR, path, std::string(), sysinclude));
 
     // Take a copy of the existing search paths, and add the new one. If
     // it's a system path, insert it in after "system_dir_end". If it's a
     // user path, simply add it to the end of the vector.
     std::vector<clang::DirectoryLookup> search_paths(
         headers.search_dir_begin(), headers.search_dir_end());
-    // TODO make sure it's not already in the list.
     const unsigned int n_quoted = std::distance(
         headers.quoted_dir_begin(), headers.quoted_dir_end());
     const unsigned int n_angled = std::distance(
@@ -335,6 +750,8 @@ PreprocessorImpl::add_include_dir(std::string const& path, bool sysinclude)
 bool
 PreprocessorImpl::define(std::string const& name, std::string const& value)
 {
+    m_settings.push_back(Setting(Setting::DEFINE, name, value));
+
     // Tokenize the value.
     std::vector<cmonster::core::Token> value_tokens;
     if (!value.empty())
@@ -396,6 +813,20 @@ PreprocessorImpl::define(std::string const& name, std::string const& value)
     }
 }
 
+void PreprocessorImpl::add_predefines(std::string const& predefines)
+{
+    m_settings.push_back(
+        Setting(Setting::PREDEFINES, std::string(), predefines));
+    clang::Preprocessor &pp = m_compiler.getPreprocessor();
+    std::string buffer = pp.getPredefines();
+    if (!buffer.empty() && buffer[buffer.size()-1] != '\n')
+        buffer.push_back('\n');
+    buffer.append(predefines);
+    if (!buffer.empty() && buffer[buffer.size()-1] != '\n')
+        buffer.push_back('\n');
+    pp.setPredefines(buffer);
+}
+
 /**
  * Defines a simple macro.
  */
@@ -446,9 +877,16 @@ PreprocessorImpl::add_macro_definition(
             value_tokens.back().getClangToken().getLocation());
     }
 
+    return install_macro(macro_identifier, macro);
+}
+
+bool PreprocessorImpl::install_macro(clang::IdentifierInfo *name,
+                                     clang::MacroInfo *macro)
+{
     // Is there an existing macro which is different? Then don't define the
     // new one.
-    clang::MacroInfo *existing_macro = pp.getMacroInfo(macro_identifier);
+    clang::Preprocessor &pp = m_compiler.getPreprocessor();
+    clang::MacroInfo *existing_macro = pp.getMacroInfo(name);
     if (existing_macro)
     {
         bool result = macro->isIdenticalTo(*existing_macro, pp);
@@ -456,13 +894,122 @@ PreprocessorImpl::add_macro_definition(
         return result;
     }
 
-    pp.setMacroInfo(macro_identifier, macro);
+    pp.setMacroInfo(name, macro);
     return true;
 }
 
+size_t PreprocessorImpl::define_many(std::string const& definitions)
+{
+    if (definitions.empty())
+        return 0;
+    ScopedTimer timer(&m_stats, Stats::TOKENIZE);
+
+    // Copy the definitions into the scratch buffer, and lex them with a
+    // single raw lexer, as in "tokenize".
+    clang::Preprocessor &pp = m_compiler.getPreprocessor();
+    clang::SourceManager &srcmgr = m_compiler.getSourceManager();
+    clang::Token scratch;
+    scratch.startToken();
+    pp.CreateString(definitions.data(), definitions.size(), scratch);
+    const char *start = srcmgr.getCharacterData(scratch.getLocation());
+    DefinitionLexer lexer(pp, scratch.getLocation(), start,
+                          start + definitions.size());
+
+    size_t defined = 0;
+    std::vector<clang::IdentifierInfo*> args;
+    clang::Token tok;
+    lexer.lex(tok);
+    while (tok.isNot(clang::tok::eof))
+    {
+        // "#define name"
+        if (tok.isNot(clang::tok::hash) || !tok.isAtStartOfLine())
+            lexer.error(tok, "Expected '#define'");
+        lexer.lex(tok);
+        if (!tok.getIdentifierInfo() || tok.isAtStartOfLine() ||
+            tok.getIdentifierInfo()->getPPKeywordID() != clang::tok::pp_define)
+        {
+            lexer.error(tok, "Expected '#define'");
+        }
+        lexer.lex(tok);
+        if (!tok.getIdentifierInfo() || tok.isAtStartOfLine())
+            lexer.error(tok, "Expected a macro name");
+        clang::IdentifierInfo *name = tok.getIdentifierInfo();
+        const clang::SourceLocation name_loc = tok.getLocation();
+        lexer.lex(tok);
+
+        // A '(' immediately following the name begins a parameter list.
+        bool is_function = false, is_varargs = false;
+        args.clear();
+        if (tok.is(clang::tok::l_paren) && !tok.hasLeadingSpace() &&
+            !tok.isAtStartOfLine())
+        {
+            is_function = true;
+            for (lexer.lex(tok); tok.isNot(clang::tok::r_paren);)
+            {
+                if (tok.isAtStartOfLine() || tok.is(clang::tok::eof))
+                    lexer.error(tok, "Unterminated macro parameter list");
+                if (tok.is(clang::tok::ellipsis))
+                {
+                    is_varargs = true;
+                    args.push_back(pp.getIdentifierInfo("__VA_ARGS__"));
+                    lexer.lex(tok);
+                    if (tok.isNot(clang::tok::r_paren) ||
+                        tok.isAtStartOfLine())
+                    {
+                        lexer.error(tok, "Expected ')' after '...'");
+                    }
+                    break;
+                }
+                if (!tok.getIdentifierInfo())
+                    lexer.error(tok, "Expected a macro parameter name");
+                args.push_back(tok.getIdentifierInfo());
+                lexer.lex(tok);
+                if (tok.is(clang::tok::comma))
+                    lexer.lex(tok);
+                else if (tok.isNot(clang::tok::r_paren))
+                    lexer.error(tok, "Expected ',' or ')'");
+            }
+            lexer.lex(tok);
+        }
+
+        // The body is the remainder of the line.
+        clang::MacroInfo *macro = pp.AllocateMacroInfo(name_loc);
+        if (is_function)
+        {
+            macro->setIsFunctionLike();
+            if (is_varargs)
+                macro->setIsC99Varargs();
+            if (!args.empty())
+            {
+                macro->setArgumentList(&args[0], args.size(),
+                                       pp.getPreprocessorAllocator());
+            }
+        }
+        for (; tok.isNot(clang::tok::eof) && !tok.isAtStartOfLine();
+             lexer.lex(tok))
+        {
+            macro->AddTokenToBody(tok);
+            macro->setDefinitionEndLoc(tok.getLocation());
+        }
+        if (install_macro(name, macro))
+            ++defined;
+    }
+
+    // Only record the definitions once they have been parsed successfully,
+    // so that "reset" does not fail.
+    m_settings.push_back(
+        Setting(Setting::DEFINE_MANY, std::string(), definitions));
+    return defined;
+}
+
 bool PreprocessorImpl::define(std::string const& name,
                           boost::shared_ptr<FunctionMacro> const& function)
 {
+    if (function)
+    {
+        m_settings.push_back(Setting(
+            Setting::FUNCTION, name, std::string(), false, function));
+    }
     if (function && add_pragma(name, function, true))
     {
         clang::Preprocessor &pp = m_compiler.getPreprocessor();
@@ -566,6 +1113,11 @@ bool PreprocessorImpl::define(std::string const& name,
 bool PreprocessorImpl::add_pragma(std::string const& name,
                               boost::shared_ptr<FunctionMacro> const& function)
 {
+    if (function)
+    {
+        m_settings.push_back(Setting(
+            Setting::PRAGMA, name, std::string(), false, function));
+    }
     return add_pragma(name, function, false);
 }
 
@@ -579,30 +1131,57 @@ bool PreprocessorImpl::add_pragma(std::string const& name,
         {
             m_compiler.getPreprocessor().AddPragmaHandler(
                 "cmonster", new DynamicPragmaHandler(
-                    *m_token_saver, name, function, m_exception));
+                    *m_token_saver, m_arena, name, function, m_exception,
+                    m_expansion_location, m_stats, m_profiler,
+                    m_streaming_window));
         }
         else
         {
             m_compiler.getPreprocessor().AddPragmaHandler(
                 new DynamicPragmaHandler(
-                    *m_token_saver, name, function, m_exception));
+                    *m_token_saver, m_arena, name, function, m_exception,
+                    m_expansion_location, m_stats, m_profiler,
+                    m_streaming_window));
         }
         return true;
     }
     return false;
 }
 
-void PreprocessorImpl::preprocess(long fd)
+void PreprocessorImpl::preprocess(long fd, size_t buffer_size)
 {
     llvm::raw_fd_ostream out(fd, false);
+    if (buffer_size)
+        out.SetBufferSize(buffer_size);
+    preprocess(out);
+    out.flush();
+    if (out.has_error())
+    {
+        out.clear_error();
+        boost::throw_exception(std::runtime_error(
+            "Failed to write preprocessed output"));
+    }
+}
 
+void PreprocessorImpl::preprocess(llvm::raw_ostream &out)
+{
     clang::PreprocessorOutputOptions opts;
     opts.ShowComments = 1;
     //opts.ShowMacroComments = 1;
     //opts.ShowMacros = 1;
 
-    clang::DoPrintPreprocessedInput(
-        m_compiler.getPreprocessor(), &out, opts);
+    if (m_streaming_window)
+    {
+        ReleasingOutputStream releasing(*this, out);
+        clang::DoPrintPreprocessedInput(
+            m_compiler.getPreprocessor(), &releasing, opts);
+    }
+    else
+    {
+        clang::DoPrintPreprocessedInput(
+            m_compiler.getPreprocessor(), &out, opts);
+    }
+    end_main_file();
     check_exception();
 }
 
@@ -616,83 +1195,255 @@ TokenIterator* PreprocessorImpl::create_iterator()
         new ExceptionDiagnosticClient(m_exception));
 
     // Return a TokenIterator.
-    return new TokenIteratorImpl(m_compiler.getPreprocessor(), m_exception);
+    return new TokenIteratorImpl(
+        *this, m_compiler.getPreprocessor(), m_exception, m_profiler);
+}
+
+IncludeGraph PreprocessorImpl::scan_dependencies()
+{
+    clang::Preprocessor &pp = m_compiler.getPreprocessor();
+    pp.EnterMainSourceFile();
+    m_include_locator->setDelegate(
+        new ExceptionDiagnosticClient(m_exception));
+
+    // Lex to the end of the main file without expanding macros or
+    // producing output. Directives, including those in the predefines
+    // buffer, are handled within Lex.
+    IncludeGraph graph;
+    m_file_change_callback->inclusions = &graph;
+    m_file_change_callback->included_files.clear();
+    clang::Token token;
+    do
+    {
+        pp.LexUnexpandedToken(token);
+    } while (token.isNot(clang::tok::eof) && !m_exception);
+    m_file_change_callback->inclusions = 0;
+    m_file_change_callback->pending = false;
+    end_main_file();
+    check_exception();
+
+    // Include guards are only known once a file has been exited.
+    clang::HeaderSearch &headers = pp.getHeaderSearchInfo();
+    for (size_t i = 0; i < graph.size(); ++i)
+    {
+        const clang::FileEntry *file =
+            m_file_change_callback->included_files[i];
+        if (file)
+        {
+            const clang::HeaderFileInfo &info = headers.getFileInfo(file);
+            if (info.ControllingMacro)
+                graph[i].guard = info.ControllingMacro->getName();
+            graph[i].pragma_once = info.isPragmaOnce;
+        }
+    }
+    return graph;
+}
+
+void PreprocessorImpl::write_token_cache(std::string const& path,
+                                         std::string const& key)
+{
+    // The configuration must be hashed before preprocessing, as is done
+    // when checking the cache.
+    TokenCacheWriter writer(m_compiler.getPreprocessor(),
+                            get_config_hash(key));
+    boost::scoped_ptr<TokenIterator> iter(create_iterator());
+    while (iter->has_next())
+        writer.append(iter->next().getClangToken());
+
+    // Record every file entered, including those that produced no tokens.
+    for (std::vector<const clang::FileEntry*>::const_iterator
+             file = m_file_change_callback->files.begin();
+         file != m_file_change_callback->files.end(); ++file)
+        writer.add_file(*file);
+    writer.write(path);
+}
+
+bool PreprocessorImpl::is_token_cache_valid(std::string const& path,
+                                            std::string const& key) const
+{
+    return token_cache::is_valid(path, get_config_hash(key));
+}
+
+TokenIterator* PreprocessorImpl::read_token_cache(std::string const& path)
+{
+    return new CachedTokenIterator(m_compiler.getPreprocessor(), path);
+}
+
+uint64_t PreprocessorImpl::get_config_hash(std::string const& key) const
+{
+    // Hash each string with its terminating NUL, so that adjacent strings
+    // cannot run together.
+    using token_cache::hash_bytes;
+    const clang::Preprocessor &pp = m_compiler.getPreprocessor();
+    uint64_t hash = hash_bytes(key.c_str(), key.size() + 1);
+    const std::string triple = m_compiler.getTarget().getTriple().str();
+    hash = hash_bytes(triple.c_str(), triple.size() + 1, hash);
+    hash = hash_bytes(pp.getPredefines().c_str(),
+                      pp.getPredefines().size() + 1, hash);
+
+    // The main file, and the include search path, determine which files
+    // are preprocessed. The main buffer's contents are hashed too, as it
+    // need not have come from a file on disk.
+    const clang::SourceManager &sm = m_compiler.getSourceManager();
+    const clang::FileEntry *main_file =
+        sm.getFileEntryForID(sm.getMainFileID());
+    if (main_file)
+    {
+        hash = hash_bytes(main_file->getName(),
+                          std::strlen(main_file->getName()) + 1, hash);
+    }
+    if (!sm.getMainFileID().isInvalid())
+    {
+        bool invalid = false;
+        const llvm::MemoryBuffer *buffer =
+            sm.getBuffer(sm.getMainFileID(), &invalid);
+        if (!invalid)
+        {
+            hash = hash_bytes(buffer->getBufferStart(),
+                              buffer->getBufferSize(), hash);
+        }
+        const char flag = invalid;
+        hash = hash_bytes(&flag, 1, hash);
+    }
+
+    // Every setting applied through this object, in order: macros,
+    // definitions blocks, function macros and pragmas. Function macros
+    // and pragmas are identified by name only; their behaviour belongs in
+    // the key.
+    for (std::vector<Setting>::const_iterator iter = m_settings.begin();
+         iter != m_settings.end(); ++iter)
+    {
+        const char kind[2] = {
+            static_cast<char>(iter->kind), static_cast<char>(iter->flag)};
+        hash = hash_bytes(kind, sizeof(kind), hash);
+        hash = hash_bytes(iter->name.c_str(), iter->name.size() + 1, hash);
+        hash = hash_bytes(iter->value.c_str(), iter->value.size() + 1, hash);
+    }
+    const clang::HeaderSearch &headers = pp.getHeaderSearchInfo();
+    for (clang::HeaderSearch::search_dir_iterator
+             iter = headers.search_dir_begin();
+         iter != headers.search_dir_end(); ++iter)
+    {
+        const char *name = iter->getName();
+        if (name)
+            hash = hash_bytes(name, std::strlen(name) + 1, hash);
+        const char flag = iter->getDirCharacteristic();
+        hash = hash_bytes(&flag, 1, hash);
+    }
+    return hash;
 }
 
-// XXX should we just be creating a new Lexer?
 std::vector<cmonster::core::Token>
 PreprocessorImpl::tokenize(const char *s, size_t len)
 {
     std::vector<cmonster::core::Token> result;
     if (!s || !len)
         return result;
+    ScopedTimer timer(&m_stats, Stats::TOKENIZE);
 
-    // If the main preprocessor hasn't yet been entered, create a temporary
-    // one to lex from.
-    clang::Preprocessor &old_pp = m_compiler.getPreprocessor();
-    PreprocessorResetter pp_resetter(m_compiler, old_pp);
-    if (m_file_change_callback->depth == 0)
+    // Copy the string into the preprocessor's scratch buffer. The scratch
+    // buffer is a single, shared SourceManager entry, so this does not
+    // create a new FileID per call. The copy is NUL-terminated, as required
+    // by the lexer.
+    clang::Preprocessor &pp = m_compiler.getPreprocessor();
+    clang::SourceManager &srcmgr = m_compiler.getSourceManager();
+    clang::Token scratch;
+    scratch.startToken();
+    pp.CreateString(s, len, scratch);
+    const char *start = srcmgr.getCharacterData(scratch.getLocation());
+
+    // Lex the string with a raw lexer. Raw lexing does no macro expansion
+    // or directive handling, which is what we want for macro results.
+    clang::Lexer lexer(scratch.getLocation(), m_compiler.getLangOpts(),
+                       start, start, start + len);
+    clang::Token tok;
+    for (lexer.LexFromRawLexer(tok); tok.isNot(clang::tok::eof);
+         lexer.LexFromRawLexer(tok))
     {
-        m_compiler.resetAndLeakPreprocessor();
-        m_compiler.createPreprocessor();
-        m_compiler.getPreprocessor().EnterMainSourceFile();
+        // Raw identifiers must be looked up in the live preprocessor to
+        // get their IdentifierInfo and keyword kind.
+        if (tok.is(clang::tok::raw_identifier))
+            pp.LookUpIdentifierInfo(tok);
+        result.push_back(cmonster::core::Token(pp, tok));
     }
+    return result;
+}
 
-    // Create a memory buffer.
-    std::auto_ptr<llvm::MemoryBuffer> mem(
-        llvm::MemoryBuffer::getMemBufferCopy(
-            llvm::StringRef(s, len), "<generated>"));
+std::string PreprocessorImpl::capture_until(std::string const& identifier)
+{
+    if (identifier.empty())
+    {
+        boost::throw_exception(
+            std::invalid_argument("Expected a non-empty identifier"));
+    }
 
-    // Create a file ID and enter it into the preprocessor.
     clang::Preprocessor &pp = m_compiler.getPreprocessor();
-    clang::SourceManager &srcmgr = m_compiler.getSourceManager();
-
-    // Transfer ownership of the memory buffer to the source manager.
-    clang::FileID fid = srcmgr.createFileIDForMemBuffer(mem.release());
-
-    // Record the current include depth, and enter the file. We can use the
-    // file change callback to (a) ensure the memory buffer file was entered,
-    // and (b) to determine when to stop lexing.
-    //
-    // Unfortunately the use of a "file" means the preprocessor output is
-    // littered with line markers. It would be nice if we could get rid of
-    // them.
-    const unsigned int old_depth = m_file_change_callback->depth;
-    pp.EnterSourceFile(fid, pp.GetCurDirLookup(), clang::SourceLocation());
-
-    // Did something go awry when trying to enter the file? Bail out.
-    if ((&pp == &old_pp) && m_file_change_callback->depth <= old_depth)
-        return result;
-
-    // Lex until we leave the file. We peek the next token, and if it's
-    // eof or from a different file, bail out.
-    //
-    // Note: I was originally using the file change PP callback's depth
-    // tracking to handle this, but I ran into a problem. The "ExitFile"
-    // callback is not invoked until the next token is lexed, so we would
-    // have to backtrack once we've exited the file. I found that if I had
-    // two macros, one calling the other, both using tokenize, the second
-    // entry to tokenize would start lexing the backtracked tokens before
-    // the tokens from the memory buffer.
+    clang::SourceManager &sm = m_compiler.getSourceManager();
     clang::Token tok;
-    while (pp.LookAhead(0).isNot(clang::tok::eof) &&
-           srcmgr.getFileID(pp.LookAhead(0).getLocation()) == fid)
+    pp.LexUnexpandedToken(tok);
+    check_exception();
+    if (is_identifier(tok, identifier))
+        return std::string();
+
+    // If the body is contiguous in one file, find the terminator in the
+    // file's buffer and return the text before it. The lexer must still
+    // consume the body; it confirms that the candidate is a token, rather
+    // than part of a comment or literal, in which case we search again.
+    std::vector<clang::Token> tokens;
+    if (tok.getLocation().isFileID())
     {
-        pp.LexUnexpandedToken(tok);
+        const std::pair<clang::FileID, unsigned> start =
+            sm.getDecomposedLoc(tok.getLocation());
+        bool invalid = false;
+        llvm::StringRef buffer = sm.getBufferData(start.first, &invalid);
+        size_t candidate = invalid ? llvm::StringRef::npos :
+            find_identifier(buffer, identifier, start.second);
+        while (candidate != llvm::StringRef::npos)
+        {
+            tokens.push_back(tok);
+            pp.LexUnexpandedToken(tok);
+            check_exception();
+            if (tok.is(clang::tok::eof) || !tok.getLocation().isFileID())
+                break;
+            const std::pair<clang::FileID, unsigned> decomposed =
+                sm.getDecomposedLoc(tok.getLocation());
+            if (decomposed.first != start.first)
+                break;
+            if (decomposed.second > candidate)
+            {
+                candidate = find_identifier(
+                    buffer, identifier, decomposed.second);
+            }
+            if (decomposed.second == candidate &&
+                is_identifier(tok, identifier))
+            {
+                return slice_lines(buffer, start.second, candidate);
+            }
+        }
+    }
 
-        // If we've had to create another preprocessor, then make sure we
-        // recreate the IdentifierInfo objects in the existing preprocessor.
-        // Everything else (importantly, the source manager) is shared between
-        // the two preprocessor objects.
-        if (&pp != &old_pp && tok.isAnyIdentifier())
+    // Otherwise (e.g. the body spans an #include, or comes from a macro
+    // expansion), lex up to the terminator and format the tokens.
+    std::vector<cmonster::core::Token> body;
+    body.reserve(tokens.size());
+    for (size_t i = 0; i < tokens.size(); ++i)
+        body.push_back(cmonster::core::Token(pp, tokens[i]));
+    while (!is_identifier(tok, identifier))
+    {
+        if (tok.is(clang::tok::eof))
         {
-            clang::IdentifierInfo *II = tok.getIdentifierInfo();
-            if (II)
-                tok.setIdentifierInfo(old_pp.getIdentifierInfo(II->getName()));
+            boost::throw_exception(std::runtime_error(
+                "Reached end of file looking for \"" + identifier + "\""));
         }
-        result.push_back(cmonster::core::Token(pp, tok));
+        body.push_back(cmonster::core::Token(pp, tok));
+        pp.LexUnexpandedToken(tok);
+        check_exception();
     }
-    return result;
+    std::string text;
+    llvm::raw_string_ostream out(text);
+    format(out, body);
+    out.flush();
+    return text;
 }
 
 Token* PreprocessorImpl::next(bool expand)
@@ -711,42 +1462,71 @@ Token* PreprocessorImpl::next(bool expand)
 // but it forces us to "enter the main source file", which means we have
 // to create a whole new preprocessor from scratch. That might be the
 // way to go anyway... we'll see how we go.
-std::ostream& PreprocessorImpl::format(
-    std::ostream &out,
-    std::vector<cmonster::core::Token> const& tokens) const
+llvm::raw_ostream& PreprocessorImpl::format(
+    llvm::raw_ostream &out,
+    std::vector<cmonster::core::Token> const& tokens,
+    bool compact) const
 {
-    unsigned int current_line = 0, current_column = 1;
+    clang::Preprocessor &pp = m_compiler.getPreprocessor();
     clang::SourceManager const& sm = m_compiler.getSourceManager();
+    clang::TokenConcatenation concat(pp);
+
+    // Spellings are written straight out of the source buffers where
+    // possible, falling back to this buffer for "dirty" tokens.
+    llvm::SmallString<128> buffer;
+
+    // Lines are 1-based, so we use zero to mean that we don't yet know
+    // which line we're on.
+    unsigned int current_line = 0;
+    clang::Token prevprev, prev;
+    prevprev.startToken();
+    prev.startToken();
     for (std::vector<cmonster::core::Token>::const_iterator
              iter = tokens.begin(); iter != tokens.end(); ++iter)
     {
-        Token const& token = *iter;
-        clang::SourceLocation loc = token.getClangToken().getLocation();
-        clang::PresumedLoc ploc = sm.getPresumedLoc(loc);
-        if (ploc.isValid())
+        clang::Token const& tok = iter->getClangToken();
+        const bool first = iter == tokens.begin();
+        if (first || tok.isAtStartOfLine())
         {
-            unsigned int line = ploc.getLine();
-            unsigned int column = ploc.getColumn();
-            if (line > current_line)
+            if (compact)
+            {
+                if (!first)
+                    out << '\n';
+            }
+            else
             {
-                // Lines are 1-based, so we use zero to mean that we haven't
-                // yet processed any tokens.
-                if (current_line > 0)
+                // Only consult the source manager for tokens that start a
+                // line; the rest are positioned relative to their
+                // predecessor.
+                clang::PresumedLoc ploc = sm.getPresumedLoc(tok.getLocation());
+                unsigned int line = 0, column = 1;
+                if (ploc.isValid())
                 {
-                    out << std::string(line-current_line, '\n');
-                    current_column = 1;
+                    line = ploc.getLine();
+                    column = ploc.getColumn();
                 }
+                if (!first)
+                {
+                    unsigned int newlines = 1;
+                    if (line > current_line && current_line > 0)
+                        newlines = line - current_line;
+                    for (unsigned int i = 0; i < newlines; ++i)
+                        out << '\n';
+                }
+                if (column > 1)
+                    out.indent(column - 1);
                 current_line = line;
             }
-            if (column > current_column)
-            {
-                out << std::string(column-current_column, ' ');
-                current_column = column;
-            }
-            out << token;
-            // TODO verify exactly getLength() chars were written
-            current_column += token.getClangToken().getLength();
         }
+        else if (tok.hasLeadingSpace() ||
+                 concat.AvoidConcat(prevprev, prev, tok))
+        {
+            out << ' ';
+        }
+
+        out << pp.getSpelling(tok, buffer);
+        prevprev = prev;
+        prev = tok;
     }
     return out;
 }
@@ -755,9 +1535,76 @@ void
 PreprocessorImpl::set_include_locator(
     boost::shared_ptr<IncludeLocator> const& locator)
 {
+    m_locator = locator;
     m_include_locator->setIncludeLocator(locator);
 }
 
+void
+PreprocessorImpl::set_include_cache(
+    boost::shared_ptr<IncludeCache> const& cache)
+{
+    m_cache = cache;
+    m_include_locator->setIncludeCache(cache);
+}
+
+void
+PreprocessorImpl::set_file_cache(boost::shared_ptr<FileCache> const& cache)
+{
+    m_file_cache_client.setFileCache(cache);
+}
+
+std::vector<std::string> PreprocessorImpl::get_entered_files() const
+{
+    std::vector<std::string> paths;
+    std::vector<const clang::FileEntry*> const& files =
+        m_file_change_callback->files;
+    paths.reserve(files.size());
+    for (std::vector<const clang::FileEntry*>::const_iterator
+             iter = files.begin(); iter != files.end(); ++iter)
+        paths.push_back((*iter)->getName());
+    return paths;
+}
+
+std::map<std::string, std::string> PreprocessorImpl::get_guarded_files()
+{
+    std::map<std::string, std::string> guards;
+    clang::HeaderSearch &headers =
+        m_compiler.getPreprocessor().getHeaderSearchInfo();
+    llvm::SmallVector<const clang::FileEntry*, 64> files;
+    m_compiler.getFileManager().GetUniqueIDMapping(files);
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        if (!files[i])
+            continue;
+        const clang::HeaderFileInfo &info = headers.getFileInfo(files[i]);
+        if (info.ControllingMacro)
+            guards[files[i]->getName()] = info.ControllingMacro->getName();
+    }
+    return guards;
+}
+
+void PreprocessorImpl::add_guarded_files(
+    std::map<std::string, std::string> const& guards)
+{
+    clang::Preprocessor &pp = m_compiler.getPreprocessor();
+    clang::HeaderSearch &headers = pp.getHeaderSearchInfo();
+    clang::FileManager &files = m_compiler.getFileManager();
+    for (std::map<std::string, std::string>::const_iterator
+             iter = guards.begin(); iter != guards.end(); ++iter)
+    {
+        if (iter->second.empty())
+            continue;
+        m_settings.push_back(
+            Setting(Setting::GUARD, iter->first, iter->second));
+        const clang::FileEntry *file = files.getFile(iter->first);
+        if (file)
+        {
+            headers.SetFileControllingMacro(
+                file, pp.getIdentifierInfo(iter->second));
+        }
+    }
+}
+
 Token* PreprocessorImpl::create_token(clang::tok::TokenKind kind,
                                       const char *value, size_t value_len)
 {
@@ -765,6 +1612,90 @@ Token* PreprocessorImpl::create_token(clang::tok::TokenKind kind,
                      kind, value, value_len);
 }
 
+void PreprocessorImpl::end_main_file()
+{
+    update_high_water();
+    m_released.clear();
+    m_released_total = 0;
+    m_profiler.reset();
+
+    // Only release the arena if preprocessing completed normally. If an
+    // exception is pending, the preprocessor may still be lexing tokens
+    // from the arena.
+    if (!m_exception)
+        m_arena.reset();
+}
+
+void PreprocessorImpl::set_streaming(size_t window)
+{
+    m_streaming_window = window;
+}
+
+size_t PreprocessorImpl::get_memory_high_water() const
+{
+    return m_high_water;
+}
+
+void PreprocessorImpl::release_consumed()
+{
+    if (!m_streaming_window)
+        return;
+
+    // Release the pages of the file currently being lexed that are more
+    // than a window behind the lexer. Only memory-mapped buffers may be
+    // released: their pages are read back from the file if they are
+    // touched again (e.g. to get a token's spelling), whereas releasing
+    // the pages of a heap buffer would discard its contents.
+    clang::Preprocessor &pp = m_compiler.getPreprocessor();
+    clang::PreprocessorLexer *pplexer = pp.getCurrentFileLexer();
+    if (pplexer)
+    {
+        clang::SourceManager &sm = m_compiler.getSourceManager();
+        bool invalid = false;
+        const llvm::MemoryBuffer *buffer =
+            sm.getBuffer(pplexer->getFileID(), &invalid);
+        if (!invalid && buffer &&
+            buffer->getBufferKind() == llvm::MemoryBuffer::MemoryBuffer_MMap)
+        {
+            // We don't use PTH, so file lexers are always clang::Lexers.
+            const char *position =
+                static_cast<clang::Lexer*>(pplexer)->getBufferLocation();
+            const size_t offset = position - buffer->getBufferStart();
+            if (offset > m_streaming_window)
+            {
+                const uintptr_t page = sysconf(_SC_PAGESIZE);
+                const uintptr_t base =
+                    reinterpret_cast<uintptr_t>(buffer->getBufferStart());
+                size_t &released = m_released[buffer];
+                uintptr_t begin = (base + released + page - 1) & ~(page - 1);
+                uintptr_t end =
+                    (base + offset - m_streaming_window) & ~(page - 1);
+                if (end > begin &&
+                    madvise(reinterpret_cast<void*>(begin), end - begin,
+                            MADV_DONTNEED) == 0)
+                {
+                    m_released_total += (end - base) - released;
+                    released = end - base;
+                }
+            }
+        }
+    }
+    update_high_water();
+}
+
+void PreprocessorImpl::update_high_water()
+{
+    clang::Preprocessor const& pp = m_compiler.getPreprocessor();
+    clang::SourceManager const& sm = m_compiler.getSourceManager();
+    const clang::SourceManager::MemoryBufferSizes buffers =
+        sm.getMemoryBufferSizes();
+    size_t retained = pp.getTotalMemory() + sm.getDataStructureSizes() +
+                      buffers.malloc_bytes + m_arena.getTotalMemory();
+    if (buffers.mmap_bytes > m_released_total)
+        retained += buffers.mmap_bytes - m_released_total;
+    m_high_water = std::max(m_high_water, retained);
+}
+
 void PreprocessorImpl::check_exception()
 {
     if (m_exception)
@@ -775,6 +1706,34 @@ void PreprocessorImpl::check_exception()
     }
 }
 
+clang::DiagnosticConsumer*
+PreprocessorImpl::swap_diagnostic_delegate(clang::DiagnosticConsumer *delegate)
+{
+    clang::DiagnosticConsumer *previous = m_include_locator->takeDelegate();
+    m_include_locator->setDelegate(delegate);
+    return previous;
+}
+
+clang::SourceLocation PreprocessorImpl::get_expansion_location() const
+{
+    return m_expansion_location;
+}
+
+Stats& PreprocessorImpl::get_stats()
+{
+    return m_stats;
+}
+
+Profiler& PreprocessorImpl::get_profiler()
+{
+    return m_profiler;
+}
+
+unsigned int PreprocessorImpl::get_generation() const
+{
+    return m_generation;
+}
+
 const clang::Preprocessor& PreprocessorImpl::getClangPreprocessor() const
 {
     return m_compiler.getPreprocessor();
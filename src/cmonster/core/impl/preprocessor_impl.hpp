@@ -24,11 +24,18 @@ SOFTWARE.
 #define _CMONSTER_CORE_PREPROCESSOR_IMPL_HPP
 
 #include "../preprocessor.hpp"
+#include "file_cache_client.hpp"
 #include "include_locator_impl.hpp"
+#include "token_arena.hpp"
 
 #include <clang/Frontend/CompilerInstance.h>
 
 #include <boost/exception_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <map>
+#include <string>
+#include <vector>
 
 namespace cmonster {
 namespace core {
@@ -52,6 +59,16 @@ public:
      */
     bool define(std::string const& name, std::string const& value="");
 
+    /**
+     * @see Preprocessor::add_predefines.
+     */
+    void add_predefines(std::string const& predefines);
+
+    /**
+     * @see Preprocessor::define_many.
+     */
+    size_t define_many(std::string const& definitions);
+
     /**
      * @see Preprocessor::define.
      */
@@ -69,6 +86,28 @@ public:
      */
     TokenIterator* create_iterator();
 
+    /**
+     * @see Preprocessor::scan_dependencies.
+     */
+    IncludeGraph scan_dependencies();
+
+    /**
+     * @see Preprocessor::write_token_cache.
+     */
+    void write_token_cache(std::string const& path,
+                           std::string const& key = std::string());
+
+    /**
+     * @see Preprocessor::is_token_cache_valid.
+     */
+    bool is_token_cache_valid(std::string const& path,
+                              std::string const& key = std::string()) const;
+
+    /**
+     * @see Preprocessor::read_token_cache.
+     */
+    TokenIterator* read_token_cache(std::string const& path);
+
     /**
      * @see Preprocessor::tokenize.
      */
@@ -83,36 +122,152 @@ public:
     /**
      * @see Preprocessor::preprocess.
      */
-    void preprocess(long fd);
+    void preprocess(long fd, size_t buffer_size = 0);
+
+    /**
+     * @see Preprocessor::preprocess.
+     */
+    void preprocess(llvm::raw_ostream &out);
 
     /**
      * @see Preprocessor::next.
      */
     Token* next(bool expand = true);
 
+    /**
+     * @see Preprocessor::capture_until.
+     */
+    std::string capture_until(std::string const& identifier);
+
     /**
      * @see Preprocessor::format.
      */
-    std::ostream& format(
-        std::ostream &out,
-        std::vector<cmonster::core::Token> const& tokens) const;
+    llvm::raw_ostream& format(
+        llvm::raw_ostream &out,
+        std::vector<cmonster::core::Token> const& tokens,
+        bool compact = false) const;
 
     /**
      * @see Preprocessor::set_include_locator.
      */
     void set_include_locator(boost::shared_ptr<IncludeLocator> const& locator);
 
+    /**
+     * @see Preprocessor::set_include_cache.
+     */
+    void set_include_cache(boost::shared_ptr<IncludeCache> const& cache);
+
+    /**
+     * @see Preprocessor::set_file_cache.
+     */
+    void set_file_cache(boost::shared_ptr<FileCache> const& cache);
+
+    /**
+     * @see Preprocessor::get_guarded_files.
+     */
+    std::map<std::string, std::string> get_guarded_files();
+
+    /**
+     * @see Preprocessor::get_entered_files.
+     */
+    std::vector<std::string> get_entered_files() const;
+
+    /**
+     * @see Preprocessor::add_guarded_files.
+     */
+    void add_guarded_files(std::map<std::string, std::string> const& guards);
+
+    /**
+     * @see Preprocessor::set_streaming.
+     */
+    void set_streaming(size_t window);
+
+    /**
+     * @see Preprocessor::get_memory_high_water.
+     */
+    size_t get_memory_high_water() const;
+
+    /**
+     * In streaming mode, release memory that has been consumed by the
+     * lexer, and update the high-water mark. This is called periodically as
+     * tokens are produced, and does nothing if streaming is disabled.
+     */
+    void release_consumed();
+
+    /**
+     * Recreate the underlying Clang preprocessor, so that a new main file
+     * may be preprocessed, and reapply the configuration made through this
+     * object (include directories, macros, pragmas and the include
+     * locator). Tokens created by the previous preprocessor are invalidated.
+     *
+     * The compiler's preprocessor options are read again, so they may be
+     * changed before calling this. The compiler's source manager may also
+     * have been replaced.
+     */
+    void reset();
+
+    /**
+     * Called once the main file has been completely preprocessed. This
+     * releases the per-run token arena.
+     */
+    void end_main_file();
+
     /**
      * Check if an exception is pending, and if so, throw it.
      */
     void check_exception();
 
+    /**
+     * Replace the client that diagnostics not handled by the include
+     * locator are delegated to, returning the previous one. Ownership of
+     * both is transferred.
+     */
+    clang::DiagnosticConsumer*
+    swap_diagnostic_delegate(clang::DiagnosticConsumer *delegate);
+
+    /**
+     * @see Preprocessor::get_expansion_location.
+     */
+    clang::SourceLocation get_expansion_location() const;
+
+    /**
+     * @see Preprocessor::get_stats.
+     */
+    Stats& get_stats();
+
+    /**
+     * @see Preprocessor::get_profiler.
+     */
+    Profiler& get_profiler();
+
+    /**
+     * @see Preprocessor::get_generation.
+     */
+    unsigned int get_generation() const;
+
     /**
      * @see Preprocessor::getClangPreprocessor.
      */
     const clang::Preprocessor& getClangPreprocessor() const;
 
 private: // Methods
+    /**
+     * Create and initialise the Clang preprocessor.
+     */
+    void initialise();
+
+    /**
+     * Compute a hash of the configuration that affects the preprocessor's
+     * output, and a key given by the user, for token cache files.
+     */
+    uint64_t get_config_hash(std::string const& key) const;
+
+    /**
+     * Estimate the memory currently retained by the preprocessor, its
+     * source manager and the token arena, and update the high-water mark.
+     */
+    void update_high_water();
+
     bool add_pragma(std::string const& name,
                     boost::shared_ptr<FunctionMacro> const& handler,
                     bool with_namespace);
@@ -123,9 +278,54 @@ private: // Methods
         std::vector<cmonster::core::Token> const& value_tokens,
         std::vector<std::string> const& args, bool is_function);
 
+    /**
+     * Define "name" as "macro", unless it is already defined. Returns true
+     * if the macro was defined, or the existing definition is identical;
+     * in the latter case, "macro" is destroyed.
+     */
+    bool install_macro(clang::IdentifierInfo *name, clang::MacroInfo *macro);
+
+private: // Types
+    /**
+     * A recorded configuration call, which is reapplied by "reset".
+     */
+    struct Setting
+    {
+        enum Kind {
+            INCLUDE_DIR, DEFINE, DEFINE_MANY, PREDEFINES, FUNCTION, PRAGMA,
+            GUARD};
+        Setting(Kind kind_, std::string const& name_,
+                std::string const& value_ = std::string(),
+                bool flag_ = false,
+                boost::shared_ptr<FunctionMacro> const& function_ =
+                    boost::shared_ptr<FunctionMacro>())
+          : kind(kind_), name(name_), value(value_), flag(flag_),
+            function(function_) {}
+        Kind                             kind;
+        std::string                      name;
+        std::string                      value;
+        bool                             flag;
+        boost::shared_ptr<FunctionMacro> function;
+    };
+
 private: // Attributes
-    clang::CompilerInstance &m_compiler;
-    boost::exception_ptr     m_exception;
+    clang::CompilerInstance           &m_compiler;
+    std::vector<Setting>               m_settings;
+    boost::shared_ptr<IncludeLocator>  m_locator;
+    boost::shared_ptr<IncludeCache>    m_cache;
+    boost::exception_ptr               m_exception;
+    TokenArena                         m_arena;
+    clang::SourceLocation              m_expansion_location;
+    Stats                              m_stats;
+    Profiler                           m_profiler;
+    FileCacheClient                    m_file_cache_client;
+    size_t                             m_streaming_window;
+    size_t                             m_high_water;
+    // The number of bytes released from the start of each memory-mapped
+    // buffer in streaming mode, and their total.
+    std::map<const llvm::MemoryBuffer*, size_t> m_released;
+    size_t                             m_released_total;
+    unsigned int                       m_generation;
 
     // All of these are owned by the Clang preprocessor object.
     impl::TokenSaverPragmaHandler  *m_token_saver;
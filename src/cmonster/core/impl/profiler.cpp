@@ -0,0 +1,202 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "../profiler.hpp"
+
+#include <llvm/ADT/SmallString.h>
+
+#include <algorithm>
+
+namespace cmonster {
+namespace core {
+
+Profiler::Profiler()
+  : m_enabled(false), m_nodes(1, Node(0, llvm::StringRef())), m_children(),
+    m_files(), m_macro_names(), m_python_ranges(), m_chain(), m_start(0) {}
+
+void Profiler::enter_file(const char *name)
+{
+    const unsigned int parent = m_files.empty() ? 0 : m_files.back();
+    m_files.push_back(get_child(parent, name ? name : "<unknown>"));
+}
+
+void Profiler::exit_file()
+{
+    // Profiling may have been enabled part way through a file.
+    if (!m_files.empty())
+        m_files.pop_back();
+}
+
+void
+Profiler::macro_expands(clang::SourceLocation name_loc, const char *name)
+{
+    m_macro_names[name_loc.getRawEncoding()] = name;
+}
+
+void Profiler::python_macro(clang::SourceManager const& sm,
+                            clang::SourceLocation pragma_loc,
+                            std::vector<cmonster::core::Token> const& result)
+{
+    // Tokens created by the macro are lexed from the scratch buffer, so
+    // they have file locations; tokens passed through from the arguments
+    // keep their own expansion history.
+    unsigned int first = ~0U, last = 0;
+    for (size_t i = 0; i < result.size(); ++i)
+    {
+        const clang::SourceLocation loc =
+            result[i].getClangToken().getLocation();
+        if (loc.isValid() && loc.isFileID())
+        {
+            first = std::min(first, loc.getRawEncoding());
+            last = std::max(last, loc.getRawEncoding());
+        }
+    }
+    if (first > last)
+        return;
+    PythonRange &range = m_python_ranges[last];
+    range.first = first;
+    range.chain.clear();
+    collect_chain(sm, pragma_loc, range.chain);
+}
+
+void Profiler::end_token(clang::SourceManager const& sm,
+                         clang::Token const& tok)
+{
+    const uint64_t ns = Stats::now() - m_start;
+
+    m_chain.clear();
+    const clang::SourceLocation loc = tok.getLocation();
+    if (loc.isMacroID())
+    {
+        collect_chain(sm, loc, m_chain);
+    }
+    else if (loc.isValid() && !m_python_ranges.empty())
+    {
+        std::map<unsigned int, PythonRange>::iterator it =
+            m_python_ranges.lower_bound(loc.getRawEncoding());
+        if (it != m_python_ranges.end() &&
+            it->second.first <= loc.getRawEncoding())
+        {
+            m_chain = it->second.chain;
+            // The results are lexed in order, so the range is finished
+            // with once its last token has been lexed.
+            if (it->first == loc.getRawEncoding())
+                m_python_ranges.erase(it);
+        }
+    }
+    else if (loc.isValid())
+    {
+        // A file token outside of any Python macro's results is not within
+        // an expansion, so the names of the expansions so far are no
+        // longer needed.
+        m_macro_names.clear();
+    }
+
+    // Results of Python macros that are never lexed in full (e.g. those
+    // passed as arguments to another macro) are discarded, oldest first,
+    // so that streaming a large file does not accumulate them.
+    while (m_python_ranges.size() > MAX_PYTHON_RANGES)
+        m_python_ranges.erase(m_python_ranges.begin());
+
+    // Descend from the current file, outermost expansion first.
+    unsigned int node = m_files.empty() ? 0 : m_files.back();
+    for (std::vector<const char*>::const_reverse_iterator
+             iter = m_chain.rbegin(); iter != m_chain.rend(); ++iter)
+    {
+        node = get_child(node, *iter);
+    }
+    m_nodes[node].ns += ns;
+    if (tok.isNot(clang::tok::eof))
+        ++m_nodes[node].tokens;
+}
+
+void Profiler::reset()
+{
+    m_files.clear();
+    m_macro_names.clear();
+    m_python_ranges.clear();
+}
+
+void Profiler::clear()
+{
+    reset();
+    m_nodes.resize(1);
+    m_children.clear();
+}
+
+void Profiler::write_folded(llvm::raw_ostream &out, bool tokens) const
+{
+    std::vector<unsigned int> path;
+    for (unsigned int i = 1; i < m_nodes.size(); ++i)
+    {
+        const uint64_t value = tokens ? m_nodes[i].tokens : m_nodes[i].ns;
+        if (!value)
+            continue;
+        path.clear();
+        for (unsigned int n = i; n != 0; n = m_nodes[n].parent)
+            path.push_back(n);
+        for (size_t j = path.size(); j > 0; --j)
+        {
+            out << m_nodes[path[j-1]].name;
+            if (j > 1)
+                out << ';';
+        }
+        out << ' ' << value << '\n';
+    }
+}
+
+void Profiler::collect_chain(clang::SourceManager const& sm,
+                             clang::SourceLocation loc,
+                             std::vector<const char*> &chain) const
+{
+    // Each expansion's range begins at the name of the macro expanded; for
+    // macro arguments, it begins at the parameter in the macro's body,
+    // which is not a recorded expansion and is skipped.
+    while (loc.isMacroID())
+    {
+        loc = sm.getImmediateExpansionRange(loc).first;
+        llvm::DenseMap<unsigned int, const char*>::const_iterator it =
+            m_macro_names.find(loc.getRawEncoding());
+        if (it != m_macro_names.end())
+            chain.push_back(it->second);
+    }
+}
+
+unsigned int Profiler::get_child(unsigned int parent, llvm::StringRef name)
+{
+    // Children are keyed on the parent's index and the child's name.
+    llvm::SmallString<64> key;
+    key.append(reinterpret_cast<const char*>(&parent),
+               reinterpret_cast<const char*>(&parent) + sizeof(parent));
+    key.append(name.begin(), name.end());
+    llvm::StringMapEntry<unsigned int> &entry =
+        m_children.GetOrCreateValue(key.str(), 0);
+    if (!entry.getValue())
+    {
+        entry.setValue(m_nodes.size());
+        m_nodes.push_back(Node(parent, name));
+    }
+    return entry.getValue();
+}
+
+}}
+
@@ -0,0 +1,74 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "../stats.hpp"
+
+namespace cmonster {
+namespace core {
+
+Stats::Stats(size_t top_n) : m_enabled(false), m_top_n(top_n)
+{
+}
+
+const char* Stats::getPhaseName(Phase phase)
+{
+    switch (phase)
+    {
+        case PRAGMA: return "pragma";
+        case FUNCTION_MACRO: return "function_macro";
+        case INCLUDE_LOCATOR: return "include_locator";
+        case TOKENIZE: return "tokenize";
+        case PARSE: return "parse";
+        case PREAMBLE: return "preamble";
+        default: return "unknown";
+    }
+}
+
+void Stats::record(Phase phase, uint64_t ns, llvm::StringRef name)
+{
+    PhaseStats &stats = m_phases[phase];
+    ++stats.count;
+    stats.total_ns += ns;
+
+    // Keep the slowest entries sorted, slowest first. The list is short, so
+    // a linear insertion is fine; most entries are rejected by the first
+    // comparison once the list is full.
+    std::vector<std::pair<uint64_t, std::string> > &slowest = stats.slowest;
+    if (m_top_n == 0 ||
+        (slowest.size() == m_top_n && ns <= slowest.back().first))
+        return;
+    std::vector<std::pair<uint64_t, std::string> >::iterator iter =
+        slowest.begin();
+    while (iter != slowest.end() && iter->first >= ns)
+        ++iter;
+    slowest.insert(iter, std::make_pair(ns, name.str()));
+    if (slowest.size() > m_top_n)
+        slowest.pop_back();
+}
+
+void Stats::clear()
+{
+    for (size_t i = 0; i < NUM_PHASES; ++i)
+        m_phases[i] = PhaseStats();
+}
+
+}}
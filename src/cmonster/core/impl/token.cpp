@@ -21,38 +21,37 @@ SOFTWARE.
 */
 
 #include "../token.hpp"
+#include "../token_kinds.hpp"
+
+#include <llvm/ADT/SmallString.h>
 
 #include <boost/exception/exception.hpp>
+#include <cassert>
+#include <cstring>
 #include <stdexcept>
 
 namespace cmonster {
 namespace core {
 
-class TokenImpl
+Token::Token() : m_preprocessor(NULL), m_token()
 {
-public:
-    TokenImpl(clang::Preprocessor &pp) : preprocessor(pp), token()
-    {
-        token.startToken();
-    }
-    TokenImpl(clang::Preprocessor &pp, clang::Token const& token_)
-      : preprocessor(pp), token(token_) {}
-    clang::Preprocessor &preprocessor;
-    clang::Token         token;
-};
-
-Token::Token() : m_impl() {}
+    m_token.startToken();
+}
 
-Token::Token(clang::Preprocessor &pp) : m_impl(new TokenImpl(pp)) {}
+Token::Token(clang::Preprocessor &pp) : m_preprocessor(&pp), m_token()
+{
+    m_token.startToken();
+}
 
 Token::Token(clang::Preprocessor &pp, clang::Token const& token)
-  : m_impl(new TokenImpl(pp, token)) {}
+  : m_preprocessor(&pp), m_token(token) {}
 
 Token::Token(clang::Preprocessor &pp, clang::tok::TokenKind kind,
              const char *value, size_t value_len)
-  : m_impl(new TokenImpl(pp))
+  : m_preprocessor(&pp), m_token()
 {
-    clang::Token &token = m_impl->token;
+    clang::Token &token = m_token;
+    token.startToken();
     token.setKind(kind);
     if (token.isAnyIdentifier())
     {
@@ -62,9 +61,8 @@ Token::Token(clang::Preprocessor &pp, clang::tok::TokenKind kind,
                 "Expected a non-empty value for identifier"));
         }
         llvm::StringRef s(value, value_len);
-        token.setIdentifierInfo(
-            m_impl->preprocessor.getIdentifierInfo(s));
-        m_impl->preprocessor.CreateString(value, value_len, token);
+        token.setIdentifierInfo(pp.getIdentifierInfo(s));
+        pp.CreateString(value, value_len, token);
     }
     else
     {
@@ -77,70 +75,84 @@ Token::Token(clang::Preprocessor &pp, clang::tok::TokenKind kind,
             }
             else
             {
-                value = clang::tok::getTokenSimpleSpelling(kind);
+                value = getKindSpelling(kind);
                 if (value)
                     value_len = strlen(value);
             }
         }
+        // Keywords carry their identifier, as they do when lexed.
+        if (value && value_len && isKindIn(kind, CATEGORY_KEYWORD))
+        {
+            token.setIdentifierInfo(pp.getIdentifierInfo(
+                llvm::StringRef(value, value_len)));
+        }
         // Must use this, as it stores the value in a "scratch buffer" for
         // later reference.
         pp.CreateString(value, value_len, token);
     }
 }
 
-Token::Token(Token const& rhs) : m_impl(new TokenImpl(*rhs.m_impl))
-{
-}
-
-Token& Token::operator=(Token const& rhs)
-{
-    // XXX can we do some kind of COW here?
-    if (rhs.m_impl)
-        m_impl.reset(new TokenImpl(*rhs.m_impl));
-    else
-        m_impl.reset();
-    return *this;
-}
-
 void Token::setClangToken(clang::Token const& token)
 {
-    m_impl->token = token;
+    m_token = token;
 }
 
 clang::Token& Token::getClangToken()
 {
-    return m_impl->token;
+    return m_token;
 }
 
 const clang::Token& Token::getClangToken() const
 {
-    return m_impl->token;
+    return m_token;
+}
+
+clang::Preprocessor& Token::getPreprocessor() const
+{
+    assert(m_preprocessor && "Token has no preprocessor");
+    return *m_preprocessor;
 }
 
 const char* Token::getName() const
 {
-    return m_impl->token.getName();
+    return m_token.getName();
 }
 
-std::ostream& operator<<(std::ostream &out, Token const& token)
+llvm::StringRef
+Token::getSpelling(llvm::SmallVectorImpl<char> &buffer, bool *invalid) const
 {
-    clang::Token const& tok = token.m_impl->token;
-    if (tok.isLiteral())
-    {
-        out << std::string(tok.getLiteralData(), tok.getLength());
-    }
-    else if (tok.isAnyIdentifier())
+    if (invalid)
+        *invalid = false;
+    if (m_token.isLiteral() && m_token.getLiteralData())
     {
-        clang::IdentifierInfo *i = tok.getIdentifierInfo();
-        out << std::string(i->getNameStart(), i->getLength());
+        return llvm::StringRef(m_token.getLiteralData(), m_token.getLength());
     }
-    else
+    else if (m_token.isAnyIdentifier() && m_token.getIdentifierInfo())
     {
-        bool invalid = false;
-        out << token.m_impl->preprocessor.getSpelling(tok, &invalid);
-        if (invalid)
-            out << "<invalid>";
+        clang::IdentifierInfo *i = m_token.getIdentifierInfo();
+        return llvm::StringRef(i->getNameStart(), i->getLength());
     }
+    return getPreprocessor().getSpelling(m_token, buffer, invalid);
+}
+
+llvm::raw_ostream& operator<<(llvm::raw_ostream &out, Token const& token)
+{
+    llvm::SmallString<64> buffer;
+    bool invalid = false;
+    out << token.getSpelling(buffer, &invalid);
+    if (invalid)
+        out << "<invalid>";
+    return out;
+}
+
+std::ostream& operator<<(std::ostream &out, Token const& token)
+{
+    llvm::SmallString<64> buffer;
+    bool invalid = false;
+    llvm::StringRef spelling = token.getSpelling(buffer, &invalid);
+    out.write(spelling.data(), spelling.size());
+    if (invalid)
+        out << "<invalid>";
     return out;
 }
 
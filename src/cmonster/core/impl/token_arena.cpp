@@ -0,0 +1,56 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "token_arena.hpp"
+
+namespace cmonster {
+namespace core {
+namespace impl {
+
+TokenArena::TokenArena() : m_allocator() {}
+
+clang::Token* TokenArena::allocate(size_t n)
+{
+    return m_allocator.Allocate<clang::Token>(n);
+}
+
+clang::Token*
+TokenArena::copy(std::vector<cmonster::core::Token> const& tokens)
+{
+    clang::Token *result = allocate(tokens.size());
+    for (size_t i = 0; i < tokens.size(); ++i)
+        result[i] = tokens[i].getClangToken();
+    return result;
+}
+
+void TokenArena::reset()
+{
+    m_allocator.Reset();
+}
+
+size_t TokenArena::getTotalMemory() const
+{
+    return m_allocator.getTotalMemory();
+}
+
+}}}
+
@@ -0,0 +1,86 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _CMONSTER_CORE_IMPL_TOKENARENA_HPP
+#define _CMONSTER_CORE_IMPL_TOKENARENA_HPP
+
+#include "../token.hpp"
+
+#include <clang/Lex/Token.h>
+#include <llvm/Support/Allocator.h>
+
+#include <vector>
+
+namespace cmonster {
+namespace core {
+namespace impl {
+
+/**
+ * A bump allocator for token arrays that are produced during a single
+ * preprocessing run, such as the results of Python macros that are entered
+ * back into the preprocessor.
+ *
+ * Arrays allocated from the arena are owned by the arena, so they must be
+ * entered into Clang with OwnsTokens=false. Nothing is freed until the arena
+ * is reset, which must only happen once the main file has been finished.
+ *
+ * Only the arrays entered into Clang by DynamicPragmaHandler come from the
+ * arena: the results of function macros, and the eof token entered on
+ * error. In streaming mode, results are allocated with new[] instead, so
+ * that Clang frees them once lexed. The std::vector<Token> results of
+ * FunctionMacro and PreprocessorImpl::tokenize, and the arguments saved by
+ * TokenSaverPragmaHandler, are still allocated on the heap.
+ */
+class TokenArena
+{
+public:
+    TokenArena();
+
+    /**
+     * Allocate an uninitialised array of "n" tokens.
+     */
+    clang::Token* allocate(size_t n);
+
+    /**
+     * Allocate an array of tokens, and copy the Clang tokens from "tokens"
+     * into it.
+     */
+    clang::Token* copy(std::vector<cmonster::core::Token> const& tokens);
+
+    /**
+     * Release all allocated token arrays.
+     */
+    void reset();
+
+    /**
+     * Get the total memory allocated by the arena, in bytes.
+     */
+    size_t getTotalMemory() const;
+
+private:
+    llvm::BumpPtrAllocator m_allocator;
+};
+
+}}}
+
+#endif
+
@@ -0,0 +1,108 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "../token_batch.hpp"
+
+#include <llvm/ADT/SmallString.h>
+
+#include <algorithm>
+#include <cassert>
+
+namespace cmonster {
+namespace core {
+
+TokenBatch::TokenBatch()
+  : m_preprocessor(NULL), m_records(), m_tokens(), m_spellings() {}
+
+void TokenBatch::clear()
+{
+    m_records.clear();
+    m_tokens.clear();
+    m_spellings.clear();
+}
+
+void TokenBatch::append(clang::Preprocessor &pp, clang::Token const& token)
+{
+    m_preprocessor = &pp;
+
+    llvm::StringRef spelling;
+    llvm::SmallString<64> buffer;
+    if (token.isAnyIdentifier() && token.getIdentifierInfo())
+    {
+        spelling = token.getIdentifierInfo()->getName();
+    }
+    else
+    {
+        bool invalid = false;
+        spelling = pp.getSpelling(token, buffer, &invalid);
+        if (invalid)
+            spelling = llvm::StringRef();
+    }
+
+    PackedToken record;
+    record.kind = static_cast<uint16_t>(token.getKind());
+    record.flags = static_cast<uint16_t>(token.getFlags());
+    record.location = token.getLocation().getRawEncoding();
+    record.spelling_offset = static_cast<uint32_t>(m_spellings.size());
+    record.spelling_length = static_cast<uint32_t>(spelling.size());
+    m_spellings.append(spelling.data(), spelling.size());
+    m_records.push_back(record);
+    m_tokens.push_back(token);
+}
+
+void TokenBatch::append(TokenBatch const& other, size_t i)
+{
+    assert(i < other.m_records.size());
+    m_preprocessor = other.m_preprocessor;
+
+    llvm::StringRef spelling = other.getSpelling(i);
+    PackedToken record = other.m_records[i];
+    record.spelling_offset = static_cast<uint32_t>(m_spellings.size());
+    m_spellings.append(spelling.data(), spelling.size());
+    m_records.push_back(record);
+    m_tokens.push_back(other.m_tokens[i]);
+}
+
+void TokenBatch::swap(TokenBatch &other)
+{
+    std::swap(m_preprocessor, other.m_preprocessor);
+    m_records.swap(other.m_records);
+    m_tokens.swap(other.m_tokens);
+    m_spellings.swap(other.m_spellings);
+}
+
+llvm::StringRef TokenBatch::getSpelling(size_t i) const
+{
+    assert(i < m_records.size());
+    PackedToken const& record = m_records[i];
+    return llvm::StringRef(m_spellings.data() + record.spelling_offset,
+                           record.spelling_length);
+}
+
+Token TokenBatch::getToken(size_t i) const
+{
+    assert(i < m_tokens.size() && m_preprocessor);
+    return Token(*m_preprocessor, m_tokens[i]);
+}
+
+}}
+
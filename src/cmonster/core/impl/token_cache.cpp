@@ -0,0 +1,454 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "../token_cache.hpp"
+
+#include <clang/Basic/SourceManager.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include <boost/exception/exception.hpp>
+
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+using namespace cmonster::core::token_cache;
+
+// Map a file into memory, read-only. Empty files are "mapped" to NULL.
+bool map_file(std::string const& path, void *&data, size_t &size)
+{
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+    {
+        close(fd);
+        return false;
+    }
+    data = NULL;
+    size = st.st_size;
+    if (size > 0)
+    {
+        data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+            data = NULL;
+    }
+    close(fd);
+    return size == 0 || data;
+}
+
+void unmap_file(void *data, size_t size)
+{
+    if (data)
+        munmap(data, size);
+}
+
+// Unmaps a file for the lifetime of the object.
+struct ScopedMapping
+{
+    ScopedMapping() : data(NULL), size(0) {}
+    ~ScopedMapping() {unmap_file(data, size);}
+    void   *data;
+    size_t  size;
+};
+
+// The sections of a mapped token cache file.
+struct Layout
+{
+    const Header       *header;
+    const FileRecord   *files;
+    const StringRecord *strings;
+    const TokenRecord  *tokens;
+    const char         *blob;
+};
+
+// Locate and validate the sections of a mapped token cache file.
+bool get_layout(const void *data, size_t size, Layout &layout)
+{
+    if (!data || size < sizeof(Header))
+        return false;
+    const char *start = static_cast<const char*>(data);
+    const Header *header = reinterpret_cast<const Header*>(start);
+    if (header->magic != MAGIC || header->version != VERSION)
+        return false;
+
+    const uint64_t files_size =
+        static_cast<uint64_t>(header->num_files) * sizeof(FileRecord);
+    const uint64_t strings_size =
+        static_cast<uint64_t>(header->num_strings) * sizeof(StringRecord);
+    const uint64_t tokens_size =
+        static_cast<uint64_t>(header->num_tokens) * sizeof(TokenRecord);
+    if (sizeof(Header) + files_size + strings_size + tokens_size +
+        header->blob_size != size)
+        return false;
+
+    layout.header = header;
+    layout.files = reinterpret_cast<const FileRecord*>(
+        start + sizeof(Header));
+    layout.strings = reinterpret_cast<const StringRecord*>(
+        start + sizeof(Header) + files_size);
+    layout.tokens = reinterpret_cast<const TokenRecord*>(
+        start + sizeof(Header) + files_size + strings_size);
+    layout.blob = start + (size - header->blob_size);
+
+    // Check that all strings lie within the blob, so they need not be
+    // checked as they are used.
+    for (uint32_t i = 0; i < header->num_files; ++i)
+    {
+        const FileRecord &file = layout.files[i];
+        if (static_cast<uint64_t>(file.name) + file.length > header->blob_size)
+            return false;
+    }
+    for (uint32_t i = 0; i < header->num_strings; ++i)
+    {
+        const StringRecord &s = layout.strings[i];
+        if (static_cast<uint64_t>(s.offset) + s.length > header->blob_size)
+            return false;
+    }
+    return true;
+}
+
+void write_all(std::FILE *file, const void *data, size_t size, bool &ok)
+{
+    if (ok && size > 0)
+        ok = std::fwrite(data, 1, size, file) == size;
+}
+
+} // Anonymous namespace.
+
+namespace cmonster {
+namespace core {
+
+///////////////////////////////////////////////////////////////////////////////
+
+namespace token_cache {
+
+uint64_t hash_bytes(const char *data, size_t len, uint64_t hash)
+{
+    for (size_t i = 0; i < len; ++i)
+    {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+bool is_valid(std::string const& path, uint64_t config_hash)
+{
+    ScopedMapping cache;
+    Layout layout;
+    if (!map_file(path, cache.data, cache.size) ||
+        !get_layout(cache.data, cache.size, layout) ||
+        layout.header->config_hash != config_hash)
+        return false;
+
+    // Check that the contents of each input file are unchanged. The sizes
+    // are compared first, which avoids rehashing most modified files.
+    for (uint32_t i = 0; i < layout.header->num_files; ++i)
+    {
+        const FileRecord &record = layout.files[i];
+        const std::string filename(layout.blob + record.name, record.length);
+        ScopedMapping file;
+        if (!map_file(filename, file.data, file.size) ||
+            file.size != record.size ||
+            hash_bytes(static_cast<const char*>(file.data), file.size) !=
+                record.content_hash)
+            return false;
+    }
+    return true;
+}
+
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+TokenCacheWriter::TokenCacheWriter(clang::Preprocessor &pp,
+                                   uint64_t config_hash)
+  : m_pp(pp), m_config_hash(config_hash), m_files(), m_file_indices(),
+    m_strings(), m_string_indices(), m_blob(), m_tokens() {}
+
+void TokenCacheWriter::add_file(const clang::FileEntry *file)
+{
+    if (file)
+        get_file_index(file);
+}
+
+uint32_t TokenCacheWriter::get_file_index(const clang::FileEntry *file)
+{
+    std::map<const clang::FileEntry*, uint32_t>::const_iterator iter =
+        m_file_indices.find(file);
+    if (iter != m_file_indices.end())
+        return iter->second;
+    const uint32_t index = m_files.size();
+    m_files.push_back(file);
+    m_file_indices[file] = index;
+    return index;
+}
+
+uint32_t TokenCacheWriter::get_string_index(llvm::StringRef s)
+{
+    llvm::StringMapEntry<uint32_t> &entry =
+        m_string_indices.GetOrCreateValue(s, m_strings.size());
+    if (entry.getValue() == m_strings.size())
+    {
+        token_cache::StringRecord record;
+        record.offset = m_blob.size();
+        record.length = s.size();
+        m_strings.push_back(record);
+        m_blob.append(s.data(), s.size());
+    }
+    return entry.getValue();
+}
+
+void TokenCacheWriter::append(clang::Token const& token)
+{
+    token_cache::TokenRecord record;
+    record.kind = token.getKind();
+    record.flags = 0;
+    if (token.isAtStartOfLine())
+        record.flags |= clang::Token::StartOfLine;
+    if (token.hasLeadingSpace())
+        record.flags |= clang::Token::LeadingSpace;
+    if (token.isExpandDisabled())
+        record.flags |= clang::Token::DisableExpand;
+    if (!token.isLiteral() && token.getIdentifierInfo())
+        record.flags |= token_cache::HAS_IDENTIFIER;
+
+    // Store the cleaned spelling, so the reader never needs to clean it.
+    llvm::SmallString<128> buffer;
+    record.spelling = get_string_index(m_pp.getSpelling(token, buffer));
+
+    // Record the expansion location of the token.
+    clang::SourceManager &sm = m_pp.getSourceManager();
+    const std::pair<clang::FileID, unsigned> decomposed =
+        sm.getDecomposedLoc(sm.getExpansionLoc(token.getLocation()));
+    const clang::FileEntry *file = decomposed.first.isInvalid() ? 0 :
+        sm.getFileEntryForID(decomposed.first);
+    if (file)
+    {
+        record.file = get_file_index(file);
+        record.line = sm.getLineNumber(decomposed.first, decomposed.second);
+        record.column =
+            sm.getColumnNumber(decomposed.first, decomposed.second);
+    }
+    else
+    {
+        record.file = token_cache::NO_FILE;
+        record.line = 0;
+        record.column = 0;
+    }
+    m_tokens.push_back(record);
+}
+
+void TokenCacheWriter::write(std::string const& path) const
+{
+    // Hash the contents of the input files as they were preprocessed,
+    // and append their names to the blob.
+    clang::SourceManager &sm = m_pp.getSourceManager();
+    std::string blob(m_blob);
+    std::vector<token_cache::FileRecord> files(m_files.size());
+    for (size_t i = 0; i < m_files.size(); ++i)
+    {
+        bool invalid = false;
+        const llvm::MemoryBuffer *buffer =
+            sm.getMemoryBufferForFile(m_files[i], &invalid);
+        const char *name = m_files[i]->getName();
+        if (!buffer || invalid)
+        {
+            boost::throw_exception(std::runtime_error(
+                std::string("Failed to read file: ") + name));
+        }
+        files[i].content_hash = token_cache::hash_bytes(
+            buffer->getBufferStart(), buffer->getBufferSize());
+        files[i].size = buffer->getBufferSize();
+        files[i].name = blob.size();
+        files[i].length = std::strlen(name);
+        blob.append(name, files[i].length);
+    }
+    if (blob.size() > 0xffffffffULL)
+    {
+        boost::throw_exception(std::runtime_error(
+            "Token cache is too large"));
+    }
+
+    token_cache::Header header;
+    header.magic = token_cache::MAGIC;
+    header.version = token_cache::VERSION;
+    header.num_files = files.size();
+    header.num_strings = m_strings.size();
+    header.num_tokens = m_tokens.size();
+    header.blob_size = blob.size();
+    header.config_hash = m_config_hash;
+
+    // Write to a temporary file, and rename it into place.
+    char suffix[32];
+    std::snprintf(suffix, sizeof(suffix), ".%ld.tmp", (long)getpid());
+    const std::string temp_path = path + suffix;
+    std::FILE *file = std::fopen(temp_path.c_str(), "wb");
+    if (!file)
+    {
+        boost::throw_exception(std::runtime_error(
+            "Failed to open file for writing: " + temp_path));
+    }
+    bool ok = true;
+    write_all(file, &header, sizeof(header), ok);
+    if (!files.empty())
+        write_all(file, &files[0], files.size() * sizeof(files[0]), ok);
+    if (!m_strings.empty())
+    {
+        write_all(file, &m_strings[0],
+                  m_strings.size() * sizeof(m_strings[0]), ok);
+    }
+    if (!m_tokens.empty())
+    {
+        write_all(file, &m_tokens[0],
+                  m_tokens.size() * sizeof(m_tokens[0]), ok);
+    }
+    write_all(file, blob.data(), blob.size(), ok);
+    ok = std::fclose(file) == 0 && ok;
+    if (!ok || std::rename(temp_path.c_str(), path.c_str()) != 0)
+    {
+        std::remove(temp_path.c_str());
+        boost::throw_exception(std::runtime_error(
+            "Failed to write token cache: " + path));
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+CachedTokenIterator::CachedTokenIterator(clang::Preprocessor &pp,
+                                         std::string const& path)
+  : m_pp(pp), m_data(NULL), m_size(0), m_header(NULL), m_files(NULL),
+    m_strings(NULL), m_records(NULL), m_blob(NULL), m_index(0),
+    m_spellings(), m_current(pp)
+{
+    Layout layout;
+    if (!map_file(path, m_data, m_size))
+    {
+        boost::throw_exception(std::runtime_error(
+            "Failed to read token cache: " + path));
+    }
+    if (!get_layout(m_data, m_size, layout))
+    {
+        unmap_file(m_data, m_size);
+        boost::throw_exception(std::runtime_error(
+            "Invalid token cache: " + path));
+    }
+    m_header = layout.header;
+    m_files = layout.files;
+    m_strings = layout.strings;
+    m_records = layout.tokens;
+    m_blob = layout.blob;
+
+    // Tokens are created lazily for each distinct spelling. An invalid
+    // location marks a spelling that has not yet been used.
+    clang::Token unused;
+    unused.startToken();
+    m_spellings.resize(m_header->num_strings, unused);
+}
+
+CachedTokenIterator::~CachedTokenIterator()
+{
+    unmap_file(m_data, m_size);
+}
+
+bool CachedTokenIterator::has_next() const throw()
+{
+    return m_index < m_header->num_tokens;
+}
+
+Token& CachedTokenIterator::next()
+{
+    if (!has_next())
+        boost::throw_exception(std::out_of_range("No more tokens"));
+    const token_cache::TokenRecord &record = m_records[m_index++];
+    if (record.spelling >= m_header->num_strings ||
+        record.kind >= clang::tok::NUM_TOKENS ||
+        (record.file != token_cache::NO_FILE &&
+         record.file >= m_header->num_files))
+    {
+        boost::throw_exception(std::runtime_error("Corrupt token cache"));
+    }
+
+    // Copy the spelling into the scratch buffer the first time it is used
+    // (or used with a different kind). Tokens with the same spelling share
+    // the scratch buffer copy.
+    const clang::tok::TokenKind kind =
+        static_cast<clang::tok::TokenKind>(record.kind);
+    clang::Token &cached = m_spellings[record.spelling];
+    if (cached.getLocation().isInvalid() || cached.isNot(kind))
+    {
+        const llvm::StringRef spelling = getString(record.spelling);
+        cached.startToken();
+        cached.setKind(kind);
+        m_pp.CreateString(spelling.data(), spelling.size(), cached);
+        if (record.flags & token_cache::HAS_IDENTIFIER)
+            cached.setIdentifierInfo(m_pp.getIdentifierInfo(spelling));
+    }
+
+    clang::Token token = cached;
+    if (record.flags & clang::Token::StartOfLine)
+        token.setFlag(clang::Token::StartOfLine);
+    if (record.flags & clang::Token::LeadingSpace)
+        token.setFlag(clang::Token::LeadingSpace);
+    if (record.flags & clang::Token::DisableExpand)
+        token.setFlag(clang::Token::DisableExpand);
+    m_current.setClangToken(token);
+    return m_current;
+}
+
+llvm::StringRef CachedTokenIterator::getString(uint32_t index) const
+{
+    const token_cache::StringRecord &s = m_strings[index];
+    return llvm::StringRef(m_blob + s.offset, s.length);
+}
+
+llvm::StringRef CachedTokenIterator::getFilename() const
+{
+    if (m_index == 0)
+        return llvm::StringRef();
+    const uint32_t file = m_records[m_index-1].file;
+    if (file == token_cache::NO_FILE)
+        return llvm::StringRef();
+    return llvm::StringRef(m_blob + m_files[file].name, m_files[file].length);
+}
+
+unsigned CachedTokenIterator::getLine() const
+{
+    return m_index ? m_records[m_index-1].line : 0;
+}
+
+unsigned CachedTokenIterator::getColumn() const
+{
+    return m_index ? m_records[m_index-1].column : 0;
+}
+
+}}
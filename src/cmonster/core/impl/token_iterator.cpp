@@ -21,6 +21,31 @@ SOFTWARE.
 */
 
 #include "../token_iterator.hpp"
+#include "../token_batch.hpp"
+
+#include <boost/exception/exception.hpp>
+
+#include <algorithm>
+#include <ctime>
+#include <sched.h>
+#include <stdexcept>
+
+namespace {
+// Give the other side of a pipeline a chance to run. After a while, sleep
+// briefly instead, so that an idle side doesn't occupy a core.
+void backoff(unsigned int &spins)
+{
+    if (++spins < 64)
+    {
+        sched_yield();
+    }
+    else
+    {
+        struct timespec delay = {0, 50000};
+        nanosleep(&delay, NULL);
+    }
+}
+}
 
 namespace cmonster {
 namespace core {
@@ -29,5 +54,221 @@ TokenIterator::~TokenIterator()
 {
 }
 
+size_t TokenIterator::next_batch(TokenBatch &batch, size_t n)
+{
+    batch.clear();
+    for (size_t i = 0; i < n && has_next(); ++i)
+    {
+        Token &token = next();
+        batch.append(token.getPreprocessor(), token.getClangToken());
+    }
+    return batch.size();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+FilteredTokenIterator::FilteredTokenIterator(
+    TokenIterator *iterator, TokenPredicatePtr const& predicate)
+  : m_iterator(iterator), m_predicate(predicate), m_current(), m_next(),
+    m_has_next(false)
+{
+    advance();
+}
+
+void FilteredTokenIterator::advance()
+{
+    while (m_iterator->has_next())
+    {
+        Token &token = m_iterator->next();
+        if ((*m_predicate)(token))
+        {
+            m_next = token;
+            m_has_next = true;
+            return;
+        }
+    }
+    m_has_next = false;
+}
+
+bool FilteredTokenIterator::has_next() const throw()
+{
+    return m_has_next;
+}
+
+Token& FilteredTokenIterator::next()
+{
+    if (!m_has_next)
+        boost::throw_exception(std::out_of_range("No more tokens"));
+    m_current = m_next;
+    advance();
+    return m_current;
+}
+
+size_t FilteredTokenIterator::next_batch(TokenBatch &batch, size_t n)
+{
+    batch.clear();
+    while (batch.size() < n && m_has_next)
+    {
+        batch.append(m_next.getPreprocessor(), m_next.getClangToken());
+        advance();
+    }
+    return batch.size();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+PipelinedTokenIterator::PipelinedTokenIterator(
+    TokenIterator *iterator, size_t batch_size, size_t capacity)
+  : m_iterator(iterator), m_batch_size(std::max<size_t>(batch_size, 1)),
+    m_ring(std::max<size_t>(capacity, 1)), m_head(0), m_tail(0),
+    m_finished(false), m_stop(false), m_exception(), m_rethrown(false),
+    m_holding(false), m_position(0), m_started(false), m_thread(),
+    m_current()
+{
+    m_started = pthread_create(
+        &m_thread, NULL, &PipelinedTokenIterator::run, this) == 0;
+}
+
+PipelinedTokenIterator::~PipelinedTokenIterator()
+{
+    m_stop = true;
+    if (m_started)
+        pthread_join(m_thread, NULL);
+}
+
+void* PipelinedTokenIterator::run(void *self_)
+{
+    PipelinedTokenIterator &self =
+        *static_cast<PipelinedTokenIterator*>(self_);
+    unsigned int spins = 0;
+    while (!self.m_stop)
+    {
+        if (self.m_tail - self.m_head >= self.m_ring.size())
+        {
+            backoff(spins);
+            continue;
+        }
+        spins = 0;
+        if (!self.produce())
+            break;
+    }
+    return NULL;
+}
+
+bool PipelinedTokenIterator::produce()
+{
+    TokenBatch &slot = m_ring[m_tail % m_ring.size()];
+    size_t n = 0;
+    try
+    {
+        n = m_iterator->next_batch(slot, m_batch_size);
+    }
+    catch (...)
+    {
+        m_exception = boost::current_exception();
+        n = 0;
+    }
+
+    // Publish the batch's contents before the new tail, and the tail (and
+    // any exception) before the "finished" flag.
+    __sync_synchronize();
+    if (n > 0)
+    {
+        m_tail = m_tail + 1;
+        return true;
+    }
+    __sync_synchronize();
+    m_finished = true;
+    return false;
+}
+
+bool PipelinedTokenIterator::wait() const throw()
+{
+    unsigned int spins = 0;
+    for (;;)
+    {
+        if (m_holding)
+        {
+            if (m_position < m_ring[m_head % m_ring.size()].size())
+                return true;
+
+            // Hand the exhausted batch back to the producer.
+            m_holding = false;
+            __sync_synchronize();
+            m_head = m_head + 1;
+        }
+
+        if (m_head != m_tail)
+        {
+            // Make sure we see the contents of the batch published before
+            // the tail was moved.
+            __sync_synchronize();
+            m_holding = true;
+            m_position = 0;
+        }
+        else if (m_finished)
+        {
+            __sync_synchronize();
+            if (m_head == m_tail)
+                return false;
+        }
+        else if (!m_started)
+        {
+            const_cast<PipelinedTokenIterator*>(this)->produce();
+        }
+        else
+        {
+            backoff(spins);
+        }
+    }
+}
+
+void PipelinedTokenIterator::rethrow()
+{
+    if (m_exception && !m_rethrown)
+    {
+        m_rethrown = true;
+        boost::rethrow_exception(m_exception);
+    }
+}
+
+bool PipelinedTokenIterator::has_next() const throw()
+{
+    return wait() || (m_exception && !m_rethrown);
+}
+
+Token& PipelinedTokenIterator::next()
+{
+    if (!wait())
+    {
+        rethrow();
+        boost::throw_exception(std::out_of_range("No more tokens"));
+    }
+    m_current = m_ring[m_head % m_ring.size()].getToken(m_position++);
+    return m_current;
+}
+
+size_t PipelinedTokenIterator::next_batch(TokenBatch &batch, size_t n)
+{
+    batch.clear();
+    while (batch.size() < n && wait())
+    {
+        TokenBatch &slot = m_ring[m_head % m_ring.size()];
+        if (m_position == 0 && slot.size() <= n - batch.size() &&
+            batch.empty())
+        {
+            // Take the whole batch, leaving our old storage to be refilled
+            // by the producer.
+            batch.swap(slot);
+            slot.clear();
+            break;
+        }
+        batch.append(slot, m_position++);
+    }
+    if (batch.empty())
+        rethrow();
+    return batch.size();
+}
+
 }}
 
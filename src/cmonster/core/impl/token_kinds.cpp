@@ -0,0 +1,68 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "../token_kinds.hpp"
+
+// A literal is one of the plain tokens (those defined with "TOK") below.
+#define CMONSTER_IS_LITERAL(X) (                                          \
+    clang::tok::X == clang::tok::numeric_constant ||                      \
+    clang::tok::X == clang::tok::char_constant ||                         \
+    clang::tok::X == clang::tok::wide_char_constant ||                    \
+    clang::tok::X == clang::tok::utf16_char_constant ||                   \
+    clang::tok::X == clang::tok::utf32_char_constant ||                   \
+    clang::tok::X == clang::tok::string_literal ||                        \
+    clang::tok::X == clang::tok::wide_string_literal ||                   \
+    clang::tok::X == clang::tok::angle_string_literal ||                  \
+    clang::tok::X == clang::tok::utf8_string_literal ||                   \
+    clang::tok::X == clang::tok::utf16_string_literal ||                  \
+    clang::tok::X == clang::tok::utf32_string_literal)
+
+#define CMONSTER_IS_IDENTIFIER(X) (                                       \
+    clang::tok::X == clang::tok::identifier ||                            \
+    clang::tok::X == clang::tok::raw_identifier)
+
+namespace cmonster {
+namespace core {
+namespace impl {
+
+const unsigned char token_kind_categories[clang::tok::NUM_TOKENS] =
+{
+#define TOK(X)                                                            \
+    CMONSTER_IS_IDENTIFIER(X) ? CATEGORY_IDENTIFIER :                     \
+    CMONSTER_IS_LITERAL(X) ? CATEGORY_LITERAL : 0,
+#define PUNCTUATOR(X, Y) CATEGORY_PUNCTUATOR,
+#define KEYWORD(X, Y) CATEGORY_KEYWORD,
+#define ANNOTATION(X) CATEGORY_ANNOTATION,
+#include <clang/Basic/TokenKinds.def>
+};
+
+const char* const token_kind_spellings[clang::tok::NUM_TOKENS] =
+{
+#define TOK(X) 0,
+#define PUNCTUATOR(X, Y) Y,
+#define KEYWORD(X, Y) #X,
+#define ANNOTATION(X) 0,
+#include <clang/Basic/TokenKinds.def>
+};
+
+}}}
+
@@ -22,6 +22,13 @@ SOFTWARE.
 
 #include "../token_predicate.hpp"
 
+#include <clang/Basic/SourceManager.h>
+#include <llvm/ADT/SmallString.h>
+
+#include <boost/exception/exception.hpp>
+
+#include <stdexcept>
+
 namespace cmonster {
 namespace core {
 
@@ -29,5 +36,115 @@ TokenPredicate::~TokenPredicate()
 {
 }
 
+///////////////////////////////////////////////////////////////////////////////
+
+KindPredicate::KindPredicate(
+    std::vector<clang::tok::TokenKind> const& kinds)
+  : m_kinds(clang::tok::NUM_TOKENS, false)
+{
+    for (std::vector<clang::tok::TokenKind>::const_iterator
+             iter = kinds.begin(); iter != kinds.end(); ++iter)
+    {
+        if (*iter < 0 || *iter >= clang::tok::NUM_TOKENS)
+        {
+            boost::throw_exception(
+                std::invalid_argument("Invalid token kind"));
+        }
+        m_kinds[*iter] = true;
+    }
+}
+
+bool KindPredicate::operator()(Token const& token) const
+{
+    return m_kinds[token.getClangToken().getKind()];
+}
+
+IdentifierPredicate::IdentifierPredicate(
+    std::vector<std::string> const& names) : m_names()
+{
+    for (std::vector<std::string>::const_iterator iter = names.begin();
+         iter != names.end(); ++iter)
+        m_names.insert(*iter);
+}
+
+bool IdentifierPredicate::operator()(Token const& token) const
+{
+    clang::Token const& tok = token.getClangToken();
+    if (tok.isLiteral() || tok.is(clang::tok::raw_identifier))
+        return false;
+    const clang::IdentifierInfo *info = tok.getIdentifierInfo();
+    return info && m_names.count(info->getName());
+}
+
+SpellingPredicate::SpellingPredicate(std::string const& pattern)
+  : m_regex(pattern)
+{
+    std::string error;
+    if (!m_regex.isValid(error))
+    {
+        boost::throw_exception(std::invalid_argument(
+            "Invalid regular expression: " + error));
+    }
+}
+
+bool SpellingPredicate::operator()(Token const& token) const
+{
+    llvm::SmallString<64> buffer;
+    return m_regex.match(token.getPreprocessor().getSpelling(
+        token.getClangToken(), buffer));
+}
+
+bool MainFilePredicate::operator()(Token const& token) const
+{
+    clang::SourceManager const& sm =
+        token.getPreprocessor().getSourceManager();
+    clang::SourceLocation loc = token.getClangToken().getLocation();
+    return loc.isValid() &&
+        sm.getFileID(sm.getExpansionLoc(loc)) == sm.getMainFileID();
+}
+
+bool MacroExpansionPredicate::operator()(Token const& token) const
+{
+    return token.getClangToken().getLocation().isMacroID();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+AndPredicate::AndPredicate(std::vector<TokenPredicatePtr> const& operands)
+  : m_operands(operands) {}
+
+bool AndPredicate::operator()(Token const& token) const
+{
+    for (std::vector<TokenPredicatePtr>::const_iterator
+             iter = m_operands.begin(); iter != m_operands.end(); ++iter)
+    {
+        if (!(**iter)(token))
+            return false;
+    }
+    return true;
+}
+
+OrPredicate::OrPredicate(std::vector<TokenPredicatePtr> const& operands)
+  : m_operands(operands) {}
+
+bool OrPredicate::operator()(Token const& token) const
+{
+    for (std::vector<TokenPredicatePtr>::const_iterator
+             iter = m_operands.begin(); iter != m_operands.end(); ++iter)
+    {
+        if ((**iter)(token))
+            return true;
+    }
+    return false;
+}
+
+NotPredicate::NotPredicate(TokenPredicatePtr const& operand)
+  : m_operand(operand) {}
+
+bool NotPredicate::operator()(Token const& token) const
+{
+    return !(*m_operand)(token);
+}
+
 }}
 
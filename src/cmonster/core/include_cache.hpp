@@ -0,0 +1,123 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _CMONSTER_CORE_INCLUDE_CACHE_HPP
+#define _CMONSTER_CORE_INCLUDE_CACHE_HPP
+
+#include <map>
+#include <string>
+
+#include <pthread.h>
+
+namespace cmonster {
+namespace core {
+
+/**
+ * A cache of external include resolutions, mapping an #include (its filename,
+ * whether it was angled, and the directory of the including file) to the
+ * absolute path returned by an IncludeLocator. Failed lookups are also
+ * recorded, so they are not retried.
+ *
+ * An IncludeCache may be shared between preprocessors, including those used
+ * concurrently from multiple threads, and may be persisted to a file.
+ */
+class IncludeCache
+{
+public:
+    IncludeCache();
+    ~IncludeCache();
+
+    /**
+     * Look up a cached include resolution.
+     *
+     * @param filename The include filename, without delimiters.
+     * @param angled True if the include used angle brackets.
+     * @param includer_dir The directory of the including file.
+     * @param absolute_path Set to the cached path, if the include was
+     *                      resolved successfully.
+     * @param located Set to true if the include was resolved successfully,
+     *                and false if resolution previously failed.
+     * @return True if there was a cached entry for the include.
+     */
+    bool lookup(std::string const& filename, bool angled,
+                std::string const& includer_dir,
+                std::string &absolute_path, bool &located) const;
+
+    /**
+     * Record an include resolution. An empty "absolute_path" records a
+     * failed resolution.
+     */
+    void insert(std::string const& filename, bool angled,
+                std::string const& includer_dir,
+                std::string const& absolute_path);
+
+    /**
+     * Remove all entries from the cache.
+     */
+    void clear();
+
+    /**
+     * Get the number of cached entries.
+     */
+    size_t size() const;
+
+    /**
+     * Load entries from a file previously written by "save". The file is
+     * ignored if it was written against a different version of "compiler",
+     * as determined by the compiler binary's modification time.
+     *
+     * @param path The path of the cache file.
+     * @param compiler The path of the compiler binary that the cached
+     *                 resolutions depend upon.
+     * @return True if the file was loaded, else false.
+     */
+    bool load(std::string const& path, std::string const& compiler);
+
+    /**
+     * Save the cache entries to a file, stamped with the modification time
+     * of the "compiler" binary.
+     *
+     * @return True if the file was written successfully, else false.
+     */
+    bool save(std::string const& path, std::string const& compiler) const;
+
+private:
+    // Non-copyable.
+    IncludeCache(IncludeCache const&);
+    IncludeCache& operator=(IncludeCache const&);
+
+    struct Key
+    {
+        std::string filename;
+        bool        angled;
+        std::string includer_dir;
+        bool operator<(Key const& rhs) const;
+    };
+    typedef std::map<Key, std::string> EntryMap;
+
+    EntryMap                m_entries;
+    mutable pthread_mutex_t m_mutex;
+};
+
+}}
+
+#endif
@@ -0,0 +1,84 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _CMONSTER_CORE_INCLUSION_HPP
+#define _CMONSTER_CORE_INCLUSION_HPP
+
+#include <string>
+#include <vector>
+
+namespace cmonster {
+namespace core {
+
+/**
+ * An #include (or #import) directive, as recorded by
+ * Preprocessor::scan_dependencies. The directives of a translation unit
+ * form its include graph: each file's includer is itself included by an
+ * earlier directive, other than the main file.
+ */
+struct Inclusion
+{
+    Inclusion() : includer(), filename(), angled(false), line(0), path(),
+                  guard(), pragma_once(false) {}
+
+    /**
+     * The name of the file containing the directive.
+     */
+    std::string includer;
+
+    /**
+     * The filename, as written in the directive.
+     */
+    std::string filename;
+
+    /**
+     * True if the filename was written in angle brackets, false if quoted.
+     */
+    bool angled;
+
+    /**
+     * The line of the directive in the includer.
+     */
+    unsigned int line;
+
+    /**
+     * The resolved path of the included file, or an empty string if it
+     * was not found.
+     */
+    std::string path;
+
+    /**
+     * The include guard macro of the included file, if one was detected.
+     */
+    std::string guard;
+
+    /**
+     * True if the included file contains "#pragma once".
+     */
+    bool pragma_once;
+};
+
+typedef std::vector<Inclusion> IncludeGraph;
+
+}}
+
+#endif
@@ -0,0 +1,65 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _CMONSTER_CORE_LOCATION_TABLE_HPP
+#define _CMONSTER_CORE_LOCATION_TABLE_HPP
+
+#include <clang/Basic/SourceManager.h>
+
+#include <stdint.h>
+#include <vector>
+
+namespace cmonster {
+namespace core {
+
+/**
+ * Presumed (file, line, column) triples for a sequence of source locations,
+ * stored by column, with a deduplicated file table.
+ */
+struct LocationTable
+{
+    // The file index of invalid locations, whose line and column are zero.
+    static const uint32_t NO_FILE = ~0U;
+
+    std::vector<uint32_t> files; // Index into "filenames", or NO_FILE
+    std::vector<uint32_t> lines;
+    std::vector<uint32_t> columns;
+
+    // The presumed filenames, in order of first appearance. The strings are
+    // owned by the source manager.
+    std::vector<const char*> filenames;
+};
+
+/**
+ * Decompose "n" raw-encoded source locations into their presumed file, line
+ * and column, as SourceLocation.filename, line and column would. Macro
+ * locations are resolved to their expansion location. The results are
+ * appended to "table". Throws std::invalid_argument, leaving "table"
+ * unchanged, if an encoding does not refer to the source manager.
+ */
+void decompose_locations(clang::SourceManager &sm, const uint32_t *locations,
+                         size_t n, LocationTable &table);
+
+}}
+
+#endif
+
@@ -0,0 +1,84 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _CMONSTER_CORE_NATIVE_MACRO_H
+#define _CMONSTER_CORE_NATIVE_MACRO_H
+
+/*
+ * C ABI for native macro handlers, loaded from a shared library with
+ * Preprocessor.define_native. Handlers run without the Python interpreter.
+ *
+ * A handler is passed the spellings of the macro's argument tokens, and the
+ * expansion location, and emits the macro's replacement text through "emit".
+ * The text is tokenized after the handler returns. A handler returns zero on
+ * success; any other value is reported as an error.
+ *
+ * Example:
+ *
+ *     int twice(const cmonster_macro_args *args, void *sink,
+ *               cmonster_emit_fn emit)
+ *     {
+ *         size_t i;
+ *         for (i = 0; i < args->num_tokens; ++i)
+ *             emit(sink, args->spellings[i], args->lengths[i]);
+ *         for (i = 0; i < args->num_tokens; ++i)
+ *             emit(sink, args->spellings[i], args->lengths[i]);
+ *         return 0;
+ *     }
+ */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct cmonster_macro_args
+{
+    /* The number of argument tokens. */
+    size_t num_tokens;
+
+    /* The spelling of each argument token (not NUL-terminated). */
+    const char * const *spellings;
+
+    /* The length of each spelling. */
+    const size_t *lengths;
+
+    /* The presumed expansion location. "filename" may be NULL. */
+    const char *filename;
+    unsigned int line;
+    unsigned int column;
+} cmonster_macro_args;
+
+/* Append replacement text for the macro expansion. */
+typedef void (*cmonster_emit_fn)(void *sink, const char *text, size_t length);
+
+/* The signature of a native macro handler. */
+typedef int (*cmonster_native_macro_fn)(const cmonster_macro_args *args,
+                                        void *sink,
+                                        cmonster_emit_fn emit);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
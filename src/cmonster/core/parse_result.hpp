@@ -30,6 +30,8 @@ SOFTWARE.
 namespace cmonster {
 namespace core {
 
+class DeclIndex;
+class DiagnosticList;
 class ParseResultImpl;
 
 class ParseResult
@@ -43,6 +45,19 @@ public:
      */
     clang::ASTContext& getClangASTContext();
 
+    /**
+     * Get the index of declarations in the translation unit. The index is
+     * built on first use, and shared by copies of this object.
+     */
+    DeclIndex const& getDeclIndex();
+
+    /**
+     * Get the diagnostics reported while parsing. These are only recorded
+     * if ParseOptions::collect_diagnostics was set; otherwise the list is
+     * empty.
+     */
+    DiagnosticList const& getDiagnostics() const;
+
 private:
     boost::shared_ptr<ParseResultImpl> m_impl;
 };
@@ -27,31 +27,177 @@ SOFTWARE.
 #include "parse_result.hpp"
 
 #include <boost/shared_ptr.hpp>
+#include <string>
 
 namespace cmonster {
 namespace core {
 
+class ParserConfig;
 class ParserImpl;
 
+/**
+ * Options controlling how much work is done when parsing a translation
+ * unit.
+ */
+struct ParseOptions
+{
+    ParseOptions()
+      : skip_header_function_bodies(false), delayed_template_parsing(false),
+        collect_diagnostics(false), syntax_only(false)
+    {}
+
+    /**
+     * Skip the bodies of functions defined outside the main file. The
+     * Clang version this is built against cannot skip function bodies, so
+     * parsing fails with std::invalid_argument if this is set.
+     */
+    bool skip_header_function_bodies;
+
+    /**
+     * Delay parsing the bodies of function templates until they are
+     * instantiated, so that templates which are never used are never
+     * parsed or analysed.
+     */
+    bool delayed_template_parsing;
+
+    /**
+     * Record every diagnostic in the parse result's diagnostic list,
+     * instead of reporting them to the default client, so that all of the
+     * errors in a translation unit are found in one parse.
+     */
+    bool collect_diagnostics;
+
+    /**
+     * Parse only as much as is needed for declaration names and source
+     * ranges, for tools that do not need a complete AST. This implies
+     * "delayed_template_parsing"; in addition, templates are not
+     * instantiated at the end of the translation unit, and warnings are not
+     * computed (errors are still reported). Function bodies are still
+     * parsed.
+     *
+     * The resulting AST has no implicit instantiations of function
+     * templates, and should not be used for code generation or rewriting
+     * within function bodies.
+     */
+    bool syntax_only;
+};
+
 /**
  * The core configurable preprocessor class.
  */
 class Parser
 {
 public:
+    /**
+     * Constructor for Parser.
+     *
+     * @param buffer The main file contents.
+     * @param buflen The length of "buffer".
+     * @param filename The name of the main file.
+     * @param pch The path of a precompiled header to implicitly include, as
+     *            generated by "generate_pch" (optional).
+     * @param copy_buffer If false, "buffer" is used in place rather than
+     *                    copied. It must then outlive the parser, and
+     *                    buffer[buflen] must be a NUL character.
+     * @param config The target and language configuration, which may be
+     *               shared with other parsers. If null, the default
+     *               configuration is used.
+     */
     Parser(const char *buffer,
            size_t buflen,
-           const char *filename = "");
+           const char *filename = "",
+           std::string const& pch = std::string(),
+           bool copy_buffer = true,
+           boost::shared_ptr<const ParserConfig> const& config =
+               boost::shared_ptr<const ParserConfig>());
+
+    /**
+     * Constructor for Parser, reading the main file from disk. Large files
+     * are memory-mapped rather than copied.
+     *
+     * @param path The path of the main file.
+     * @param pch The path of a precompiled header to implicitly include
+     *            (optional).
+     * @param config The target and language configuration (optional).
+     */
+    explicit Parser(std::string const& path,
+                    std::string const& pch = std::string(),
+                    boost::shared_ptr<const ParserConfig> const& config =
+                        boost::shared_ptr<const ParserConfig>());
 
     /**
      * Get the preprocessor owned by this parser.
      */
     Preprocessor& getPreprocessor();
 
+    /**
+     * Get the timing statistics for this parser and its preprocessor.
+     */
+    Stats& getStats();
+
     /**
      * Parse the translation unit.
      */
-    ParseResult parse();
+    ParseResult parse(ParseOptions const& options = ParseOptions());
+
+    /**
+     * Replace the contents of the main file, and parse the translation unit
+     * again. This may be called repeatedly, e.g. as a file is edited; it
+     * may also be called instead of "parse".
+     *
+     * State is reused between calls: the file and source managers are kept,
+     * so unchanged headers are not read again, and the preamble of the main
+     * file (the directives up to the last #include) is compiled into a
+     * temporary precompiled header, which is only rebuilt when the preamble
+     * changes. Only the remainder of the file is parsed from source. The
+     * preprocessor's configuration is retained.
+     *
+     * The results of previous parses remain valid: each keeps its own AST,
+     * preprocessor and source manager alive. While the previous result is
+     * in use, a new source manager is created, so headers are read again.
+     * Tokens obtained from the preprocessor are invalidated.
+     *
+     * @param buffer The new main file contents, which are copied.
+     * @param buflen The length of "buffer".
+     * @param options Options for parsing.
+     */
+    ParseResult reparse(const char *buffer, size_t buflen,
+                        ParseOptions const& options = ParseOptions());
+
+    /**
+     * Return the parser to its configured state with a new main file, so
+     * that it may be reused for an unrelated translation unit without the
+     * cost of constructing another. The parser configuration, and the
+     * preprocessor's configuration (include directories, macros, pragmas
+     * and the include locator) are kept, as are the file manager's caches;
+     * the main file, any preamble, and the AST are dropped. "parse" may then
+     * be called again.
+     *
+     * As for "reparse", the results of previous parses remain valid, but
+     * tokens obtained from the preprocessor are invalidated.
+     *
+     * @param buffer The new main file contents, which are copied.
+     * @param buflen The length of "buffer".
+     * @param filename The name of the new main file.
+     */
+    void reset(const char *buffer, size_t buflen, const char *filename = "");
+
+    /**
+     * As above, but reading the new main file from disk.
+     *
+     * @param path The path of the new main file.
+     */
+    void reset(std::string const& path);
+
+    /**
+     * Parse the translation unit as a prefix header, and write it out as a
+     * precompiled header which may be passed to the constructor of other
+     * parsers with the same configuration. This may be called instead of,
+     * but not as well as, "parse".
+     *
+     * @param path The path of the precompiled header file to write.
+     */
+    void generate_pch(std::string const& path);
 
 private:
     boost::shared_ptr<ParserImpl> m_impl;
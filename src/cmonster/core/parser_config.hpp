@@ -0,0 +1,132 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _CMONSTER_CORE_PARSER_CONFIG_HPP
+#define _CMONSTER_CORE_PARSER_CONFIG_HPP
+
+#include <clang/Basic/LangOptions.h>
+#include <llvm/ADT/IntrusiveRefCntPtr.h>
+
+#include <boost/shared_ptr.hpp>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <pthread.h>
+
+namespace clang {
+    class CompilerInstance;
+    class TargetInfo;
+}
+
+namespace cmonster {
+namespace core {
+
+/**
+ * An immutable parser configuration: the target triple, language options,
+ * header search paths and additional predefined macros.
+ *
+ * The target information and language options are computed once, when the
+ * configuration is created, and are then shared by every Parser created
+ * with the configuration. A ParserConfig may be shared between parsers used
+ * concurrently from multiple threads.
+ */
+class ParserConfig
+{
+public:
+    /**
+     * A header search directory, and whether it is a system directory.
+     */
+    typedef std::pair<std::string, bool> IncludeDir;
+
+    /**
+     * Constructor for ParserConfig.
+     *
+     * @param triple The target triple. If empty, the host triple is used.
+     * @param language The input language: one of "c", "c++", "objective-c"
+     *                 or "objective-c++".
+     * @param standard The language standard, e.g. "c99" or "gnu++98". If
+     *                 empty, the default for the language is used.
+     * @param include_dirs Header search directories, which are searched in
+     *                     order, along with any directories added to the
+     *                     preprocessor.
+     * @param predefines Source text to add to the predefines buffer, such
+     *                   as the target compiler's predefined macros.
+     * @throw std::invalid_argument If the triple, language or standard is
+     *                              not recognised.
+     */
+    ParserConfig(std::string const& triple = std::string(),
+                 std::string const& language = "c++",
+                 std::string const& standard = std::string(),
+                 std::vector<IncludeDir> const& include_dirs =
+                     std::vector<IncludeDir>(),
+                 std::string const& predefines = std::string());
+
+    ~ParserConfig();
+
+    /**
+     * Get the configuration used by parsers created without one. This is
+     * created on first use, for the host target and C++.
+     */
+    static boost::shared_ptr<const ParserConfig> get_default();
+
+    std::string const& getTriple() const;
+    std::string const& getLanguage() const;
+    std::string const& getStandard() const;
+    clang::LangOptions const& getLangOptions() const;
+    std::vector<IncludeDir> const& getIncludeDirs() const;
+    std::string const& getPredefines() const;
+
+    /**
+     * Configure a compiler instance with the shared target information,
+     * the language options and the header search paths. This must be
+     * called before the compiler's preprocessor is created.
+     */
+    void attach(clang::CompilerInstance &compiler) const;
+
+    /**
+     * Release the compiler instance's reference to the shared target
+     * information. This must be called before the compiler is destroyed.
+     */
+    void detach(clang::CompilerInstance &compiler) const;
+
+private:
+    // Non-copyable.
+    ParserConfig(ParserConfig const&);
+    ParserConfig& operator=(ParserConfig const&);
+
+    std::string                                 m_triple;
+    std::string                                 m_language;
+    std::string                                 m_standard;
+    clang::LangOptions                          m_lang_options;
+    std::vector<IncludeDir>                     m_include_dirs;
+    std::string                                 m_predefines;
+    llvm::IntrusiveRefCntPtr<clang::TargetInfo> m_target;
+
+    // Guards the target information's reference count, which is not
+    // thread-safe.
+    mutable pthread_mutex_t                     m_mutex;
+};
+
+}}
+
+#endif
@@ -23,18 +23,26 @@ SOFTWARE.
 #ifndef _CMONSTER_CORE_PREPROCESSOR_HPP
 #define _CMONSTER_CORE_PREPROCESSOR_HPP
 
+#include <map>
 #include <ostream>
 #include <string>
 #include <vector>
 
+#include "inclusion.hpp"
+#include "profiler.hpp"
+#include "stats.hpp"
+
 #include <boost/shared_ptr.hpp>
 #include <clang/Basic/TokenKinds.h>
 #include <clang/Lex/Preprocessor.h>
+#include <llvm/Support/raw_ostream.h>
 
 namespace cmonster {
 namespace core {
 
+class FileCache;
 class FunctionMacro;
+class IncludeCache;
 class IncludeLocator;
 class TokenIterator;
 class TokenPredicate;
@@ -49,11 +57,15 @@ public:
     virtual ~Preprocessor() {}
 
     /**
-     * Add an include directory.
+     * Add an include directory. Directories already in the search path
+     * (including those referred to by another path) are not added again,
+     * so that each #include searches a directory at most once.
      *
      * @param path The include directory path to add.
      * @param sysinclude True if path is a system include directory.
-     * @return True if the include path was added successfully.
+     * @return True if the include path was added successfully, or was
+     *         already in the search path; false if the directory does not
+     *         exist.
      */
     virtual bool
     add_include_dir(std::string const& path, bool sysinclude = true) = 0;
@@ -68,6 +80,29 @@ public:
     virtual bool
     define(std::string const& name, std::string const& value="") = 0;
 
+    /**
+     * Append source text to the predefines buffer, which is preprocessed
+     * before the main file. This is much cheaper than calling "define" for
+     * each of a large number of macros, and must be called before
+     * preprocessing begins.
+     *
+     * @param predefines The source text (e.g. "#define" directives) to add.
+     */
+    virtual void add_predefines(std::string const& predefines) = 0;
+
+    /**
+     * Define many plain old macros at once, from a block of "#define"
+     * directives, one per line; blank lines and comments are ignored. Unlike
+     * "add_predefines", the macros are defined immediately. The block is
+     * lexed in a single pass, which is much cheaper than calling "define"
+     * for each macro.
+     *
+     * @param definitions The "#define" directives.
+     * @return The number of macros defined. As with "define", a macro which
+     *         conflicts with an existing definition is not defined.
+     */
+    virtual size_t define_many(std::string const& definitions) = 0;
+
     /**
      * Define a macro that expands by invoking a given callable object.
      *
@@ -103,6 +138,60 @@ public:
      */
     virtual TokenIterator* create_iterator() = 0;
 
+    /**
+     * Preprocess the input only as far as is needed to determine its
+     * dependencies, and return its include graph. Directives are
+     * processed as usual, but no output tokens are produced and macros
+     * outside of directives are not expanded, so #includes produced by
+     * function macros are not seen. Headers with detected include guards
+     * or "#pragma once" are not entered again.
+     *
+     * @return The #include directives processed, in order.
+     */
+    virtual IncludeGraph scan_dependencies() = 0;
+
+    /**
+     * Preprocess the input, writing the output tokens to a token cache
+     * file (see TokenCacheWriter) rather than returning them. The cache
+     * records a hash of the preprocessor's configuration (including the
+     * main buffer, and every macro, definitions block, function macro and
+     * pragma added) and the given key, and the contents of every file
+     * entered while preprocessing.
+     *
+     * @param path The path of the token cache file to write.
+     * @param key Additional configuration that is not visible to the
+     *            preprocessor, such as the definitions of function macros.
+     */
+    virtual void
+    write_token_cache(std::string const& path,
+                      std::string const& key = std::string()) = 0;
+
+    /**
+     * Check whether a token cache file may be used in place of
+     * preprocessing the input: it must have been written with the same
+     * configuration and key, and each of its input files must be
+     * unchanged.
+     *
+     * @param path The path of the token cache file.
+     * @param key The key passed to write_token_cache.
+     */
+    virtual bool
+    is_token_cache_valid(std::string const& path,
+                         std::string const& key = std::string()) const = 0;
+
+    /**
+     * Read tokens from a token cache file, without preprocessing. The
+     * returned tokens are bound to this preprocessor.
+     *
+     * The caller is responsible for deleting the object when it is no
+     * longer needed.
+     *
+     * @param path The path of the token cache file.
+     * @return A TokenIterator which will yield the cached tokens, allocated
+     *         with "new".
+     */
+    virtual TokenIterator* read_token_cache(std::string const& path) = 0;
+
     /**
      * Tokenize a string.
      *
@@ -128,20 +217,48 @@ public:
      * descriptor.
      *
      * @param fd TODO
+     * @param buffer_size The size of the output buffer, or zero for the
+     *                    default.
      */
-    virtual void preprocess(long fd) = 0;
+    virtual void preprocess(long fd, size_t buffer_size = 0) = 0;
+
+    /**
+     * Preprocess the input and write the result to the specified stream.
+     *
+     * @param out The output stream. The caller is responsible for flushing
+     *            it.
+     */
+    virtual void preprocess(llvm::raw_ostream &out) = 0;
 
     /**
      * Lex the next token in the stream.
      */
     virtual Token* next(bool expand = true) = 0;
 
+    /**
+     * Consume unexpanded tokens up to and including the identifier given,
+     * returning the source text before it, with its original formatting.
+     * This is used to capture the bodies of "py_def" macros.
+     *
+     * If the tokens are not contiguous in a single file, they are formatted
+     * as by "format" instead.
+     *
+     * @throw std::runtime_error If the end of the file is reached first.
+     */
+    virtual std::string capture_until(std::string const& identifier) = 0;
+
     /**
      * Format a sequence of tokens.
+     *
+     * Line breaks and spacing are derived from each token's StartOfLine and
+     * LeadingSpace flags. Unless "compact" is true, the source location of
+     * each token starting a line is used to reproduce its line and column.
+     * In compact mode, tokens are separated by at most one character.
      */
-    virtual std::ostream& format(
-        std::ostream &out,
-        std::vector<cmonster::core::Token> const& tokens) const = 0;
+    virtual llvm::raw_ostream& format(
+        llvm::raw_ostream &out,
+        std::vector<cmonster::core::Token> const& tokens,
+        bool compact = false) const = 0;
 
     /**
      * Set the preprocessor's "include locator", for locating includes
@@ -150,6 +267,96 @@ public:
     virtual void
     set_include_locator(boost::shared_ptr<IncludeLocator> const& locator) = 0;
 
+    /**
+     * Set the cache of include locator results. The cache may be shared
+     * between preprocessors.
+     */
+    virtual void
+    set_include_cache(boost::shared_ptr<IncludeCache> const& cache) = 0;
+
+    /**
+     * Set the cache of file system lookups and file contents. The cache may
+     * be shared between preprocessors, and should be set before
+     * preprocessing begins.
+     */
+    virtual void
+    set_file_cache(boost::shared_ptr<FileCache> const& cache) = 0;
+
+    /**
+     * Get the files that are known to be guarded against multiple inclusion
+     * by a controlling macro ("#ifndef X / #define X ... #endif"), mapped to
+     * the name of the macro. Guards are detected when a file is first
+     * preprocessed, whether it was found by header search or by the include
+     * locator. Files guarded by "#pragma once" are not included, as they
+     * cannot be skipped before they have been entered once.
+     */
+    virtual std::map<std::string, std::string> get_guarded_files() = 0;
+
+    /**
+     * Get the paths of the files entered since the preprocessor was
+     * created or reset, in the order they were first entered, including
+     * the main file if it was read from disk. These are the files that
+     * the output depends on.
+     */
+    virtual std::vector<std::string> get_entered_files() const = 0;
+
+    /**
+     * Add known include guards, e.g. those returned by "get_guarded_files"
+     * in an earlier run, so that later inclusions of the files are skipped
+     * without lexing them if the macro is defined. Files that do not exist
+     * are ignored.
+     *
+     * @param guards A map of file paths to controlling macro names.
+     */
+    virtual void
+    add_guarded_files(std::map<std::string, std::string> const& guards) = 0;
+
+    /**
+     * Enable or disable streaming mode, for very large translation units.
+     *
+     * In streaming mode, memory that is no longer needed is released while
+     * preprocessing: pages of memory-mapped files that are more than
+     * "window" bytes behind the lexer are returned to the operating system
+     * (they are read again if needed), and the results of Python macros are
+     * freed as soon as they have been lexed. A window of zero disables
+     * streaming mode.
+     */
+    virtual void set_streaming(size_t window) = 0;
+
+    /**
+     * Get the estimated peak memory retained by the preprocessor and its
+     * source manager, in bytes. This is sampled as tokens are produced in
+     * streaming mode, and when the main file has been preprocessed.
+     */
+    virtual size_t get_memory_high_water() const = 0;
+
+    /**
+     * Get the expansion location of the function macro currently being
+     * invoked, or an invalid location if no function macro is being invoked.
+     */
+    virtual clang::SourceLocation get_expansion_location() const = 0;
+
+    /**
+     * Get the timing statistics for this preprocessor, and the parser that
+     * owns it (if any). Statistics are disabled by default, and are kept
+     * across reparses.
+     */
+    virtual Stats& get_stats() = 0;
+
+    /**
+     * Get the profile of the macros and headers that tokens were produced
+     * from. Profiling is disabled by default, and only tokens produced by
+     * iterators are profiled; the profile is kept across reparses.
+     */
+    virtual Profiler& get_profiler() = 0;
+
+    /**
+     * Get the number of times the underlying Clang preprocessor has been
+     * recreated, by Parser::reparse or Parser::reset. Identifiers and tokens
+     * from an earlier generation are invalid.
+     */
+    virtual unsigned int get_generation() const = 0;
+
     /**
      * Get the underlying Clang preprocessor.
      */
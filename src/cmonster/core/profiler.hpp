@@ -0,0 +1,173 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _CMONSTER_CORE_PROFILER_HPP
+#define _CMONSTER_CORE_PROFILER_HPP
+
+#include "stats.hpp"
+#include "token.hpp"
+
+#include <clang/Basic/SourceManager.h>
+#include <clang/Lex/Token.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <stdint.h>
+
+namespace cmonster {
+namespace core {
+
+/**
+ * Attributes the time spent producing each output token, and the token
+ * itself, to a stack of frames: the chain of included files, followed by
+ * the chain of macro expansions (including Python macros) that the token
+ * came from. The totals for each distinct stack are reported as "folded
+ * stacks", as consumed by flamegraph.pl and similar tools.
+ *
+ * Profiling is disabled by default. While disabled, each hook costs only a
+ * test of a flag.
+ */
+class Profiler
+{
+public:
+    Profiler();
+
+    bool isEnabled() const
+    {
+        return m_enabled;
+    }
+
+    void setEnabled(bool enabled)
+    {
+        m_enabled = enabled;
+    }
+
+    /**
+     * Called when a file is entered, and when it is exited.
+     */
+    void enter_file(const char *name);
+    void exit_file();
+
+    /**
+     * Called when a macro is expanded, with the location of its name. The
+     * names are kept until a token outside of any macro expansion is
+     * lexed.
+     */
+    void macro_expands(clang::SourceLocation name_loc, const char *name);
+
+    /**
+     * Called with the tokens that a Python macro expanded to. "pragma_loc"
+     * is the location of the macro's pragma, whose expansion chain leads
+     * back to the macro.
+     */
+    void python_macro(clang::SourceManager const& sm,
+                      clang::SourceLocation pragma_loc,
+                      std::vector<cmonster::core::Token> const& result);
+
+    /**
+     * Called before lexing a token, to start timing it.
+     */
+    void begin_token()
+    {
+        m_start = Stats::now();
+    }
+
+    /**
+     * Called after lexing a token, to charge it, and the time since
+     * "begin_token" was called, to its stack. The time spent in macros
+     * that produce no tokens (e.g. "py_def") is charged to the token that
+     * follows them; the eof token is charged time, but is not counted.
+     */
+    void end_token(clang::SourceManager const& sm, clang::Token const& tok);
+
+    /**
+     * Discard the state that refers to the current main file. This must be
+     * called when the Clang preprocessor is recreated; the totals are kept.
+     */
+    void reset();
+
+    /**
+     * Discard the totals.
+     */
+    void clear();
+
+    /**
+     * Write a line for each stack, "frame;frame;frame value", where the
+     * value is the number of tokens produced if "tokens" is true, or
+     * otherwise the time spent in nanoseconds.
+     */
+    void write_folded(llvm::raw_ostream &out, bool tokens) const;
+
+private:
+    struct Node
+    {
+        Node(unsigned int parent_, llvm::StringRef name_)
+          : parent(parent_), name(name_), ns(0), tokens(0) {}
+        unsigned int parent;
+        std::string  name;
+        uint64_t     ns;
+        uint64_t     tokens;
+    };
+
+    // The maximum number of Python macro results to keep track of.
+    static const size_t MAX_PYTHON_RANGES = 1024;
+
+    // The results of a Python macro, as a range of raw locations, with the
+    // chain of macros (innermost first) that produced them. Each is
+    // dropped once its last token has been lexed.
+    struct PythonRange
+    {
+        unsigned int             first;
+        std::vector<const char*> chain;
+    };
+
+    // Append the names of the macro expansions that "loc" is within to
+    // "chain", innermost first.
+    void collect_chain(clang::SourceManager const& sm,
+                       clang::SourceLocation loc,
+                       std::vector<const char*> &chain) const;
+
+    // Get the index of the child of "parent" with the given name, creating
+    // it if necessary.
+    unsigned int get_child(unsigned int parent, llvm::StringRef name);
+
+    bool                                       m_enabled;
+    std::vector<Node>                          m_nodes;
+    llvm::StringMap<unsigned int>              m_children;
+    std::vector<unsigned int>                  m_files;
+    llvm::DenseMap<unsigned int, const char*>  m_macro_names;
+    std::map<unsigned int, PythonRange>        m_python_ranges;
+    std::vector<const char*>                   m_chain;
+    uint64_t                                   m_start;
+};
+
+}}
+
+#endif
+
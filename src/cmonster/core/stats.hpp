@@ -0,0 +1,158 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _CMONSTER_CORE_STATS_HPP
+#define _CMONSTER_CORE_STATS_HPP
+
+#include <llvm/ADT/StringRef.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <stdint.h>
+#include <time.h>
+
+namespace cmonster {
+namespace core {
+
+/**
+ * Counters and timers for the phases of preprocessing and parsing. Each
+ * phase records the number of times it was entered, the cumulative time
+ * spent in it, and its slowest individual entries by name (e.g. the macro
+ * or include filename).
+ *
+ * Statistics are disabled by default. While disabled, timing a phase costs
+ * only a test of a flag.
+ */
+class Stats
+{
+public:
+    enum Phase
+    {
+        PRAGMA,          // Handling a cmonster pragma (including macros).
+        FUNCTION_MACRO,  // Calling a function macro.
+        INCLUDE_LOCATOR, // Locating an #include externally.
+        TOKENIZE,        // Tokenizing macro results.
+        PARSE,           // Parsing the translation unit.
+        PREAMBLE,        // Building the precompiled preamble for reparse.
+        NUM_PHASES
+    };
+
+    /**
+     * The statistics for a single phase.
+     */
+    struct PhaseStats
+    {
+        PhaseStats() : count(0), total_ns(0), slowest() {}
+
+        uint64_t count;
+        uint64_t total_ns;
+
+        // The slowest entries, as (duration in ns, name), slowest first.
+        std::vector<std::pair<uint64_t, std::string> > slowest;
+    };
+
+    /**
+     * @param top_n The number of slowest entries to keep for each phase.
+     */
+    explicit Stats(size_t top_n = 10);
+
+    /**
+     * Get the name of a phase, e.g. "function_macro".
+     */
+    static const char* getPhaseName(Phase phase);
+
+    bool isEnabled() const
+    {
+        return m_enabled;
+    }
+
+    void setEnabled(bool enabled)
+    {
+        m_enabled = enabled;
+    }
+
+    /**
+     * Record an entry of a phase. The name is only copied if the entry is
+     * among the slowest.
+     */
+    void record(Phase phase, uint64_t ns, llvm::StringRef name);
+
+    PhaseStats const& getPhaseStats(Phase phase) const
+    {
+        return m_phases[phase];
+    }
+
+    /**
+     * Discard all recorded statistics.
+     */
+    void clear();
+
+    /**
+     * Get the current value of the monotonic clock, in nanoseconds.
+     */
+    static uint64_t now()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+    }
+
+private:
+    bool       m_enabled;
+    size_t     m_top_n;
+    PhaseStats m_phases[NUM_PHASES];
+};
+
+/**
+ * Times a phase for the lifetime of the object, if statistics are given and
+ * enabled.
+ */
+class ScopedTimer
+{
+public:
+    ScopedTimer(Stats *stats, Stats::Phase phase,
+                llvm::StringRef name = llvm::StringRef())
+      : m_stats(stats && stats->isEnabled() ? stats : 0), m_phase(phase),
+        m_name(name), m_start(m_stats ? Stats::now() : 0) {}
+
+    ~ScopedTimer()
+    {
+        if (m_stats)
+            m_stats->record(m_phase, Stats::now() - m_start, m_name);
+    }
+
+private:
+    // Non-copyable.
+    ScopedTimer(ScopedTimer const&);
+    ScopedTimer& operator=(ScopedTimer const&);
+
+    Stats           *m_stats;
+    Stats::Phase     m_phase;
+    llvm::StringRef  m_name;
+    uint64_t         m_start;
+};
+
+}}
+
+#endif
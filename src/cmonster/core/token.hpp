@@ -24,16 +24,23 @@ SOFTWARE.
 #define _CMONSTER_CORE_TOKEN_HPP
 
 #include <clang/Lex/Preprocessor.h>
-
-#include <boost/shared_ptr.hpp>
+#include <clang/Lex/Token.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/raw_ostream.h>
 
 #include <ostream>
 
 namespace cmonster {
 namespace core {
 
-class TokenImpl;
-
+/**
+ * A token, bound to the preprocessor that produced it.
+ *
+ * Token is a small value type: the Clang token is held inline, and the
+ * preprocessor is referenced by pointer. Copying a Token is therefore
+ * trivial, and vectors of tokens are stored contiguously.
+ */
 class Token
 {
 public:
@@ -44,9 +51,6 @@ public:
           clang::tok::TokenKind kind,
           const char *value = NULL, size_t value_len = 0);
 
-    Token(Token const& rhs);
-    Token& operator=(Token const& rhs);
-
     /**
      * Get the underlying Clang token.
      */
@@ -62,15 +66,40 @@ public:
      */
     void setClangToken(clang::Token const&);
 
+    /**
+     * Get the preprocessor to which the token belongs.
+     */
+    clang::Preprocessor& getPreprocessor() const;
+
     /**
      * Get the token name (stringified "kind").
      */
     const char* getName() const;
 
+    /**
+     * Get the token's spelling.
+     *
+     * Literals and identifiers are referenced directly from their source,
+     * scratch buffer or identifier table entry. Other tokens are referenced
+     * from their source buffer, unless they require cleaning (e.g. they
+     * contain escaped newlines), in which case the cleaned spelling is
+     * written to "buffer".
+     *
+     * @param buffer A buffer in which to store the spelling, if required.
+     * @param invalid Set to true if the spelling could not be determined.
+     * @return A reference to the spelling, valid for as long as the token's
+     *         preprocessor and "buffer".
+     */
+    llvm::StringRef getSpelling(llvm::SmallVectorImpl<char> &buffer,
+                                bool *invalid = 0) const;
+
 private:
     friend std::ostream& operator<<(std::ostream&, Token const& token);
+    friend llvm::raw_ostream&
+    operator<<(llvm::raw_ostream&, Token const& token);
 
-    boost::shared_ptr<TokenImpl> m_impl;
+    clang::Preprocessor *m_preprocessor;
+    clang::Token         m_token;
 };
 
 /**
@@ -78,6 +107,11 @@ private:
  */
 std::ostream& operator<<(std::ostream&, Token const&);
 
+/**
+ * Output stream operator for Token.
+ */
+llvm::raw_ostream& operator<<(llvm::raw_ostream&, Token const&);
+
 }}
 
 #endif
@@ -0,0 +1,124 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _CMONSTER_CORE_TOKENBATCH_HPP
+#define _CMONSTER_CORE_TOKENBATCH_HPP
+
+#include "token.hpp"
+
+#include <clang/Lex/Preprocessor.h>
+#include <clang/Lex/Token.h>
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace cmonster {
+namespace core {
+
+/**
+ * A packed, fixed-size record describing a single token. The spelling of the
+ * token is stored in the owning TokenBatch's spelling buffer.
+ */
+struct PackedToken
+{
+    uint16_t kind;
+    uint16_t flags;
+    uint32_t location;
+    uint32_t spelling_offset;
+    uint32_t spelling_length;
+};
+
+/**
+ * A contiguous batch of tokens, as filled by TokenIterator::next_batch.
+ *
+ * Each token is recorded as a PackedToken, with all spellings concatenated
+ * into a single buffer. The underlying Clang tokens are retained so that a
+ * full Token may be created on demand.
+ */
+class TokenBatch
+{
+public:
+    TokenBatch();
+
+    /**
+     * Remove all tokens from the batch, retaining allocated storage.
+     */
+    void clear();
+
+    /**
+     * Append a token to the batch.
+     */
+    void append(clang::Preprocessor &pp, clang::Token const& token);
+
+    /**
+     * Append the i'th token of another batch to this batch. Unlike the
+     * above, this does not consult the preprocessor.
+     */
+    void append(TokenBatch const& other, size_t i);
+
+    /**
+     * Exchange the contents (and allocated storage) of two batches.
+     */
+    void swap(TokenBatch &other);
+
+    /**
+     * Get the number of tokens in the batch.
+     */
+    size_t size() const {return m_records.size();}
+
+    /**
+     * Check if the batch is empty.
+     */
+    bool empty() const {return m_records.empty();}
+
+    /**
+     * Get the packed token records. The records are stored contiguously.
+     */
+    std::vector<PackedToken> const& records() const {return m_records;}
+
+    /**
+     * Get the buffer containing the concatenated token spellings.
+     */
+    std::string const& spellings() const {return m_spellings;}
+
+    /**
+     * Get the spelling of the i'th token.
+     */
+    llvm::StringRef getSpelling(size_t i) const;
+
+    /**
+     * Create a Token object for the i'th token.
+     */
+    Token getToken(size_t i) const;
+
+private:
+    clang::Preprocessor       *m_preprocessor;
+    std::vector<PackedToken>   m_records;
+    std::vector<clang::Token>  m_tokens;
+    std::string                m_spellings;
+};
+
+}}
+
+#endif
+
@@ -0,0 +1,240 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _CMONSTER_CORE_TOKEN_CACHE_HPP
+#define _CMONSTER_CORE_TOKEN_CACHE_HPP
+
+#include "token.hpp"
+#include "token_iterator.hpp"
+
+#include <clang/Basic/FileManager.h>
+#include <clang/Lex/Preprocessor.h>
+#include <clang/Lex/Token.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+namespace cmonster {
+namespace core {
+
+/**
+ * The on-disk format of a token cache file. A file consists of a Header,
+ * followed by the file table, the string table, the token records, and
+ * a blob holding the characters of every string (filenames and token
+ * spellings). Records are fixed-size and naturally aligned, so a mapped
+ * file can be used in place. Integers are stored in host byte order; a
+ * file written on a host of a different byte order fails the magic
+ * check, and is treated as invalid.
+ */
+namespace token_cache {
+
+const uint32_t MAGIC   = 0x4b544d43; // "CMTK" in little-endian.
+const uint32_t VERSION = 1;
+
+// Set in TokenRecord::flags if the token has an IdentifierInfo (i.e. it is
+// an identifier or keyword). The remaining bits are Clang token flags.
+const uint16_t HAS_IDENTIFIER = 0x8000;
+
+// Stored in TokenRecord::file for tokens that are not in any file, such as
+// those produced by function macros.
+const uint32_t NO_FILE = 0xffffffff;
+
+struct Header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_files;
+    uint32_t num_strings;
+    uint32_t num_tokens;
+    uint32_t blob_size;
+    uint64_t config_hash;
+};
+
+/**
+ * An input file, whose contents must be unchanged for the cache to be used.
+ */
+struct FileRecord
+{
+    uint64_t content_hash;
+    uint64_t size;
+    uint32_t name;   // Offset of the filename in the blob.
+    uint32_t length; // Length of the filename.
+};
+
+/**
+ * An interned string, referred to by its index in the string table.
+ */
+struct StringRecord
+{
+    uint32_t offset;
+    uint32_t length;
+};
+
+/**
+ * A token. The line and column are those of the token's expansion
+ * location.
+ */
+struct TokenRecord
+{
+    uint16_t kind;
+    uint16_t flags;
+    uint32_t spelling; // Index into the string table.
+    uint32_t file;     // Index into the file table, or NO_FILE.
+    uint32_t line;
+    uint32_t column;
+};
+
+/**
+ * Compute a 64-bit FNV-1a hash of a sequence of bytes, continuing from a
+ * previous hash value if given.
+ */
+uint64_t hash_bytes(const char *data, size_t len,
+                    uint64_t hash = 14695981039346656037ULL);
+
+/**
+ * Check whether a token cache file exists, was written with the given
+ * configuration hash, and that each of the files it was produced from
+ * still has the same contents.
+ */
+bool is_valid(std::string const& path, uint64_t config_hash);
+
+}
+
+/**
+ * Accumulates preprocessed tokens, and writes them to a token cache file.
+ */
+class TokenCacheWriter
+{
+public:
+    /**
+     * @param pp The preprocessor that produced the tokens.
+     * @param config_hash A hash of the preprocessor's configuration.
+     */
+    TokenCacheWriter(clang::Preprocessor &pp, uint64_t config_hash);
+
+    /**
+     * Record a file that the tokens were produced from, such as a header
+     * that defines only macros. Files containing appended tokens are
+     * recorded automatically.
+     */
+    void add_file(const clang::FileEntry *file);
+
+    /**
+     * Append a preprocessed token.
+     */
+    void append(clang::Token const& token);
+
+    /**
+     * Write the cache to the specified path. The file is written under a
+     * temporary name and then renamed, so readers never see a partially
+     * written cache.
+     */
+    void write(std::string const& path) const;
+
+private:
+    uint32_t get_file_index(const clang::FileEntry *file);
+    uint32_t get_string_index(llvm::StringRef s);
+
+    clang::Preprocessor                       &m_pp;
+    uint64_t                                   m_config_hash;
+    std::vector<const clang::FileEntry*>       m_files;
+    std::map<const clang::FileEntry*, uint32_t> m_file_indices;
+    std::vector<token_cache::StringRecord>     m_strings;
+    llvm::StringMap<uint32_t>                  m_string_indices;
+    std::string                                m_blob;
+    std::vector<token_cache::TokenRecord>      m_tokens;
+};
+
+/**
+ * A TokenIterator that reads tokens from a token cache file, mapped into
+ * memory, rather than preprocessing.
+ *
+ * Tokens are bound to the given preprocessor; their spellings are copied
+ * into its scratch buffer once per distinct string, so token locations
+ * refer to the scratch buffer. The original locations are available from
+ * getFilename, getLine and getColumn.
+ */
+class CachedTokenIterator : public TokenIterator
+{
+public:
+    /**
+     * @param pp The preprocessor to bind the tokens to.
+     * @param path The path of the token cache file.
+     * @throw std::runtime_error if the file cannot be read or is invalid.
+     */
+    CachedTokenIterator(clang::Preprocessor &pp, std::string const& path);
+    ~CachedTokenIterator();
+
+    /**
+     * @see TokenIterator::has_next.
+     */
+    bool has_next() const throw();
+
+    /**
+     * @see TokenIterator::next.
+     */
+    Token& next();
+
+    /**
+     * Get the name of the file containing the most recently returned
+     * token, or an empty string if it was not in a file.
+     */
+    llvm::StringRef getFilename() const;
+
+    /**
+     * Get the line of the most recently returned token.
+     */
+    unsigned getLine() const;
+
+    /**
+     * Get the column of the most recently returned token.
+     */
+    unsigned getColumn() const;
+
+private:
+    // Not copyable.
+    CachedTokenIterator(CachedTokenIterator const&);
+    CachedTokenIterator& operator=(CachedTokenIterator const&);
+
+    llvm::StringRef getString(uint32_t index) const;
+
+    clang::Preprocessor                    &m_pp;
+    void                                   *m_data;
+    size_t                                  m_size;
+    const token_cache::Header              *m_header;
+    const token_cache::FileRecord          *m_files;
+    const token_cache::StringRecord        *m_strings;
+    const token_cache::TokenRecord         *m_records;
+    const char                             *m_blob;
+    uint32_t                                m_index;
+    std::vector<clang::Token>               m_spellings;
+    Token                                   m_current;
+};
+
+}}
+
+#endif
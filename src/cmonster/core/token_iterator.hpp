@@ -24,6 +24,15 @@ SOFTWARE.
 #define _CMONSTER_CORE_PREPROCESSOR_ITERATOR_HPP
 
 #include "token.hpp"
+#include "token_batch.hpp"
+#include "token_predicate.hpp"
+
+#include <boost/exception_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include <cstddef>
+#include <pthread.h>
+#include <vector>
 
 namespace cmonster {
 namespace core {
@@ -45,6 +54,151 @@ public:
      * Get the next token, subsequently incrementing the iterator.
      */
     virtual Token& next() = 0;
+
+    /**
+     * Fill a batch with up to "n" tokens, subsequently incrementing the
+     * iterator past them. The batch is cleared first.
+     *
+     * @param batch The batch to fill.
+     * @param n The maximum number of tokens to add to the batch.
+     * @return The number of tokens added to the batch.
+     */
+    virtual size_t next_batch(TokenBatch &batch, size_t n);
+};
+
+/**
+ * A TokenIterator that yields only those tokens from another iterator that
+ * match a predicate. With native predicates, filtering (and batching) is
+ * done entirely in C++.
+ */
+class FilteredTokenIterator : public TokenIterator
+{
+public:
+    /**
+     * @param iterator The iterator to filter, which is deleted with this
+     *                 object, or by the constructor if it throws.
+     * @param predicate The predicate that tokens must match.
+     */
+    FilteredTokenIterator(TokenIterator *iterator,
+                          TokenPredicatePtr const& predicate);
+
+    /**
+     * @see TokenIterator::has_next.
+     */
+    bool has_next() const throw();
+
+    /**
+     * @see TokenIterator::next.
+     */
+    Token& next();
+
+    /**
+     * @see TokenIterator::next_batch.
+     */
+    size_t next_batch(TokenBatch &batch, size_t n);
+
+private:
+    /**
+     * Advance the underlying iterator to the next matching token.
+     */
+    void advance();
+
+    boost::scoped_ptr<TokenIterator> m_iterator;
+    TokenPredicatePtr                m_predicate;
+    Token                            m_current;
+    Token                            m_next;
+    bool                             m_has_next;
+};
+
+/**
+ * A TokenIterator that preprocesses on a separate thread, overlapping
+ * lexing and macro expansion with the consumption of tokens.
+ *
+ * A producer thread fills batches from another iterator, and hands them to
+ * the consumer through a lock-free, single-producer/single-consumer ring.
+ * The batches are filled (and their spellings copied) entirely on the
+ * producer thread, so consuming a batch's records and spellings does not
+ * touch the preprocessor. Anything else that consults the preprocessor,
+ * such as resolving a token's location, must wait until the iterator is
+ * exhausted.
+ *
+ * Callbacks made while preprocessing (e.g. to macros) run on the producer
+ * thread. If the thread cannot be started, batches are produced on the
+ * consumer thread as they are needed.
+ */
+class PipelinedTokenIterator : public TokenIterator
+{
+public:
+    /**
+     * @param iterator The iterator to consume on the producer thread, which
+     *                 is deleted with this object.
+     * @param batch_size The number of tokens in each batch in the ring.
+     * @param capacity The number of batches in the ring.
+     */
+    PipelinedTokenIterator(TokenIterator *iterator, size_t batch_size = 256,
+                           size_t capacity = 8);
+
+    /**
+     * Stops the producer thread (after it has finished its current batch)
+     * and waits for it to exit.
+     */
+    ~PipelinedTokenIterator();
+
+    /**
+     * @see TokenIterator::has_next.
+     */
+    bool has_next() const throw();
+
+    /**
+     * @see TokenIterator::next.
+     */
+    Token& next();
+
+    /**
+     * @see TokenIterator::next_batch.
+     *
+     * If "n" is at least the ring's batch size, batches are handed over
+     * without copying the tokens.
+     */
+    size_t next_batch(TokenBatch &batch, size_t n);
+
+private:
+    static void* run(void *self);
+
+    /**
+     * Fill the batch at the tail of the ring, and publish it. Returns false
+     * once the underlying iterator is exhausted or has failed.
+     */
+    bool produce();
+
+    /**
+     * Wait until a token is available at the head of the ring, releasing
+     * exhausted batches. Returns false if there are no more tokens.
+     */
+    bool wait() const throw();
+
+    /**
+     * Rethrow the exception raised by the underlying iterator, if it has
+     * not already been rethrown.
+     */
+    void rethrow();
+
+    boost::scoped_ptr<TokenIterator>  m_iterator;
+    const size_t                      m_batch_size;
+    mutable std::vector<TokenBatch>   m_ring;
+    // The ring's head is only written by the consumer, and the tail and
+    // "finished" flag only by the producer.
+    mutable volatile size_t           m_head;
+    volatile size_t                   m_tail;
+    volatile bool                     m_finished;
+    volatile bool                     m_stop;
+    boost::exception_ptr              m_exception;
+    bool                              m_rethrown;
+    mutable bool                      m_holding;
+    mutable size_t                    m_position;
+    bool                              m_started;
+    pthread_t                         m_thread;
+    Token                             m_current;
 };
 
 }}
@@ -0,0 +1,81 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _CMONSTER_CORE_TOKEN_KINDS_HPP
+#define _CMONSTER_CORE_TOKEN_KINDS_HPP
+
+#include <clang/Basic/TokenKinds.h>
+
+namespace cmonster {
+namespace core {
+
+/**
+ * Categories of token kinds. These are bits, which may be combined into a
+ * mask to test against.
+ */
+enum TokenCategory
+{
+    CATEGORY_IDENTIFIER = 1 << 0, // Identifiers, including raw identifiers.
+    CATEGORY_KEYWORD    = 1 << 1, // Keywords, e.g. "int".
+    CATEGORY_LITERAL    = 1 << 2, // Numeric, character and string literals.
+    CATEGORY_PUNCTUATOR = 1 << 3, // Punctuators, e.g. "+=".
+    CATEGORY_ANNOTATION = 1 << 4  // Annotations made by the parser.
+};
+
+namespace impl {
+
+// Tables indexed by token kind, generated from "TokenKinds.def".
+extern const unsigned char token_kind_categories[clang::tok::NUM_TOKENS];
+extern const char* const token_kind_spellings[clang::tok::NUM_TOKENS];
+
+}
+
+/**
+ * Get the categories of a token kind; exactly one bit is set, unless the
+ * kind is a special token (e.g. eof), for which none are.
+ */
+inline unsigned int getKindCategories(clang::tok::TokenKind kind)
+{
+    return impl::token_kind_categories[kind];
+}
+
+/**
+ * Test whether a token kind is in any of the categories of a mask.
+ */
+inline bool isKindIn(clang::tok::TokenKind kind, unsigned int mask)
+{
+    return (impl::token_kind_categories[kind] & mask) != 0;
+}
+
+/**
+ * Get the fixed spelling of a keyword or punctuator kind, or NULL for
+ * other kinds.
+ */
+inline const char* getKindSpelling(clang::tok::TokenKind kind)
+{
+    return impl::token_kind_spellings[kind];
+}
+
+}}
+
+#endif
+
@@ -25,6 +25,15 @@ SOFTWARE.
 
 #include "token.hpp"
 
+#include <clang/Basic/TokenKinds.h>
+#include <llvm/ADT/StringSet.h>
+#include <llvm/Support/Regex.h>
+
+#include <boost/shared_ptr.hpp>
+
+#include <string>
+#include <vector>
+
 namespace cmonster {
 namespace core {
 
@@ -39,6 +48,102 @@ public:
     virtual bool operator()(Token const& token) const = 0;
 };
 
+typedef boost::shared_ptr<const TokenPredicate> TokenPredicatePtr;
+
+/**
+ * Matches tokens of any of the given kinds.
+ */
+class KindPredicate : public TokenPredicate
+{
+public:
+    explicit KindPredicate(std::vector<clang::tok::TokenKind> const& kinds);
+    bool operator()(Token const& token) const;
+private:
+    std::vector<bool> m_kinds;
+};
+
+/**
+ * Matches identifiers (and keywords) with any of the given names.
+ */
+class IdentifierPredicate : public TokenPredicate
+{
+public:
+    explicit IdentifierPredicate(std::vector<std::string> const& names);
+    bool operator()(Token const& token) const;
+private:
+    llvm::StringSet<> m_names;
+};
+
+/**
+ * Matches tokens whose spelling matches a POSIX extended regular
+ * expression. The expression is not anchored.
+ */
+class SpellingPredicate : public TokenPredicate
+{
+public:
+    /**
+     * @throw std::invalid_argument if the expression is invalid.
+     */
+    explicit SpellingPredicate(std::string const& pattern);
+    bool operator()(Token const& token) const;
+private:
+    mutable llvm::Regex m_regex;
+};
+
+/**
+ * Matches tokens expanded (or written) in the main file.
+ */
+class MainFilePredicate : public TokenPredicate
+{
+public:
+    bool operator()(Token const& token) const;
+};
+
+/**
+ * Matches tokens produced by macro expansion.
+ */
+class MacroExpansionPredicate : public TokenPredicate
+{
+public:
+    bool operator()(Token const& token) const;
+};
+
+/**
+ * Matches tokens that match all of the given predicates.
+ */
+class AndPredicate : public TokenPredicate
+{
+public:
+    explicit AndPredicate(std::vector<TokenPredicatePtr> const& operands);
+    bool operator()(Token const& token) const;
+private:
+    std::vector<TokenPredicatePtr> m_operands;
+};
+
+/**
+ * Matches tokens that match any of the given predicates.
+ */
+class OrPredicate : public TokenPredicate
+{
+public:
+    explicit OrPredicate(std::vector<TokenPredicatePtr> const& operands);
+    bool operator()(Token const& token) const;
+private:
+    std::vector<TokenPredicatePtr> m_operands;
+};
+
+/**
+ * Matches tokens that do not match the given predicate.
+ */
+class NotPredicate : public TokenPredicate
+{
+public:
+    explicit NotPredicate(TokenPredicatePtr const& operand);
+    bool operator()(Token const& token) const;
+private:
+    TokenPredicatePtr m_operand;
+};
+
 }}
 
 #endif
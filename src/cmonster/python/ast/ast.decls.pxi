@@ -26,6 +26,7 @@
 
 cdef class Decl:
     cdef clang.decls.Decl *ptr
+    cdef object __weakref__
 
     def __str__(self):
         return self.kind_name
@@ -71,6 +72,16 @@ cdef Decl create_Decl(clang.decls.Decl *d):
     decl.ptr = d
     return decl
 
+
+def _wrap_decl(capsule):
+    """
+    Create a Decl wrapper from a capsule holding a clang::Decl pointer. This
+    is used by ParseResult.get_decl, which caches the wrappers.
+    """
+    assert PyCapsule_IsValid(capsule, <char*>0)
+    return create_Decl(
+        <clang.decls.Decl*>PyCapsule_GetPointer(capsule, <char*>0))
+
 ###############################################################################
 
 cdef class NamedDecl(Decl):
@@ -181,3 +181,17 @@ cdef Statement create_Statement(clang.statements.Stmt *ptr,
     astctx.Retain()
     return stmt
 
+
+def _wrap_stmt(capsule, context_capsule):
+    """
+    Create a Statement wrapper from capsules holding a clang::Stmt pointer,
+    and the clang::ASTContext it belongs to. This is used by
+    ParseResult.match.
+    """
+    assert PyCapsule_IsValid(capsule, <char*>0)
+    assert PyCapsule_IsValid(context_capsule, <char*>0)
+    return create_Statement(
+        <clang.statements.Stmt*>PyCapsule_GetPointer(capsule, <char*>0),
+        <clang.astcontext.ASTContext*>PyCapsule_GetPointer(
+            context_capsule, <char*>0))
+
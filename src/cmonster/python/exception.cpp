@@ -37,6 +37,24 @@ void set_python_exception()
     if (!PyErr_Occurred())
     {
         boost::exception_ptr const& e = boost::current_exception();
+
+        // A Python exception raised on another thread is raised again here.
+        if (e)
+        {
+            try
+            {
+                boost::rethrow_exception(e);
+            }
+            catch (python_exception const& python_e)
+            {
+                if (python_e.restore())
+                    return;
+            }
+            catch (...)
+            {
+            }
+        }
+
         if (e)
         {
             std::string what = boost::to_string(e);
@@ -29,15 +29,21 @@ SOFTWARE.
 #include <exception>
 #include <string>
 
+#include "gil.hpp"
 #include "scoped_pyobject.hpp"
 
 #include <boost/exception/all.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/throw_exception.hpp>
 
 namespace cmonster {
 namespace python {
 
 /**
  * An exception class that is thrown when a Python exception has occurred.
+ * It should be thrown with boost::throw_exception, so that it may be
+ * captured by boost::current_exception and raised again on another thread
+ * (see "restore").
  */
 struct python_exception : public std::exception
 {
@@ -45,18 +51,25 @@ struct python_exception : public std::exception
      * Default constructor. This should be called when a Python exception has
      * occurred.
      */
-    inline python_exception() {assert(PyErr_Occurred());}
+    inline python_exception()
+      : m_what(), m_type(), m_value(), m_traceback()
+    {
+        assert(PyErr_Occurred());
+        fetch_what();
+    }
 
     /**
      * This constructor may be called to set a Python exception.
      */
     inline python_exception(PyObject *type, const char *message = NULL)
+      : m_what(), m_type(), m_value(), m_traceback()
     {
         assert(!PyErr_Occurred());
         if (message)
             PyErr_SetString(type, message);
         else
             PyErr_SetNone(type);
+        fetch_what();
     }
 
     /**
@@ -65,30 +78,35 @@ struct python_exception : public std::exception
     inline ~python_exception() throw() {}
 
     /**
-     * Convert the current Python exception to a string.
-     *
-     * XXX should this clear the current exception too?
+     * Get the string form of the Python exception. This is computed at
+     * construction, while the GIL is held, so it is safe to call from code
+     * that has released the GIL.
      */
     inline const char *what() const throw()
     {
-        if (m_what.empty() && PyErr_Occurred())
-        {
-            PyObject *exc, *val, *tb;
-            PyErr_Fetch(&exc, &val, &tb);
-            PyErr_NormalizeException(&exc, &val, &tb);
-            ScopedPyObject str(PyObject_Str(val));
-            if (str)
-            {
-                ScopedPyObject utf8_value(PyUnicode_AsUTF8String(str));
-                const char *value;
-                if (utf8_value && (value = PyBytes_AsString(utf8_value)))
-                    m_what = value;
-            }
-            PyErr_Restore(exc, val, tb);
-        }
         return m_what.c_str();
     }
 
+    /**
+     * Set the Python exception captured at construction as the current
+     * exception. The error indicator belongs to the thread that raised the
+     * exception, so this is how it is raised on another thread, e.g. from
+     * a macro called on a pipelined iterator's producer thread. The GIL
+     * must be held.
+     *
+     * @return True if there was a captured exception.
+     */
+    inline bool restore() const
+    {
+        if (!m_type)
+            return false;
+        Py_INCREF(m_type.get());
+        Py_XINCREF(m_value.get());
+        Py_XINCREF(m_traceback.get());
+        PyErr_Restore(m_type.get(), m_value.get(), m_traceback.get());
+        return true;
+    }
+
     static inline void boost_throw_exception()
     {
         assert(PyErr_Occurred());
@@ -132,7 +150,58 @@ struct python_exception : public std::exception
     }
 
 private:
-    mutable std::string m_what;
+    /**
+     * Releases a reference, acquiring the GIL if necessary, as copies of
+     * the exception may be destroyed on any thread.
+     */
+    struct DecRef
+    {
+        void operator()(PyObject *obj) const
+        {
+            ScopedGILAcquire gil;
+            Py_DECREF(obj);
+        }
+    };
+
+    static inline boost::shared_ptr<PyObject> hold(PyObject *obj)
+    {
+        if (!obj)
+            return boost::shared_ptr<PyObject>();
+        Py_INCREF(obj);
+        return boost::shared_ptr<PyObject>(obj, DecRef());
+    }
+
+    /**
+     * Convert the current Python exception to a string, and keep a
+     * reference to it, leaving the exception set.
+     */
+    inline void fetch_what()
+    {
+        PyObject *exc, *val, *tb;
+        PyErr_Fetch(&exc, &val, &tb);
+        PyErr_NormalizeException(&exc, &val, &tb);
+        if (val)
+        {
+            ScopedPyObject str(PyObject_Str(val));
+            if (str)
+            {
+                ScopedPyObject utf8_value(PyUnicode_AsUTF8String(str));
+                const char *value;
+                if (utf8_value && (value = PyBytes_AsString(utf8_value)))
+                    m_what = value;
+            }
+            PyErr_Clear();
+        }
+        m_type = hold(exc);
+        m_value = hold(val);
+        m_traceback = hold(tb);
+        PyErr_Restore(exc, val, tb);
+    }
+
+    std::string                 m_what;
+    boost::shared_ptr<PyObject> m_type;
+    boost::shared_ptr<PyObject> m_value;
+    boost::shared_ptr<PyObject> m_traceback;
 };
 
 /**
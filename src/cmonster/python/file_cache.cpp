@@ -0,0 +1,167 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* Define this to ensure only the limited API is used, so we can ensure forward
+ * binary compatibility. */
+#define Py_LIMITED_API
+
+#include <Python.h>
+
+#include "exception.hpp"
+#include "file_cache.hpp"
+
+#include <string>
+
+namespace cmonster {
+namespace python {
+
+static PyTypeObject *FileCacheType = NULL;
+PyDoc_STRVAR(FileCache_doc,
+    "A cache of file system lookups and file contents, which may be shared\n"
+    "between parsers so that headers are only read once per process.");
+
+struct FileCache
+{
+    PyObject_HEAD
+    boost::shared_ptr<cmonster::core::FileCache> *cache;
+};
+
+static void FileCache_dealloc(FileCache* self)
+{
+    if (self->cache)
+        delete self->cache;
+    PyObject_Del((PyObject*)self);
+}
+
+static int FileCache_init(FileCache *self, PyObject *args, PyObject *kwds)
+{
+    if (!PyArg_ParseTuple(args, ":FileCache"))
+        return -1;
+    try
+    {
+        self->cache = new boost::shared_ptr<cmonster::core::FileCache>(
+            new cmonster::core::FileCache);
+        return 0;
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return -1;
+    }
+}
+
+static PyObject* FileCache_invalidate(FileCache *self, PyObject *args)
+{
+    const char *path;
+    int path_size;
+    if (!PyArg_ParseTuple(args, "s#:invalidate", &path, &path_size))
+        return NULL;
+    try
+    {
+        (*self->cache)->invalidate(std::string(path, path_size));
+        Py_RETURN_NONE;
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
+static PyObject* FileCache_clear(FileCache *self, PyObject *args)
+{
+    if (!PyArg_ParseTuple(args, ":clear"))
+        return NULL;
+    (*self->cache)->clear();
+    Py_RETURN_NONE;
+}
+
+static Py_ssize_t FileCache_len(FileCache *self)
+{
+    return static_cast<Py_ssize_t>((*self->cache)->size());
+}
+
+static PyObject* FileCache_get_memory(FileCache *self, void *closure)
+{
+    return PyLong_FromSize_t((*self->cache)->get_total_memory());
+}
+
+static PyMethodDef FileCache_methods[] =
+{
+    {(char*)"invalidate",
+     (PyCFunction)&FileCache_invalidate, METH_VARARGS},
+    {(char*)"clear",
+     (PyCFunction)&FileCache_clear, METH_VARARGS},
+    {NULL}
+};
+
+static PyGetSetDef FileCache_getset[] =
+{
+    {(char*)"memory", (getter)FileCache_get_memory,
+     NULL, NULL /* docs */, NULL /* closure */},
+    {NULL}
+};
+
+static PyType_Slot FileCacheTypeSlots[] =
+{
+    {Py_tp_dealloc,  (void*)FileCache_dealloc},
+    {Py_tp_init,     (void*)FileCache_init},
+    {Py_tp_methods,  (void*)FileCache_methods},
+    {Py_tp_getset,   (void*)FileCache_getset},
+    {Py_tp_doc,      (void*)FileCache_doc},
+    {Py_sq_length,   (void*)FileCache_len},
+    {Py_tp_alloc,    (void*)PyType_GenericAlloc},
+    {Py_tp_new,      (void*)PyType_GenericNew},
+    {0, NULL}
+};
+
+static PyType_Spec FileCacheTypeSpec =
+{
+    "cmonster._cmonster.FileCache",
+    sizeof(FileCache),
+    0,
+    Py_TPFLAGS_DEFAULT|Py_TPFLAGS_BASETYPE,
+    FileCacheTypeSlots
+};
+
+PyTypeObject* init_file_cache_type()
+{
+    FileCacheType = (PyTypeObject*)PyType_FromSpec(&FileCacheTypeSpec);
+    if (!FileCacheType)
+        return NULL;
+    if (PyType_Ready((PyTypeObject*)FileCacheType) < 0)
+        return NULL;
+    return FileCacheType;
+}
+
+PyTypeObject* get_file_cache_type()
+{
+    return FileCacheType;
+}
+
+boost::shared_ptr<cmonster::core::FileCache> const&
+get_file_cache(FileCache *wrapper)
+{
+    return *wrapper->cache;
+}
+
+}}
@@ -20,30 +20,34 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 
-#ifndef _CMONSTER_PYTHON_PYFILEOSTREAM_HPP
-#define _CMONSTER_PYTHON_PYFILEOSTREAM_HPP
+#ifndef _CMONSTER_PYTHON_FILE_CACHE_HPP
+#define _CMONSTER_PYTHON_FILE_CACHE_HPP
 
-#include "scoped_pyobject.hpp"
+#include "../core/file_cache.hpp"
 
-#include <llvm/Support/raw_ostream.h>
+#include <boost/shared_ptr.hpp>
 
 namespace cmonster {
 namespace python {
 
-class pyfile_ostream : public llvm::raw_ostream
-{
-public:
-    pyfile_ostream(PyObject *file);
-    ~pyfile_ostream();
+struct FileCache;
 
-private:
-    virtual void write_impl(const char *ptr, size_t size);
-    virtual uint64_t current_pos() const;
+/**
+ * Initialise the FileCache Python type object.
+ */
+PyTypeObject* init_file_cache_type();
 
-    ScopedPyObject m_file;
-};
+/**
+ * Get the FileCache Python type object.
+ */
+PyTypeObject* get_file_cache_type();
+
+/**
+ * Get the core FileCache wrapped by a FileCache Python object.
+ */
+boost::shared_ptr<cmonster::core::FileCache> const&
+get_file_cache(FileCache *wrapper);
 
 }}
 
 #endif
-
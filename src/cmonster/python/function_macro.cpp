@@ -28,38 +28,222 @@ SOFTWARE.
 
 #include "exception.hpp"
 #include "function_macro.hpp"
+#include "gil.hpp"
 #include "preprocessor.hpp"
 #include "scoped_pyobject.hpp"
-#include "source_location.hpp"
 #include "token.hpp"
 
 #include <stdexcept>
 
+namespace cmonster {
+namespace python {
+
 namespace {
-    struct ScopedPyObject {
-        ScopedPyObject(PyObject *ref) : m_ref(ref) {}
-        ~ScopedPyObject() {Py_XDECREF(m_ref);}
-        operator PyObject* () {return m_ref;}
-        PyObject *m_ref;
-    };
+
+/**
+ * Get an interned string, creating it on first use. The reference is held
+ * for the lifetime of the process.
+ */
+PyObject* get_interned(PyObject *&cache, const char *s)
+{
+    if (!cache)
+    {
+        cache = PyUnicode_InternFromString(s);
+        if (!cache)
+            boost::throw_exception(python_exception());
+    }
+    return cache;
 }
 
-namespace cmonster {
-namespace python {
+PyObject *preprocessor_key = NULL;
+PyObject *location_key = NULL;
+PyObject *context_key = NULL;
+
+// Stand-ins for the preprocessor, and the expansion location, of the macro
+// being called on the current thread (see "cmonster._preprocessor").
+PyObject *preprocessor_proxy = NULL;
+PyObject *location_proxy = NULL;
+
+/**
+ * Get the proxies bound to the "preprocessor" and "location" globals,
+ * importing them on first use. The references are held for the lifetime
+ * of the process.
+ */
+void get_proxies()
+{
+    if (preprocessor_proxy)
+        return;
+    ScopedPyObject module(PyImport_ImportModule("cmonster._preprocessor"));
+    if (!module)
+        boost::throw_exception(python_exception());
+    PyObject *pp = PyObject_GetAttrString(module, "_macro_preprocessor");
+    if (!pp)
+        boost::throw_exception(python_exception());
+    PyObject *loc = PyObject_GetAttrString(module, "_macro_location");
+    if (!loc)
+    {
+        Py_DECREF(pp);
+        boost::throw_exception(python_exception());
+    }
+    preprocessor_proxy = pp;
+    location_proxy = loc;
+}
+
+/**
+ * Check whether the name "location" is referenced by a code object, or by
+ * any code nested within it (e.g. lambdas and inner functions).
+ */
+bool code_references_location(PyObject *code)
+{
+    ScopedPyObject names(PyObject_GetAttrString(code, "co_names"));
+    if (names && PySequence_Contains(names, location_key) == 1)
+        return true;
+    ScopedPyObject consts(PyObject_GetAttrString(code, "co_consts"));
+    const Py_ssize_t n = consts ? PySequence_Size(consts) : -1;
+    for (Py_ssize_t i = 0; i < n; ++i)
+    {
+        ScopedPyObject item(PySequence_GetItem(consts, i));
+        if (item && PyObject_HasAttrString(item, "co_names") &&
+            code_references_location(item))
+            return true;
+    }
+    PyErr_Clear();
+    return false;
+}
+
+/**
+ * Check whether the name "location" is referenced by the callable's code.
+ * Returns false if the callable has no code object (e.g. for builtins).
+ */
+bool references_location(PyObject *callable)
+{
+    ScopedPyObject code(PyObject_GetAttrString(callable, "__code__"));
+    if (code)
+        return code_references_location(code);
+    PyErr_Clear();
+    return false;
+}
+
+/**
+ * Makes a preprocessor the current one for macros called on this thread,
+ * for the lifetime of the object, and then restores the previous one. The
+ * GIL must be held.
+ */
+class ScopedMacroContext
+{
+public:
+    ScopedMacroContext(Preprocessor *preprocessor)
+      : m_dict(PyThreadState_GetDict()), m_previous(NULL)
+    {
+        if (!m_dict)
+            throw std::runtime_error("No thread state for macro call");
+        m_previous = PyDict_GetItem(m_dict, context_key);
+        Py_XINCREF(m_previous);
+        if (PyDict_SetItem(
+                m_dict, context_key, (PyObject*)preprocessor) == -1)
+        {
+            Py_XDECREF(m_previous);
+            boost::throw_exception(python_exception());
+        }
+    }
+
+    ~ScopedMacroContext()
+    {
+        // Don't disturb an exception raised by the macro.
+        PyObject *exc, *val, *tb;
+        PyErr_Fetch(&exc, &val, &tb);
+        if (m_previous)
+        {
+            PyDict_SetItem(m_dict, context_key, m_previous);
+            Py_DECREF(m_previous);
+        }
+        else
+        {
+            PyDict_DelItem(m_dict, context_key);
+        }
+        PyErr_Clear();
+        PyErr_Restore(exc, val, tb);
+    }
+
+private:
+    // Non-copyable.
+    ScopedMacroContext(ScopedMacroContext const&);
+    ScopedMacroContext& operator=(ScopedMacroContext const&);
+
+    PyObject *m_dict;
+    PyObject *m_previous;
+};
+
+}
+
+PyObject* get_macro_preprocessor(PyObject *self, PyObject *args)
+{
+    if (!PyArg_ParseTuple(args, ":_current_macro_preprocessor"))
+        return NULL;
+    PyObject *dict = PyThreadState_GetDict();
+    PyObject *preprocessor =
+        (dict && context_key) ? PyDict_GetItem(dict, context_key) : NULL;
+    if (!preprocessor)
+    {
+        PyErr_SetString(PyExc_RuntimeError,
+                        "No macro is being expanded on this thread");
+        return NULL;
+    }
+    Py_INCREF(preprocessor);
+    return preprocessor;
+}
 
 FunctionMacro::FunctionMacro(Preprocessor *preprocessor, PyObject *callable)
-  : m_preprocessor(preprocessor), m_callable(callable)
+  : m_preprocessor(preprocessor), m_callable(callable), m_globals(NULL)
 {
     if (!preprocessor)
         throw std::invalid_argument("preprocessor == NULL");
     if (!callable)
         throw std::invalid_argument("callable == NULL");
+    PyObject *key = get_interned(preprocessor_key, "preprocessor");
+    get_interned(location_key, "location");
+    get_interned(context_key, "cmonster.macro_preprocessor");
+    get_proxies();
+
+    // Bind the "preprocessor" global variable once, in the globals of the
+    // function (or those of the caller, for other callables). The globals
+    // may be shared by macros in other preprocessors, possibly on other
+    // threads, so the variable is bound to a proxy for the preprocessor
+    // expanding the macro on the calling thread, which is set per call.
+    m_globals = PyObject_GetAttrString(callable, "__globals__");
+    if (!m_globals || !PyDict_Check(m_globals))
+    {
+        PyErr_Clear();
+        Py_XDECREF(m_globals);
+        m_globals = PyEval_GetGlobals();
+        Py_XINCREF(m_globals);
+    }
+    if (m_globals)
+    {
+        if (PyDict_SetItem(m_globals, key, preprocessor_proxy) == -1)
+        {
+            Py_DECREF(m_globals);
+            boost::throw_exception(python_exception());
+        }
+
+        // The "location" global is only bound for functions that refer to
+        // it, so as not to clobber other modules' variables. Others may use
+        // "preprocessor.location".
+        if (references_location(callable) &&
+            PyDict_SetItem(m_globals, location_key, location_proxy) == -1)
+        {
+            Py_DECREF(m_globals);
+            boost::throw_exception(python_exception());
+        }
+    }
+
     Py_INCREF((PyObject*)m_preprocessor);
     Py_INCREF(m_callable);
 }
 
 FunctionMacro::~FunctionMacro()
 {
+    Py_XDECREF(m_globals);
     Py_DECREF(m_callable);
     Py_DECREF((PyObject*)m_preprocessor);
 }
@@ -69,6 +253,9 @@ FunctionMacro::operator()(
     clang::SourceLocation const& expansion_location,
     std::vector<cmonster::core::Token> const& arguments) const
 {
+    // Macros are expanded with the GIL released.
+    ScopedGILAcquire gil;
+
     // Create the arguments tuple.
     ScopedPyObject args_tuple = PyTuple_New(arguments.size());
     if (!args_tuple)
@@ -79,35 +266,16 @@ FunctionMacro::operator()(
         PyTuple_SetItem(args_tuple, i, reinterpret_cast<PyObject*>(token));
     }
 
-    // Set the "preprocessor" and "location" global variables.
-    //
-    // XXX How do we create a closure via the C API? It would be better if we
-    // could bind a function to the preprocessor it was created with, when we
-    // define the function.
-    PyObject *globals = PyEval_GetGlobals();
-    if (globals)
+    // Call the function, with this macro's preprocessor as the current
+    // one, for the "preprocessor" and "location" globals.
+    PyObject *result_ref;
     {
-        PyObject *key = PyUnicode_FromString("preprocessor");
-        if (!key)
-            throw python_exception();
-        Py_INCREF((PyObject*)m_preprocessor);
-        PyDict_SetItem(globals, key, (PyObject*)m_preprocessor);
-
-        cmonster::core::Preprocessor &pp = get_preprocessor(m_preprocessor);
-        SourceLocation *location = create_source_location(
-            expansion_location, pp.getClangPreprocessor().getSourceManager());
-        if (!location)
-            throw python_exception();
-        key = PyUnicode_FromString("location");
-        if (!key)
-            throw python_exception();
-        PyDict_SetItem(globals, key, (PyObject*)location);
+        ScopedMacroContext context(m_preprocessor);
+        result_ref = PyObject_Call(m_callable, args_tuple, NULL);
     }
-
-    // Call the function.
-    ScopedPyObject py_result = PyObject_Call(m_callable, args_tuple, NULL);
+    ScopedPyObject py_result(result_ref);
     if (!py_result)
-        throw python_exception();
+        boost::throw_exception(python_exception());
 
     // Transform the result.
     std::vector<cmonster::core::Token> result;
@@ -124,7 +292,7 @@ FunctionMacro::operator()(
             Py_ssize_t u8_size;
             if (PyBytes_AsStringAndSize(utf8, &u8_chars, &u8_size) == -1)
             {
-                throw python_exception();
+                boost::throw_exception(python_exception());
             }
             else
             {
@@ -136,21 +304,21 @@ FunctionMacro::operator()(
         }
         else
         {
-            throw python_exception();
+            boost::throw_exception(python_exception());
         }
     }
 
     // If it's not a string, it should be a sequence of Token objects.
     if (!PySequence_Check(py_result))
     {
-        throw python_exception(PyExc_TypeError,
-            "macro functions must return a sequence of tokens");
+        boost::throw_exception(python_exception(PyExc_TypeError,
+            "macro functions must return a sequence of tokens"));
     }
 
     const Py_ssize_t seqlen = PySequence_Size(py_result);
     if (seqlen == -1)
     {
-        throw python_exception();
+        boost::throw_exception(python_exception());
     }
     else
     {
@@ -165,8 +333,8 @@ FunctionMacro::operator()(
             else
             {
                 // Invalid return value.
-                throw python_exception(PyExc_TypeError,
-                    "macro functions must return a sequence of tokens");
+                boost::throw_exception(python_exception(PyExc_TypeError,
+                    "macro functions must return a sequence of tokens"));
             }
         }
     }
@@ -31,6 +31,14 @@ namespace python {
 class Preprocessor;
 
 /**
+ * A function macro implemented by a Python callable.
+ *
+ * The preprocessor is made available to the callable through the
+ * "preprocessor" global variable, and the expansion location through
+ * "preprocessor.location". For compatibility, the "location" global variable
+ * is also set if the callable's code refers to it. The globals are bound to
+ * proxies for the preprocessor expanding a macro on the calling thread, so
+ * the callable may be shared by several preprocessors.
  */
 class FunctionMacro : public cmonster::core::FunctionMacro
 {
@@ -45,8 +53,16 @@ public:
 private:
     Preprocessor *m_preprocessor;
     PyObject     *m_callable;
+    PyObject     *m_globals;
 };
 
+/**
+ * Get the preprocessor expanding a macro on the calling thread, or raise
+ * RuntimeError if there is none. This is
+ * "_cmonster._current_macro_preprocessor".
+ */
+PyObject* get_macro_preprocessor(PyObject *self, PyObject *args);
+
 }}
 
 #endif
@@ -0,0 +1,181 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* Define this to ensure only the limited API is used, so we can ensure forward
+ * binary compatibility. */
+#define Py_LIMITED_API
+
+#include <Python.h>
+
+#include "exception.hpp"
+#include "include_cache.hpp"
+
+#include <string>
+
+namespace cmonster {
+namespace python {
+
+static PyTypeObject *IncludeCacheType = NULL;
+PyDoc_STRVAR(IncludeCache_doc,
+    "A cache of include locator results, which may be shared between\n"
+    "preprocessors and persisted to a file.");
+
+struct IncludeCache
+{
+    PyObject_HEAD
+    boost::shared_ptr<cmonster::core::IncludeCache> *cache;
+};
+
+static void IncludeCache_dealloc(IncludeCache* self)
+{
+    if (self->cache)
+        delete self->cache;
+    PyObject_Del((PyObject*)self);
+}
+
+static int
+IncludeCache_init(IncludeCache *self, PyObject *args, PyObject *kwds)
+{
+    if (!PyArg_ParseTuple(args, ":IncludeCache"))
+        return -1;
+    try
+    {
+        self->cache = new boost::shared_ptr<cmonster::core::IncludeCache>(
+            new cmonster::core::IncludeCache);
+        return 0;
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return -1;
+    }
+}
+
+static PyObject* IncludeCache_load(IncludeCache *self, PyObject *args)
+{
+    const char *path, *compiler;
+    int path_size, compiler_size;
+    if (!PyArg_ParseTuple(args, "s#s#:load", &path, &path_size,
+                          &compiler, &compiler_size))
+        return NULL;
+    try
+    {
+        if ((*self->cache)->load(std::string(path, path_size),
+                                 std::string(compiler, compiler_size)))
+            Py_RETURN_TRUE;
+        Py_RETURN_FALSE;
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
+static PyObject* IncludeCache_save(IncludeCache *self, PyObject *args)
+{
+    const char *path, *compiler;
+    int path_size, compiler_size;
+    if (!PyArg_ParseTuple(args, "s#s#:save", &path, &path_size,
+                          &compiler, &compiler_size))
+        return NULL;
+    try
+    {
+        if ((*self->cache)->save(std::string(path, path_size),
+                                 std::string(compiler, compiler_size)))
+            Py_RETURN_TRUE;
+        Py_RETURN_FALSE;
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
+static PyObject* IncludeCache_clear(IncludeCache *self, PyObject *args)
+{
+    if (!PyArg_ParseTuple(args, ":clear"))
+        return NULL;
+    (*self->cache)->clear();
+    Py_RETURN_NONE;
+}
+
+static Py_ssize_t IncludeCache_len(IncludeCache *self)
+{
+    return static_cast<Py_ssize_t>((*self->cache)->size());
+}
+
+static PyMethodDef IncludeCache_methods[] =
+{
+    {(char*)"load",
+     (PyCFunction)&IncludeCache_load, METH_VARARGS},
+    {(char*)"save",
+     (PyCFunction)&IncludeCache_save, METH_VARARGS},
+    {(char*)"clear",
+     (PyCFunction)&IncludeCache_clear, METH_VARARGS},
+    {NULL}
+};
+
+static PyType_Slot IncludeCacheTypeSlots[] =
+{
+    {Py_tp_dealloc,  (void*)IncludeCache_dealloc},
+    {Py_tp_init,     (void*)IncludeCache_init},
+    {Py_tp_methods,  (void*)IncludeCache_methods},
+    {Py_tp_doc,      (void*)IncludeCache_doc},
+    {Py_sq_length,   (void*)IncludeCache_len},
+    {Py_tp_alloc,    (void*)PyType_GenericAlloc},
+    {Py_tp_new,      (void*)PyType_GenericNew},
+    {0, NULL}
+};
+
+static PyType_Spec IncludeCacheTypeSpec =
+{
+    "cmonster._cmonster.IncludeCache",
+    sizeof(IncludeCache),
+    0,
+    Py_TPFLAGS_DEFAULT|Py_TPFLAGS_BASETYPE,
+    IncludeCacheTypeSlots
+};
+
+PyTypeObject* init_include_cache_type()
+{
+    IncludeCacheType = (PyTypeObject*)PyType_FromSpec(&IncludeCacheTypeSpec);
+    if (!IncludeCacheType)
+        return NULL;
+    if (PyType_Ready((PyTypeObject*)IncludeCacheType) < 0)
+        return NULL;
+    return IncludeCacheType;
+}
+
+PyTypeObject* get_include_cache_type()
+{
+    return IncludeCacheType;
+}
+
+boost::shared_ptr<cmonster::core::IncludeCache> const&
+get_include_cache(IncludeCache *wrapper)
+{
+    return *wrapper->cache;
+}
+
+}}
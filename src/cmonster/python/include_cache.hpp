@@ -20,40 +20,34 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 
-/* Define this to ensure only the limited API is used, so we can ensure forward
- * binary compatibility. */
-#define Py_LIMITED_API
-#include <Python.h>
+#ifndef _CMONSTER_PYTHON_INCLUDE_CACHE_HPP
+#define _CMONSTER_PYTHON_INCLUDE_CACHE_HPP
 
-#include "pyfile_ostream.hpp"
+#include "../core/include_cache.hpp"
+
+#include <boost/shared_ptr.hpp>
 
 namespace cmonster {
 namespace python {
 
-pyfile_ostream::pyfile_ostream(PyObject *file)
-  : llvm::raw_ostream(), m_file(file)
-{
-    Py_XINCREF(m_file);
-}
-
-pyfile_ostream::~pyfile_ostream()
-{
-    ScopedPyObject result(PyObject_CallMethod(m_file, (char*)"flush", NULL));
-}
-
-void pyfile_ostream::write_impl(const char *ptr, size_t size)
-{
-    ScopedPyObject result(PyObject_CallMethod(
-        m_file, (char*)"write", (char*)"s#", ptr, (Py_ssize_t)size));
-}
-
-uint64_t pyfile_ostream::current_pos() const
-{
-    ScopedPyObject result(PyObject_CallMethod(m_file, (char*)"tell", NULL));
-    if (!result)
-        return 0;
-    return static_cast<uint64_t>(PyLong_AsLongLong(result));
-}
+struct IncludeCache;
+
+/**
+ * Initialise the IncludeCache Python type object.
+ */
+PyTypeObject* init_include_cache_type();
+
+/**
+ * Get the IncludeCache Python type object.
+ */
+PyTypeObject* get_include_cache_type();
+
+/**
+ * Get the core IncludeCache wrapped by an IncludeCache Python object.
+ */
+boost::shared_ptr<cmonster::core::IncludeCache> const&
+get_include_cache(IncludeCache *wrapper);
 
 }}
 
+#endif
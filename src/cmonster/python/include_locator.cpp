@@ -27,6 +27,7 @@ SOFTWARE.
 #include <Python.h>
 
 #include "exception.hpp"
+#include "gil.hpp"
 #include "scoped_pyobject.hpp"
 #include "include_locator.hpp"
 
@@ -54,6 +55,9 @@ IncludeLocator::locate(std::string const& include, std::string &abs_path) const
     // FIXME The Python exceptions won't fly... probably should convert to C++
     // exceptions and discard them.
 
+    // Includes are located with the GIL released.
+    ScopedGILAcquire gil;
+
     // Call the function. Anything other than a string will be treated as the
     // function having failed to locate the include.
     ScopedPyObject result = PyObject_CallFunction(
@@ -28,22 +28,36 @@ SOFTWARE.
 
 #include <iostream>
 
+#include "../core/token_kinds.hpp"
+#include "file_cache.hpp"
+#include "function_macro.hpp"
+#include "include_cache.hpp"
 #include "parser.hpp"
+#include "parser_config.hpp"
 #include "parse_result.hpp"
 #include "preprocessor.hpp"
 #include "rewriter.hpp"
 #include "source_location.hpp"
+#include "token_batch.hpp"
+#include "token_filter.hpp"
 #include "token_iterator.hpp"
 #include "token.hpp"
 
 #include <clang/Basic/TokenKinds.h>
 
+static PyMethodDef CmonsterMethods[] = {
+    {(char*)"_current_macro_preprocessor",
+     (PyCFunction)&cmonster::python::get_macro_preprocessor, METH_VARARGS,
+     (char*)"Get the preprocessor expanding a macro on this thread."},
+    {NULL, NULL, 0, NULL}
+};
+
 static PyModuleDef cmonstermodule = {
     PyModuleDef_HEAD_INIT,
     "_cmonster",
     "Extension module to expose a native C++ parser/preprocessor.",
     -1,
-    NULL, NULL, NULL, NULL, NULL
+    CmonsterMethods, NULL, NULL, NULL, NULL
 };
 
 // Init function for "_ast". We're bundling two modules into the same
@@ -55,10 +69,20 @@ extern "C" {
 PyMODINIT_FUNC
 PyInit__cmonster(void)
 {
+    // The pipelined token iterator runs Python macros on its producer
+    // thread, through PyGILState_Ensure. Before Python 3.7 the GIL is only
+    // created on request, so create it before any such thread can start.
+    PyEval_InitThreads();
+
     PyObject *ParserType = (PyObject*)cmonster::python::init_parser_type();
     if (!ParserType)
         return NULL;
 
+    PyObject *ParserConfigType =
+        (PyObject*)cmonster::python::init_parser_config_type();
+    if (!ParserConfigType)
+        return NULL;
+
     PyObject *ParseResultType =
         (PyObject*)cmonster::python::init_parse_result_type();
     if (!ParseResultType)
@@ -68,6 +92,26 @@ PyInit__cmonster(void)
     if (!TokenType)
         return NULL;
 
+    PyObject *TokenBatchType =
+        (PyObject*)cmonster::python::init_token_batch_type();
+    if (!TokenBatchType)
+        return NULL;
+
+    PyObject *TokenFilterType =
+        (PyObject*)cmonster::python::init_token_filter_type();
+    if (!TokenFilterType)
+        return NULL;
+
+    PyObject *IncludeCacheType =
+        (PyObject*)cmonster::python::init_include_cache_type();
+    if (!IncludeCacheType)
+        return NULL;
+
+    PyObject *FileCacheType =
+        (PyObject*)cmonster::python::init_file_cache_type();
+    if (!FileCacheType)
+        return NULL;
+
     PyObject *RewriterType = (PyObject*)cmonster::python::init_rewriter_type();
     if (!RewriterType)
         return NULL;
@@ -89,13 +133,23 @@ PyInit__cmonster(void)
 
     // Add types.
     Py_INCREF(ParserType);
+    Py_INCREF(ParserConfigType);
     Py_INCREF(ParseResultType);
     Py_INCREF(TokenType);
+    Py_INCREF(TokenBatchType);
+    Py_INCREF(TokenFilterType);
+    Py_INCREF(IncludeCacheType);
+    Py_INCREF(FileCacheType);
     Py_INCREF(RewriterType);
     Py_INCREF(SourceLocationType);
     PyModule_AddObject(module, "Parser", ParserType);
+    PyModule_AddObject(module, "ParserConfig", ParserConfigType);
     PyModule_AddObject(module, "ParseResult", ParseResultType);
     PyModule_AddObject(module, "Token", TokenType);
+    PyModule_AddObject(module, "TokenBatch", TokenBatchType);
+    PyModule_AddObject(module, "TokenFilter", TokenFilterType);
+    PyModule_AddObject(module, "IncludeCache", IncludeCacheType);
+    PyModule_AddObject(module, "FileCache", FileCacheType);
     PyModule_AddObject(module, "Rewriter", RewriterType);
     PyModule_AddObject(module, "SourceLocation", SourceLocationType);
 
@@ -108,6 +162,18 @@ PyInit__cmonster(void)
         PyModule_AddIntConstant(module, name.c_str(), i);
     }
 
+    // Add constants (token categories), for Token.kind_in.
+    PyModule_AddIntConstant(module, "category_identifier",
+                            cmonster::core::CATEGORY_IDENTIFIER);
+    PyModule_AddIntConstant(module, "category_keyword",
+                            cmonster::core::CATEGORY_KEYWORD);
+    PyModule_AddIntConstant(module, "category_literal",
+                            cmonster::core::CATEGORY_LITERAL);
+    PyModule_AddIntConstant(module, "category_punctuator",
+                            cmonster::core::CATEGORY_PUNCTUATOR);
+    PyModule_AddIntConstant(module, "category_annotation",
+                            cmonster::core::CATEGORY_ANNOTATION);
+
     // Create the _ast module, and add it to _cmonster.
     PyObject *ast_module = PyInit__cmonster_ast();
     if (!ast_module)
@@ -0,0 +1,271 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* Define this to ensure only the limited API is used, so we can ensure forward
+ * binary compatibility. */
+#define Py_LIMITED_API
+
+#include <Python.h>
+
+#include "gil.hpp"
+#include "output_stream.hpp"
+#include "scoped_pyobject.hpp"
+
+#include <cstdio>
+
+namespace cmonster {
+namespace python {
+
+python_ostream::python_ostream(PyObject *callable, bool text)
+  : llvm::raw_ostream(), m_callable(callable), m_text(text), m_pos(0),
+    m_pending(), m_exc(NULL), m_val(NULL), m_tb(NULL)
+{
+    ScopedGILAcquire gil;
+    Py_INCREF(m_callable);
+}
+
+python_ostream::~python_ostream()
+{
+    flush();
+    ScopedGILAcquire gil;
+    Py_DECREF(m_callable);
+    Py_XDECREF(m_exc);
+    Py_XDECREF(m_val);
+    Py_XDECREF(m_tb);
+}
+
+bool python_ostream::check()
+{
+    if (!m_exc)
+        return true;
+    PyErr_Restore(m_exc, m_val, m_tb);
+    m_exc = m_val = m_tb = NULL;
+    return false;
+}
+
+void python_ostream::write_impl(const char *ptr, size_t size)
+{
+    m_pos += size;
+
+    ScopedGILAcquire gil;
+    if (m_exc)
+        return;
+
+    PyObject *result;
+    if (m_text)
+    {
+        // Chunks may split multi-byte sequences, so hold back any incomplete
+        // sequence until the next chunk.
+        const char *data = ptr;
+        Py_ssize_t data_size = static_cast<Py_ssize_t>(size);
+        if (!m_pending.empty())
+        {
+            m_pending.append(ptr, size);
+            data = m_pending.data();
+            data_size = static_cast<Py_ssize_t>(m_pending.size());
+        }
+        Py_ssize_t consumed = 0;
+        ScopedPyObject str(PyUnicode_DecodeUTF8Stateful(
+            data, data_size, "replace", &consumed));
+        if (!str)
+        {
+            PyErr_Fetch(&m_exc, &m_val, &m_tb);
+            return;
+        }
+        m_pending.assign(data + consumed, data_size - consumed);
+        result = PyObject_CallFunctionObjArgs(m_callable, str.get(), NULL);
+    }
+    else
+    {
+        result = PyObject_CallFunction(
+            m_callable, (char*)"y#", ptr, (Py_ssize_t)size);
+    }
+
+    if (result)
+        Py_DECREF(result);
+    else
+        PyErr_Fetch(&m_exc, &m_val, &m_tb);
+}
+
+void python_ostream::finish()
+{
+    if (m_exc || m_pending.empty())
+        return;
+    ScopedPyObject str(PyUnicode_DecodeUTF8(
+        m_pending.data(), static_cast<Py_ssize_t>(m_pending.size()),
+        "replace"));
+    m_pending.clear();
+    if (!str)
+    {
+        PyErr_Fetch(&m_exc, &m_val, &m_tb);
+        return;
+    }
+    PyObject *result =
+        PyObject_CallFunctionObjArgs(m_callable, str.get(), NULL);
+    if (result)
+        Py_DECREF(result);
+    else
+        PyErr_Fetch(&m_exc, &m_val, &m_tb);
+}
+
+uint64_t python_ostream::current_pos() const
+{
+    return m_pos;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+output_stream::output_stream()
+  : m_stream(), m_python_stream(NULL), m_fd_stream(NULL) {}
+
+output_stream::~output_stream()
+{
+    // If "close" wasn't called (e.g. an exception occurred while writing),
+    // discard any error, as raw_fd_ostream aborts on unhandled errors.
+    if (m_stream.get())
+    {
+        m_stream->flush();
+        if (m_fd_stream)
+            m_fd_stream->clear_error();
+    }
+}
+
+static bool flush_file(PyObject *file)
+{
+    if (!PyObject_HasAttrString(file, "flush"))
+        return true;
+    ScopedPyObject result(PyObject_CallMethod(file, (char*)"flush", NULL));
+    return result.get() != NULL;
+}
+
+bool output_stream::open(PyObject *target, size_t buffer_size)
+{
+    long fd = -1;
+    if (!target || target == Py_None)
+    {
+        // Flush any output buffered by Python first.
+        PyObject *py_stdout = PySys_GetObject((char*)"stdout");
+        if (py_stdout && !flush_file(py_stdout))
+            return false;
+        fd = fileno(stdout);
+    }
+    else if (PyLong_Check(target))
+    {
+        fd = PyLong_AsLong(target);
+        if (fd == -1 && PyErr_Occurred())
+            return false;
+    }
+    else if (PyUnicode_Check(target))
+    {
+        ScopedPyObject utf8_filename(PyUnicode_AsUTF8String(target));
+        const char *filename;
+        if (!utf8_filename ||
+            !(filename = PyBytes_AsString(utf8_filename)))
+            return false;
+
+        std::string error;
+        m_fd_stream = new llvm::raw_fd_ostream(filename, error);
+        m_stream.reset(m_fd_stream);
+        if (!error.empty())
+        {
+            m_stream.reset();
+            m_fd_stream = NULL;
+            PyErr_SetString(PyExc_IOError, error.c_str());
+            return false;
+        }
+        m_stream->SetBufferSize(buffer_size);
+        return true;
+    }
+    else if (PyObject_HasAttrString(target, "fileno"))
+    {
+        // Objects such as io.BytesIO have a "fileno" method which raises an
+        // exception; fall back to "write" for those.
+        if (!flush_file(target))
+            return false;
+        ScopedPyObject pylong(
+            PyObject_CallMethod(target, (char*)"fileno", NULL));
+        if (pylong)
+            fd = PyLong_AsLong(pylong);
+        if (fd == -1)
+        {
+            if (!PyObject_HasAttrString(target, "write"))
+                return false;
+            PyErr_Clear();
+        }
+    }
+
+    if (fd != -1)
+    {
+        m_fd_stream = new llvm::raw_fd_ostream(fd, false);
+        m_stream.reset(m_fd_stream);
+    }
+    else if (PyObject_HasAttrString(target, "write"))
+    {
+        ScopedPyObject write(PyObject_GetAttrString(target, "write"));
+        if (!write)
+            return false;
+        const bool text = PyObject_HasAttrString(target, "encoding");
+        m_python_stream = new python_ostream(write, text);
+        m_stream.reset(m_python_stream);
+    }
+    else if (PyCallable_Check(target))
+    {
+        m_python_stream = new python_ostream(target, false);
+        m_stream.reset(m_python_stream);
+    }
+    else
+    {
+        PyErr_SetString(PyExc_TypeError,
+            "Expected None, a file descriptor, a filename, a file-like "
+            "object, or a callable");
+        return false;
+    }
+    m_stream->SetBufferSize(buffer_size);
+    return true;
+}
+
+bool output_stream::close()
+{
+    if (!m_stream.get())
+        return true;
+
+    m_stream->flush();
+    bool ok = true;
+    if (m_python_stream)
+    {
+        m_python_stream->finish();
+        ok = m_python_stream->check();
+    }
+    else if (m_fd_stream && m_fd_stream->has_error())
+    {
+        m_fd_stream->clear_error();
+        PyErr_SetString(PyExc_IOError, "Failed to write output");
+        ok = false;
+    }
+
+    m_stream.reset();
+    m_python_stream = NULL;
+    m_fd_stream = NULL;
+    return ok;
+}
+
+}}
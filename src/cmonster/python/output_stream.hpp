@@ -0,0 +1,140 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _CMONSTER_PYTHON_OUTPUT_STREAM_HPP
+#define _CMONSTER_PYTHON_OUTPUT_STREAM_HPP
+
+#include <Python.h>
+
+#include <llvm/Support/raw_ostream.h>
+
+#include <memory>
+#include <string>
+
+namespace cmonster {
+namespace python {
+
+/**
+ * The default buffer size for output streams.
+ */
+const size_t DEFAULT_OUTPUT_BUFFER_SIZE = 64 * 1024;
+
+/**
+ * An llvm::raw_ostream which passes buffered chunks of output to a Python
+ * callable, such as a file object's "write" method. The GIL is acquired for
+ * each chunk, so the stream may be written to with the GIL released.
+ *
+ * Exceptions raised by the callable cannot propagate through Clang, so the
+ * first exception is stored, all further output is discarded, and the
+ * exception is restored by "check".
+ */
+class python_ostream : public llvm::raw_ostream
+{
+public:
+    /**
+     * @param callable The callable to pass chunks to.
+     * @param text If true, chunks are passed as str (decoded from UTF-8),
+     *             else as bytes.
+     */
+    python_ostream(PyObject *callable, bool text);
+    ~python_ostream();
+
+    /**
+     * Restore the exception raised by the callable, if any. Must be called
+     * with the GIL held, after flushing.
+     *
+     * @return False if an exception was raised, else true.
+     */
+    bool check();
+
+    /**
+     * Pass any incomplete UTF-8 sequence held back in text mode to the
+     * callable, with the invalid bytes replaced by U+FFFD. Must be called
+     * with the GIL held, after flushing.
+     */
+    void finish();
+
+private:
+    virtual void write_impl(const char *ptr, size_t size);
+    virtual uint64_t current_pos() const;
+
+    PyObject    *m_callable;
+    bool         m_text;
+    uint64_t     m_pos;
+    std::string  m_pending; // incomplete UTF-8 sequence, in text mode
+    PyObject    *m_exc, *m_val, *m_tb;
+};
+
+/**
+ * An output stream for a Python output target, which may be:
+ *
+ *  - None, for standard output,
+ *  - an integer file descriptor,
+ *  - a filename,
+ *  - an object with a "fileno" method (which will be flushed first),
+ *  - an object with a "write" method, or
+ *  - a callable, which will be passed chunks of bytes.
+ *
+ * File descriptors are written to directly, with a buffer of the specified
+ * size. Other targets receive chunks of (at most) the buffer size.
+ */
+class output_stream
+{
+public:
+    output_stream();
+    ~output_stream();
+
+    /**
+     * Open the stream for a target. Objects with a "write" method are passed
+     * str if they have an "encoding" attribute (i.e. text files), and bytes
+     * otherwise.
+     *
+     * @return False with a Python exception set on failure.
+     */
+    bool open(PyObject *target,
+              size_t buffer_size = DEFAULT_OUTPUT_BUFFER_SIZE);
+
+    /**
+     * Get the underlying stream. May be used with the GIL released.
+     */
+    llvm::raw_ostream& get() {return *m_stream;}
+
+    /**
+     * Flush and close the stream. Must be called with the GIL held.
+     *
+     * @return False with a Python exception set on failure.
+     */
+    bool close();
+
+private:
+    // Non-copyable.
+    output_stream(output_stream const&);
+    output_stream& operator=(output_stream const&);
+
+    std::auto_ptr<llvm::raw_ostream>  m_stream;
+    python_ostream                   *m_python_stream;
+    llvm::raw_fd_ostream             *m_fd_stream;
+};
+
+}}
+
+#endif
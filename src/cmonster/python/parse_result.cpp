@@ -25,33 +25,65 @@ SOFTWARE.
 #define Py_LIMITED_API
 
 #include <Python.h>
+
+#include <llvm/ADT/DenseMap.h>
+
+#include <cstring>
 #include <sstream>
 #include <stdexcept>
 #include <iostream>
+#include <string>
+#include <vector>
 
+#include "../core/ast_query.hpp"
+#include "../core/decl_export.hpp"
+#include "../core/decl_index.hpp"
+#include "../core/diagnostics.hpp"
+#include "../core/location_table.hpp"
 #include "exception.hpp"
+#include "gil.hpp"
 #include "parser.hpp"
 #include "parse_result.hpp"
 #include "scoped_pyobject.hpp"
+#include "source_location.hpp"
 
 namespace cmonster {
 namespace python {
 
 static PyTypeObject *TranslationUnitDeclType = NULL;
+static PyObject *WrapDeclFunction = NULL;
+static PyObject *WrapStmtFunction = NULL;
 static PyTypeObject *ParseResultType = NULL;
 PyDoc_STRVAR(ParseResult_doc, "ParseResult objects");
 
+// Interned filename strings, keyed by the source manager's presumed
+// filename (which is owned by the file entry or the line table).
+typedef llvm::DenseMap<const char*, PyObject*> FilenameStringMap;
+
 struct ParseResult
 {
     PyObject_HEAD
     Parser *parser;
     cmonster::core::ParseResult *result;
+    PyObject *decl_cache; // WeakValueDictionary of Decl wrappers, by index
+    FilenameStringMap *filename_strings;
 };
 
 static void ParseResult_dealloc(ParseResult* self)
 {
     if (self->result)
         delete self->result;
+    Py_XDECREF(self->decl_cache);
+    if (self->filename_strings)
+    {
+        for (FilenameStringMap::iterator
+                 iter = self->filename_strings->begin();
+             iter != self->filename_strings->end(); ++iter)
+        {
+            Py_DECREF(iter->second);
+        }
+        delete self->filename_strings;
+    }
     Py_DECREF(self->parser);
     PyObject_Del((PyObject*)self);
 }
@@ -81,8 +113,583 @@ ParseResult_init(ParseResult *self, PyObject *args, PyObject *kwds)
     return 0;
 }
 
+/**
+ * Get an attribute of the Cython AST module, "cmonster._cmonster_ast".
+ * Returns a new reference.
+ */
+static PyObject* get_ast_attribute(const char *name)
+{
+    ScopedPyObject ast_module(PyImport_ImportModule("cmonster._cmonster_ast"));
+    if (!ast_module)
+        return NULL;
+    return PyObject_GetAttrString(ast_module, name);
+}
+
+/**
+ * Check that "index" is a valid declaration index, raising IndexError if not.
+ */
+static bool
+check_decl_index(cmonster::core::DeclIndex const& index, Py_ssize_t i)
+{
+    if (i < 0 || static_cast<size_t>(i) >= index.size())
+    {
+        PyErr_SetString(PyExc_IndexError, "declaration index out of range");
+        return false;
+    }
+    return true;
+}
+
+static PyObject*
+create_index_list(std::vector<unsigned int> const& indices)
+{
+    ScopedPyObject list(PyList_New(indices.size()));
+    if (!list)
+        return NULL;
+    for (size_t i = 0; i < indices.size(); ++i)
+    {
+        PyObject *value = PyLong_FromUnsignedLong(indices[i]);
+        if (!value)
+            return NULL;
+        PyList_SetItem(list, i, value);
+    }
+    return list.release();
+}
+
+static PyObject*
+ParseResult_find_decls(ParseResult *self, PyObject *args, PyObject *kwds)
+{
+    PyObject *kind = Py_None;
+    const char *name = NULL;
+    static const char *keywords[] = {"kind", "name", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|Oz:find_decls",
+                                     (char**)keywords, &kind, &name))
+        return NULL;
+
+    clang::Decl::Kind kind_;
+    if (kind != Py_None)
+    {
+        long value = PyLong_AsLong(kind);
+        if (value == -1 && PyErr_Occurred())
+            return NULL;
+        kind_ = static_cast<clang::Decl::Kind>(value);
+    }
+
+    try
+    {
+        cmonster::core::DeclIndex const& index = self->result->getDeclIndex();
+        if (name)
+        {
+            return create_index_list(index.find_by_name(
+                name, kind != Py_None ? &kind_ : NULL));
+        }
+        else if (kind != Py_None)
+        {
+            return create_index_list(index.find_by_kind(kind_));
+        }
+        else
+        {
+            std::vector<unsigned int> all(index.size());
+            for (size_t i = 0; i < all.size(); ++i)
+                all[i] = i;
+            return create_index_list(all);
+        }
+    }
+    catch (...)
+    {
+        set_python_exception();
+    }
+    return NULL;
+}
+
+static PyObject* ParseResult_get_decl(ParseResult *self, PyObject *args)
+{
+    Py_ssize_t i;
+    if (!PyArg_ParseTuple(args, "n:get_decl", &i))
+        return NULL;
+
+    try
+    {
+        cmonster::core::DeclIndex const& index = self->result->getDeclIndex();
+        if (!check_decl_index(index, i))
+            return NULL;
+
+        // Wrappers are cached for as long as they are referenced elsewhere,
+        // so repeated traversals reuse them.
+        if (!self->decl_cache)
+        {
+            ScopedPyObject weakref(PyImport_ImportModule("weakref"));
+            if (!weakref)
+                return NULL;
+            self->decl_cache = PyObject_CallMethod(
+                weakref, (char*)"WeakValueDictionary", NULL);
+            if (!self->decl_cache)
+                return NULL;
+        }
+        ScopedPyObject key(PyLong_FromSsize_t(i));
+        if (!key)
+            return NULL;
+        PyObject *decl = PyObject_GetItem(self->decl_cache, key);
+        if (decl)
+            return decl;
+        if (!PyErr_ExceptionMatches(PyExc_KeyError))
+            return NULL;
+        PyErr_Clear();
+
+        if (!WrapDeclFunction)
+        {
+            WrapDeclFunction = get_ast_attribute("_wrap_decl");
+            if (!WrapDeclFunction)
+                return NULL;
+        }
+        ScopedPyObject capsule(PyCapsule_New(index[i].decl, NULL, NULL));
+        if (!capsule)
+            return NULL;
+        ScopedPyObject wrapper(PyObject_CallFunctionObjArgs(
+            WrapDeclFunction, capsule.get(), NULL));
+        if (!wrapper)
+            return NULL;
+        if (PyObject_SetItem(self->decl_cache, key, wrapper) == -1)
+            return NULL;
+        return wrapper.release();
+    }
+    catch (...)
+    {
+        set_python_exception();
+    }
+    return NULL;
+}
+
+static PyObject* ParseResult_get_decl_info(ParseResult *self, PyObject *args)
+{
+    Py_ssize_t i;
+    if (!PyArg_ParseTuple(args, "n:get_decl_info", &i))
+        return NULL;
+
+    try
+    {
+        cmonster::core::DeclIndex const& index = self->result->getDeclIndex();
+        if (!check_decl_index(index, i))
+            return NULL;
+        cmonster::core::DeclIndex::Entry const& entry = index[i];
+
+        const char *name = NULL;
+        int name_len = 0;
+        if (entry.name)
+        {
+            name = entry.name->getNameStart();
+            name_len = entry.name->getLength();
+        }
+        clang::SourceManager &sm =
+            self->result->getClangASTContext().getSourceManager();
+        ScopedPyObject begin((PyObject*)create_source_location(
+            clang::SourceLocation::getFromRawEncoding(entry.begin), sm));
+        if (!begin)
+            return NULL;
+        ScopedPyObject end((PyObject*)create_source_location(
+            clang::SourceLocation::getFromRawEncoding(entry.end), sm));
+        if (!end)
+            return NULL;
+
+        // (kind, name, parent, begin, end)
+        if (entry.parent == index.NO_PARENT)
+        {
+            return Py_BuildValue("(Iz#OOO)", entry.kind, name, name_len,
+                                 Py_None, begin.get(), end.get());
+        }
+        return Py_BuildValue("(Iz#IOO)", entry.kind, name, name_len,
+                             entry.parent, begin.get(), end.get());
+    }
+    catch (...)
+    {
+        set_python_exception();
+    }
+    return NULL;
+}
+
+/**
+ * Convert a str, or an iterable of str, to a vector of strings.
+ */
+static bool
+get_string_list(PyObject *obj, std::vector<std::string> &strings)
+{
+    if (!obj || obj == Py_None)
+        return true;
+
+    ScopedPyObject seq(PyUnicode_Check(obj) ?
+        PyTuple_Pack(1, obj) : PySequence_Tuple(obj));
+    if (!seq)
+        return false;
+    const Py_ssize_t size = PyTuple_Size(seq);
+    for (Py_ssize_t i = 0; i < size; ++i)
+    {
+        PyObject *item = PyTuple_GetItem(seq, i);
+        if (!PyUnicode_Check(item))
+        {
+            PyErr_SetString(PyExc_TypeError, "expected str");
+            return false;
+        }
+        ScopedPyObject utf8(PyUnicode_AsUTF8String(item));
+        if (!utf8)
+            return false;
+        strings.push_back(PyBytes_AsString(utf8));
+    }
+    return true;
+}
+
+/**
+ * Create a Python wrapper for a matched AST node.
+ */
+static PyObject*
+create_match_wrapper(ParseResult *self, cmonster::core::AstMatch const& match)
+{
+    PyObject *&function = match.decl ? WrapDeclFunction : WrapStmtFunction;
+    if (!function)
+    {
+        function = get_ast_attribute(match.decl ? "_wrap_decl" : "_wrap_stmt");
+        if (!function)
+            return NULL;
+    }
+    if (match.decl)
+    {
+        ScopedPyObject capsule(PyCapsule_New(match.decl, NULL, NULL));
+        if (!capsule)
+            return NULL;
+        return PyObject_CallFunctionObjArgs(function, capsule.get(), NULL);
+    }
+    else
+    {
+        ScopedPyObject capsule(PyCapsule_New(match.stmt, NULL, NULL));
+        if (!capsule)
+            return NULL;
+        ScopedPyObject context(PyCapsule_New(
+            &self->result->getClangASTContext(), NULL, NULL));
+        if (!context)
+            return NULL;
+        return PyObject_CallFunctionObjArgs(
+            function, capsule.get(), context.get(), NULL);
+    }
+}
+
+static PyObject*
+ParseResult_match(ParseResult *self, PyObject *args, PyObject *kwds)
+{
+    PyObject *decl_kinds = NULL;
+    PyObject *stmt_kinds = NULL;
+    const char *name = NULL;
+    PyObject *main_file_only = NULL;
+    PyObject *with_body = NULL;
+    PyObject *callback = NULL;
+    static const char *keywords[] = {
+        "decl_kinds", "stmt_kinds", "name", "main_file_only", "with_body",
+        "callback", NULL
+    };
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|OOzOOO:match",
+                                     (char**)keywords, &decl_kinds,
+                                     &stmt_kinds, &name, &main_file_only,
+                                     &with_body, &callback))
+        return NULL;
+    if (callback == Py_None)
+        callback = NULL;
+    if (callback && !PyCallable_Check(callback))
+    {
+        PyErr_SetString(PyExc_TypeError, "expected callable for callback");
+        return NULL;
+    }
+
+    cmonster::core::AstQuery query;
+    if (!get_string_list(decl_kinds, query.decl_kinds) ||
+        !get_string_list(stmt_kinds, query.stmt_kinds))
+        return NULL;
+    if (name)
+        query.name_pattern = name;
+    if (main_file_only)
+    {
+        const int value = PyObject_IsTrue(main_file_only);
+        if (value == -1)
+            return NULL;
+        query.main_file_only = value;
+    }
+    if (with_body)
+    {
+        const int value = PyObject_IsTrue(with_body);
+        if (value == -1)
+            return NULL;
+        query.with_body = value;
+    }
+
+    try
+    {
+        // The traversal is done without the GIL. Python is only entered to
+        // wrap (and call back on) the matching nodes.
+        std::vector<cmonster::core::AstMatch> matches;
+        {
+            ScopedGILRelease nogil;
+            matches = cmonster::core::match_ast(
+                self->result->getClangASTContext(), query);
+        }
+
+        ScopedPyObject result(callback ? NULL : PyList_New(matches.size()));
+        if (!callback && !result)
+            return NULL;
+        for (size_t i = 0; i < matches.size(); ++i)
+        {
+            PyObject *wrapper = create_match_wrapper(self, matches[i]);
+            if (!wrapper)
+                return NULL;
+            if (callback)
+            {
+                ScopedPyObject wrapper_(wrapper);
+                ScopedPyObject rc(PyObject_CallFunctionObjArgs(
+                    callback, wrapper, NULL));
+                if (!rc)
+                    return NULL;
+            }
+            else
+            {
+                PyList_SetItem(result, i, wrapper);
+            }
+        }
+        if (callback)
+            Py_RETURN_NONE;
+        return result.release();
+    }
+    catch (...)
+    {
+        set_python_exception();
+    }
+    return NULL;
+}
+
+// Create a bytes object containing the native-endian uint32 array.
+static PyObject* uint32_bytes(std::vector<uint32_t> const& values)
+{
+    return PyBytes_FromStringAndSize(
+        values.empty() ? "" : reinterpret_cast<const char*>(&values[0]),
+        values.size() * sizeof(uint32_t));
+}
+
+// Create an (offsets, data) tuple of bytes objects for a string column.
+static PyObject*
+string_column(cmonster::core::StringColumn const& column)
+{
+    ScopedPyObject offsets(uint32_bytes(column.offsets));
+    if (!offsets)
+        return NULL;
+    ScopedPyObject data(PyBytes_FromStringAndSize(
+        column.data.data(), column.data.size()));
+    if (!data)
+        return NULL;
+    return PyTuple_Pack(2, offsets.get(), data.get());
+}
+
+// Set a dictionary item, stealing the reference to "value".
+static bool set_item(PyObject *dict, const char *key, PyObject *value)
+{
+    ScopedPyObject value_(value);
+    return value_ && PyDict_SetItemString(dict, key, value_) == 0;
+}
+
+static PyObject*
+ParseResult_export_decls(ParseResult *self, PyObject *args, PyObject *kw)
+{
+    static const char *keywords[] = {"threads", NULL};
+    unsigned int threads = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kw, "|I:export_decls",
+                                     (char**)keywords, &threads))
+        return NULL;
+
+    try
+    {
+        cmonster::core::DeclColumns columns;
+        {
+            ScopedGILRelease nogil;
+            columns = cmonster::core::export_decls(
+                self->result->getClangASTContext(),
+                self->result->getDeclIndex(), threads);
+        }
+
+        ScopedPyObject files(PyList_New(columns.filenames.size()));
+        if (!files)
+            return NULL;
+        for (size_t i = 0; i < columns.filenames.size(); ++i)
+        {
+            std::string const& filename = columns.filenames[i];
+            PyObject *s = PyUnicode_FromStringAndSize(
+                filename.data(), filename.size());
+            if (!s)
+                return NULL;
+            PyList_SetItem(files, i, s);
+        }
+
+        ScopedPyObject kind_names(PyDict_New());
+        if (!kind_names)
+            return NULL;
+        for (std::map<uint32_t, std::string>::const_iterator
+                 iter = columns.kind_names.begin();
+             iter != columns.kind_names.end(); ++iter)
+        {
+            ScopedPyObject kind(PyLong_FromUnsignedLong(iter->first));
+            ScopedPyObject name(PyUnicode_FromStringAndSize(
+                iter->second.data(), iter->second.size()));
+            if (!kind || !name ||
+                PyDict_SetItem(kind_names, kind, name) == -1)
+                return NULL;
+        }
+
+        ScopedPyObject result(PyDict_New());
+        if (!result ||
+            !set_item(result, "kind", uint32_bytes(columns.kinds)) ||
+            !set_item(result, "parent", uint32_bytes(columns.parents)) ||
+            !set_item(result, "file", uint32_bytes(columns.files)) ||
+            !set_item(result, "line", uint32_bytes(columns.lines)) ||
+            !set_item(result, "name", string_column(columns.names)) ||
+            !set_item(result, "qualified_name",
+                      string_column(columns.qualified_names)) ||
+            !set_item(result, "type", string_column(columns.types)) ||
+            PyDict_SetItemString(result, "files", files) == -1 ||
+            PyDict_SetItemString(result, "kind_names", kind_names) == -1)
+        {
+            return NULL;
+        }
+        return result.release();
+    }
+    catch (...)
+    {
+        set_python_exception();
+    }
+    return NULL;
+}
+
+// Get the interned string for a presumed filename. Returns a new reference.
+static PyObject*
+get_filename_string(ParseResult *self, const char *filename)
+{
+    if (!self->filename_strings)
+        self->filename_strings = new FilenameStringMap;
+
+    PyObject *&string = (*self->filename_strings)[filename];
+    if (!string)
+    {
+        string = PyUnicode_InternFromString(filename);
+        if (!string)
+        {
+            self->filename_strings->erase(filename);
+            return NULL;
+        }
+    }
+    Py_INCREF(string);
+    return string;
+}
+
+// Read raw location encodings from a bytes object of native-endian uint32
+// values, or from an iterable of integers or SourceLocation objects.
+static bool
+get_raw_locations(PyObject *obj, std::vector<uint32_t> &locations)
+{
+    if (PyBytes_Check(obj))
+    {
+        char *data;
+        Py_ssize_t size;
+        if (PyBytes_AsStringAndSize(obj, &data, &size) == -1)
+            return false;
+        if (size % sizeof(uint32_t))
+        {
+            PyErr_SetString(PyExc_ValueError,
+                "Expected a multiple of 4 bytes of location encodings");
+            return false;
+        }
+        locations.resize(size / sizeof(uint32_t));
+        if (size)
+            memcpy(&locations[0], data, size);
+        return true;
+    }
+
+    ScopedPyObject iter(PyObject_GetIter(obj));
+    if (!iter)
+        return false;
+    for (;;)
+    {
+        ScopedPyObject item(PyIter_Next(iter));
+        if (!item)
+            return !PyErr_Occurred();
+        if (PyObject_TypeCheck(item, get_source_location_type()))
+        {
+            locations.push_back(get_source_location(
+                (SourceLocation*)item.get()).getRawEncoding());
+            continue;
+        }
+        const unsigned long value = PyLong_AsUnsignedLong(item);
+        if (PyErr_Occurred())
+            return false;
+        locations.push_back(static_cast<uint32_t>(value));
+    }
+}
+
+static PyObject*
+ParseResult_decompose_locations(ParseResult *self, PyObject *args)
+{
+    PyObject *locations_;
+    if (!PyArg_ParseTuple(args, "O:decompose_locations", &locations_))
+        return NULL;
+
+    try
+    {
+        std::vector<uint32_t> locations;
+        if (!get_raw_locations(locations_, locations))
+            return NULL;
+
+        cmonster::core::LocationTable table;
+        {
+            ScopedGILRelease nogil;
+            cmonster::core::decompose_locations(
+                self->result->getClangASTContext().getSourceManager(),
+                locations.empty() ? NULL : &locations[0],
+                locations.size(), table);
+        }
+
+        ScopedPyObject files(PyList_New(table.filenames.size()));
+        if (!files)
+            return NULL;
+        for (size_t i = 0; i < table.filenames.size(); ++i)
+        {
+            PyObject *s = get_filename_string(self, table.filenames[i]);
+            if (!s)
+                return NULL;
+            PyList_SetItem(files, i, s);
+        }
+
+        ScopedPyObject file(uint32_bytes(table.files));
+        ScopedPyObject line(uint32_bytes(table.lines));
+        ScopedPyObject column(uint32_bytes(table.columns));
+        if (!file || !line || !column)
+            return NULL;
+        return PyTuple_Pack(4, file.get(), line.get(), column.get(),
+                            files.get());
+    }
+    catch (std::invalid_argument const& e)
+    {
+        PyErr_SetString(PyExc_ValueError, e.what());
+    }
+    catch (...)
+    {
+        set_python_exception();
+    }
+    return NULL;
+}
+
 static PyMethodDef ParseResult_methods[] =
 {
+    {(char*)"find_decls", (PyCFunction)&ParseResult_find_decls,
+     METH_VARARGS | METH_KEYWORDS},
+    {(char*)"match", (PyCFunction)&ParseResult_match,
+     METH_VARARGS | METH_KEYWORDS},
+    {(char*)"get_decl", (PyCFunction)&ParseResult_get_decl, METH_VARARGS},
+    {(char*)"get_decl_info",
+     (PyCFunction)&ParseResult_get_decl_info, METH_VARARGS},
+    {(char*)"export_decls", (PyCFunction)&ParseResult_export_decls,
+     METH_VARARGS | METH_KEYWORDS},
+    {(char*)"decompose_locations",
+     (PyCFunction)&ParseResult_decompose_locations, METH_VARARGS},
     {NULL}
 };
 
@@ -91,15 +698,10 @@ ParseResult_get_translation_unit(ParseResult *self, void *closure)
 {
     if (!TranslationUnitDeclType)
     {
-        ScopedPyObject ast_module(PyImport_ImportModule(
-            "cmonster._cmonster_ast"));
-        if (!ast_module)
-            return NULL;
-        TranslationUnitDeclType = (PyTypeObject*)PyObject_GetAttrString(
-            ast_module, "TranslationUnitDecl");
+        TranslationUnitDeclType =
+            (PyTypeObject*)get_ast_attribute("TranslationUnitDecl");
         if (!TranslationUnitDeclType)
             return NULL;
-        Py_INCREF(TranslationUnitDeclType);
     }
     clang::ASTContext &context(self->result->getClangASTContext());
     clang::TranslationUnitDecl *decl = context.getTranslationUnitDecl();
@@ -112,10 +714,70 @@ ParseResult_get_translation_unit(ParseResult *self, void *closure)
     return NULL;
 }
 
+static PyObject* ParseResult_get_decl_count(ParseResult *self, void *closure)
+{
+    try
+    {
+        return PyLong_FromSize_t(self->result->getDeclIndex().size());
+    }
+    catch (...)
+    {
+        set_python_exception();
+    }
+    return NULL;
+}
+
+static PyObject* ParseResult_get_diagnostics(ParseResult *self, void *closure)
+{
+    static const char *level_names[] = {
+        "ignored", "note", "warning", "error", "fatal"};
+
+    try
+    {
+        cmonster::core::DiagnosticList const& diagnostics =
+            self->result->getDiagnostics();
+        clang::SourceManager &sm =
+            self->result->getClangASTContext().getSourceManager();
+        ScopedPyObject list(PyList_New(diagnostics.size()));
+        if (!list)
+            return NULL;
+        for (size_t i = 0; i < diagnostics.size(); ++i)
+        {
+            cmonster::core::DiagnosticList::Record const& record =
+                diagnostics[i];
+            ScopedPyObject location((PyObject*)create_source_location(
+                clang::SourceLocation::getFromRawEncoding(record.location),
+                sm));
+            if (!location)
+                return NULL;
+            llvm::StringRef message = diagnostics.get_message(i);
+            const char *level = record.level < 5 ?
+                level_names[record.level] : "unknown";
+
+            // (level, id, location, message)
+            PyObject *tuple = Py_BuildValue("(sIOs#)", level, record.id,
+                location.get(), message.data(), (int)message.size());
+            if (!tuple)
+                return NULL;
+            PyList_SetItem(list, i, tuple);
+        }
+        return list.release();
+    }
+    catch (...)
+    {
+        set_python_exception();
+    }
+    return NULL;
+}
+
 static PyGetSetDef ParseResult_getset[] =
 {
     {(char*)"translation_unit", (getter)ParseResult_get_translation_unit,
      NULL, NULL /* docs */, NULL /* closure */},
+    {(char*)"decl_count", (getter)ParseResult_get_decl_count,
+     NULL, NULL /* docs */, NULL /* closure */},
+    {(char*)"diagnostics", (getter)ParseResult_get_diagnostics,
+     NULL, NULL /* docs */, NULL /* closure */},
     {NULL}
 };
 
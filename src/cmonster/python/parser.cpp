@@ -20,17 +20,22 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 
+// XXX Py_LIMITED_API is disabled, as the buffer protocol is not part of the
+// limited API.
 /* Define this to ensure only the limited API is used, so we can ensure forward
  * binary compatibility. */
-#define Py_LIMITED_API
+//#define Py_LIMITED_API
 
 #include <Python.h>
 #include <sstream>
 #include <stdexcept>
 #include <iostream>
+#include <memory>
 
 #include "exception.hpp"
+#include "gil.hpp"
 #include "parser.hpp"
+#include "parser_config.hpp"
 #include "parse_result.hpp"
 #include "preprocessor.hpp"
 #include "scoped_pyobject.hpp"
@@ -45,31 +50,117 @@ struct Parser
 {
     PyObject_HEAD
     cmonster::core::Parser *parser;
+    PyObject *data; // bytes object referenced by the parser, if any
 };
 
 static void Parser_dealloc(Parser* self)
 {
     if (self->parser)
         delete self->parser;
+    Py_XDECREF(self->data);
     PyObject_Del((PyObject*)self);
 }
 
-// TODO support initialising with a file object or a string.
 static int
 Parser_init(Parser *self, PyObject *args, PyObject *kwds)
 {
-    char *buffer;
-    int buflen;
-    char *filename;
-    if (!PyArg_ParseTuple(args, "s#|s", &buffer, &buflen, &filename))
+    PyObject *data;
+    char *filename = NULL;
+    char *pch = NULL;
+    PyObject *config_ = NULL;
+    static const char *keywords[] = {
+        "data", "filename", "pch", "config", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|zzO", (char**)keywords,
+                                     &data, &filename, &pch, &config_))
         return -1;
 
+    boost::shared_ptr<const cmonster::core::ParserConfig> config;
+    if (config_ && config_ != Py_None)
+    {
+        if (!PyObject_TypeCheck(config_, get_parser_config_type()))
+        {
+            PyErr_SetString(PyExc_TypeError, "Expected a ParserConfig");
+            return -1;
+        }
+        config = get_parser_config((ParserConfig*)config_);
+        if (!config)
+        {
+            PyErr_SetString(PyExc_RuntimeError,
+                            "ParserConfig has not been initialised");
+            return -1;
+        }
+    }
+
     try
     {
-        // Create a core parser object.
-        // TODO
-        self->parser = new cmonster::core::Parser(
-            buffer, buflen, filename ? filename : "");
+        const std::string pch_(pch ? pch : "");
+        if (data == Py_None)
+        {
+            // Read the main file directly from disk.
+            if (!filename)
+            {
+                PyErr_SetString(PyExc_ValueError,
+                    "A filename must be specified if data is None");
+                return -1;
+            }
+            self->parser = new cmonster::core::Parser(
+                filename, pch_, config);
+        }
+        else if (PyBytes_Check(data))
+        {
+            // Bytes objects are immutable and always NUL-terminated, so the
+            // parser can refer to the contents directly.
+            char *buffer;
+            Py_ssize_t buflen;
+            if (PyBytes_AsStringAndSize(data, &buffer, &buflen) == -1)
+                return -1;
+            self->parser = new cmonster::core::Parser(
+                buffer, buflen, filename ? filename : "", pch_, false,
+                config);
+            Py_INCREF(data);
+            self->data = data;
+        }
+        else if (PyUnicode_Check(data))
+        {
+            // Encode the str once, and have the parser refer to the
+            // encoded bytes object, which is kept alive with the parser.
+            ScopedPyObject utf8(PyUnicode_AsUTF8String(data));
+            char *buffer;
+            Py_ssize_t buflen;
+            if (!utf8 ||
+                PyBytes_AsStringAndSize(utf8, &buffer, &buflen) == -1)
+                return -1;
+            self->parser = new cmonster::core::Parser(
+                buffer, buflen, filename ? filename : "", pch_, false,
+                config);
+            self->data = utf8.release();
+        }
+        else if (PyObject_CheckBuffer(data))
+        {
+            // Other buffers (e.g. bytearray or mmap objects) may be
+            // modified, and are not NUL-terminated, so they are copied.
+            Py_buffer view;
+            if (PyObject_GetBuffer(data, &view, PyBUF_SIMPLE) == -1)
+                return -1;
+            try
+            {
+                self->parser = new cmonster::core::Parser(
+                    static_cast<const char*>(view.buf), view.len,
+                    filename ? filename : "", pch_, true, config);
+            }
+            catch (...)
+            {
+                PyBuffer_Release(&view);
+                throw;
+            }
+            PyBuffer_Release(&view);
+        }
+        else
+        {
+            PyErr_SetString(PyExc_TypeError,
+                "Expected str, bytes, a buffer or None for data");
+            return -1;
+        }
         return 0;
     }
     catch (...)
@@ -79,12 +170,129 @@ Parser_init(Parser *self, PyObject *args, PyObject *kwds)
     return -1;
 }
 
-static PyObject* Parser_parse(Parser *self, PyObject *args)
+/**
+ * Convert optional boolean keyword arguments to parse options.
+ */
+static bool
+get_parse_options(PyObject *skip_header_bodies, PyObject *delayed_templates,
+                  PyObject *collect_diagnostics, PyObject *syntax_only,
+                  cmonster::core::ParseOptions &options)
+{
+    if (skip_header_bodies)
+    {
+        const int value = PyObject_IsTrue(skip_header_bodies);
+        if (value == -1)
+            return false;
+        if (value)
+        {
+            PyErr_SetString(PyExc_ValueError,
+                "skip_header_bodies is not supported by this version of "
+                "Clang");
+            return false;
+        }
+        options.skip_header_function_bodies = value;
+    }
+    if (delayed_templates)
+    {
+        const int value = PyObject_IsTrue(delayed_templates);
+        if (value == -1)
+            return false;
+        options.delayed_template_parsing = value;
+    }
+    if (collect_diagnostics)
+    {
+        const int value = PyObject_IsTrue(collect_diagnostics);
+        if (value == -1)
+            return false;
+        options.collect_diagnostics = value;
+    }
+    if (syntax_only)
+    {
+        const int value = PyObject_IsTrue(syntax_only);
+        if (value == -1)
+            return false;
+        options.syntax_only = value;
+    }
+    return true;
+}
+
+static PyObject* Parser_parse(Parser *self, PyObject *args, PyObject *kwds)
+{
+    PyObject *skip_header_bodies = NULL;
+    PyObject *delayed_templates = NULL;
+    PyObject *collect_diagnostics = NULL;
+    PyObject *syntax_only = NULL;
+    static const char *keywords[] = {
+        "skip_header_bodies", "delayed_templates", "collect_diagnostics",
+        "syntax_only", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|OOOO:parse",
+                                     (char**)keywords, &skip_header_bodies,
+                                     &delayed_templates, &collect_diagnostics,
+                                     &syntax_only))
+        return NULL;
+    cmonster::core::ParseOptions options;
+    if (!get_parse_options(skip_header_bodies, delayed_templates,
+                           collect_diagnostics, syntax_only, options))
+        return NULL;
+
+    try
+    {
+        std::auto_ptr<cmonster::core::ParseResult> result;
+        {
+            ScopedGILRelease nogil;
+            result.reset(new cmonster::core::ParseResult(
+                self->parser->parse(options)));
+        }
+        return (PyObject*)create_parse_result(self, *result);
+    }
+    catch (...)
+    {
+        set_python_exception();
+    }
+    return NULL;
+}
+
+static PyObject* Parser_reparse(Parser *self, PyObject *args, PyObject *kwds)
 {
+    PyObject *data;
+    PyObject *skip_header_bodies = NULL;
+    PyObject *delayed_templates = NULL;
+    PyObject *collect_diagnostics = NULL;
+    PyObject *syntax_only = NULL;
+    static const char *keywords[] = {
+        "data", "skip_header_bodies", "delayed_templates",
+        "collect_diagnostics", "syntax_only", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|OOOO:reparse",
+                                     (char**)keywords, &data,
+                                     &skip_header_bodies, &delayed_templates,
+                                     &collect_diagnostics, &syntax_only))
+        return NULL;
+    cmonster::core::ParseOptions options;
+    if (!get_parse_options(skip_header_bodies, delayed_templates,
+                           collect_diagnostics, syntax_only, options))
+        return NULL;
+
+    // The data is copied by the parser, so a temporary UTF-8 encoding of a
+    // str object is sufficient.
+    const bool is_str = PyUnicode_Check(data);
+    ScopedPyObject utf8(is_str ? PyUnicode_AsUTF8String(data) : NULL);
+    if (is_str && !utf8)
+        return NULL;
+    char *buffer;
+    Py_ssize_t buflen;
+    if (PyBytes_AsStringAndSize(
+            is_str ? (PyObject*)utf8 : data, &buffer, &buflen) == -1)
+        return NULL;
+
     try
     {
-        cmonster::core::ParseResult result = self->parser->parse();
-        return (PyObject*)create_parse_result(self, result);
+        std::auto_ptr<cmonster::core::ParseResult> result;
+        {
+            ScopedGILRelease nogil;
+            result.reset(new cmonster::core::ParseResult(
+                self->parser->reparse(buffer, buflen, options)));
+        }
+        return (PyObject*)create_parse_result(self, *result);
     }
     catch (...)
     {
@@ -93,9 +301,169 @@ static PyObject* Parser_parse(Parser *self, PyObject *args)
     return NULL;
 }
 
+static PyObject* Parser_reset(Parser *self, PyObject *args, PyObject *kwds)
+{
+    PyObject *data;
+    char *filename = NULL;
+    static const char *keywords[] = {"data", "filename", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|z:reset",
+                                     (char**)keywords, &data, &filename))
+        return NULL;
+
+    try
+    {
+        if (data == Py_None)
+        {
+            if (!filename)
+            {
+                PyErr_SetString(PyExc_ValueError,
+                    "A filename must be specified if data is None");
+                return NULL;
+            }
+            const std::string path(filename);
+            ScopedGILRelease nogil;
+            self->parser->reset(path);
+        }
+        else
+        {
+            // The data is copied by the parser.
+            const bool is_str = PyUnicode_Check(data);
+            if (!is_str && !PyBytes_Check(data))
+            {
+                PyErr_SetString(PyExc_TypeError,
+                    "Expected str, bytes or None for data");
+                return NULL;
+            }
+            ScopedPyObject utf8(is_str ? PyUnicode_AsUTF8String(data) : NULL);
+            if (is_str && !utf8)
+                return NULL;
+            char *buffer;
+            Py_ssize_t buflen;
+            if (PyBytes_AsStringAndSize(
+                    is_str ? (PyObject*)utf8 : data, &buffer, &buflen) == -1)
+                return NULL;
+            ScopedGILRelease nogil;
+            self->parser->reset(buffer, buflen, filename ? filename : "");
+        }
+
+        // The previous main file, if it was given as bytes, is no longer
+        // referenced.
+        Py_CLEAR(self->data);
+        Py_RETURN_NONE;
+    }
+    catch (...)
+    {
+        set_python_exception();
+    }
+    return NULL;
+}
+
+static PyObject* Parser_generate_pch(Parser *self, PyObject *args)
+{
+    char *path;
+    if (!PyArg_ParseTuple(args, "s:generate_pch", &path))
+        return NULL;
+
+    try
+    {
+        {
+            ScopedGILRelease nogil;
+            self->parser->generate_pch(path);
+        }
+        Py_RETURN_NONE;
+    }
+    catch (...)
+    {
+        set_python_exception();
+    }
+    return NULL;
+}
+
+static PyObject*
+Parser_enable_stats(Parser *self, PyObject *args, PyObject *kwds)
+{
+    PyObject *enabled = Py_True;
+    static const char *keywords[] = {"enabled", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O:enable_stats",
+                                     (char**)keywords, &enabled))
+        return NULL;
+    const int enabled_ = PyObject_IsTrue(enabled);
+    if (enabled_ == -1)
+        return NULL;
+    self->parser->getStats().setEnabled(enabled_ == 1);
+    Py_RETURN_NONE;
+}
+
+/**
+ * Create a dict of the statistics for a single phase.
+ */
+static PyObject*
+create_phase_stats(cmonster::core::Stats::PhaseStats const& stats)
+{
+    ScopedPyObject slowest(PyList_New(stats.slowest.size()));
+    if (!slowest)
+        return NULL;
+    for (size_t i = 0; i < stats.slowest.size(); ++i)
+    {
+        std::string const& name = stats.slowest[i].second;
+        PyObject *entry = Py_BuildValue(
+            "(s#K)", name.data(), (int)name.size(),
+            (unsigned long long)stats.slowest[i].first);
+        if (!entry)
+            return NULL;
+        PyList_SetItem(slowest, i, entry);
+    }
+    return Py_BuildValue("{s:K,s:K,s:O}",
+                         "count", (unsigned long long)stats.count,
+                         "total_ns", (unsigned long long)stats.total_ns,
+                         "slowest", (PyObject*)slowest);
+}
+
+static PyObject* Parser_stats(Parser *self, PyObject *args, PyObject *kwds)
+{
+    PyObject *clear = Py_False;
+    static const char *keywords[] = {"clear", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O:stats",
+                                     (char**)keywords, &clear))
+        return NULL;
+    const int clear_ = PyObject_IsTrue(clear);
+    if (clear_ == -1)
+        return NULL;
+
+    cmonster::core::Stats &stats = self->parser->getStats();
+    ScopedPyObject result(PyDict_New());
+    if (!result)
+        return NULL;
+    for (int i = 0; i < cmonster::core::Stats::NUM_PHASES; ++i)
+    {
+        const cmonster::core::Stats::Phase phase =
+            static_cast<cmonster::core::Stats::Phase>(i);
+        ScopedPyObject phase_stats(
+            create_phase_stats(stats.getPhaseStats(phase)));
+        if (!phase_stats || PyDict_SetItemString(
+                result, cmonster::core::Stats::getPhaseName(phase),
+                phase_stats) == -1)
+            return NULL;
+    }
+    if (clear_)
+        stats.clear();
+    return result.release();
+}
+
 static PyMethodDef Parser_methods[] =
 {
-    {(char*)"parse", (PyCFunction)&Parser_parse, METH_VARARGS},
+    {(char*)"parse", (PyCFunction)&Parser_parse,
+     METH_VARARGS | METH_KEYWORDS},
+    {(char*)"reparse", (PyCFunction)&Parser_reparse,
+     METH_VARARGS | METH_KEYWORDS},
+    {(char*)"generate_pch",
+     (PyCFunction)&Parser_generate_pch, METH_VARARGS},
+    {(char*)"reset", (PyCFunction)&Parser_reset,
+     METH_VARARGS | METH_KEYWORDS},
+    {(char*)"enable_stats", (PyCFunction)&Parser_enable_stats,
+     METH_VARARGS | METH_KEYWORDS},
+    {(char*)"stats", (PyCFunction)&Parser_stats,
+     METH_VARARGS | METH_KEYWORDS},
     {NULL}
 };
 
@@ -0,0 +1,260 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* Define this to ensure only the limited API is used, so we can ensure forward
+ * binary compatibility. */
+#define Py_LIMITED_API
+
+#include <Python.h>
+
+#include "exception.hpp"
+#include "parser_config.hpp"
+#include "scoped_pyobject.hpp"
+
+#include <string>
+#include <vector>
+
+namespace cmonster {
+namespace python {
+
+static PyTypeObject *ParserConfigType = NULL;
+PyDoc_STRVAR(ParserConfig_doc,
+    "An immutable target and language configuration, which may be shared\n"
+    "between parsers. The target information is computed once, when the\n"
+    "configuration is created.");
+
+struct ParserConfig
+{
+    PyObject_HEAD
+    boost::shared_ptr<const cmonster::core::ParserConfig> *config;
+};
+
+static void ParserConfig_dealloc(ParserConfig* self)
+{
+    if (self->config)
+        delete self->config;
+    PyObject_Del((PyObject*)self);
+}
+
+/**
+ * Append the paths in an iterable of str to "include_dirs".
+ */
+static bool
+get_include_dirs(PyObject *paths, bool sysinclude,
+                 std::vector<cmonster::core::ParserConfig::IncludeDir>
+                     &include_dirs)
+{
+    if (!paths)
+        return true;
+    ScopedPyObject iter(PyObject_GetIter(paths));
+    if (!iter)
+        return false;
+    while (PyObject *item_ = PyIter_Next(iter))
+    {
+        ScopedPyObject item(item_);
+        ScopedPyObject utf8(PyUnicode_AsUTF8String(item));
+        if (!utf8)
+            return false;
+        char *path;
+        Py_ssize_t path_size;
+        if (PyBytes_AsStringAndSize(utf8, &path, &path_size) == -1)
+            return false;
+        include_dirs.push_back(std::make_pair(
+            std::string(path, path_size), sysinclude));
+    }
+    return !PyErr_Occurred();
+}
+
+static int
+ParserConfig_init(ParserConfig *self, PyObject *args, PyObject *kwds)
+{
+    const char *triple = NULL;
+    const char *language = "c++";
+    const char *standard = NULL;
+    PyObject *include_dirs = NULL;
+    PyObject *system_include_dirs = NULL;
+    const char *predefines = NULL;
+    static const char *keywords[] = {
+        "triple", "language", "standard", "include_dirs",
+        "system_include_dirs", "predefines", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|zszOOz:ParserConfig",
+                                     (char**)keywords, &triple, &language,
+                                     &standard, &include_dirs,
+                                     &system_include_dirs, &predefines))
+        return -1;
+
+    std::vector<cmonster::core::ParserConfig::IncludeDir> dirs;
+    if (!get_include_dirs(include_dirs, false, dirs) ||
+        !get_include_dirs(system_include_dirs, true, dirs))
+        return -1;
+
+    try
+    {
+        boost::shared_ptr<const cmonster::core::ParserConfig> *config =
+            new boost::shared_ptr<const cmonster::core::ParserConfig>(
+                new cmonster::core::ParserConfig(
+                    triple ? triple : "", language, standard ? standard : "",
+                    dirs, predefines ? predefines : ""));
+        // __init__ may be called again; parsers keep their own reference
+        // to the previous configuration.
+        delete self->config;
+        self->config = config;
+        return 0;
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return -1;
+    }
+}
+
+static PyObject* get_string(std::string const& value)
+{
+    return PyUnicode_FromStringAndSize(value.data(), value.size());
+}
+
+/**
+ * Get the configuration, or raise RuntimeError and return NULL if the
+ * object has not been initialised (e.g. if __init__ was never called).
+ */
+static const cmonster::core::ParserConfig* get_config(ParserConfig *self)
+{
+    if (!self->config)
+    {
+        PyErr_SetString(PyExc_RuntimeError,
+                        "ParserConfig has not been initialised");
+        return NULL;
+    }
+    return self->config->get();
+}
+
+static PyObject* ParserConfig_get_triple(ParserConfig *self, void *closure)
+{
+    const cmonster::core::ParserConfig *config = get_config(self);
+    return config ? get_string(config->getTriple()) : NULL;
+}
+
+static PyObject* ParserConfig_get_language(ParserConfig *self, void *closure)
+{
+    const cmonster::core::ParserConfig *config = get_config(self);
+    return config ? get_string(config->getLanguage()) : NULL;
+}
+
+static PyObject* ParserConfig_get_standard(ParserConfig *self, void *closure)
+{
+    const cmonster::core::ParserConfig *config = get_config(self);
+    if (!config)
+        return NULL;
+    std::string const& standard = config->getStandard();
+    if (standard.empty())
+        Py_RETURN_NONE;
+    return get_string(standard);
+}
+
+static PyObject*
+ParserConfig_get_include_dirs(ParserConfig *self, void *closure)
+{
+    const cmonster::core::ParserConfig *config = get_config(self);
+    if (!config)
+        return NULL;
+    std::vector<cmonster::core::ParserConfig::IncludeDir> const& dirs =
+        config->getIncludeDirs();
+    ScopedPyObject result(PyTuple_New(dirs.size()));
+    if (!result)
+        return NULL;
+    for (size_t i = 0; i < dirs.size(); ++i)
+    {
+        PyObject *dir = Py_BuildValue("(s#O)", dirs[i].first.data(),
+                                      (int)dirs[i].first.size(),
+                                      dirs[i].second ? Py_True : Py_False);
+        if (!dir)
+            return NULL;
+        PyTuple_SetItem(result, i, dir);
+    }
+    return result.release();
+}
+
+static PyObject*
+ParserConfig_get_predefines(ParserConfig *self, void *closure)
+{
+    const cmonster::core::ParserConfig *config = get_config(self);
+    return config ? get_string(config->getPredefines()) : NULL;
+}
+
+static PyGetSetDef ParserConfig_getset[] =
+{
+    {(char*)"triple", (getter)ParserConfig_get_triple,
+     NULL, NULL /* docs */, NULL /* closure */},
+    {(char*)"language", (getter)ParserConfig_get_language,
+     NULL, NULL /* docs */, NULL /* closure */},
+    {(char*)"standard", (getter)ParserConfig_get_standard,
+     NULL, NULL /* docs */, NULL /* closure */},
+    {(char*)"include_dirs", (getter)ParserConfig_get_include_dirs,
+     NULL, NULL /* docs */, NULL /* closure */},
+    {(char*)"predefines", (getter)ParserConfig_get_predefines,
+     NULL, NULL /* docs */, NULL /* closure */},
+    {NULL}
+};
+
+static PyType_Slot ParserConfigTypeSlots[] =
+{
+    {Py_tp_dealloc,  (void*)ParserConfig_dealloc},
+    {Py_tp_init,     (void*)ParserConfig_init},
+    {Py_tp_getset,   (void*)ParserConfig_getset},
+    {Py_tp_doc,      (void*)ParserConfig_doc},
+    {Py_tp_alloc,    (void*)PyType_GenericAlloc},
+    {Py_tp_new,      (void*)PyType_GenericNew},
+    {0, NULL}
+};
+
+static PyType_Spec ParserConfigTypeSpec =
+{
+    "cmonster._cmonster.ParserConfig",
+    sizeof(ParserConfig),
+    0,
+    Py_TPFLAGS_DEFAULT|Py_TPFLAGS_BASETYPE,
+    ParserConfigTypeSlots
+};
+
+PyTypeObject* init_parser_config_type()
+{
+    ParserConfigType = (PyTypeObject*)PyType_FromSpec(&ParserConfigTypeSpec);
+    if (!ParserConfigType)
+        return NULL;
+    if (PyType_Ready((PyTypeObject*)ParserConfigType) < 0)
+        return NULL;
+    return ParserConfigType;
+}
+
+PyTypeObject* get_parser_config_type()
+{
+    return ParserConfigType;
+}
+
+boost::shared_ptr<const cmonster::core::ParserConfig> const&
+get_parser_config(ParserConfig *wrapper)
+{
+    static const boost::shared_ptr<const cmonster::core::ParserConfig> none;
+    return wrapper->config ? *wrapper->config : none;
+}
+
+}}
@@ -0,0 +1,54 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _CMONSTER_PYTHON_PARSER_CONFIG_HPP
+#define _CMONSTER_PYTHON_PARSER_CONFIG_HPP
+
+#include "../core/parser_config.hpp"
+
+#include <boost/shared_ptr.hpp>
+
+namespace cmonster {
+namespace python {
+
+struct ParserConfig;
+
+/**
+ * Initialise the ParserConfig Python type object.
+ */
+PyTypeObject* init_parser_config_type();
+
+/**
+ * Get the ParserConfig Python type object.
+ */
+PyTypeObject* get_parser_config_type();
+
+/**
+ * Get the core ParserConfig wrapped by a ParserConfig Python object, or a
+ * null pointer if the object has not been initialised.
+ */
+boost::shared_ptr<const cmonster::core::ParserConfig> const&
+get_parser_config(ParserConfig *wrapper);
+
+}}
+
+#endif
@@ -26,18 +26,29 @@ SOFTWARE.
 
 #include <Python.h>
 
+#include <llvm/ADT/DenseMap.h>
+
+#include <algorithm>
 #include <cstdio>
 #include <fstream>
 #include <sstream>
 #include <stdexcept>
 #include <iostream>
 
+#include "../core/builtin_macros.hpp"
+#include "../core/token_iterator.hpp"
 #include "exception.hpp"
+#include "gil.hpp"
 #include "function_macro.hpp"
+#include "file_cache.hpp"
+#include "include_cache.hpp"
 #include "include_locator.hpp"
+#include "output_stream.hpp"
 #include "parser.hpp"
 #include "preprocessor.hpp"
 #include "scoped_pyobject.hpp"
+#include "source_location.hpp"
+#include "token_filter.hpp"
 #include "token_iterator.hpp"
 #include "token_predicate.hpp"
 #include "token.hpp"
@@ -48,11 +59,26 @@ namespace python {
 static PyTypeObject *PreprocessorType = NULL;
 PyDoc_STRVAR(Preprocessor_doc, "Preprocessor objects");
 
+typedef llvm::DenseMap<clang::IdentifierInfo const*, PyObject*>
+    IdentifierStringMap;
+
+static void clear_identifier_strings(IdentifierStringMap &strings)
+{
+    for (IdentifierStringMap::iterator iter = strings.begin();
+         iter != strings.end(); ++iter)
+    {
+        Py_DECREF(iter->second);
+    }
+    strings.clear();
+}
+
 struct Preprocessor
 {
     PyObject_HEAD
     Parser *parser;
     cmonster::core::Preprocessor *preprocessor;
+    IdentifierStringMap *identifier_strings;
+    unsigned int identifier_generation; // Generation of identifier_strings
 };
 
 Preprocessor* create_preprocessor(Parser *parser)
@@ -77,8 +103,90 @@ static PyObject* Preprocessor_iter(Preprocessor *pp)
     }
 }
 
+static PyObject*
+Preprocessor_iter_batches(Preprocessor *self, PyObject *args, PyObject *kwds)
+{
+    static const char *keywords[] = {"batch_size", "pipelined", NULL};
+    Py_ssize_t batch_size = 1024;
+    PyObject *pipelined = Py_False;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|nO:iter_batches",
+                                     (char**)keywords, &batch_size,
+                                     &pipelined))
+        return NULL;
+    try
+    {
+        return (PyObject*)create_batch_iterator(
+            self, batch_size, PyObject_IsTrue(pipelined));
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
+static PyObject*
+Preprocessor_filter(Preprocessor *self, PyObject *args, PyObject *kwds)
+{
+    PyObject *predicate_;
+    Py_ssize_t batch_size = 0;
+    static const char *keywords[] = {"predicate", "batch_size", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|n:filter",
+                                     (char**)keywords, &predicate_,
+                                     &batch_size))
+        return NULL;
+    if (batch_size < 0)
+    {
+        PyErr_SetString(PyExc_ValueError, "batch size must be positive");
+        return NULL;
+    }
+
+    try
+    {
+        // Native filters are applied without calling into Python; any
+        // other callable is called once per token.
+        cmonster::core::TokenPredicatePtr predicate;
+        if (PyObject_TypeCheck(predicate_, get_token_filter_type()))
+        {
+            predicate = get_token_filter((TokenFilter*)predicate_);
+            if (!predicate)
+                return NULL;
+        }
+        else if (PyCallable_Check(predicate_))
+        {
+            predicate.reset(new cmonster::python::TokenPredicate(
+                self, predicate_));
+        }
+        else
+        {
+            PyErr_SetString(PyExc_TypeError,
+                "Expected a TokenFilter or callable");
+            return NULL;
+        }
+
+        // The filtered iterator owns the underlying iterator as soon as it
+        // is constructed, even if its first advance throws.
+        std::auto_ptr<cmonster::core::TokenIterator> iterator(
+            self->preprocessor->create_iterator());
+        cmonster::core::TokenIterator *filtered =
+            new cmonster::core::FilteredTokenIterator(
+                iterator.release(), predicate);
+        return (PyObject*)create_iterator(self, filtered, batch_size);
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
 static void Preprocessor_dealloc(Preprocessor* self)
 {
+    if (self->identifier_strings)
+    {
+        clear_identifier_strings(*self->identifier_strings);
+        delete self->identifier_strings;
+    }
     Py_XDECREF(self->parser);
     PyObject_Del((PyObject*)self);
 }
@@ -111,10 +219,118 @@ Preprocessor_add_include_dir(Preprocessor* self, PyObject *args)
 
     try
     {
-        self->preprocessor->add_include_dir(
-            path, PyObject_IsTrue(sysinclude));
-        Py_INCREF(Py_None);
-        return Py_None;
+        if (self->preprocessor->add_include_dir(
+                path, PyObject_IsTrue(sysinclude)))
+            Py_RETURN_TRUE;
+        Py_RETURN_FALSE;
+    }
+    catch (...)
+    {
+        set_python_exception();
+    }
+    return NULL;
+}
+
+static PyObject*
+Preprocessor_add_predefines(Preprocessor* self, PyObject *args)
+{
+    const char *predefines;
+    int predefines_size;
+    if (!PyArg_ParseTuple(args, "s#:add_predefines",
+                          &predefines, &predefines_size))
+        return NULL;
+
+    try
+    {
+        self->preprocessor->add_predefines(
+            std::string(predefines, predefines_size));
+        Py_RETURN_NONE;
+    }
+    catch (...)
+    {
+        set_python_exception();
+    }
+    return NULL;
+}
+
+/**
+ * Append the UTF-8 encoding of a str object to "out".
+ */
+static bool append_utf8(PyObject *obj, std::string &out)
+{
+    ScopedPyObject utf8(PyUnicode_AsUTF8String(obj));
+    char *data;
+    Py_ssize_t size;
+    if (!utf8 || PyBytes_AsStringAndSize(utf8, &data, &size) == -1)
+        return false;
+    out.append(data, size);
+    return true;
+}
+
+static PyObject*
+Preprocessor_define_many(Preprocessor* self, PyObject *args)
+{
+    PyObject *definitions;
+    if (!PyArg_ParseTuple(args, "O:define_many", &definitions))
+        return NULL;
+
+    // Either a block of "#define" directives, or an iterable of (name,
+    // value) pairs, which are formatted as directives.
+    std::string block;
+    if (PyUnicode_Check(definitions))
+    {
+        if (!append_utf8(definitions, block))
+            return NULL;
+    }
+    else
+    {
+        ScopedPyObject iter(PyObject_GetIter(definitions));
+        if (!iter)
+            return NULL;
+        for (;;)
+        {
+            ScopedPyObject item(PyIter_Next(iter));
+            if (!item)
+            {
+                if (PyErr_Occurred())
+                    return NULL;
+                break;
+            }
+            ScopedPyObject pair(PySequence_Tuple(item));
+            PyObject *name, *value;
+            if (!pair ||
+                !PyArg_ParseTuple(pair, "UO:define_many", &name, &value))
+                return NULL;
+            block.append("#define ");
+            if (!append_utf8(name, block))
+                return NULL;
+            if (value != Py_None)
+            {
+                if (!PyUnicode_Check(value))
+                {
+                    PyErr_SetString(PyExc_TypeError,
+                        "Expected str or None for macro value");
+                    return NULL;
+                }
+                const size_t value_start = block.size() + 1;
+                block.push_back(' ');
+                if (!append_utf8(value, block))
+                    return NULL;
+                // A newline would end the directive.
+                std::replace(block.begin() + value_start, block.end(),
+                             '\n', ' ');
+            }
+            block.push_back('\n');
+        }
+    }
+
+    try
+    {
+        return PyLong_FromSize_t(self->preprocessor->define_many(block));
+    }
+    catch (std::invalid_argument const& e)
+    {
+        PyErr_SetString(PyExc_ValueError, e.what());
     }
     catch (...)
     {
@@ -123,11 +339,51 @@ Preprocessor_add_include_dir(Preprocessor* self, PyObject *args)
     return NULL;
 }
 
-static PyObject* Preprocessor_define(Preprocessor* self, PyObject *args)
+/**
+ * Determine whether a function macro should be memoized: if "pure" is not
+ * specified, then the callable may be marked with a true
+ * "__cmonster_pure__" attribute (see cmonster.pure).
+ */
+static int is_pure(PyObject *callable, PyObject *pure)
+{
+    if (pure)
+        return PyObject_IsTrue(pure);
+    ScopedPyObject attr(PyObject_GetAttrString(callable, "__cmonster_pure__"));
+    if (!attr)
+    {
+        PyErr_Clear();
+        return 0;
+    }
+    return PyObject_IsTrue(attr);
+}
+
+/**
+ * Create a function macro for a Python callable, memoizing its results if
+ * it is pure.
+ */
+static boost::shared_ptr<cmonster::core::FunctionMacro>
+create_function_macro(Preprocessor *self, PyObject *callable, bool pure)
+{
+    boost::shared_ptr<cmonster::core::FunctionMacro> function(
+        new cmonster::python::FunctionMacro(self, callable));
+    if (pure)
+    {
+        function.reset(
+            new cmonster::core::MemoizingFunctionMacro(function));
+    }
+    return function;
+}
+
+static PyObject*
+Preprocessor_define(Preprocessor* self, PyObject *args, PyObject *kwds)
 {
     PyObject *macro;
     PyObject *value = NULL;
-    if (!PyArg_ParseTuple(args, "O|O:define", &macro, &value))
+    PyObject *pure = NULL;
+    static const char *keywords[] = {"macro", "value", "pure", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|OO:define",
+                                     (char**)keywords, &macro, &value,
+                                     &pure))
         return NULL;
 
     try
@@ -162,10 +418,11 @@ static PyObject* Preprocessor_define(Preprocessor* self, PyObject *args)
                     }
                     else if (PyCallable_Check(value)) // define(name, callable)
                     {
-                        boost::shared_ptr<cmonster::core::FunctionMacro>
-                            function(new cmonster::python::FunctionMacro(
-                                self, value));
-                        self->preprocessor->define(macro_name, function);
+                        const int pure_ = is_pure(value, pure);
+                        if (pure_ == -1)
+                            return NULL;
+                        self->preprocessor->define(macro_name,
+                            create_function_macro(self, value, pure_ == 1));
                     }
                     else
                     {
@@ -189,9 +446,11 @@ static PyObject* Preprocessor_define(Preprocessor* self, PyObject *args)
         {
             // TODO ensure "value" was not specified.
             const char *name = PyEval_GetFuncName(macro);
-            boost::shared_ptr<cmonster::core::FunctionMacro>
-                function(new cmonster::python::FunctionMacro(self, macro));
-            self->preprocessor->define(name, function);
+            const int pure_ = is_pure(macro, pure);
+            if (pure_ == -1)
+                return NULL;
+            self->preprocessor->define(
+                name, create_function_macro(self, macro, pure_ == 1));
         }
         else
         {
@@ -239,6 +498,86 @@ static PyObject* Preprocessor_add_pragma(Preprocessor* self, PyObject *args)
     return Py_None;
 }
 
+static PyObject*
+Preprocessor_define_builtin(Preprocessor* self, PyObject *args)
+{
+    const Py_ssize_t nargs = PyTuple_Size(args);
+    if (nargs < 2)
+    {
+        PyErr_SetString(PyExc_TypeError,
+            "define_builtin expects at least two arguments (name, kind)");
+        return NULL;
+    }
+
+    // All arguments must be strings: name, kind, and then any parameters.
+    std::vector<std::string> strings;
+    strings.reserve(nargs);
+    for (Py_ssize_t i = 0; i < nargs; ++i)
+    {
+        PyObject *arg = PyTuple_GetItem(args, i);
+        if (!PyUnicode_Check(arg))
+        {
+            PyErr_SetString(PyExc_TypeError,
+                "define_builtin expects string arguments");
+            return NULL;
+        }
+        ScopedPyObject utf8(PyUnicode_AsUTF8String(arg));
+        if (!utf8)
+            return NULL;
+        char *buffer;
+        Py_ssize_t size;
+        if (PyBytes_AsStringAndSize(utf8, &buffer, &size) == -1)
+            return NULL;
+        strings.push_back(std::string(buffer, size));
+    }
+
+    try
+    {
+        std::vector<std::string> params(strings.begin() + 2, strings.end());
+        boost::shared_ptr<cmonster::core::FunctionMacro> function =
+            cmonster::core::create_builtin_macro(
+                *self->preprocessor, strings[1], params);
+        if (!function)
+        {
+            PyErr_Format(PyExc_ValueError, "unknown builtin macro kind: %s",
+                         strings[1].c_str());
+            return NULL;
+        }
+        self->preprocessor->define(strings[0], function);
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject*
+Preprocessor_define_native(Preprocessor* self, PyObject *args)
+{
+    const char *name = NULL;
+    const char *library = NULL;
+    const char *symbol = NULL;
+    if (!PyArg_ParseTuple(args, "sss:define_native",
+                          &name, &library, &symbol))
+        return NULL;
+
+    try
+    {
+        boost::shared_ptr<cmonster::core::FunctionMacro> function =
+            cmonster::core::create_native_macro(
+                *self->preprocessor, library, symbol);
+        self->preprocessor->define(name, function);
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
 static PyObject* Preprocessor_tokenize(Preprocessor* self, PyObject *args)
 {
     const char *s = NULL;
@@ -273,49 +612,177 @@ static PyObject* Preprocessor_tokenize(Preprocessor* self, PyObject *args)
     return Py_None;
 }
 
-static PyObject* Preprocessor_preprocess(Preprocessor* self, PyObject *args)
+static PyObject*
+Preprocessor_preprocess(Preprocessor* self, PyObject *args, PyObject *kw)
 {
     PyObject *f = NULL;
-    if (!PyArg_ParseTuple(args, "|O:preprocess", &f))
+    Py_ssize_t buffer_size = DEFAULT_OUTPUT_BUFFER_SIZE;
+    static const char *keywords[] = {"file", "buffer_size", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kw, "|On:preprocess",
+                                     (char**)keywords, &f, &buffer_size))
+        return NULL;
+    if (buffer_size <= 0)
+    {
+        PyErr_SetString(PyExc_ValueError, "buffer_size must be positive");
+        return NULL;
+    }
+
+    output_stream out;
+    if (!out.open(f, static_cast<size_t>(buffer_size)))
         return NULL;
     try
     {
-        boost::shared_ptr<FILE> file;
-        long fd;
-        if (!f || f == Py_None)
+        ScopedGILRelease nogil;
+        self->preprocessor->preprocess(out.get());
+    }
+    catch (...)
+    {
+        // Close the stream, discarding any error it raises in favour of the
+        // original exception.
+        set_python_exception();
+        PyObject *exc, *val, *tb;
+        PyErr_Fetch(&exc, &val, &tb);
+        out.close();
+        PyErr_Clear();
+        PyErr_Restore(exc, val, tb);
+        return NULL;
+    }
+    if (!out.close())
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+static PyObject*
+Preprocessor_preprocess_to_bytes(Preprocessor* self, PyObject *args)
+{
+    if (!PyArg_ParseTuple(args, ":preprocess_to_bytes"))
+        return NULL;
+    try
+    {
+        std::string buffer;
         {
-            fd = fileno(stdout);
+            ScopedGILRelease nogil;
+            llvm::raw_string_ostream out(buffer);
+            self->preprocessor->preprocess(out);
+            out.flush();
         }
-        else if (PyUnicode_Check(f))
+        return PyBytes_FromStringAndSize(buffer.data(), buffer.size());
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
+// Convert a string to a Python str, or None if it is empty.
+static PyObject* string_or_none(std::string const& s)
+{
+    if (s.empty())
+        Py_RETURN_NONE;
+    return PyUnicode_FromStringAndSize(s.data(), s.size());
+}
+
+static PyObject*
+Preprocessor_scan_dependencies(Preprocessor* self, PyObject *args)
+{
+    if (!PyArg_ParseTuple(args, ":scan_dependencies"))
+        return NULL;
+    try
+    {
+        cmonster::core::IncludeGraph graph;
         {
-            ScopedPyObject utf8_filename(PyUnicode_AsUTF8String(f));
-            const char *filename;
-            if (utf8_filename && (filename = PyBytes_AsString(utf8_filename)))
-            {
-                file.reset(fopen(filename, "w"), &fclose);
-                fd = fileno(file.get());
-            }
-            else
-            {
-                return NULL;
-            }
+            ScopedGILRelease nogil;
+            graph = self->preprocessor->scan_dependencies();
         }
-        else
+
+        // Each inclusion is returned as a tuple of (includer, filename,
+        // angled, line, path, guard, pragma_once).
+        ScopedPyObject result(PyList_New(graph.size()));
+        if (!result)
+            return NULL;
+        for (size_t i = 0; i < graph.size(); ++i)
         {
-            // Assume it's a file-like object with a fileno() method.
-            PyObject *pylong = PyObject_CallMethod(f, (char*)"fileno", NULL);
-            if (!pylong || (fd = PyLong_AsLong(pylong)) == -1)
+            cmonster::core::Inclusion const& inclusion = graph[i];
+            PyObject *value = Py_BuildValue("(s#s#OINNO)",
+                inclusion.includer.data(), (int)inclusion.includer.size(),
+                inclusion.filename.data(), (int)inclusion.filename.size(),
+                inclusion.angled ? Py_True : Py_False,
+                inclusion.line,
+                string_or_none(inclusion.path),
+                string_or_none(inclusion.guard),
+                inclusion.pragma_once ? Py_True : Py_False);
+            if (!value)
                 return NULL;
+            PyList_SetItem(result, i, value);
         }
-        self->preprocessor->preprocess(fd);
+        return result.release();
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
+static PyObject*
+Preprocessor_write_token_cache(Preprocessor* self, PyObject *args)
+{
+    const char *path;
+    const char *key = "";
+    if (!PyArg_ParseTuple(args, "s|s:write_token_cache", &path, &key))
+        return NULL;
+    try
+    {
+        {
+            ScopedGILRelease nogil;
+            self->preprocessor->write_token_cache(path, key);
+        }
+        Py_RETURN_NONE;
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
+static PyObject*
+Preprocessor_is_token_cache_valid(Preprocessor* self, PyObject *args)
+{
+    const char *path;
+    const char *key = "";
+    if (!PyArg_ParseTuple(args, "s|s:is_token_cache_valid", &path, &key))
+        return NULL;
+    try
+    {
+        if (self->preprocessor->is_token_cache_valid(path, key))
+            Py_RETURN_TRUE;
+        Py_RETURN_FALSE;
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
+static PyObject*
+Preprocessor_read_token_cache(Preprocessor* self, PyObject *args)
+{
+    const char *path;
+    if (!PyArg_ParseTuple(args, "s:read_token_cache", &path))
+        return NULL;
+    try
+    {
+        return (PyObject*)create_iterator(
+            self, self->preprocessor->read_token_cache(path));
     }
     catch (...)
     {
         set_python_exception();
         return NULL;
     }
-    Py_INCREF(Py_None);
-    return Py_None;
 }
 
 static PyObject* Preprocessor_next(Preprocessor* self, PyObject *args)
@@ -345,10 +812,33 @@ static PyObject* Preprocessor_next(Preprocessor* self, PyObject *args)
     }
 }
 
-PyObject* Preprocessor_format_tokens(Preprocessor *self, PyObject *args)
+static PyObject*
+Preprocessor_capture_until(Preprocessor* self, PyObject *args)
 {
+    const char *identifier;
+    if (!PyArg_ParseTuple(args, "s:capture_until", &identifier))
+        return NULL;
+    try
+    {
+        std::string const& text =
+            self->preprocessor->capture_until(identifier);
+        return PyUnicode_FromStringAndSize(text.data(), text.size());
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
+PyObject*
+Preprocessor_format_tokens(Preprocessor *self, PyObject *args, PyObject *kwds)
+{
+    static const char *keywords[] = {"tokens", "compact", NULL};
     PyObject *tokens;
-    if (!PyArg_ParseTuple(args, "O:format_tokens", &tokens))
+    PyObject *compact = Py_False;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|O:format_tokens",
+                                     (char**)keywords, &tokens, &compact))
         return NULL;
 
     ScopedPyObject iter(PyObject_GetIter(tokens));
@@ -378,10 +868,14 @@ PyObject* Preprocessor_format_tokens(Preprocessor *self, PyObject *args)
         }
 
         // Format the sequence of tokens.
-        std::ostringstream ss;
+        std::string formatted;
         if (!token_vector.empty())
-            self->preprocessor->format(ss, token_vector);
-        std::string formatted = ss.str();
+        {
+            llvm::raw_string_ostream out(formatted);
+            self->preprocessor->format(
+                out, token_vector, PyObject_IsTrue(compact));
+            out.flush();
+        }
         return PyUnicode_FromStringAndSize(formatted.data(), formatted.size());
     }
     catch (...)
@@ -418,29 +912,313 @@ PyObject* Preprocessor_set_include_locator(Preprocessor *self, PyObject *args)
     }
 }
 
+PyObject* Preprocessor_set_include_cache(Preprocessor *self, PyObject *args)
+{
+    PyObject *cache_;
+    if (!PyArg_ParseTuple(args, "O:set_include_cache", &cache_))
+        return NULL;
+
+    if (!PyObject_TypeCheck(cache_, get_include_cache_type()))
+    {
+        PyErr_SetString(PyExc_TypeError, "Expected an IncludeCache");
+        return NULL;
+    }
+
+    try
+    {
+        self->preprocessor->set_include_cache(
+            get_include_cache((IncludeCache*)cache_));
+        Py_RETURN_NONE;
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
+PyObject* Preprocessor_set_file_cache(Preprocessor *self, PyObject *args)
+{
+    PyObject *cache_;
+    if (!PyArg_ParseTuple(args, "O:set_file_cache", &cache_))
+        return NULL;
+
+    if (!PyObject_TypeCheck(cache_, get_file_cache_type()))
+    {
+        PyErr_SetString(PyExc_TypeError, "Expected a FileCache");
+        return NULL;
+    }
+
+    try
+    {
+        self->preprocessor->set_file_cache(
+            get_file_cache((FileCache*)cache_));
+        Py_RETURN_NONE;
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
+static PyObject*
+Preprocessor_get_entered_files(Preprocessor *self, PyObject *args)
+{
+    if (!PyArg_ParseTuple(args, ":get_entered_files"))
+        return NULL;
+
+    try
+    {
+        std::vector<std::string> const& files =
+            self->preprocessor->get_entered_files();
+        ScopedPyObject result(PyList_New(files.size()));
+        if (!result)
+            return NULL;
+        for (size_t i = 0; i < files.size(); ++i)
+        {
+            PyObject *path = PyUnicode_FromStringAndSize(
+                files[i].data(), files[i].size());
+            if (!path)
+                return NULL;
+            PyList_SetItem(result, i, path);
+        }
+        return result.release();
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
+static PyObject*
+Preprocessor_get_guarded_files(Preprocessor *self, PyObject *args)
+{
+    if (!PyArg_ParseTuple(args, ":get_guarded_files"))
+        return NULL;
+
+    try
+    {
+        std::map<std::string, std::string> const& guards =
+            self->preprocessor->get_guarded_files();
+        ScopedPyObject result(PyDict_New());
+        if (!result)
+            return NULL;
+        for (std::map<std::string, std::string>::const_iterator
+                 iter = guards.begin(); iter != guards.end(); ++iter)
+        {
+            ScopedPyObject path(PyUnicode_FromStringAndSize(
+                iter->first.data(), iter->first.size()));
+            ScopedPyObject guard(PyUnicode_FromStringAndSize(
+                iter->second.data(), iter->second.size()));
+            if (!path || !guard ||
+                PyDict_SetItem(result, path, guard) == -1)
+                return NULL;
+        }
+        return result.release();
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
+static PyObject*
+Preprocessor_add_guarded_files(Preprocessor *self, PyObject *args)
+{
+    PyObject *guards_;
+    if (!PyArg_ParseTuple(args, "O!:add_guarded_files",
+                          &PyDict_Type, &guards_))
+        return NULL;
+
+    std::map<std::string, std::string> guards;
+    ScopedPyObject items(PyDict_Items(guards_));
+    if (!items)
+        return NULL;
+    for (Py_ssize_t i = 0; i < PyList_Size(items); ++i)
+    {
+        PyObject *path, *guard;
+        if (!PyArg_ParseTuple(PyList_GetItem(items, i),
+                              "UU:add_guarded_files", &path, &guard))
+            return NULL;
+        ScopedPyObject path_utf8(PyUnicode_AsUTF8String(path));
+        ScopedPyObject guard_utf8(PyUnicode_AsUTF8String(guard));
+        if (!path_utf8 || !guard_utf8)
+            return NULL;
+        guards[PyBytes_AsString(path_utf8)] = PyBytes_AsString(guard_utf8);
+    }
+
+    try
+    {
+        self->preprocessor->add_guarded_files(guards);
+        Py_RETURN_NONE;
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
+static PyObject*
+Preprocessor_set_streaming(Preprocessor *self, PyObject *args)
+{
+    Py_ssize_t window = 1024 * 1024;
+    if (!PyArg_ParseTuple(args, "|n:set_streaming", &window))
+        return NULL;
+    if (window < 0)
+    {
+        PyErr_SetString(PyExc_ValueError, "window must not be negative");
+        return NULL;
+    }
+    self->preprocessor->set_streaming(static_cast<size_t>(window));
+    Py_RETURN_NONE;
+}
+
+static PyObject*
+Preprocessor_enable_profiling(Preprocessor *self, PyObject *args,
+                              PyObject *kwds)
+{
+    PyObject *enabled = Py_True;
+    static const char *keywords[] = {"enabled", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O:enable_profiling",
+                                     (char**)keywords, &enabled))
+        return NULL;
+    const int enabled_ = PyObject_IsTrue(enabled);
+    if (enabled_ == -1)
+        return NULL;
+    self->preprocessor->get_profiler().setEnabled(enabled_ == 1);
+    Py_RETURN_NONE;
+}
+
+static PyObject*
+Preprocessor_profile(Preprocessor *self, PyObject *args, PyObject *kwds)
+{
+    PyObject *tokens = Py_False;
+    PyObject *clear = Py_False;
+    static const char *keywords[] = {"tokens", "clear", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|OO:profile",
+                                     (char**)keywords, &tokens, &clear))
+        return NULL;
+    const int tokens_ = PyObject_IsTrue(tokens);
+    if (tokens_ == -1)
+        return NULL;
+    const int clear_ = PyObject_IsTrue(clear);
+    if (clear_ == -1)
+        return NULL;
+
+    cmonster::core::Profiler &profiler = self->preprocessor->get_profiler();
+    std::string buffer;
+    {
+        llvm::raw_string_ostream out(buffer);
+        profiler.write_folded(out, tokens_ == 1);
+        out.flush();
+    }
+    if (clear_)
+        profiler.clear();
+    return PyUnicode_FromStringAndSize(buffer.data(), buffer.size());
+}
+
 static PyMethodDef Preprocessor_methods[] =
 {
     {(char*)"add_include_dir",
      (PyCFunction)&Preprocessor_add_include_dir, METH_VARARGS},
     {(char*)"define",
-     (PyCFunction)&Preprocessor_define, METH_VARARGS},
+     (PyCFunction)&Preprocessor_define, METH_VARARGS | METH_KEYWORDS},
+    {(char*)"add_predefines",
+     (PyCFunction)&Preprocessor_add_predefines, METH_VARARGS},
+    {(char*)"define_many",
+     (PyCFunction)&Preprocessor_define_many, METH_VARARGS},
     {(char*)"add_pragma",
      (PyCFunction)&Preprocessor_add_pragma, METH_VARARGS},
+    {(char*)"define_builtin",
+     (PyCFunction)&Preprocessor_define_builtin, METH_VARARGS},
+    {(char*)"define_native",
+     (PyCFunction)&Preprocessor_define_native, METH_VARARGS},
     {(char*)"tokenize",
      (PyCFunction)&Preprocessor_tokenize, METH_VARARGS},
     {(char*)"preprocess",
-     (PyCFunction)&Preprocessor_preprocess, METH_VARARGS},
+     (PyCFunction)&Preprocessor_preprocess, METH_VARARGS | METH_KEYWORDS},
+    {(char*)"preprocess_to_bytes",
+     (PyCFunction)&Preprocessor_preprocess_to_bytes, METH_VARARGS},
+    {(char*)"scan_dependencies",
+     (PyCFunction)&Preprocessor_scan_dependencies, METH_VARARGS},
+    {(char*)"write_token_cache",
+     (PyCFunction)&Preprocessor_write_token_cache, METH_VARARGS},
+    {(char*)"is_token_cache_valid",
+     (PyCFunction)&Preprocessor_is_token_cache_valid, METH_VARARGS},
+    {(char*)"read_token_cache",
+     (PyCFunction)&Preprocessor_read_token_cache, METH_VARARGS},
     {(char*)"next",
      (PyCFunction)&Preprocessor_next, METH_VARARGS},
+    {(char*)"capture_until",
+     (PyCFunction)&Preprocessor_capture_until, METH_VARARGS},
     {(char*)"format_tokens",
-     (PyCFunction)&Preprocessor_format_tokens, METH_VARARGS},
+     (PyCFunction)&Preprocessor_format_tokens, METH_VARARGS | METH_KEYWORDS},
     {(char*)"set_include_locator",
      (PyCFunction)&Preprocessor_set_include_locator, METH_VARARGS},
+    {(char*)"set_include_cache",
+     (PyCFunction)&Preprocessor_set_include_cache, METH_VARARGS},
+    {(char*)"set_file_cache",
+     (PyCFunction)&Preprocessor_set_file_cache, METH_VARARGS},
+    {(char*)"get_entered_files",
+     (PyCFunction)&Preprocessor_get_entered_files, METH_VARARGS},
+    {(char*)"get_guarded_files",
+     (PyCFunction)&Preprocessor_get_guarded_files, METH_VARARGS},
+    {(char*)"add_guarded_files",
+     (PyCFunction)&Preprocessor_add_guarded_files, METH_VARARGS},
+    {(char*)"set_streaming",
+     (PyCFunction)&Preprocessor_set_streaming, METH_VARARGS},
+    {(char*)"enable_profiling",
+     (PyCFunction)&Preprocessor_enable_profiling,
+     METH_VARARGS | METH_KEYWORDS},
+    {(char*)"profile",
+     (PyCFunction)&Preprocessor_profile, METH_VARARGS | METH_KEYWORDS},
+    {(char*)"iter_batches",
+     (PyCFunction)&Preprocessor_iter_batches, METH_VARARGS | METH_KEYWORDS},
+    {(char*)"filter",
+     (PyCFunction)&Preprocessor_filter, METH_VARARGS | METH_KEYWORDS},
+    {NULL}
+};
+
+static PyObject* Preprocessor_get_location(Preprocessor *self, void *closure)
+{
+    try
+    {
+        cmonster::core::Preprocessor &pp = *self->preprocessor;
+        clang::SourceLocation const& loc = pp.get_expansion_location();
+        if (loc.isInvalid())
+            Py_RETURN_NONE;
+        return (PyObject*)create_source_location(
+            loc, pp.getClangPreprocessor().getSourceManager());
+    }
+    catch (...)
+    {
+        set_python_exception();
+    }
+    return NULL;
+}
+
+static PyObject*
+Preprocessor_get_memory_high_water(Preprocessor *self, void *closure)
+{
+    return PyLong_FromSize_t(self->preprocessor->get_memory_high_water());
+}
+
+static PyGetSetDef Preprocessor_getset[] =
+{
+    {(char*)"location", (getter)Preprocessor_get_location,
+     NULL, NULL /* docs */, NULL /* closure */},
+    {(char*)"memory_high_water", (getter)Preprocessor_get_memory_high_water,
+     NULL, NULL /* docs */, NULL /* closure */},
     {NULL}
 };
 
 static PyType_Slot PreprocessorTypeSlots[] =
 {
+    {Py_tp_getset,  (void*)Preprocessor_getset},
     {Py_tp_dealloc, (void*)Preprocessor_dealloc},
     {Py_tp_init,    (void*)Preprocessor_init},
     {Py_tp_methods, (void*)Preprocessor_methods},
@@ -467,6 +1245,35 @@ cmonster::core::Preprocessor& get_preprocessor(Preprocessor *wrapper)
     return *wrapper->preprocessor;
 }
 
+PyObject* get_identifier_string(Preprocessor *wrapper,
+                                clang::IdentifierInfo const& identifier)
+{
+    if (!wrapper->identifier_strings)
+        wrapper->identifier_strings = new IdentifierStringMap;
+
+    // Identifiers are invalidated when the parser is reset or reparses.
+    const unsigned int generation = wrapper->preprocessor->get_generation();
+    if (wrapper->identifier_generation != generation)
+    {
+        clear_identifier_strings(*wrapper->identifier_strings);
+        wrapper->identifier_generation = generation;
+    }
+
+    // Identifier names are NUL-terminated in the identifier table.
+    PyObject *&string = (*wrapper->identifier_strings)[&identifier];
+    if (!string)
+    {
+        string = PyUnicode_InternFromString(identifier.getNameStart());
+        if (!string)
+        {
+            wrapper->identifier_strings->erase(&identifier);
+            return NULL;
+        }
+    }
+    Py_INCREF(string);
+    return string;
+}
+
 PyTypeObject* init_preprocessor_type()
 {
     PreprocessorType = (PyTypeObject*)PyType_FromSpec(&PreprocessorTypeSpec);
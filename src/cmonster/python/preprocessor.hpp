@@ -44,6 +44,15 @@ Preprocessor* create_preprocessor(Parser *parser);
  */
 cmonster::core::Preprocessor& get_preprocessor(Preprocessor *wrapper);
 
+/**
+ * Get the spelling of an identifier as an interned Python string.
+ *
+ * Strings are cached per Preprocessor wrapper, so each identifier is only
+ * decoded once. Returns a new reference, or NULL if an error occurred.
+ */
+PyObject* get_identifier_string(Preprocessor *wrapper,
+                                clang::IdentifierInfo const& identifier);
+
 /**
  * Initialise the Preprocessor Python type object.
  */
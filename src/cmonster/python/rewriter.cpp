@@ -25,24 +25,51 @@ SOFTWARE.
 #define Py_LIMITED_API
 
 #include <Python.h>
+#include <algorithm>
 #include <sstream>
 #include <stdexcept>
 #include <iostream>
+#include <vector>
 
 #include "exception.hpp"
+#include "gil.hpp"
+#include "output_stream.hpp"
 #include "parse_result.hpp"
 #include "rewriter.hpp"
 #include "scoped_pyobject.hpp"
 #include "source_location.hpp"
-#include "pyfile_ostream.hpp"
 
 #include <clang/Rewrite/Rewriter.h>
+#include <clang/Basic/FileManager.h>
 #include <clang/Basic/SourceManager.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
 
 namespace cmonster {
 namespace python {
 
+// Flags for Rewriter.insert_many.
+enum
+{
+    REWRITE_AFTER = 1,
+    REWRITE_INDENT = 2
+};
+
 static PyTypeObject *RewriterType = NULL;
+
+// The process umask, for the permissions of new files written by
+// commit_all. umask cannot be read without setting it, which races with
+// other threads, so it is read once, when the module is initialised.
+static mode_t process_umask = 022;
+
 PyDoc_STRVAR(Rewriter_doc, "Rewriter objects");
 
 struct Rewriter
@@ -50,6 +77,7 @@ struct Rewriter
     PyObject_HEAD
     ParseResult *result;
     clang::Rewriter *rewriter;
+    bool all_files; // whether files other than the main file may be edited
 };
 
 static void Rewriter_dealloc(Rewriter* self)
@@ -63,8 +91,16 @@ static void Rewriter_dealloc(Rewriter* self)
 static int
 Rewriter_init(Rewriter *self, PyObject *args, PyObject *kwds)
 {
-    if (!PyArg_ParseTuple(args, "O", &self->result))
+    PyObject *all_files = Py_False;
+    static const char *keywords[] = {"result", "all_files", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|O:Rewriter",
+                                     (char**)keywords, &self->result,
+                                     &all_files))
+        return -1;
+    const int all_files_ = PyObject_IsTrue(all_files);
+    if (all_files_ == -1)
         return -1;
+    self->all_files = all_files_ == 1;
     if (!PyObject_TypeCheck(self->result, get_parse_result_type()))
     {
         PyErr_SetString(PyExc_TypeError,
@@ -107,6 +143,7 @@ static bool get_source_location(PyObject *arg, clang::SourceLocation &result)
         {
             result = clang::SourceLocation::getFromRawEncoding(
                 static_cast<unsigned>(encoding));
+            return true;
         }
     }
 
@@ -116,6 +153,45 @@ static bool get_source_location(PyObject *arg, clang::SourceLocation &result)
     return false;
 }
 
+/**
+ * Check that a location is valid, and refers to one of the source manager's
+ * entries. Encodings from Python are otherwise looked up out of bounds.
+ */
+static bool check_source_location(clang::SourceManager &sm,
+                                  clang::SourceLocation loc)
+{
+    if (loc.isInvalid())
+    {
+        PyErr_SetString(PyExc_ValueError, "Invalid source location");
+        return false;
+    }
+    if (!sm.isLocalSourceLocation(loc) && !sm.isLoadedSourceLocation(loc))
+    {
+        PyErr_Format(PyExc_ValueError,
+            "Invalid source location encoding %u", loc.getRawEncoding());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Check whether the given file may be edited. Only the main file may be
+ * edited, unless the rewriter was created with all_files=True, in which
+ * case any file read from disk may be edited.
+ */
+static bool is_editable(Rewriter *self, clang::FileID fid)
+{
+    clang::SourceManager &sm = self->rewriter->getSourceMgr();
+    if (fid == sm.getMainFileID())
+        return true;
+    if (self->all_files && sm.getFileEntryForID(fid))
+        return true;
+    PyErr_SetString(PyExc_ValueError, self->all_files ?
+        "Source location is not in a file" :
+        "Source location is outside main file");
+    return false;
+}
+
 static PyObject*
 insert_text(Rewriter *self, PyObject *loc,
             const char *text, int text_size,
@@ -135,21 +211,13 @@ insert_text(Rewriter *self, PyObject *loc,
     if (!get_source_location(loc, sloc))
         return NULL;
 
-    if (sloc.isInvalid())
-    {
-        PyErr_SetString(PyExc_ValueError, "Invalid source location");
+    clang::SourceManager &sm = self->rewriter->getSourceMgr();
+    if (!check_source_location(sm, sloc))
         return NULL;
-    }
 
-    // Ensure source location is in main file.
-    cmonster::core::ParseResult &result_ = get_parse_result(self->result);
-    clang::ASTContext &astctx = result_.getClangASTContext();
-    if (!astctx.getSourceManager().isFromMainFile(sloc))
-    {
-        PyErr_SetString(PyExc_ValueError,
-            "Source location is outside main file");
+    // Ensure source location is in an editable file.
+    if (!is_editable(self, sm.getFileID(sm.getExpansionLoc(sloc))))
         return NULL;
-    }
 
     llvm::StringRef insertion(text, text_size);
     self->rewriter->InsertText(sloc, insertion, after_==1, indent_==1);
@@ -172,32 +240,477 @@ static PyObject* Rewriter_insert(Rewriter *self, PyObject *args, PyObject *kw)
     return insert_text(self, loc, text, text_size, after, indent);
 }
 
+namespace {
+
+/**
+ * An edit to apply in Rewriter.insert_many.
+ */
+struct Edit
+{
+    clang::SourceLocation loc;
+    clang::FileID fid;
+    unsigned offset;
+    unsigned length;
+    int flags;
+    std::string text;
+    size_t index;
+
+    // Order by file and offset; at the same offset, insertions come before
+    // replacements, and otherwise the edits keep their given order.
+    bool operator<(Edit const& rhs) const
+    {
+        if (fid != rhs.fid)
+            return fid < rhs.fid;
+        if (offset != rhs.offset)
+            return offset < rhs.offset;
+        if ((length == 0) != (rhs.length == 0))
+            return length == 0;
+        return index < rhs.index;
+    }
+};
+
+}
+
+/**
+ * Convert an edit record, (location, text[, flags[, length]]), to an Edit.
+ */
+static bool
+get_edit(Rewriter *self, PyObject *record, Edit &edit)
+{
+    ScopedPyObject tuple(PySequence_Tuple(record));
+    if (!tuple)
+        return false;
+
+    PyObject *loc;
+    const char *text;
+    int text_size;
+    edit.flags = REWRITE_AFTER | REWRITE_INDENT;
+    edit.length = 0;
+    if (!PyArg_ParseTuple(tuple, "Os#|iI:insert_many", &loc, &text,
+                          &text_size, &edit.flags, &edit.length))
+        return false;
+    edit.text.assign(text, text_size);
+
+    // Encoded locations are the common case, so avoid the generic lookup.
+    if (PyLong_Check(loc))
+    {
+        const unsigned long encoding = PyLong_AsUnsignedLong(loc);
+        if (encoding == (unsigned long)-1 && PyErr_Occurred())
+            return false;
+        edit.loc = clang::SourceLocation::getFromRawEncoding(
+            static_cast<unsigned>(encoding));
+    }
+    else if (!get_source_location(loc, edit.loc))
+    {
+        return false;
+    }
+
+    clang::SourceManager &sm = self->rewriter->getSourceMgr();
+    if (!check_source_location(sm, edit.loc))
+        return false;
+    if (!edit.loc.isFileID())
+    {
+        PyErr_SetString(PyExc_ValueError,
+            "Source location is within a macro expansion");
+        return false;
+    }
+
+    const std::pair<clang::FileID, unsigned> decomposed =
+        sm.getDecomposedLoc(edit.loc);
+    if (!is_editable(self, decomposed.first))
+        return false;
+    edit.fid = decomposed.first;
+    edit.offset = decomposed.second;
+    if (edit.offset + edit.length > sm.getBuffer(
+            decomposed.first)->getBufferSize())
+    {
+        PyErr_SetString(PyExc_ValueError,
+            "Replaced text extends past the end of the file");
+        return false;
+    }
+    return true;
+}
+
+static PyObject* Rewriter_insert_many(Rewriter *self, PyObject *args)
+{
+    PyObject *records;
+    if (!PyArg_ParseTuple(args, "O:insert_many", &records))
+        return NULL;
+
+    ScopedPyObject iter(PyObject_GetIter(records));
+    if (!iter)
+        return NULL;
+
+    // Convert and validate all of the edits before applying any.
+    std::vector<Edit> edits;
+    while (PyObject *record_ = PyIter_Next(iter))
+    {
+        ScopedPyObject record(record_);
+        edits.push_back(Edit());
+        edits.back().index = edits.size() - 1;
+        if (!get_edit(self, record, edits.back()))
+            return NULL;
+    }
+    if (PyErr_Occurred())
+        return NULL;
+
+    // Sort the edits, and check that no edit falls within text replaced by
+    // another.
+    std::sort(edits.begin(), edits.end());
+    unsigned replaced_end = 0;
+    for (std::vector<Edit>::const_iterator edit = edits.begin();
+         edit != edits.end(); ++edit)
+    {
+        if (edit != edits.begin() && edit->fid != (edit-1)->fid)
+            replaced_end = 0;
+        if (edit->offset < replaced_end)
+        {
+            PyErr_Format(PyExc_ValueError,
+                "Edit %d overlaps text replaced by another edit",
+                (int)edit->index);
+            return NULL;
+        }
+        if (edit->length > 0)
+            replaced_end = edit->offset + edit->length;
+    }
+
+    for (std::vector<Edit>::const_iterator edit = edits.begin();
+         edit != edits.end(); ++edit)
+    {
+        if (edit->length > 0)
+        {
+            self->rewriter->ReplaceText(edit->loc, edit->length, edit->text);
+        }
+        else
+        {
+            self->rewriter->InsertText(
+                edit->loc, edit->text, (edit->flags & REWRITE_AFTER) != 0,
+                (edit->flags & REWRITE_INDENT) != 0);
+        }
+    }
+    Py_RETURN_NONE;
+}
+
 // XXX should we support rewriting non-main files?
-static PyObject* Rewriter_dump(Rewriter *self, PyObject *args)
+static PyObject* Rewriter_dump(Rewriter *self, PyObject *args, PyObject *kw)
 {
     PyObject *file;
-    if (!PyArg_ParseTuple(args, "O:dump", &file))
+    Py_ssize_t buffer_size = DEFAULT_OUTPUT_BUFFER_SIZE;
+    static const char *keywords[] = {"file", "buffer_size", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kw, "O|n:dump", (char**)keywords,
+                                     &file, &buffer_size))
         return NULL;
+    if (buffer_size <= 0)
+    {
+        PyErr_SetString(PyExc_ValueError, "buffer_size must be positive");
+        return NULL;
+    }
 
     const clang::RewriteBuffer *buffer =
         self->rewriter->getRewriteBufferFor(
             self->rewriter->getSourceMgr().getMainFileID());
     if (buffer)
     {
-        pyfile_ostream ostream(file);
-        buffer->write(ostream);
-        ostream.flush();
+        output_stream out;
+        if (!out.open(file, static_cast<size_t>(buffer_size)))
+            return NULL;
+        buffer->write(out.get());
+        if (!out.close())
+            return NULL;
         Py_RETURN_TRUE;
     }
     Py_RETURN_FALSE;
 }
 
+namespace {
+
+/**
+ * A modified file to write out in Rewriter.commit_all.
+ */
+struct FileWrite
+{
+    const clang::RewriteBuffer *buffer;
+    std::string                 path;
+    std::string                 temp_path;
+    std::string                 error;
+};
+
+/**
+ * Normalise a path to be written under a commit_all directory: leading
+ * slashes, "." and empty components are dropped, and ".." components are
+ * resolved. Throws std::invalid_argument if the path would resolve outside
+ * the directory.
+ */
+std::string relative_to_root(std::string const& path)
+{
+    std::vector<std::string> components;
+    std::string::size_type start = 0;
+    while (start <= path.size())
+    {
+        std::string::size_type end = path.find('/', start);
+        if (end == std::string::npos)
+            end = path.size();
+        const std::string component(path, start, end - start);
+        if (component == "..")
+        {
+            if (components.empty())
+            {
+                throw std::invalid_argument(
+                    "'" + path + "' resolves outside the directory");
+            }
+            components.pop_back();
+        }
+        else if (!component.empty() && component != ".")
+        {
+            components.push_back(component);
+        }
+        start = end + 1;
+    }
+    if (components.empty())
+        throw std::invalid_argument("'" + path + "' is not a file path");
+
+    std::string result(components[0]);
+    for (size_t i = 1; i < components.size(); ++i)
+        result.append("/").append(components[i]);
+    return result;
+}
+
+/**
+ * A share of the files to write, for one thread.
+ */
+struct WriteTask
+{
+    std::vector<FileWrite> *writes;
+    size_t                  first;
+    size_t                  stride;
+    mode_t                  mask;
+};
+
+/**
+ * Create the parent directories of "path", if they do not exist.
+ */
+void make_parent_dirs(std::string const& path)
+{
+    for (std::string::size_type slash = path.find('/', 1);
+         slash != std::string::npos; slash = path.find('/', slash + 1))
+    {
+        // Failures are reported when the file itself is created.
+        mkdir(path.substr(0, slash).c_str(), 0777);
+    }
+}
+
+/**
+ * Write a rewrite buffer to a temporary file alongside its destination.
+ * The file takes the permissions of the file it replaces, if any.
+ */
+void write_file(FileWrite &file, mode_t mask)
+{
+    make_parent_dirs(file.path);
+    std::string path_template(file.path + ".XXXXXX");
+    std::vector<char> temp_path(path_template.begin(), path_template.end());
+    temp_path.push_back('\0');
+    const int fd = mkstemp(&temp_path[0]);
+    if (fd == -1)
+    {
+        file.error = "Failed to create a temporary file for '" +
+            file.path + "': " + std::strerror(errno);
+        return;
+    }
+    file.temp_path = &temp_path[0];
+
+    struct stat st;
+    const mode_t mode = ::stat(file.path.c_str(), &st) == 0 ?
+        (st.st_mode & 07777) : (0666 & ~mask);
+    fchmod(fd, mode);
+
+    llvm::raw_fd_ostream out(fd, true);
+    file.buffer->write(out);
+    out.close();
+    if (out.has_error())
+    {
+        out.clear_error();
+        file.error = "Failed to write '" + file.temp_path + "'";
+    }
+}
+
+void* write_files(void *arg)
+{
+    WriteTask const& task = *static_cast<WriteTask*>(arg);
+    for (size_t i = task.first; i < task.writes->size(); i += task.stride)
+        write_file((*task.writes)[i], task.mask);
+    return NULL;
+}
+
+/**
+ * Write each of the files in parallel, and then rename them into place.
+ * If any file fails to be written, then no file is replaced.
+ */
+void commit_files(std::vector<FileWrite> &writes)
+{
+    const mode_t mask = process_umask;
+
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    const size_t nthreads = std::min(
+        writes.size(), static_cast<size_t>(ncpus > 0 ? ncpus : 1));
+    std::vector<WriteTask> tasks(nthreads);
+    std::vector<pthread_t> threads(nthreads);
+    std::vector<bool> started(nthreads, false);
+    for (size_t i = 0; i < nthreads; ++i)
+    {
+        WriteTask task = {&writes, i, nthreads, mask};
+        tasks[i] = task;
+        // The calling thread takes the first share, and any share for
+        // which a thread could not be started.
+        if (i > 0)
+        {
+            started[i] = pthread_create(
+                &threads[i], NULL, &write_files, &tasks[i]) == 0;
+        }
+    }
+    for (size_t i = 0; i < nthreads; ++i)
+    {
+        if (!started[i])
+            write_files(&tasks[i]);
+    }
+    for (size_t i = 0; i < nthreads; ++i)
+    {
+        if (started[i])
+            pthread_join(threads[i], NULL);
+    }
+
+    std::string error;
+    for (std::vector<FileWrite>::const_iterator iter = writes.begin();
+         iter != writes.end() && error.empty(); ++iter)
+    {
+        error = iter->error;
+    }
+    for (std::vector<FileWrite>::const_iterator iter = writes.begin();
+         iter != writes.end(); ++iter)
+    {
+        if (iter->temp_path.empty())
+            continue;
+        if (!error.empty())
+        {
+            unlink(iter->temp_path.c_str());
+        }
+        else if (std::rename(iter->temp_path.c_str(),
+                             iter->path.c_str()) != 0)
+        {
+            error = "Failed to rename '" + iter->temp_path + "' to '" +
+                iter->path + "': " + std::strerror(errno);
+            unlink(iter->temp_path.c_str());
+        }
+    }
+    if (!error.empty())
+        throw std::runtime_error(error);
+}
+
+/**
+ * Get the name of a file, as given when it was included.
+ */
+std::string get_filename(clang::SourceManager &sm, clang::FileID fid)
+{
+    const clang::FileEntry *entry = sm.getFileEntryForID(fid);
+    if (entry)
+        return entry->getName();
+    return sm.getBuffer(fid)->getBufferIdentifier();
+}
+
+}
+
+static PyObject* Rewriter_modified_files(Rewriter *self, PyObject *args)
+{
+    if (!PyArg_ParseTuple(args, ":modified_files"))
+        return NULL;
+
+    ScopedPyObject result(PyList_New(0));
+    if (!result)
+        return NULL;
+    clang::SourceManager &sm = self->rewriter->getSourceMgr();
+    for (clang::Rewriter::buffer_iterator
+             iter = self->rewriter->buffer_begin();
+         iter != self->rewriter->buffer_end(); ++iter)
+    {
+        std::string const& filename = get_filename(sm, iter->first);
+        ScopedPyObject name(PyUnicode_FromStringAndSize(
+            filename.data(), filename.size()));
+        if (!name || PyList_Append(result, name) == -1)
+            return NULL;
+    }
+    return result.release();
+}
+
+static PyObject*
+Rewriter_commit_all(Rewriter *self, PyObject *args, PyObject *kw)
+{
+    const char *directory = NULL;
+    static const char *keywords[] = {"directory", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kw, "|z:commit_all",
+                                     (char**)keywords, &directory))
+        return NULL;
+
+    try
+    {
+        // Determine the destination of each modified file; either the file
+        // itself, or the same path under "directory".
+        std::vector<FileWrite> writes;
+        clang::SourceManager &sm = self->rewriter->getSourceMgr();
+        for (clang::Rewriter::buffer_iterator
+                 iter = self->rewriter->buffer_begin();
+             iter != self->rewriter->buffer_end(); ++iter)
+        {
+            FileWrite file;
+            file.buffer = &iter->second;
+            file.path = get_filename(sm, iter->first);
+            if (directory)
+            {
+                file.path = std::string(directory) + "/" +
+                    relative_to_root(file.path);
+            }
+            writes.push_back(file);
+        }
+
+        {
+            ScopedGILRelease nogil;
+            commit_files(writes);
+        }
+
+        ScopedPyObject result(PyList_New(writes.size()));
+        if (!result)
+            return NULL;
+        for (size_t i = 0; i < writes.size(); ++i)
+        {
+            PyObject *path = PyUnicode_FromStringAndSize(
+                writes[i].path.data(), writes[i].path.size());
+            if (!path)
+                return NULL;
+            PyList_SetItem(result, i, path);
+        }
+        return result.release();
+    }
+    catch (std::invalid_argument const& e)
+    {
+        PyErr_SetString(PyExc_ValueError, e.what());
+    }
+    catch (...)
+    {
+        set_python_exception();
+    }
+    return NULL;
+}
+
 static PyMethodDef Rewriter_methods[] =
 {
     {(char*)"insert",
      (PyCFunction)&Rewriter_insert, METH_VARARGS | METH_KEYWORDS},
+    {(char*)"insert_many",
+     (PyCFunction)&Rewriter_insert_many, METH_VARARGS},
     {(char*)"dump",
-     (PyCFunction)&Rewriter_dump, METH_VARARGS},
+     (PyCFunction)&Rewriter_dump, METH_VARARGS | METH_KEYWORDS},
+    {(char*)"modified_files",
+     (PyCFunction)&Rewriter_modified_files, METH_VARARGS},
+    {(char*)"commit_all",
+     (PyCFunction)&Rewriter_commit_all, METH_VARARGS | METH_KEYWORDS},
     {NULL}
 };
 
@@ -223,11 +736,22 @@ static PyType_Spec RewriterTypeSpec =
 
 PyTypeObject* init_rewriter_type()
 {
+    process_umask = umask(0);
+    umask(process_umask);
+
     RewriterType = (PyTypeObject*)PyType_FromSpec(&RewriterTypeSpec);
     if (!RewriterType)
         return NULL;
     if (PyType_Ready((PyTypeObject*)RewriterType) < 0)
         return NULL;
+
+    // Add the insert_many flags as class attributes.
+    ScopedPyObject after(PyLong_FromLong(REWRITE_AFTER));
+    ScopedPyObject indent(PyLong_FromLong(REWRITE_INDENT));
+    if (!after || !indent ||
+        PyObject_SetAttrString((PyObject*)RewriterType, "AFTER", after) ||
+        PyObject_SetAttrString((PyObject*)RewriterType, "INDENT", indent))
+        return NULL;
     return RewriterType;
 }
 
@@ -34,7 +34,6 @@ SOFTWARE.
 #include "parse_result.hpp"
 #include "source_location.hpp"
 #include "scoped_pyobject.hpp"
-#include "pyfile_ostream.hpp"
 
 #include <clang/Basic/SourceLocation.h>
 #include <clang/Basic/SourceManager.h>
@@ -147,6 +146,12 @@ SourceLocation_get_column(SourceLocation *self, void *closure)
     return PyLong_FromLong(column);
 }
 
+static PyObject*
+SourceLocation_get_encoding(SourceLocation *self, void *closure)
+{
+    return PyLong_FromUnsignedLong(self->source_location.getRawEncoding());
+}
+
 PyObject* SourceLocation_add(PyObject *lhs, PyObject *rhs)
 {
     if (!PyObject_TypeCheck(lhs, SourceLocationType))
@@ -199,6 +204,8 @@ static PyGetSetDef SourceLocation_getset[] =
      NULL, NULL /* docs */, NULL /* closure */},
     {(char*)"in_main_file", (getter)SourceLocation_get_in_main_file,
      NULL, NULL /* docs */, NULL /* closure */},
+    {(char*)"encoding", (getter)SourceLocation_get_encoding,
+     NULL, NULL /* docs */, NULL /* closure */},
     {NULL}
 };
 
@@ -33,8 +33,9 @@ SOFTWARE.
 #include "scoped_pyobject.hpp"
 #include "source_location.hpp"
 #include "token.hpp"
-#include <iostream>
-#include <sstream>
+#include "../core/token_kinds.hpp"
+
+#include <llvm/ADT/SmallString.h>
 
 namespace cmonster {
 namespace python {
@@ -138,19 +139,26 @@ static int Token_init(Token *self, PyObject *args, PyObject *kwargs)
 
 static PyObject* Token_str(Token *self)
 {
-    std::ostringstream ss;
-    ss << *self->token;
-    std::string s = ss.str();
-    return PyUnicode_FromStringAndSize(s.c_str(), s.size());
+    clang::Token const& token = self->token->getClangToken();
+    clang::IdentifierInfo *identifier = token.getIdentifierInfo();
+    if (identifier)
+        return get_identifier_string(self->preprocessor, *identifier);
+
+    llvm::SmallString<64> buffer;
+    bool invalid = false;
+    llvm::StringRef spelling = self->token->getSpelling(buffer, &invalid);
+    if (invalid)
+        return PyUnicode_FromString("<invalid>");
+    return PyUnicode_FromStringAndSize(spelling.data(), spelling.size());
 }
 
 static PyObject* Token_repr(Token *self)
 {
-    std::ostringstream ss;
-    ss << "Token(tok_" << self->token->getName() << ", '"
-       << *self->token << "')";
-    std::string s = ss.str();
-    return PyUnicode_FromStringAndSize(s.c_str(), s.size());
+    ScopedPyObject spelling(Token_str(self));
+    if (!spelling)
+        return NULL;
+    return PyUnicode_FromFormat(
+        "Token(tok_%s, '%U')", self->token->getName(), (PyObject*)spelling);
 
 /*
     cmonster::core::token_type::string_type const& value =
@@ -187,6 +195,16 @@ Token_set_token_id(Token *self, PyObject *value, void *closure)
     return Py_None;
 }
 
+static PyObject* Token_get_identifier(Token *self, void *closure)
+{
+    clang::Token const& token = self->token->getClangToken();
+    clang::IdentifierInfo *identifier = token.getIdentifierInfo();
+    if (identifier)
+        return get_identifier_string(self->preprocessor, *identifier);
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
 static PyObject* Token_get_location(Token *self, void *closure)
 {
     clang::Preprocessor const& pp =
@@ -195,6 +213,24 @@ static PyObject* Token_get_location(Token *self, void *closure)
         self->token->getClangToken().getLocation(), pp.getSourceManager());
 }
 
+// The category getters, with the category bit as the closure.
+static PyObject* Token_get_category(Token *self, void *closure)
+{
+    const unsigned int mask = static_cast<unsigned int>(
+        reinterpret_cast<size_t>(closure));
+    return PyBool_FromLong(cmonster::core::isKindIn(
+        self->token->getClangToken().getKind(), mask));
+}
+
+static PyObject* Token_kind_in(Token *self, PyObject *args)
+{
+    unsigned int mask;
+    if (!PyArg_ParseTuple(args, "I:kind_in", &mask))
+        return NULL;
+    return PyBool_FromLong(cmonster::core::isKindIn(
+        self->token->getClangToken().getKind(), mask));
+}
+
 static Py_ssize_t Token_length(Token *self)
 {
     clang::Token const& token = self->token->getClangToken();
@@ -206,6 +242,25 @@ static PyGetSetDef Token_getset[] = {
      NULL /* docs */, NULL /* closure */},
     {(char*)"location", (getter)Token_get_location, NULL,
      NULL /* docs */, NULL /* closure */},
+    {(char*)"identifier", (getter)Token_get_identifier, NULL,
+     (char*)"The interned spelling of an identifier or keyword, or None",
+     NULL /* closure */},
+    {(char*)"is_identifier", (getter)Token_get_category, NULL,
+     NULL /* docs */, (void*)cmonster::core::CATEGORY_IDENTIFIER},
+    {(char*)"is_keyword", (getter)Token_get_category, NULL,
+     NULL /* docs */, (void*)cmonster::core::CATEGORY_KEYWORD},
+    {(char*)"is_literal", (getter)Token_get_category, NULL,
+     NULL /* docs */, (void*)cmonster::core::CATEGORY_LITERAL},
+    {(char*)"is_punctuator", (getter)Token_get_category, NULL,
+     NULL /* docs */, (void*)cmonster::core::CATEGORY_PUNCTUATOR},
+    {NULL}
+};
+
+static PyMethodDef Token_methods[] =
+{
+    {(char*)"kind_in", (PyCFunction)&Token_kind_in, METH_VARARGS,
+     (char*)"Test whether the token's kind is in any of the categories of "
+            "a mask, e.g. category_keyword | category_literal"},
     {NULL}
 };
 
@@ -213,6 +268,7 @@ static PyType_Slot TokenTypeSlots[] =
 {
     {Py_tp_dealloc, (void*)Token_dealloc},
     {Py_tp_getset,  (void*)Token_getset},
+    {Py_tp_methods, (void*)Token_methods},
     {Py_tp_str,     (void*)Token_str},
     {Py_tp_repr,    (void*)Token_repr},
     {Py_tp_doc,     (void*)Token_doc},
@@ -0,0 +1,273 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// XXX Py_LIMITED_API is disabled, as the buffer protocol is not part of the
+// limited API.
+/* Define this to ensure only the limited API is used, so we can ensure forward
+ * binary compatibility. */
+//#define Py_LIMITED_API
+
+#include <Python.h>
+#include <stdexcept>
+
+#include "exception.hpp"
+#include "preprocessor.hpp"
+#include "scoped_pyobject.hpp"
+#include "token.hpp"
+#include "token_batch.hpp"
+
+namespace cmonster {
+namespace python {
+
+static PyTypeObject *TokenBatchType = NULL;
+PyDoc_STRVAR(TokenBatch_doc,
+"A batch of tokens. Batches support the buffer protocol, exposing an array\n"
+"of (kind, flags, location, spelling_offset, spelling_length) records, with\n"
+"the struct format \"=HHIII\". Spelling offsets refer to the \"spellings\"\n"
+"attribute. Indexing a batch creates a Token object, except in batches from\n"
+"a pipelined iterator, which provide only kinds and spellings.");
+
+struct TokenBatch
+{
+    PyObject_HEAD
+    Preprocessor *preprocessor;
+    cmonster::core::TokenBatch *batch;
+    // Set for batches from a pipelined iterator, whose tokens must not be
+    // resolved while the producer thread is using the preprocessor.
+    bool spelling_only;
+    Py_ssize_t shape[1];
+    Py_ssize_t strides[1];
+};
+
+static void TokenBatch_dealloc(TokenBatch* self)
+{
+    Py_XDECREF(self->preprocessor);
+    if (self->batch)
+        delete self->batch;
+    PyObject_Del((PyObject*)self);
+}
+
+TokenBatch* create_token_batch(Preprocessor *pp)
+{
+    ScopedPyObject args = Py_BuildValue("(O)", pp);
+    if (!args)
+        return NULL;
+    return (TokenBatch*)PyObject_CallObject((PyObject*)TokenBatchType, args);
+}
+
+static int TokenBatch_init(TokenBatch *self, PyObject *args, PyObject *kwds)
+{
+    Preprocessor *pp;
+    if (!PyArg_ParseTuple(args, "O", &pp))
+        return -1;
+
+    if (!PyObject_TypeCheck(pp, get_preprocessor_type()))
+    {
+        PyErr_SetString(PyExc_TypeError, "a Preprocessor is required");
+        return -1;
+    }
+
+    Py_INCREF(pp);
+    self->preprocessor = pp;
+    self->batch = new cmonster::core::TokenBatch;
+    self->spelling_only = false;
+    return 0;
+}
+
+static Py_ssize_t TokenBatch_length(TokenBatch *self)
+{
+    return static_cast<Py_ssize_t>(self->batch->size());
+}
+
+static PyObject* TokenBatch_item(TokenBatch *self, Py_ssize_t i)
+{
+    if (i < 0 || i >= static_cast<Py_ssize_t>(self->batch->size()))
+    {
+        PyErr_SetString(PyExc_IndexError, "token index out of range");
+        return NULL;
+    }
+    if (self->spelling_only)
+    {
+        PyErr_SetString(PyExc_TypeError,
+            "tokens of a pipelined batch are not available; "
+            "use kind(i) and spelling(i)");
+        return NULL;
+    }
+    try
+    {
+        return (PyObject*)create_token(
+            self->preprocessor, self->batch->getToken(i));
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
+static PyObject* TokenBatch_spelling(TokenBatch *self, PyObject *args)
+{
+    Py_ssize_t i;
+    if (!PyArg_ParseTuple(args, "n:spelling", &i))
+        return NULL;
+    if (i < 0)
+        i += static_cast<Py_ssize_t>(self->batch->size());
+    if (i < 0 || i >= static_cast<Py_ssize_t>(self->batch->size()))
+    {
+        PyErr_SetString(PyExc_IndexError, "token index out of range");
+        return NULL;
+    }
+    llvm::StringRef spelling = self->batch->getSpelling(i);
+    return PyUnicode_FromStringAndSize(spelling.data(), spelling.size());
+}
+
+static PyObject* TokenBatch_kind(TokenBatch *self, PyObject *args)
+{
+    Py_ssize_t i;
+    if (!PyArg_ParseTuple(args, "n:kind", &i))
+        return NULL;
+    if (i < 0)
+        i += static_cast<Py_ssize_t>(self->batch->size());
+    if (i < 0 || i >= static_cast<Py_ssize_t>(self->batch->size()))
+    {
+        PyErr_SetString(PyExc_IndexError, "token index out of range");
+        return NULL;
+    }
+    return PyLong_FromLong(self->batch->records()[i].kind);
+}
+
+static PyObject* TokenBatch_get_spellings(TokenBatch *self, void *closure)
+{
+    std::string const& spellings = self->batch->spellings();
+    return PyBytes_FromStringAndSize(spellings.data(), spellings.size());
+}
+
+static int
+TokenBatch_getbuffer(TokenBatch *self, Py_buffer *view, int flags)
+{
+    if ((flags & PyBUF_WRITABLE) == PyBUF_WRITABLE)
+    {
+        PyErr_SetString(PyExc_BufferError, "TokenBatch is not writable");
+        view->obj = NULL;
+        return -1;
+    }
+
+    static cmonster::core::PackedToken empty;
+    std::vector<cmonster::core::PackedToken> const& records =
+        self->batch->records();
+    self->shape[0] = static_cast<Py_ssize_t>(records.size());
+    self->strides[0] = sizeof(cmonster::core::PackedToken);
+
+    Py_INCREF(self);
+    view->obj = (PyObject*)self;
+    view->buf = records.empty() ? &empty : (void*)&records[0];
+    view->len = records.size() * sizeof(cmonster::core::PackedToken);
+    view->readonly = 1;
+    view->itemsize = sizeof(cmonster::core::PackedToken);
+    view->format = (flags & PyBUF_FORMAT) ? (char*)"=HHIII" : NULL;
+    view->ndim = 1;
+    view->shape = (flags & PyBUF_ND) ? self->shape : NULL;
+    view->strides =
+        ((flags & PyBUF_STRIDES) == PyBUF_STRIDES) ? self->strides : NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    return 0;
+}
+
+static PyMethodDef TokenBatch_methods[] =
+{
+    {(char*)"spelling",
+     (PyCFunction)&TokenBatch_spelling, METH_VARARGS},
+    {(char*)"kind",
+     (PyCFunction)&TokenBatch_kind, METH_VARARGS},
+    {NULL}
+};
+
+static PyGetSetDef TokenBatch_getset[] = {
+    {(char*)"spellings", (getter)TokenBatch_get_spellings, NULL,
+     NULL /* docs */, NULL /* closure */},
+    {NULL}
+};
+
+static PyType_Slot TokenBatchTypeSlots[] =
+{
+    {Py_tp_dealloc, (void*)TokenBatch_dealloc},
+    {Py_tp_init,    (void*)TokenBatch_init},
+    {Py_tp_methods, (void*)TokenBatch_methods},
+    {Py_tp_getset,  (void*)TokenBatch_getset},
+    {Py_tp_doc,     (void*)TokenBatch_doc},
+    {Py_tp_alloc,   (void*)PyType_GenericAlloc},
+    {Py_tp_new,     (void*)PyType_GenericNew},
+
+    // See note below in "init_token_batch_type".
+    {Py_sq_length,  (void*)TokenBatch_length},
+    {Py_sq_item,    (void*)TokenBatch_item},
+    {Py_bf_getbuffer, (void*)TokenBatch_getbuffer},
+
+    {0, NULL}
+};
+
+static PyType_Spec TokenBatchTypeSpec =
+{
+    "cmonster._cmonster.TokenBatch",
+    sizeof(TokenBatch),
+    0,
+    Py_TPFLAGS_DEFAULT,
+    TokenBatchTypeSlots
+};
+
+PyTypeObject* init_token_batch_type()
+{
+    TokenBatchType = (PyTypeObject*)PyType_FromSpec(&TokenBatchTypeSpec);
+    if (!TokenBatchType)
+        return NULL;
+
+    // FIXME (CPython Issue 13115) -- see "token.cpp" for more info.
+    TokenBatchType->tp_as_sequence =
+        &((PyHeapTypeObject*)TokenBatchType)->as_sequence;
+    TokenBatchType->tp_as_buffer =
+        &((PyHeapTypeObject*)TokenBatchType)->as_buffer;
+
+    if (PyType_Ready(TokenBatchType) < 0)
+        return NULL;
+    return TokenBatchType;
+}
+
+PyTypeObject* get_token_batch_type()
+{
+    return TokenBatchType;
+}
+
+void set_token_batch_spelling_only(TokenBatch *wrapper)
+{
+    wrapper->spelling_only = true;
+}
+
+cmonster::core::TokenBatch& get_token_batch(TokenBatch *wrapper)
+{
+    if (!wrapper)
+        throw std::invalid_argument("wrapper == NULL");
+    return *wrapper->batch;
+}
+
+}}
+
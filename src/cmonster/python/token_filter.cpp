@@ -0,0 +1,316 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* Define this to ensure only the limited API is used, so we can ensure forward
+ * binary compatibility. */
+#define Py_LIMITED_API
+
+#include <Python.h>
+
+#include "exception.hpp"
+#include "scoped_pyobject.hpp"
+#include "token_filter.hpp"
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace cmonster {
+namespace python {
+
+static PyTypeObject *TokenFilterType = NULL;
+PyDoc_STRVAR(TokenFilter_doc,
+    "A native token predicate, for use with Preprocessor.filter.\n\n"
+    "Filters are created with the static methods kinds, identifiers,\n"
+    "spelling, in_main_file and from_macro_expansion, and combined with\n"
+    "the &, | and ~ operators.");
+
+struct TokenFilter
+{
+    PyObject_HEAD
+    cmonster::core::TokenPredicatePtr *predicate;
+};
+
+static void TokenFilter_dealloc(TokenFilter* self)
+{
+    if (self->predicate)
+        delete self->predicate;
+    PyObject_Del((PyObject*)self);
+}
+
+/**
+ * Create a TokenFilter wrapping a predicate, taking ownership of it.
+ */
+static PyObject*
+create_token_filter(cmonster::core::TokenPredicate *predicate)
+{
+    cmonster::core::TokenPredicatePtr predicate_(predicate);
+    TokenFilter *filter = (TokenFilter*)PyObject_CallObject(
+        (PyObject*)TokenFilterType, NULL);
+    if (filter)
+    {
+        try
+        {
+            filter->predicate =
+                new cmonster::core::TokenPredicatePtr(predicate_);
+        }
+        catch (...)
+        {
+            Py_DECREF(filter);
+            set_python_exception();
+            return NULL;
+        }
+    }
+    return (PyObject*)filter;
+}
+
+static PyObject* TokenFilter_kinds(PyObject *unused, PyObject *args)
+{
+    std::vector<clang::tok::TokenKind> kinds;
+    const Py_ssize_t size = PyTuple_Size(args);
+    for (Py_ssize_t i = 0; i < size; ++i)
+    {
+        const long kind = PyLong_AsLong(PyTuple_GetItem(args, i));
+        if (kind == -1 && PyErr_Occurred())
+            return NULL;
+        if (kind < 0 || kind >= clang::tok::NUM_TOKENS)
+        {
+            PyErr_SetString(PyExc_ValueError, "invalid token kind");
+            return NULL;
+        }
+        kinds.push_back(static_cast<clang::tok::TokenKind>(kind));
+    }
+    try
+    {
+        return create_token_filter(
+            new cmonster::core::KindPredicate(kinds));
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
+static PyObject* TokenFilter_identifiers(PyObject *unused, PyObject *args)
+{
+    std::vector<std::string> names;
+    const Py_ssize_t size = PyTuple_Size(args);
+    for (Py_ssize_t i = 0; i < size; ++i)
+    {
+        PyObject *item = PyTuple_GetItem(args, i);
+        if (!PyUnicode_Check(item))
+        {
+            PyErr_SetString(PyExc_TypeError, "expected str");
+            return NULL;
+        }
+        ScopedPyObject utf8(PyUnicode_AsUTF8String(item));
+        if (!utf8)
+            return NULL;
+        names.push_back(PyBytes_AsString(utf8));
+    }
+    try
+    {
+        return create_token_filter(
+            new cmonster::core::IdentifierPredicate(names));
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
+static PyObject* TokenFilter_spelling(PyObject *unused, PyObject *args)
+{
+    const char *pattern;
+    int pattern_size;
+    if (!PyArg_ParseTuple(args, "s#:spelling", &pattern, &pattern_size))
+        return NULL;
+    try
+    {
+        return create_token_filter(new cmonster::core::SpellingPredicate(
+            std::string(pattern, pattern_size)));
+    }
+    catch (std::invalid_argument const& e)
+    {
+        PyErr_SetString(PyExc_ValueError, e.what());
+        return NULL;
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
+static PyObject* TokenFilter_in_main_file(PyObject *unused, PyObject *args)
+{
+    if (!PyArg_ParseTuple(args, ":in_main_file"))
+        return NULL;
+    try
+    {
+        return create_token_filter(new cmonster::core::MainFilePredicate);
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
+static PyObject*
+TokenFilter_from_macro_expansion(PyObject *unused, PyObject *args)
+{
+    if (!PyArg_ParseTuple(args, ":from_macro_expansion"))
+        return NULL;
+    try
+    {
+        return create_token_filter(
+            new cmonster::core::MacroExpansionPredicate);
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
+/**
+ * Common implementation of the & and | operators.
+ */
+template <typename Combinator>
+static PyObject* TokenFilter_combine(PyObject *lhs, PyObject *rhs)
+{
+    if (!PyObject_TypeCheck(lhs, TokenFilterType) ||
+        !PyObject_TypeCheck(rhs, TokenFilterType))
+    {
+        Py_INCREF(Py_NotImplemented);
+        return Py_NotImplemented;
+    }
+    std::vector<cmonster::core::TokenPredicatePtr> operands(2);
+    operands[0] = get_token_filter((TokenFilter*)lhs);
+    operands[1] = get_token_filter((TokenFilter*)rhs);
+    if (!operands[0] || !operands[1])
+        return NULL;
+    try
+    {
+        return create_token_filter(new Combinator(operands));
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
+static PyObject* TokenFilter_and(PyObject *lhs, PyObject *rhs)
+{
+    return TokenFilter_combine<cmonster::core::AndPredicate>(lhs, rhs);
+}
+
+static PyObject* TokenFilter_or(PyObject *lhs, PyObject *rhs)
+{
+    return TokenFilter_combine<cmonster::core::OrPredicate>(lhs, rhs);
+}
+
+static PyObject* TokenFilter_invert(TokenFilter *self)
+{
+    cmonster::core::TokenPredicatePtr operand = get_token_filter(self);
+    if (!operand)
+        return NULL;
+    try
+    {
+        return create_token_filter(new cmonster::core::NotPredicate(operand));
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
+static PyMethodDef TokenFilter_methods[] =
+{
+    {(char*)"kinds",
+     (PyCFunction)&TokenFilter_kinds, METH_VARARGS | METH_STATIC},
+    {(char*)"identifiers",
+     (PyCFunction)&TokenFilter_identifiers, METH_VARARGS | METH_STATIC},
+    {(char*)"spelling",
+     (PyCFunction)&TokenFilter_spelling, METH_VARARGS | METH_STATIC},
+    {(char*)"in_main_file",
+     (PyCFunction)&TokenFilter_in_main_file, METH_VARARGS | METH_STATIC},
+    {(char*)"from_macro_expansion",
+     (PyCFunction)&TokenFilter_from_macro_expansion,
+     METH_VARARGS | METH_STATIC},
+    {NULL}
+};
+
+static PyType_Slot TokenFilterTypeSlots[] =
+{
+    {Py_tp_dealloc,  (void*)TokenFilter_dealloc},
+    {Py_tp_methods,  (void*)TokenFilter_methods},
+    {Py_tp_doc,      (void*)TokenFilter_doc},
+    {Py_nb_and,      (void*)TokenFilter_and},
+    {Py_nb_or,       (void*)TokenFilter_or},
+    {Py_nb_invert,   (void*)TokenFilter_invert},
+    {Py_tp_alloc,    (void*)PyType_GenericAlloc},
+    {Py_tp_new,      (void*)PyType_GenericNew},
+    {0, NULL}
+};
+
+static PyType_Spec TokenFilterTypeSpec =
+{
+    "cmonster._cmonster.TokenFilter",
+    sizeof(TokenFilter),
+    0,
+    Py_TPFLAGS_DEFAULT,
+    TokenFilterTypeSlots
+};
+
+PyTypeObject* init_token_filter_type()
+{
+    TokenFilterType = (PyTypeObject*)PyType_FromSpec(&TokenFilterTypeSpec);
+    if (!TokenFilterType)
+        return NULL;
+    if (PyType_Ready((PyTypeObject*)TokenFilterType) < 0)
+        return NULL;
+    return TokenFilterType;
+}
+
+PyTypeObject* get_token_filter_type()
+{
+    return TokenFilterType;
+}
+
+cmonster::core::TokenPredicatePtr get_token_filter(TokenFilter *wrapper)
+{
+    if (!wrapper->predicate)
+    {
+        PyErr_SetString(PyExc_TypeError,
+            "TokenFilter objects must be created with a factory method");
+        return cmonster::core::TokenPredicatePtr();
+    }
+    return *wrapper->predicate;
+}
+
+}}
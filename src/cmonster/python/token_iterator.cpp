@@ -25,10 +25,14 @@ SOFTWARE.
 #define Py_LIMITED_API
 
 #include <Python.h>
+#include <memory>
 #include <stdexcept>
 #include <iostream>
 
 #include "exception.hpp"
+#include "gil.hpp"
+#include "scoped_pyobject.hpp"
+#include "token_batch.hpp"
 #include "token_iterator.hpp"
 #include "token.hpp"
 #include "preprocessor.hpp"
@@ -45,12 +49,26 @@ struct TokenIterator
     PyObject_HEAD
     Preprocessor *preprocessor;
     cmonster::core::TokenIterator *iterator;
+    Py_ssize_t batch_size;
+    bool pipelined;
 };
 
 static void TokenIterator_dealloc(TokenIterator* self)
 {
     if (self->iterator)
-        delete self->iterator;
+    {
+        // A pipelined iterator's producer may be waiting for the GIL to
+        // call a macro; it must be able to finish before it is joined.
+        if (self->pipelined)
+        {
+            ScopedGILRelease nogil;
+            delete self->iterator;
+        }
+        else
+        {
+            delete self->iterator;
+        }
+    }
     Py_XDECREF(self->preprocessor);
     PyObject_Del((PyObject*)self);
 }
@@ -61,10 +79,46 @@ static PyObject* TokenIterator_iter(TokenIterator *iter)
     return (PyObject*)iter;
 }
 
+static PyObject* TokenIterator_iternext_batch(TokenIterator *self)
+{
+    ScopedPyObject batch((PyObject*)create_token_batch(self->preprocessor));
+    if (!batch)
+        return NULL;
+    try
+    {
+        cmonster::core::TokenBatch &batch_ =
+            get_token_batch((TokenBatch*)batch.get());
+        size_t n;
+        {
+            ScopedGILRelease nogil;
+            n = self->iterator->next_batch(batch_, self->batch_size);
+        }
+        if (n)
+        {
+            if (self->pipelined)
+                set_token_batch_spelling_only((TokenBatch*)batch.get());
+            return batch.release();
+        }
+        else
+        {
+            delete self->iterator;
+            self->iterator = NULL;
+        }
+    }
+    catch (...)
+    {
+        set_python_exception();
+    }
+    return NULL;
+}
+
 static PyObject* TokenIterator_iternext(TokenIterator *self)
 {
     if (self->iterator)
     {
+        if (self->batch_size > 0)
+            return TokenIterator_iternext_batch(self);
+
         try
         {
             if (self->iterator->has_next())
@@ -133,6 +187,60 @@ TokenIterator* create_iterator(Preprocessor *preprocessor)
     return iter;
 }
 
+TokenIterator*
+create_iterator(Preprocessor *preprocessor,
+                cmonster::core::TokenIterator *iterator,
+                Py_ssize_t batch_size)
+{
+    std::auto_ptr<cmonster::core::TokenIterator> owned(iterator);
+    TokenIterator *iter = (TokenIterator*)PyObject_CallObject(
+        (PyObject*)TokenIteratorType, NULL);
+    if (iter)
+    {
+        iter->iterator = owned.release();
+        iter->batch_size = batch_size;
+        Py_INCREF(preprocessor);
+        iter->preprocessor = preprocessor;
+    }
+    return iter;
+}
+
+TokenIterator*
+create_batch_iterator(Preprocessor *preprocessor, Py_ssize_t batch_size,
+                      bool pipelined)
+{
+    if (batch_size <= 0)
+    {
+        PyErr_SetString(PyExc_ValueError, "batch size must be positive");
+        return NULL;
+    }
+    if (pipelined)
+    {
+        cmonster::core::TokenIterator *iterator;
+        try
+        {
+            std::auto_ptr<cmonster::core::TokenIterator> base(
+                get_preprocessor(preprocessor).create_iterator());
+            iterator = new cmonster::core::PipelinedTokenIterator(
+                base.release(), static_cast<size_t>(batch_size));
+        }
+        catch (...)
+        {
+            set_python_exception();
+            return NULL;
+        }
+        TokenIterator *iter =
+            create_iterator(preprocessor, iterator, batch_size);
+        if (iter)
+            iter->pipelined = true;
+        return iter;
+    }
+    TokenIterator *iter = create_iterator(preprocessor);
+    if (iter)
+        iter->batch_size = batch_size;
+    return iter;
+}
+
 PyObject* init_token_iterator_type()
 {
     TokenIteratorType = PyType_FromSpec(&TokenIteratorTypeSpec);
@@ -24,6 +24,10 @@ SOFTWARE.
 #define _CMONSTER_PYTHON_TOKEN_ITERATOR_HPP
 
 namespace cmonster {
+namespace core {
+class TokenIterator;
+}
+
 namespace python {
 
 // Python object structure to wrap a cmonster::core::TokenIterator.
@@ -36,6 +40,28 @@ struct TokenIterator;
  */
 TokenIterator* create_iterator(Preprocessor *preprocessor);
 
+/**
+ * Create a new heap-allocated TokenIterator from the specified preprocessor
+ * object, wrapping an existing core iterator (such as one reading a token
+ * cache). The Python object takes ownership of the core iterator, even if
+ * creation fails. If "batch_size" is positive, the iterator yields
+ * TokenBatch objects.
+ */
+TokenIterator*
+create_iterator(Preprocessor *preprocessor,
+                cmonster::core::TokenIterator *iterator,
+                Py_ssize_t batch_size = 0);
+
+/**
+ * Create a new heap-allocated TokenIterator from the specified preprocessor
+ * object, which will yield TokenBatch objects of up to "batch_size" tokens,
+ * rather than individual Token objects. If "pipelined" is true, tokens are
+ * preprocessed ahead of the consumer on a separate thread.
+ */
+TokenIterator*
+create_batch_iterator(Preprocessor *preprocessor, Py_ssize_t batch_size,
+                      bool pipelined = false);
+
 /**
  * Initialise the TokenIterator Python type object.
  */
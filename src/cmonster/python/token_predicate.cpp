@@ -27,6 +27,7 @@ SOFTWARE.
 #include <Python.h>
 
 #include "exception.hpp"
+#include "gil.hpp"
 #include "scoped_pyobject.hpp"
 #include "token_predicate.hpp"
 #include "token.hpp"
@@ -55,16 +56,18 @@ TokenPredicate::~TokenPredicate()
 
 bool TokenPredicate::operator()(cmonster::core::Token const& token) const
 {
+    ScopedGILAcquire gil;
+
     // Create the arguments tuple.
     ScopedPyObject args_tuple =
         Py_BuildValue("(O)", create_token(m_preprocessor, token));
     if (!args_tuple)
-        throw python_exception();
+        boost::throw_exception(python_exception());
 
     // Call the function.
     ScopedPyObject result = PyObject_Call(m_callable, args_tuple, NULL);
     if (!result)
-        throw python_exception();
+        boost::throw_exception(python_exception());
     return PyObject_IsTrue(result);
 }
 
@@ -0,0 +1,96 @@
+# Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+# 
+# Permission is hereby granted, free of charge, to any person
+# obtaining a copy of this software and associated documentation
+# files (the "Software"), to deal in the Software without
+# restriction, including without limitation the rights to use,
+# copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following
+# conditions:
+# 
+# The above copyright notice and this permission notice shall be
+# included in all copies or substantial portions of the Software.
+# 
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+# OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+# NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+# HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+# WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+# OTHER DEALINGS IN THE SOFTWARE.
+
+import cmonster.batch
+import json
+import os
+import tempfile
+import unittest
+
+class TestBatch(unittest.TestCase):
+    def test_run_in_order(self):
+        with tempfile.TemporaryDirectory() as d:
+            jobs = []
+            for i in range(4):
+                filename = os.path.join(d, "%d.c" % i)
+                with open(filename, "w") as f:
+                    f.write("VALUE_%d\n" % i)
+                jobs.append(cmonster.batch.Job(
+                    filename, defines=["VALUE_%d=%d" % (i, i*10)]))
+
+            for threads in (False, True):
+                results = list(cmonster.batch.run(
+                    jobs, processes=2, threads=threads))
+                self.assertEqual([j.filename for j in jobs],
+                                 [r.job.filename for r in results])
+                for i, result in enumerate(results):
+                    self.assertIsNone(result.error)
+                    self.assertIn(("%d" % (i*10)).encode(), result.output)
+
+
+    def test_job_directory(self):
+        # Relative paths are resolved against each job's directory, without
+        # changing the working directory, which threads share.
+        with tempfile.TemporaryDirectory() as d:
+            jobs = []
+            for i in range(4):
+                directory = os.path.join(d, str(i))
+                os.makedirs(os.path.join(directory, "include"))
+                with open(os.path.join(directory, "include", "value.h"),
+                          "w") as f:
+                    f.write("#define VALUE %d\n" % (i*10))
+                with open(os.path.join(directory, "main.c"), "w") as f:
+                    f.write("#include <value.h>\nVALUE\n")
+                jobs.append(cmonster.batch.Job(
+                    "main.c", include_dirs=["include"], directory=directory))
+
+            cwd = os.getcwd()
+            results = list(cmonster.batch.run(
+                jobs, processes=4, threads=True))
+            self.assertEqual(cwd, os.getcwd())
+            for i, result in enumerate(results):
+                self.assertIsNone(result.error)
+                self.assertIn(("%d" % (i*10)).encode(), result.output)
+
+
+    def test_compile_commands(self):
+        with tempfile.TemporaryDirectory() as d:
+            path = os.path.join(d, "compile_commands.json")
+            with open(path, "w") as f:
+                json.dump([
+                    {"directory": d, "file": "a.c",
+                     "command": "cc -Iinclude -DX=1 -D Y -c a.c"},
+                    {"directory": d, "file": "b.c",
+                     "arguments": ["cc", "-I", "/abs", "-c", "b.c"]}], f)
+
+            jobs = cmonster.batch.jobs_from_compile_commands(path)
+            self.assertEqual(2, len(jobs))
+            self.assertEqual(os.path.join(d, "a.c"), jobs[0].filename)
+            self.assertEqual((os.path.join(d, "include"),),
+                             jobs[0].include_dirs)
+            self.assertEqual(("X=1", "Y"), jobs[0].defines)
+            self.assertEqual(("/abs",), jobs[1].include_dirs)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,114 @@
+# Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+# 
+# Permission is hereby granted, free of charge, to any person
+# obtaining a copy of this software and associated documentation
+# files (the "Software"), to deal in the Software without
+# restriction, including without limitation the rights to use,
+# copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following
+# conditions:
+# 
+# The above copyright notice and this permission notice shall be
+# included in all copies or substantial portions of the Software.
+# 
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+# OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+# NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+# HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+# WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+# OTHER DEALINGS IN THE SOFTWARE.
+
+import cmonster
+import cmonster.cache
+import os
+import tempfile
+import time
+import unittest
+
+
+def _tree_size(directory):
+    total = 0
+    for (dirpath, dirnames, filenames) in os.walk(directory):
+        for name in filenames:
+            total += os.path.getsize(os.path.join(dirpath, name))
+    return total
+
+
+class TestResultCache(unittest.TestCase):
+    def test_preprocess_hit(self):
+        with tempfile.TemporaryDirectory() as d:
+            header = os.path.join(d, "value.h")
+            with open(header, "w") as f:
+                f.write("#define VALUE 1\n")
+            with open(os.path.join(d, "main.c"), "w") as f:
+                f.write('#include "value.h"\nint x = VALUE;\n')
+
+            setup = lambda parser: \
+                parser.preprocessor.add_include_dir(d)
+            cache = cmonster.cache.ResultCache(os.path.join(d, "cache"))
+            main = os.path.join(d, "main.c")
+            first = cache.preprocess(main, setup=setup, key=d)
+            self.assertIn(b"int x = 1;", first)
+            self.assertEqual((0, 1), (cache.hits, cache.misses))
+
+            # A hit must not call "setup", as no Parser is created.
+            def fail(parser):
+                raise AssertionError("parser created on a cache hit")
+            self.assertEqual(
+                first, cache.preprocess(main, setup=fail, key=d))
+            self.assertEqual((1, 1), (cache.hits, cache.misses))
+
+            # Changing an included header invalidates the entry.
+            with open(header, "w") as f:
+                f.write("#define VALUE 2\n")
+            second = cache.preprocess(main, setup=setup, key=d)
+            self.assertIn(b"int x = 2;", second)
+            self.assertEqual((1, 2), (cache.hits, cache.misses))
+
+
+    def test_parse_diagnostics(self):
+        with tempfile.TemporaryDirectory() as d:
+            cache = cmonster.cache.ResultCache(d)
+            data = "int f() { return undeclared; }\n"
+            def count(result):
+                return len(result.diagnostics)
+            first = cache.parse("main.c", count, data=data)
+            self.assertFalse(first.hit)
+            self.assertTrue(first.diagnostics)
+            second = cache.parse("main.c", count, data=data)
+            self.assertTrue(second.hit)
+            self.assertEqual(first.diagnostics, second.diagnostics)
+            self.assertEqual(len(first.diagnostics), second.value)
+            self.assertEqual("error", second.diagnostics[0][0])
+            self.assertFalse(cache.parse("main.c", data=data + "\n").hit)
+
+
+    def test_eviction(self):
+        with tempfile.TemporaryDirectory() as d:
+            # Measure one entry, and make room for four of them.
+            sizing = cmonster.cache.ResultCache(os.path.join(d, "sizing"))
+            sizing.preprocess("00.c", data="int x00;\n")
+            max_size = _tree_size(sizing.directory) * 4
+
+            cache = cmonster.cache.ResultCache(
+                os.path.join(d, "cache"), max_size=max_size)
+            for i in range(16):
+                cache.preprocess("%02d.c" % i, data="int x%02d;\n" % i)
+                # Give each entry a distinct modification time.
+                time.sleep(0.02)
+            self.assertLessEqual(_tree_size(cache.directory), max_size)
+            self.assertEqual((0, 16), (cache.hits, cache.misses))
+
+            # The most recent entries survive, and older ones are evicted.
+            for i in (15, 14):
+                cache.preprocess("%02d.c" % i, data="int x%02d;\n" % i)
+            self.assertEqual((2, 16), (cache.hits, cache.misses))
+            cache.preprocess("00.c", data="int x00;\n")
+            self.assertEqual((2, 17), (cache.hits, cache.misses))
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -23,8 +23,40 @@
 
 import cmonster
 import os
+import shutil
+import subprocess
+import tempfile
 import unittest
 
+# A native macro handler, built against "native_macro.h" in the source tree.
+_NATIVE_SOURCE = r"""
+#include <stdio.h>
+#include <string.h>
+#include "native_macro.h"
+
+int twice(const cmonster_macro_args *args, void *sink, cmonster_emit_fn emit)
+{
+    char line[32];
+    size_t i, n;
+    for (n = 0; n < 2; ++n)
+    {
+        for (i = 0; i < args->num_tokens; ++i)
+        {
+            emit(sink, args->spellings[i], args->lengths[i]);
+            emit(sink, " ", 1);
+        }
+    }
+    sprintf(line, "%u", args->line);
+    emit(sink, line, strlen(line));
+    return 0;
+}
+
+int fail(const cmonster_macro_args *args, void *sink, cmonster_emit_fn emit)
+{
+    return 2;
+}
+"""
+
 class TestDefine(unittest.TestCase):
     def test_define_object(self):
         pp = cmonster.Preprocessor("test.c", data="ABC")
@@ -42,6 +74,13 @@ class TestDefine(unittest.TestCase):
         self.assertEqual("123", str(toks[0]))
 
 
+    def test_add_predefines(self):
+        pp = cmonster.Preprocessor("test.c", data="ABC DEF(1)")
+        pp.add_predefines("#define ABC 123\n#define DEF(x) x+x")
+        toks = [tok for tok in pp]
+        self.assertEqual(["123", "1", "+", "1"], [str(t) for t in toks])
+
+
     def test_define_python_function(self):
         def ABC(arg):
             return "".join(reversed(str(arg)))
@@ -52,6 +91,18 @@ class TestDefine(unittest.TestCase):
         self.assertEqual("123", str(toks[0]))
 
 
+    def test_define_leading_expansion(self):
+        # Expansions at the start of the file come from scratch buffers,
+        # and must not be skipped along with the predefines.
+        def ABC(arg):
+            return "int " + str(arg)
+        pp = cmonster.Preprocessor("test.c", data="ABC(x) DEF;")
+        pp.add_predefines("#define DEF = 1")
+        pp.define(ABC)
+        toks = [str(tok) for tok in pp]
+        self.assertEqual(["int", "x", "=", "1", ";"], toks)
+
+
     def test_define_python_function_with_name(self):
         def XYZ(x):
             return "123"
@@ -62,6 +113,191 @@ class TestDefine(unittest.TestCase):
         self.assertEqual("123", str(toks[0]))
 
 
+    def test_py_def_cache(self):
+        from cmonster import _preprocessor
+        # Count the macro bodies compiled, by shadowing the builtin.
+        compiled = []
+        def compile_(*args):
+            compiled.append(args[0])
+            return compile(*args)
+        _preprocessor.compile = compile_
+        cache_dir = _preprocessor._code_cache_dir
+        _preprocessor._code_cache_dir = None
+        try:
+            data = ("py_def(ABC(x))\n    return str(x)[::-1] + '0'\n"
+                    "py_end\nABC(123)")
+            toks = [tok for tok in cmonster.Preprocessor("test.c", data=data)]
+            self.assertEqual(["3210"], [str(tok) for tok in toks])
+            self.assertEqual(1, len(compiled))
+            ncached = len(_preprocessor._code_cache)
+
+            # Redefining an identical macro should reuse the compiled code.
+            toks = [tok for tok in
+                    cmonster.Preprocessor("test2.c", data=data)]
+            self.assertEqual(["3210"], [str(tok) for tok in toks])
+            self.assertEqual(1, len(compiled))
+            self.assertEqual(ncached, len(_preprocessor._code_cache))
+        finally:
+            del _preprocessor.compile
+            _preprocessor._code_cache_dir = cache_dir
+
+
+    def test_capture_until(self):
+        data = ("int a;\nCAPTURE()\n"
+                "    x = 'END' /* END */\n"
+                "      y\n"
+                "END int b;")
+        pp = cmonster.Preprocessor("test.c", data=data)
+        captured = []
+        def CAPTURE(*args):
+            captured.append(pp.capture_until("END"))
+        pp.define(CAPTURE)
+        toks = [str(tok) for tok in pp]
+        self.assertEqual(["int", "a", ";", "int", "b", ";"], toks)
+
+        # The text is captured verbatim, including the comment; terminators
+        # within comments and literals are ignored.
+        self.assertEqual(["    x = 'END' /* END */\n      y"], captured)
+
+
+    def test_define_pure_function(self):
+        calls = []
+        @cmonster.pure
+        def ABC(arg):
+            calls.append(str(arg))
+            return "".join(reversed(str(arg)))
+        def XYZ(arg):
+            calls.append(str(arg))
+            return str(arg)
+        pp = cmonster.Preprocessor(
+            "test.c", data="ABC(321) ABC(321) ABC(45) XYZ(6) XYZ(6)")
+        pp.define(ABC)
+        pp.define(XYZ)
+        toks = [str(tok) for tok in pp]
+        self.assertEqual(["123", "123", "54", "6", "6"], toks)
+        self.assertEqual(["321", "45", "6", "6"], calls)
+
+
+    def test_py_def_pure(self):
+        # py_def globals are private, so calls are recorded through a
+        # builtin name.
+        import builtins
+        builtins._cmonster_test_calls = calls = []
+        try:
+            data = ("py_def(pure ABC(x))\n"
+                    "    _cmonster_test_calls.append(str(x))\n"
+                    "    return str(x)[::-1]\n"
+                    "py_end\n"
+                    "ABC(123) ABC(123) ABC(45)")
+            pp = cmonster.Preprocessor("test.c", data=data)
+            toks = [str(tok) for tok in pp]
+            self.assertEqual(["321", "321", "54"], toks)
+            self.assertEqual(["123", "45"], calls)
+        finally:
+            del builtins._cmonster_test_calls
+
+
+    def test_define_many(self):
+        pp = cmonster.Preprocessor(
+            "test.c", data="A B(1, 2) C(x) D E")
+        definitions = """\
+#define A 1 + \\
+    2
+  /* comment */
+#define B(x, y) y x
+#define C(...) [__VA_ARGS__]
+"""
+        self.assertEqual(3, pp.define_many(definitions))
+        self.assertEqual(2, pp.define_many([("D", "d"), ["E", None]]))
+
+        # Conflicting definitions are not defined.
+        self.assertEqual(0, pp.define_many("#define A 3\n"))
+        toks = [str(tok) for tok in pp]
+        self.assertEqual(
+            ["1", "+", "2", "2", "1", "[", "x", "]", "d"], toks)
+
+        self.assertRaises(ValueError, pp.define_many, "#define\n")
+        self.assertRaises(ValueError, pp.define_many, "#define F(x\n")
+        self.assertRaises(ValueError, pp.define_many, "G 1\n")
+
+
+    def test_define_builtin(self):
+        pp = cmonster.Preprocessor(
+            "test.c", data="C() C() S(a + b) N(x) T(two) T(other)")
+        pp.define_builtin("C", "counter", "5")
+        pp.define_builtin("S", "stringify")
+        pp.define_builtin("N", "concat_counter")
+        pp.define_builtin("T", "table", "one=1", "two=2", "=0")
+        toks = [str(tok) for tok in pp]
+        self.assertEqual(["5", "6", '"a + b"', "x0", "2", "0"], toks)
+        self.assertRaises(ValueError, pp.define_builtin, "X", "no_such_kind")
+
+
+    def test_define_native(self):
+        include_dir = os.path.join(
+            os.path.dirname(os.path.abspath(__file__)),
+            "..", "src", "cmonster", "core")
+        if not os.path.exists(os.path.join(include_dir, "native_macro.h")):
+            self.skipTest("native_macro.h not found")
+        tempdir = tempfile.mkdtemp()
+        try:
+            source = os.path.join(tempdir, "native.c")
+            library = os.path.join(tempdir, "native.so")
+            with open(source, "w") as f:
+                f.write(_NATIVE_SOURCE)
+            try:
+                status = subprocess.call(
+                    [os.environ.get("CC", "cc"), "-shared", "-fPIC",
+                     "-I", include_dir, "-o", library, source])
+            except OSError:
+                status = -1
+            if status != 0:
+                self.skipTest("no C compiler")
+
+            pp = cmonster.Preprocessor(
+                "test.c", data="\nTWICE(a + 1) FAIL()")
+            pp.define_native("TWICE", library, "twice")
+            pp.define_native("FAIL", library, "fail")
+            self.assertRaises(RuntimeError, pp.define_native,
+                              "MISSING", library, "no_such_symbol")
+            toks = []
+            with self.assertRaises(RuntimeError):
+                for tok in pp:
+                    toks.append(str(tok))
+            self.assertEqual(["a", "+", "1", "a", "+", "1", "2"], toks)
+        finally:
+            shutil.rmtree(tempdir)
+
+
+    def test_define_python_function_location(self):
+        def LINE():
+            return str(preprocessor.location.line)
+        def COLUMN():
+            return str(location.column)
+        pp = cmonster.Preprocessor("test.c", data="LINE()\n  COLUMN()")
+        pp.define(LINE)
+        pp.define(COLUMN)
+        self.assertIsNone(pp.location)
+        toks = [str(tok) for tok in pp]
+        self.assertEqual(["1", "3"], toks)
+
+
+    def test_define_python_function_shared(self):
+        # The same function (and module globals) used by two preprocessors,
+        # expanded alternately, sees the preprocessor expanding it each time.
+        def FILE():
+            return '"%s"' % (lambda: location.filename)()
+        pp_a = cmonster.Preprocessor("a.c", data="FILE() FILE()")
+        pp_b = cmonster.Preprocessor("b.c", data="FILE() FILE()")
+        pp_a.define(FILE)
+        pp_b.define(FILE)
+        toks = []
+        for tok_a, tok_b in zip(pp_a, pp_b):
+            toks.extend([str(tok_a), str(tok_b)])
+        self.assertEqual(['"a.c"', '"b.c"', '"a.c"', '"b.c"'], toks)
+        self.assertRaises(RuntimeError, getattr, preprocessor, "location")
+
+
 if __name__ == "__main__":
     unittest.main()
 
@@ -51,6 +51,22 @@ class TestIncludeLocator(unittest.TestCase):
             self.assertEqual("abc", str(tokens[0]))
 
 
+    def test_include_dir_duplicates(self):
+        with tempfile.TemporaryDirectory() as d:
+            with open(os.path.join(d, "header.h"), "w") as f:
+                f.write("abc\n")
+
+            pp = cmonster.Preprocessor("test.c", data="#include <header.h>")
+            self.assertTrue(pp.add_include_dir(d))
+            # Adding the same directory again, by any path, is a no-op.
+            self.assertTrue(pp.add_include_dir(d + "/."))
+            self.assertTrue(pp.add_include_dir(d, False))
+            self.assertFalse(pp.add_include_dir(os.path.join(d, "missing")))
+
+            tokens = [t for t in pp]
+            self.assertEqual(["abc"], [str(t) for t in tokens])
+
+
     def test_include_cwd(self):
         with tempfile.NamedTemporaryFile("w", dir=".") as f:
             f.write("abc\n")
@@ -78,6 +94,76 @@ class TestIncludeLocator(unittest.TestCase):
             tokens = [t for t in pp]
 
 
+    def test_locator_include_guards(self):
+        with tempfile.TemporaryDirectory() as d:
+            headers = {
+                "<guarded.h>": os.path.join(d, "guarded.h"),
+                "<once.h>": os.path.join(d, "once.h"),
+            }
+            with open(headers["<guarded.h>"], "w") as f:
+                f.write("#ifndef GUARDED_H\n#define GUARDED_H\n"
+                        "guarded\n#endif\n")
+            with open(headers["<once.h>"], "w") as f:
+                f.write("#pragma once\nonce\n")
+
+            # Headers found by the include locator are only entered once.
+            data = "#include <guarded.h>\n#include <once.h>\n" * 2
+            pp = cmonster.Preprocessor("test.c", data=data)
+            pp.set_include_locator(headers.get)
+            self.assertEqual(["guarded", "once"], [str(t) for t in pp])
+            guards = pp.get_guarded_files()
+            self.assertEqual("GUARDED_H", guards[headers["<guarded.h>"]])
+            self.assertNotIn(headers["<once.h>"], guards)
+
+            # Remove the guard, so that the header's contents would appear
+            # if it were entered again. The guard being defined no longer
+            # skips it by itself.
+            with open(headers["<guarded.h>"], "w") as f:
+                f.write("unguarded\n")
+            data = "#define GUARDED_H\n#include <guarded.h>\n"
+            pp = cmonster.Preprocessor("test.c", data=data)
+            pp.set_include_locator(headers.get)
+            self.assertEqual(["unguarded"], [str(t) for t in pp])
+
+            # Known guards may be given to another preprocessor, which then
+            # skips the header without entering it.
+            pp = cmonster.Preprocessor("test.c", data=data)
+            pp.set_include_locator(headers.get)
+            pp.add_guarded_files(guards)
+            self.assertEqual([], [str(t) for t in pp])
+            self.assertNotIn(headers["<guarded.h>"], pp.get_entered_files())
+
+
+    def test_include_cache(self):
+        with tempfile.TemporaryDirectory() as d:
+            header = os.path.join(d, "cached.h")
+            with open(header, "w") as f:
+                f.write("abc\n")
+
+            calls = []
+            def locator(include):
+                calls.append(include)
+                return header
+
+            cache = cmonster.IncludeCache()
+            for i in range(2):
+                pp = cmonster.Preprocessor(
+                    "test.c", data="#include <no_such_header_0.h>")
+                pp.set_include_locator(locator)
+                pp.set_include_cache(cache)
+                tokens = [str(t) for t in pp]
+                self.assertEqual(["abc"], tokens)
+            self.assertEqual(["<no_such_header_0.h>"], calls)
+            self.assertEqual(1, len(cache))
+
+            # Round trip through a file.
+            path = os.path.join(d, "includes.cache")
+            self.assertTrue(cache.save(path, header))
+            loaded = cmonster.IncludeCache()
+            self.assertTrue(loaded.load(path, header))
+            self.assertEqual(1, len(loaded))
+
+
 if __name__ == "__main__":
     unittest.main()
 
@@ -21,6 +21,7 @@
 # FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
 # OTHER DEALINGS IN THE SOFTWARE.
 
+import array
 import cmonster
 import os
 import unittest
@@ -51,6 +52,43 @@ class TestLocation(unittest.TestCase):
         loc -= 1
         self.assertEqual(1, loc.line)
 
+    def test_decompose_locations(self):
+        data = "int a;\n#line 10 \"other.c\"\n  int b;\nint c;\n"
+        parser = cmonster.Parser("test.c", data=data)
+        result = parser.parse()
+        locations = [result.get_decl_info(i)[3]
+                     for i in range(result.decl_count)]
+        encodings = [loc.encoding for loc in locations] + [0]
+
+        file, line, column, files = result.decompose_locations(encodings)
+        file = array.array("I", file)
+        line = array.array("I", line)
+        column = array.array("I", column)
+        self.assertEqual(len(encodings), len(file))
+        for i, loc in enumerate(locations):
+            if file[i] == 0xFFFFFFFF:
+                continue # implicit declarations
+            self.assertEqual(loc.filename, files[file[i]])
+            self.assertEqual(loc.line, line[i])
+            self.assertEqual(loc.column, column[i])
+        self.assertEqual(0xFFFFFFFF, file[-1])
+        self.assertEqual((0, 0), (line[-1], column[-1]))
+
+        # Raw bytes and SourceLocation objects are accepted alike, and
+        # filenames are the same interned objects each time.
+        raw = array.array("I", encodings).tobytes()
+        file2, line2, column2, files2 = result.decompose_locations(raw)
+        self.assertEqual((line.tobytes(), column.tobytes()), (line2, column2))
+        _, _, _, files3 = result.decompose_locations(locations)
+        for a, b in zip(files2, files3):
+            self.assertIs(a, b)
+        self.assertIn("other.c", files)
+
+        # Encodings beyond the source manager's entries are rejected.
+        for bad in (0x7FFFFFF0, 0xFFFFFFF0):
+            self.assertRaises(ValueError, result.decompose_locations,
+                              [encodings[0], bad])
+
 
 if __name__ == "__main__":
     unittest.main()
@@ -23,7 +23,11 @@
 
 import cmonster
 import cmonster.ast
+import concurrent.futures
+import io
 import os
+import struct
+import tempfile
 import unittest
 
 class TestParser(unittest.TestCase):
@@ -126,6 +130,405 @@ int main()
         # the same object, so we can test for equality.
         self.assertIs(decls[1], y_init.subexpr.subexpr.decl)
 
+
+    def test_from_path(self):
+        with tempfile.NamedTemporaryFile("w", suffix=".c") as f:
+            f.write("int x;\n")
+            f.flush()
+            p = cmonster.Parser.from_path(f.name)
+            decls = [d for d in p.parse().translation_unit.declarations]
+            self.assertEqual("x", decls[-1].name)
+            self.assertEqual(f.name, decls[-1].location.filename)
+
+
+    def test_bytes_data(self):
+        for data in (b"int x;", "int x;", bytearray(b"int x;")):
+            p = cmonster.Parser("test.c", data=data)
+            decls = [d for d in p.parse().translation_unit.declarations]
+            self.assertEqual("x", decls[-1].name)
+        self.assertRaises(TypeError, cmonster.Parser, "test.c", data=1)
+
+
+    def test_pch(self):
+        with tempfile.TemporaryDirectory() as d:
+            header = os.path.join(d, "header.h")
+            with open(header, "w") as f:
+                f.write("int from_header(int x);\n")
+            pch = cmonster.generate_pch([header], os.path.join(d, "test.pch"))
+            self.assertTrue(os.path.exists(pch))
+
+            p = cmonster.Parser(
+                "test.c", data="int y = from_header(1);", pch=pch)
+            result = p.parse()
+            decls = [d for d in result.translation_unit.declarations]
+            self.assertEqual("y", decls[-1].name)
+
+
+    def test_reparse(self):
+        with tempfile.TemporaryDirectory() as d:
+            header = os.path.join(d, "header.h")
+            with open(header, "w") as f:
+                f.write("int from_header(int x);\n")
+            preamble = "#include \"%s\"\n" % header
+
+            p = cmonster.Parser("test.c", data=preamble + "int x;")
+            p.preprocessor.define("VALUE", "1")
+            p.enable_stats()
+            for name in ("a", "b", "c"):
+                data = preamble + "int %s = from_header(VALUE);" % name
+                result = p.reparse(data)
+                decls = [d for d in result.translation_unit.declarations]
+                self.assertEqual(name, decls[-1].name)
+
+            # The preamble is built once, and reused while it is unchanged.
+            stats = p.stats()
+            self.assertEqual(3, stats["parse"]["count"])
+            self.assertEqual(1, stats["preamble"]["count"])
+
+            # Changing the preamble causes it to be rebuilt. The previous
+            # result remains usable.
+            previous = result
+            result = p.reparse("#define VALUE2 2\nint d = VALUE2;")
+            decls = [d for d in result.translation_unit.declarations]
+            self.assertEqual("d", decls[-1].name)
+            self.assertEqual(2, p.stats()["preamble"]["count"])
+            self.assertTrue(previous.find_decls(name="c"))
+            self.assertFalse(previous.find_decls(name="d"))
+
+
+    def test_reset(self):
+        p = cmonster.Parser("a.c", data="int a = VALUE;")
+        p.preprocessor.define("VALUE", "1")
+        first = p.parse()
+
+        # The configuration survives a reset, including py_def.
+        data = "py_def(T())\n    return 'int'\npy_end\nT() b = VALUE;"
+        p.reset("b.c", data)
+        result = p.parse()
+        decls = [d for d in result.translation_unit.declarations]
+        self.assertEqual("b", decls[-1].name)
+
+        # Results of the previous parse are kept alive, and still usable.
+        decls = [d for d in first.translation_unit.declarations]
+        self.assertEqual("a", decls[-1].name)
+        self.assertEqual("a.c", decls[-1].location.filename)
+
+        with tempfile.TemporaryDirectory() as d:
+            path = os.path.join(d, "c.c")
+            with open(path, "w") as f:
+                f.write("int c;\n")
+            p.reset(path)
+            decls = [d for d in p.parse().translation_unit.declarations]
+            self.assertEqual("c", decls[-1].name)
+        self.assertRaises(Exception, p.reset, "no_such_file.c")
+
+
+    def test_reset_builtin_table(self):
+        # Table values are lexed again by the new preprocessor after a reset.
+        p = cmonster.Parser("a.c", data="T(type) a;")
+        p.preprocessor.define_builtin("T", "table", "type=int", "=long")
+        decls = [d for d in p.parse().translation_unit.declarations]
+        self.assertEqual("a", decls[-1].name)
+        p.reset("b.c", "T(type) b; T(other) c;")
+        decls = [d for d in p.parse().translation_unit.declarations]
+        self.assertEqual(["b", "c"], [d.name for d in decls[-2:]])
+
+
+    def test_parser_pool(self):
+        pool = cmonster.ParserPool(2)
+        names = ["f%d" % i for i in range(8)]
+        def parse(name):
+            with pool.parser(name + ".c", data="int %s;" % name) as p:
+                decls = [d for d in p.parse().translation_unit.declarations]
+                return decls[-1].name
+        with concurrent.futures.ThreadPoolExecutor(4) as executor:
+            self.assertEqual(names, list(executor.map(parse, names)))
+
+        # All parsers are in use.
+        a = pool.acquire("a.c", data="")
+        b = pool.acquire("b.c", data="")
+        self.assertRaises(cmonster.TimeoutError, pool.acquire, "c.c", "",
+                          0.01)
+        pool.release(a)
+        pool.release(pool.acquire("c.c", data=""))
+        pool.release(b)
+
+
+    def test_decl_index(self):
+        p = cmonster.Parser(
+            "test.c", data="int a; struct S {int m;}; int f(int x);")
+        result = p.parse()
+        self.assertEqual(0, result.find_decls()[0])
+        self.assertEqual(result.decl_count, len(result.find_decls()))
+
+        # The translation unit has no parent.
+        self.assertIsNone(result.get_decl_info(0)[2])
+
+        [f] = result.find_decls(name="f")
+        decl = result.get_decl(f)
+        self.assertIsInstance(decl, cmonster.ast.FunctionDecl)
+        self.assertEqual("f", decl.name)
+        self.assertIs(decl, result.get_decl(f))
+        self.assertIn(f, result.find_decls(kind=decl.kind))
+        self.assertEqual([], result.find_decls(kind=decl.kind, name="a"))
+        self.assertEqual([], result.find_decls(name="no_such_identifier"))
+
+        # Parameters and members are indexed beneath their parents.
+        [x] = result.find_decls(name="x")
+        self.assertEqual(f, result.get_decl_info(x)[2])
+        s = result.find_decls(name="S")[0]
+        [m] = result.find_decls(name="m")
+        kind, name, parent, begin, end = result.get_decl_info(m)
+        self.assertEqual(("m", s), (name, parent))
+        self.assertEqual(1, begin.line)
+
+
+    def test_export_decls(self):
+        p = cmonster.Parser("test.c",
+                            data="struct S {int m;};\nint f(int x);\n")
+        result = p.parse()
+        (f, x, m) = [result.find_decls(name=n)[0] for n in ("f", "x", "m")]
+
+        for threads in (1, 4):
+            columns = result.export_decls(threads=threads)
+            kinds = struct.unpack("=%dI" % result.decl_count, columns["kind"])
+            parents = struct.unpack("=%dI" % result.decl_count,
+                                    columns["parent"])
+            lines = struct.unpack("=%dI" % result.decl_count, columns["line"])
+            files = struct.unpack("=%dI" % result.decl_count, columns["file"])
+
+            def strings(column):
+                (offsets, data) = columns[column]
+                offsets = struct.unpack("=%dI" % (result.decl_count + 1),
+                                        offsets)
+                return [data[offsets[i]:offsets[i+1]].decode()
+                        for i in range(result.decl_count)]
+            names = strings("name")
+            types = strings("type")
+
+            self.assertEqual("Function", columns["kind_names"][kinds[f]])
+            self.assertEqual(("f", "int (int)", 2), (names[f], types[f],
+                                                     lines[f]))
+            self.assertEqual(("x", "int", f), (names[x], types[x],
+                                               parents[x]))
+            self.assertEqual("S::m", strings("qualified_name")[m])
+            self.assertEqual("test.c", columns["files"][files[f]])
+
+
+    def test_match(self):
+        p = cmonster.Parser("test.c", data="""
+int f(int x);
+int g(int y) {return y;}
+int h() {return 1;}
+""")
+        result = p.parse()
+        names = [d.name for d in result.match(decl_kinds="Function")]
+        self.assertEqual(["f", "g", "h"], names)
+        names = [d.name for d in result.match(decl_kinds=["Function"],
+                                              with_body=True, name="^[gz]")]
+        self.assertEqual(["g"], names)
+
+        # Abstract kinds match all subclasses.
+        names = [d.name for d in result.match(decl_kinds="Named", name="y")]
+        self.assertEqual(["y"], names)
+
+        stmts = result.match(stmt_kinds="ReturnStmt", main_file_only=True)
+        self.assertEqual(["ReturnStmt"] * 2, [s.class_name for s in stmts])
+
+        matched = []
+        self.assertIsNone(result.match(decl_kinds="ParmVar",
+                                       callback=matched.append))
+        self.assertEqual(["x", "y"], [d.name for d in matched])
+        self.assertRaises(RuntimeError, result.match, decl_kinds="Bogus")
+
+
+    def test_parse_options(self):
+        with tempfile.TemporaryDirectory() as d:
+            header = os.path.join(d, "header.h")
+            with open(header, "w") as f:
+                f.write("inline int in_header() {return 0;}\n"
+                        "template <typename T> T unused(T x) {return x;}\n")
+            data = "#include \"%s\"\nint f() {return in_header();}" % header
+            p = cmonster.Parser("test.c", data=data)
+
+            # Clang 3.0 cannot skip function bodies, so the option is
+            # rejected rather than ignored.
+            self.assertRaises(ValueError, p.parse, skip_header_bodies=True)
+            result = p.parse(delayed_templates=True)
+            [f] = result.match(decl_kinds="Function", name="^f$")
+            self.assertIsNotNone(f.body)
+            [h] = result.match(decl_kinds="Function", name="^in_header$")
+            self.assertIsNotNone(h.body)
+
+
+    def test_parser_config(self):
+        with tempfile.TemporaryDirectory() as d:
+            with open(os.path.join(d, "config.h"), "w") as f:
+                f.write("int from_config_dir();\n")
+            config = cmonster.ParserConfig(
+                language="c", standard="c99", system_include_dirs=[d],
+                predefines="#define CONFIGURED 1\n")
+            self.assertEqual("c", config.language)
+            self.assertEqual("c99", config.standard)
+            self.assertEqual(((d, True),), config.include_dirs)
+
+            # The configuration may be shared by many parsers.
+            data = "#include <config.h>\nint x = CONFIGURED;"
+            for i in range(2):
+                p = cmonster.Parser("test.c", data=data, config=config)
+                result = p.parse()
+                names = [decl.name for decl in result.match(
+                    decl_kinds=("Function", "Var"), main_file_only=False)]
+                self.assertIn("from_config_dir", names)
+                self.assertIn("x", names)
+
+        self.assertRaises(RuntimeError, cmonster.ParserConfig,
+                          language="fortran")
+
+        # Initialising again replaces the configuration.
+        config = cmonster.ParserConfig(language="c")
+        config.__init__(language="c++", standard="c++98")
+        self.assertEqual("c++", config.language)
+        self.assertEqual("c++98", config.standard)
+
+        # An uninitialised configuration cannot be used.
+        config = cmonster.ParserConfig.__new__(cmonster.ParserConfig)
+        self.assertRaises(RuntimeError, getattr, config, "triple")
+        self.assertRaises(RuntimeError, getattr, config, "include_dirs")
+        self.assertRaises(RuntimeError, cmonster.Parser, "test.c",
+                          data="", config=config)
+
+
+    def test_rewriter_insert_many(self):
+        parser = cmonster.Parser("test.c", data="int abc;\nint def;\n")
+        result = parser.parse()
+        [abc, def_] = result.match(decl_kinds="Var")
+        rewriter = cmonster.Rewriter(result)
+        rewriter.insert_many([
+            (abc.location, "x", 0, 3),
+            (abc.location, "/*abc*/"),
+            [def_, "y", cmonster.Rewriter.AFTER, 3],
+        ])
+        f = io.StringIO()
+        self.assertTrue(rewriter.dump(f))
+        self.assertEqual("int /*abc*/x;\nint y;\n", f.getvalue())
+
+        # Overlapping edits are rejected, and nothing is applied.
+        rewriter = cmonster.Rewriter(result)
+        self.assertRaises(ValueError, rewriter.insert_many,
+                          [(abc.location, "x", 0, 3),
+                           (abc.location + 1, "y")])
+        self.assertFalse(rewriter.dump(io.StringIO()))
+
+        # Encodings outside of the source manager's entries are rejected.
+        for encoding in (0x7FFFFFF0, 0xFFFFFFF0):
+            self.assertRaises(ValueError, rewriter.insert_many,
+                              [(encoding, "x")])
+            self.assertRaises(ValueError, rewriter.insert, encoding, "x")
+        self.assertFalse(rewriter.dump(io.StringIO()))
+
+
+    def test_rewriter_commit_all(self):
+        with tempfile.TemporaryDirectory() as d:
+            header = os.path.join(d, "header.h")
+            with open(header, "w") as f:
+                f.write("int in_header;\n")
+            data = "#include \"%s\"\nint in_main;\n" % header
+            result = cmonster.Parser("test.c", data=data).parse()
+            decls = result.match(decl_kinds="Var", main_file_only=False)
+            [in_header] = [decl for decl in decls
+                           if decl.name == "in_header"]
+            [in_main] = [decl for decl in decls if decl.name == "in_main"]
+
+            # Only the main file may be edited by default.
+            self.assertRaises(ValueError, cmonster.Rewriter(result).insert,
+                              in_header, "static ")
+
+            rewriter = cmonster.Rewriter(result, all_files=True)
+            rewriter.insert_many([(in_header, "h_", 0),
+                                  (in_main, "m_", 0)])
+            self.assertEqual(sorted(["test.c", header]),
+                             sorted(rewriter.modified_files()))
+
+            out = os.path.join(d, "out")
+            paths = rewriter.commit_all(out)
+            self.assertEqual(2, len(paths))
+            with open(os.path.join(out, "test.c")) as f:
+                self.assertIn("int m_in_main;", f.read())
+            with open(out + header) as f:
+                self.assertEqual("int h_in_header;\n", f.read())
+            # The original files are untouched.
+            with open(header) as f:
+                self.assertEqual("int in_header;\n", f.read())
+
+            # Files may not be written outside the directory.
+            result = cmonster.Parser("../escape.c", data="int x;").parse()
+            [x] = result.match(decl_kinds="Var")
+            rewriter = cmonster.Rewriter(result)
+            rewriter.insert(x, "static ")
+            self.assertRaises(ValueError, rewriter.commit_all, out)
+            self.assertFalse(os.path.exists(os.path.join(d, "escape.c")))
+
+
+    def test_stats(self):
+        def ABC(arg):
+            return str(arg)
+        parser = cmonster.Parser("test.c", data="int x = ABC(1);")
+        parser.preprocessor.define(ABC)
+        stats = parser.stats()
+        self.assertEqual(0, stats["function_macro"]["count"])
+
+        parser.enable_stats()
+        parser.parse()
+        stats = parser.stats(clear=True)
+        self.assertEqual(1, stats["parse"]["count"])
+        self.assertEqual(1, stats["function_macro"]["count"])
+        [(name, ns)] = stats["function_macro"]["slowest"]
+        self.assertEqual("ABC", name)
+        self.assertLessEqual(ns, stats["function_macro"]["total_ns"])
+        self.assertEqual(0, parser.stats()["parse"]["count"])
+
+
+    def test_collect_diagnostics(self):
+        p = cmonster.Parser("test.c",
+                            data="int a = x;\nint b = y;\nint c;\n")
+        result = p.parse(collect_diagnostics=True)
+        errors = [d for d in result.diagnostics if d[0] == "error"]
+        self.assertEqual(2, len(errors))
+        level, id_, location, message = errors[0]
+        self.assertEqual((1, "x"), (location.line, message.split("'")[1]))
+        self.assertEqual(2, errors[1][2].line)
+        self.assertIn("y", errors[1][3])
+
+        # Parsing continued past the errors.
+        self.assertEqual(1, len(result.find_decls(name="c")))
+
+        # A clean parse has no diagnostics, and they are only collected on
+        # request.
+        result = p.reparse("int d;\n", collect_diagnostics=True)
+        self.assertEqual([], result.diagnostics)
+        result = p.reparse("int e;\n")
+        self.assertEqual([], result.diagnostics)
+
+
+    def test_syntax_only(self):
+        data = ("template <typename T> struct Box {T value;};\n"
+                "template <typename T> T twice(T x) {return x + x;}\n"
+                "int f() {return twice(1);}\n"
+                "int g() {}\n"
+                "Box<int> b;\n")
+        p = cmonster.Parser("test.cpp", data=data)
+        full = p.parse(collect_diagnostics=True)
+        warnings = [d for d in full.diagnostics if d[0] == "warning"]
+        self.assertTrue(warnings)
+
+        # Declarations are all found, but warnings are not computed.
+        result = p.reparse(data, collect_diagnostics=True, syntax_only=True)
+        self.assertEqual([], result.diagnostics)
+        for name in ("Box", "twice", "f", "g", "b"):
+            self.assertTrue(result.find_decls(name=name), name)
+
+
 if __name__ == "__main__":
     unittest.main()
 
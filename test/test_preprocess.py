@@ -0,0 +1,320 @@
+# Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+# 
+# Permission is hereby granted, free of charge, to any person
+# obtaining a copy of this software and associated documentation
+# files (the "Software"), to deal in the Software without
+# restriction, including without limitation the rights to use,
+# copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following
+# conditions:
+# 
+# The above copyright notice and this permission notice shall be
+# included in all copies or substantial portions of the Software.
+# 
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+# OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+# NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+# HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+# WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+# OTHER DEALINGS IN THE SOFTWARE.
+
+import cmonster
+import io
+import os
+import shutil
+import sys
+import tempfile
+import unittest
+
+# Coroutines for test_async_iter_batches. They are compiled only on Python
+# 3.5+, as "async def" is a syntax error in older versions.
+_ASYNC_SOURCE = """
+async def consume(batches):
+    result = []
+    async for batch in batches:
+        result.append([str(batch[i]) for i in range(len(batch))])
+    return result
+
+async def close_early(batches, state):
+    await batches.__anext__()
+    await batches.aclose()
+    return state["active"]
+"""
+
+class TestPreprocess(unittest.TestCase):
+    def test_preprocess_to_bytes(self):
+        pp = cmonster.Preprocessor("test.c", data="#define X 123\nint x = X;")
+        output = pp.preprocess_to_bytes()
+        self.assertIsInstance(output, bytes)
+        self.assertIn(b"int x = 123;", output)
+
+
+    def test_preprocess_to_callback(self):
+        chunks = []
+        data = "".join("int x%d;\n" % i for i in range(1000))
+        pp = cmonster.Preprocessor("test.c", data=data)
+        pp.preprocess(chunks.append, buffer_size=1024)
+        self.assertTrue(len(chunks) > 1)
+        self.assertTrue(all(len(chunk) <= 1024 for chunk in chunks))
+        self.assertIn(b"int x999;", b"".join(chunks))
+
+
+    def test_preprocess_to_file_objects(self):
+        pp = cmonster.Preprocessor("test.c", data="int x;")
+        f = io.BytesIO()
+        pp.preprocess(f)
+        self.assertIn(b"int x;", f.getvalue())
+
+        pp = cmonster.Preprocessor("test.c", data="int y;")
+        f = io.StringIO()
+        pp.preprocess(f)
+        self.assertIn("int y;", f.getvalue())
+
+
+    def test_token_cache(self):
+        tempdir = tempfile.mkdtemp()
+        try:
+            header = os.path.join(tempdir, "test.h")
+            source = os.path.join(tempdir, "test.c")
+            cache = os.path.join(tempdir, "test.tokens")
+            with open(header, "w") as f:
+                f.write("#define X 123\nint y;\n")
+            with open(source, "w") as f:
+                f.write('#include "test.h"\nint x = X;\n')
+            expected = [(tok.token_id, str(tok))
+                        for tok in cmonster.Preprocessor(source)]
+
+            pp = cmonster.Preprocessor(source)
+            self.assertFalse(pp.is_token_cache_valid(cache))
+            pp.write_token_cache(cache, "key")
+
+            pp = cmonster.Preprocessor(source)
+            self.assertTrue(pp.is_token_cache_valid(cache, "key"))
+            self.assertFalse(pp.is_token_cache_valid(cache, "other"))
+            toks = [(tok.token_id, str(tok))
+                    for tok in pp.read_token_cache(cache)]
+            self.assertEqual(expected, toks)
+
+            # Modifying an included file invalidates the cache.
+            with open(header, "w") as f:
+                f.write("#define X 456\nint y;\n")
+            pp = cmonster.Preprocessor(source)
+            self.assertFalse(pp.is_token_cache_valid(cache, "key"))
+        finally:
+            shutil.rmtree(tempdir)
+
+
+    def test_token_cache_config(self):
+        tempdir = tempfile.mkdtemp()
+        try:
+            cache = os.path.join(tempdir, "test.tokens")
+            pp = cmonster.Preprocessor("test.c", data="int x = X;\n")
+            pp.define("X", "1")
+            pp.write_token_cache(cache)
+
+            pp = cmonster.Preprocessor("test.c", data="int x = X;\n")
+            pp.define("X", "1")
+            self.assertTrue(pp.is_token_cache_valid(cache))
+
+            # Changing the in-memory main buffer invalidates the cache.
+            pp = cmonster.Preprocessor("test.c", data="int y = X;\n")
+            pp.define("X", "1")
+            self.assertFalse(pp.is_token_cache_valid(cache))
+
+            # So does changing a macro, or a block of definitions.
+            pp = cmonster.Preprocessor("test.c", data="int x = X;\n")
+            pp.define("X", "2")
+            self.assertFalse(pp.is_token_cache_valid(cache))
+            pp = cmonster.Preprocessor("test.c", data="int x = X;\n")
+            pp.define("X", "1")
+            pp.define_many([("Y", "1")])
+            self.assertFalse(pp.is_token_cache_valid(cache))
+        finally:
+            shutil.rmtree(tempdir)
+
+
+    def test_scan_dependencies(self):
+        tempdir = tempfile.mkdtemp()
+        try:
+            files = {
+                "a.h": "#ifndef A_H\n#define A_H\nint a;\n#endif\n",
+                "b.h": '#pragma once\n#include "a.h"\n',
+                "test.c": '#include "a.h"\n#include "b.h"\n'
+                          '#include "b.h"\nint x;\n'
+            }
+            for name, data in files.items():
+                with open(os.path.join(tempdir, name), "w") as f:
+                    f.write(data)
+            source = os.path.join(tempdir, "test.c")
+            graph = cmonster.Preprocessor(source).scan_dependencies()
+
+            summary = [(os.path.basename(includer), filename, angled, line,
+                        os.path.basename(path), guard, pragma_once)
+                       for (includer, filename, angled, line, path, guard,
+                            pragma_once) in graph]
+            self.assertEqual([
+                ("test.c", "a.h", False, 1, "a.h", "A_H", False),
+                ("test.c", "b.h", False, 2, "b.h", None, True),
+                ("b.h", "a.h", False, 2, "a.h", "A_H", False),
+                ("test.c", "b.h", False, 3, "b.h", None, True)], summary)
+        finally:
+            shutil.rmtree(tempdir)
+
+
+    def test_profile(self):
+        tempdir = tempfile.mkdtemp()
+        try:
+            files = {
+                "a.h": "#define PAIR(x) x, x\n"
+                       "#define WRAP(x) { PAIR(x) }\n"
+                       "int a;\n",
+                "test.c": '#include "a.h"\n'
+                          "py_def(REV(x))\n"
+                          "    return str(x)[::-1]\n"
+                          "py_end\n"
+                          "int v[] = WRAP(1);\n"
+                          "int r = REV(123);\n"
+            }
+            for name, data in files.items():
+                with open(os.path.join(tempdir, name), "w") as f:
+                    f.write(data)
+            pp = cmonster.Preprocessor(os.path.join(tempdir, "test.c"))
+            pp.enable_profiling()
+            toks = [str(tok) for tok in pp]
+            self.assertIn("321", toks)
+
+            # Each line is "frame;frame;... value"; file frames are paths.
+            profile = {}
+            for line in pp.profile(tokens=True).splitlines():
+                stack, value = line.rsplit(" ", 1)
+                stack = ";".join(os.path.basename(frame)
+                                 for frame in stack.split(";"))
+                profile[stack] = int(value)
+            self.assertEqual({
+                "test.c": 9,
+                "test.c;a.h": 3,
+                "test.c;WRAP": 2,
+                "test.c;WRAP;PAIR": 3,
+                "test.c;REV": 1}, profile)
+            self.assertEqual(len(toks), sum(profile.values()))
+
+            # Times are reported for the same stacks.
+            times = pp.profile(clear=True).splitlines()
+            self.assertTrue(times)
+            self.assertEqual("", pp.profile())
+        finally:
+            shutil.rmtree(tempdir)
+
+
+    def test_streaming(self):
+        tempdir = tempfile.mkdtemp()
+        try:
+            # Large enough to be memory-mapped, and not a whole number of
+            # pages.
+            source = os.path.join(tempdir, "test.c")
+            with open(source, "w") as f:
+                for i in range(20000):
+                    f.write("int x%d = NEG(%d);\n" % (i, i))
+
+            def NEG(arg):
+                return "-%s" % arg
+
+            def preprocess(window):
+                pp = cmonster.Preprocessor(source)
+                pp.define(NEG)
+                if window:
+                    pp.set_streaming(window)
+                return (pp.preprocess_to_bytes(), pp.memory_high_water)
+
+            (output, full) = preprocess(0)
+            (streamed_output, streamed) = preprocess(16 * 1024)
+            self.assertIn(b"int x19999 = -19999;", output)
+            self.assertEqual(output, streamed_output)
+            self.assertTrue(0 < streamed < full)
+        finally:
+            shutil.rmtree(tempdir)
+
+
+    def test_file_cache(self):
+        tempdir = tempfile.mkdtemp()
+        try:
+            header = os.path.join(tempdir, "test.h")
+            with open(header, "w") as f:
+                f.write("int x;\n")
+            data = '#include "%s"\n' % header
+
+            def preprocess(cache):
+                pp = cmonster.Preprocessor("test.c", data=data)
+                pp.set_file_cache(cache)
+                return [str(tok) for tok in pp]
+
+            # The header is read once, and shared by both preprocessors.
+            cache = cmonster.FileCache()
+            self.assertEqual(["int", "x", ";"], preprocess(cache))
+            self.assertEqual(["int", "x", ";"], preprocess(cache))
+            self.assertEqual(1, len(cache))
+            self.assertEqual(7, cache.memory)
+
+            # Editing the header is picked up by the next preprocessor.
+            with open(header, "w") as f:
+                f.write("int yy;\n")
+            self.assertEqual(["int", "yy", ";"], preprocess(cache))
+            self.assertEqual(1, len(cache))
+            self.assertEqual(8, cache.memory)
+            cache.invalidate(header)
+            self.assertEqual(["int", "yy", ";"], preprocess(cache))
+        finally:
+            shutil.rmtree(tempdir)
+
+
+    @unittest.skipIf(sys.version_info < (3, 5), "requires asyncio")
+    def test_async_iter_batches(self):
+        import asyncio
+        import cmonster.aio
+        coroutines = {}
+        exec(_ASYNC_SOURCE, coroutines)
+
+        def TWICE(arg):
+            return "%s %s" % (arg, arg)
+        data = "".join("int x%d = TWICE(%d);\n" % (i, i) for i in range(100))
+        pp = cmonster.Preprocessor("test.c", data=data)
+        pp.define(TWICE)
+
+        batches = cmonster.aio.iter_batches(pp, batch_size=64, max_pending=2)
+        loop = asyncio.new_event_loop()
+        try:
+            result = loop.run_until_complete(coroutines["consume"](batches))
+        finally:
+            loop.close()
+        self.assertTrue(all(len(batch) <= 64 for batch in result))
+        spellings = [spelling for batch in result for spelling in batch]
+        self.assertEqual(100 * 6, len(spellings))
+        self.assertEqual(["int", "x99", "=", "99", "99", ";"],
+                         spellings[-6:])
+
+        # Closing early waits for the batch being lexed on the worker.
+        import time
+        state = {"active": 0}
+        def SLOW(arg):
+            state["active"] += 1
+            time.sleep(0.01)
+            state["active"] -= 1
+            return str(arg)
+        pp = cmonster.Preprocessor("test.c", data="SLOW(1) " * 100)
+        pp.define(SLOW)
+
+        batches = cmonster.aio.iter_batches(pp, batch_size=8, max_pending=1)
+        loop = asyncio.new_event_loop()
+        try:
+            active = loop.run_until_complete(
+                coroutines["close_early"](batches, state))
+            self.assertEqual(0, active)
+        finally:
+            loop.close()
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -23,6 +23,7 @@
 
 import cmonster
 import os
+import struct
 import unittest
 
 class TestToken(unittest.TestCase):
@@ -34,6 +35,174 @@ class TestToken(unittest.TestCase):
         self.assertEqual(3, len(toks[0]))
 
 
+    def test_iter_batches(self):
+        pp = cmonster.Preprocessor("test.c", data="ABC 123 + def")
+        batches = [batch for batch in pp.iter_batches(3)]
+        self.assertEqual(2, len(batches))
+        self.assertEqual([3, 1], [len(b) for b in batches])
+
+        # Check the packed records.
+        view = memoryview(batches[0])
+        self.assertEqual(3, len(view))
+        self.assertEqual("=HHIII", view.format)
+        data = view.tobytes()
+        size = struct.calcsize("=HHIII")
+        records = [struct.unpack_from("=HHIII", data, offset)
+                   for offset in range(0, len(data), size)]
+        self.assertEqual(cmonster.tok_identifier, records[0][0])
+        self.assertEqual(cmonster.tok_numeric_constant, records[1][0])
+        self.assertEqual(cmonster.tok_plus, records[2][0])
+        spellings = batches[0].spellings
+        self.assertEqual(
+            b"123", spellings[records[1][3]:records[1][3]+records[1][4]])
+
+        # Tokens are created on demand.
+        self.assertEqual("ABC", batches[0].spelling(0))
+        self.assertEqual("def", str(batches[1][0]))
+        self.assertEqual(cmonster.tok_identifier, batches[1][0].token_id)
+
+
+    def test_tokenize(self):
+        pp = cmonster.Preprocessor("test.c", data="")
+        toks = pp.tokenize("int x = 42;")
+        self.assertEqual(
+            [cmonster.tok_kw_int, cmonster.tok_identifier, cmonster.tok_equal,
+             cmonster.tok_numeric_constant, cmonster.tok_semi],
+            [tok.token_id for tok in toks])
+        self.assertEqual(["int", "x", "=", "42", ";"], [str(t) for t in toks])
+
+
+    def test_filter(self):
+        data = "#define F(x) x + foo\nint foo = F(bar); foobar; 42;"
+        TokenFilter = cmonster.TokenFilter
+        def filtered(predicate, **kwargs):
+            pp = cmonster.Preprocessor("test.c", data=data)
+            return [str(tok) for tok in pp.filter(predicate, **kwargs)]
+
+        self.assertEqual(["foo", "foo"],
+                         filtered(TokenFilter.identifiers("foo")))
+        self.assertEqual(["42"], filtered(
+            TokenFilter.kinds(cmonster.tok_numeric_constant)))
+        self.assertEqual(["foo", "foo", "foobar"],
+                         filtered(TokenFilter.spelling("^foo")))
+        self.assertEqual(["bar", "+", "foo"],
+                         filtered(TokenFilter.from_macro_expansion()))
+        self.assertEqual(["foo"], filtered(
+            TokenFilter.identifiers("foo") &
+            ~TokenFilter.from_macro_expansion()))
+        self.assertEqual(["42", "foobar"], sorted(filtered(
+            TokenFilter.kinds(cmonster.tok_numeric_constant) |
+            TokenFilter.identifiers("foobar"))))
+        self.assertEqual(11, len(filtered(TokenFilter.in_main_file())))
+        self.assertEqual(["int"], filtered(lambda tok: str(tok) == "int"))
+        self.assertRaises(ValueError, TokenFilter.spelling, "(")
+
+        # A predicate raising on the first token fails the call cleanly.
+        def fail(tok):
+            raise KeyError(str(tok))
+        pp = cmonster.Preprocessor("test.c", data=data)
+        self.assertRaises(KeyError, pp.filter, fail)
+
+        # Filtered batches contain only the matching tokens.
+        pp = cmonster.Preprocessor("test.c", data=data)
+        batches = list(pp.filter(TokenFilter.spelling("o"), batch_size=2))
+        self.assertEqual([2, 1], [len(batch) for batch in batches])
+
+
+    def test_iter_batches_pipelined(self):
+        def NEG(arg):
+            return "-%s" % arg
+        data = "".join("int x%d = NEG(%d);\n" % (i, i) for i in range(500))
+
+        def spellings(**kwargs):
+            pp = cmonster.Preprocessor("test.c", data=data)
+            pp.define(NEG)
+            result = []
+            for batch in pp.iter_batches(64, **kwargs):
+                self.assertTrue(len(batch) <= 64)
+                result.extend(batch.spelling(i) for i in range(len(batch)))
+            return result
+
+        expected = spellings()
+        self.assertEqual(500 * 6, len(expected))
+        self.assertEqual(expected, spellings(pipelined=True))
+
+        # Pipelined batches provide kinds and spellings, but not Tokens,
+        # which would consult the preprocessor while the producer runs.
+        pp = cmonster.Preprocessor("test.c", data=data)
+        pp.define(NEG)
+        batch = next(iter(pp.iter_batches(64, pipelined=True)))
+        self.assertEqual(cmonster.tok_kw_int, batch.kind(0))
+        self.assertRaises(TypeError, lambda: batch[0])
+
+        # Exceptions raised by macros on the producer thread are raised
+        # again, unchanged, by the consumer.
+        def FAIL(arg):
+            raise KeyError(arg)
+        pp = cmonster.Preprocessor("test.c", data=data + "FAIL(x)\n")
+        pp.define(FAIL)
+        pp.define(NEG)
+        with self.assertRaises(KeyError):
+            for batch in pp.iter_batches(64, pipelined=True):
+                pass
+
+
+    def test_token_str(self):
+        pp = cmonster.Preprocessor("test.c", data='foo "bar" += foo int')
+        toks = list(pp)
+        self.assertEqual(["foo", '"bar"', "+=", "foo", "int"],
+                         [str(tok) for tok in toks])
+        # Identifier spellings are interned, and shared between tokens.
+        self.assertIs(str(toks[0]), str(toks[3]))
+        self.assertEqual("Token(tok_plusequal, '+=')", repr(toks[2]))
+
+
+    def test_token_identifier(self):
+        pp = cmonster.Preprocessor("test.c", data="foo 123 foo int")
+        toks = list(pp)
+        self.assertEqual("foo", toks[0].identifier)
+        self.assertIs(toks[0].identifier, toks[2].identifier)
+        self.assertIsNone(toks[1].identifier)
+        self.assertEqual("int", toks[3].identifier)
+
+
+    def test_token_categories(self):
+        pp = cmonster.Preprocessor("test.c", data='foo int 42 "s" +=')
+        toks = list(pp)
+        self.assertEqual([True, False, False, False, False],
+                         [tok.is_identifier for tok in toks])
+        self.assertEqual([False, True, False, False, False],
+                         [tok.is_keyword for tok in toks])
+        self.assertEqual([False, False, True, True, False],
+                         [tok.is_literal for tok in toks])
+        self.assertEqual([False, False, False, False, True],
+                         [tok.is_punctuator for tok in toks])
+
+        mask = cmonster.category_keyword | cmonster.category_literal
+        self.assertEqual([False, True, True, True, False],
+                         [tok.kind_in(mask) for tok in toks])
+
+        # Keyword tokens created from their kind alone are spelled, and
+        # carry their identifier, as lexed ones do.
+        tok = cmonster.Token(pp, cmonster.tok_kw_int)
+        self.assertEqual("int", str(tok))
+        self.assertEqual("int", tok.identifier)
+        self.assertEqual("+=", str(cmonster.Token(pp, cmonster.tok_plusequal)))
+
+
+    def test_format_tokens(self):
+        data = "int  x =\n    f (1);\n"
+        pp = cmonster.Preprocessor("test.c", data=data)
+        toks = list(pp)
+        self.assertEqual("int x =\n    f (1);", pp.format_tokens(toks))
+        self.assertEqual("int x =\nf (1);",
+                         pp.format_tokens(toks, compact=True))
+
+        # Spaces are inserted where tokens would otherwise be pasted.
+        pp = cmonster.Preprocessor("test.c", data="#define PLUS +\n+PLUS")
+        self.assertEqual("+ +", pp.format_tokens(list(pp), compact=True))
+
+
 if __name__ == "__main__":
     unittest.main()
 